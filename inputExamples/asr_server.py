@@ -0,0 +1,100 @@
+import argparse
+import asyncio
+import base64
+import hashlib
+import json
+import struct
+import wave
+
+# Stand-in for a Vosk recognition server, muji_moe default ws://127.0.0.1:2700
+# Replays the transcript of a WAV: partials grow with the audio received,
+# the full transcript answers the eof. Play the same WAV with the file
+# input source to test voice input without a microphone or a real recognizer.
+#
+#   python3 asr_server.py hello.wav "hello there" --delay-ms 40
+
+GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC11B85"
+
+parser = argparse.ArgumentParser()
+parser.add_argument("wav")
+parser.add_argument("transcript")
+parser.add_argument("--port", type=int, default=2700)
+parser.add_argument("--delay-ms", type=int, default=0, help="added to every answer, like a network round trip")
+args = parser.parse_args()
+
+with wave.open(args.wav, "rb") as w:
+    wav_seconds = w.getnframes() / w.getframerate()
+
+
+async def read_frame(reader):
+    head = await reader.readexactly(2)
+    opcode = head[0] & 0x0F
+    length = head[1] & 0x7F
+    if length == 126:
+        length = struct.unpack(">H", await reader.readexactly(2))[0]
+    elif length == 127:
+        length = struct.unpack(">Q", await reader.readexactly(8))[0]
+    mask = await reader.readexactly(4) if head[1] & 0x80 else b"\0\0\0\0"
+    payload = bytearray(await reader.readexactly(length))
+    for i in range(length):
+        payload[i] ^= mask[i & 3]
+    return opcode, bytes(payload)
+
+
+def frame(opcode, payload):
+    if len(payload) < 126:
+        head = struct.pack(">BB", 0x80 | opcode, len(payload))
+    elif len(payload) < 65536:
+        head = struct.pack(">BBH", 0x80 | opcode, 126, len(payload))
+    else:
+        head = struct.pack(">BBQ", 0x80 | opcode, 127, len(payload))
+    return head + payload
+
+
+def answer(writer, message):
+    # Delayed without holding back the next message, like a network path
+    data = frame(0x1, json.dumps(message, ensure_ascii=False).encode())
+    return asyncio.get_running_loop().call_later(args.delay_ms / 1000, writer.write, data)
+
+
+async def session(reader, writer):
+    request = (await reader.readuntil(b"\r\n\r\n")).decode()
+    key = [line.split(":", 1)[1].strip() for line in request.split("\r\n") if line.lower().startswith("sec-websocket-key")][0]
+    accept = base64.b64encode(hashlib.sha1((key + GUID).encode()).digest()).decode()
+    writer.write(("HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                  "Sec-WebSocket-Accept: " + accept + "\r\n\r\n").encode())
+
+    sample_rate = 16000
+    received = 0
+    try:
+        while True:
+            opcode, payload = await read_frame(reader)
+            if opcode == 0x8:
+                break
+            if opcode == 0x2:
+                received += len(payload) // 2
+                shown = int(len(args.transcript) * min(received / sample_rate / wav_seconds, 1.0))
+                answer(writer, {"partial": args.transcript[:shown]})
+            elif opcode == 0x1:
+                message = json.loads(payload)
+                if "config" in message:
+                    sample_rate = message["config"].get("sample_rate", sample_rate)
+                elif message.get("eof"):
+                    answer(writer, {"text": args.transcript})
+                    print("utterance of %.2f s recognized" % (received / sample_rate))
+                    break
+        await asyncio.sleep(args.delay_ms / 1000)
+        writer.write(frame(0x8, struct.pack(">H", 1000)))
+        await writer.drain()
+    except (asyncio.IncompleteReadError, ConnectionError):
+        pass
+    writer.close()
+
+
+async def main():
+    server = await asyncio.start_server(session, "127.0.0.1", args.port)
+    print("listening on ws://127.0.0.1:%d" % args.port)
+    async with server:
+        await server.serve_forever()
+
+asyncio.run(main())
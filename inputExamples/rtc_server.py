@@ -0,0 +1,144 @@
+import argparse
+import asyncio
+import base64
+import hashlib
+import json
+import struct
+import time
+import wave
+
+# Mock realtime voice server for the RTC chat mode, muji_moe default ws://127.0.0.1:2800
+# Answers every utterance or typed message with the same reply: the transcript,
+# an emotion, the reply text and the reply WAV streamed as PCM at the pace of a
+# realtime model. Speech during a reply cancels it. Prints the latency from the
+# end of speech to the first audio sent, the client reports what it received.
+#
+#   python3 rtc_server.py reply.wav "Nice to meet you!" --transcript "hello there" --emotion happy --delay-ms 300
+
+GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC11B85"
+
+parser = argparse.ArgumentParser()
+parser.add_argument("wav", help="16 bit PCM reply")
+parser.add_argument("text", help="reply text")
+parser.add_argument("--transcript", default="", help="what the server claims to have heard")
+parser.add_argument("--emotion", default="")
+parser.add_argument("--port", type=int, default=2800)
+parser.add_argument("--delay-ms", type=int, default=0, help="end of speech to the first audio, like a model thinking")
+parser.add_argument("--chunk-ms", type=int, default=40)
+parser.add_argument("--speed", type=float, default=1.5, help="audio sent per real time")
+args = parser.parse_args()
+
+with wave.open(args.wav, "rb") as w:
+    if w.getsampwidth() != 2:
+        raise SystemExit("reply must be 16 bit PCM")
+    channels = w.getnchannels()
+    rate = w.getframerate()
+    reply = w.readframes(w.getnframes())
+
+
+async def read_frame(reader):
+    head = await reader.readexactly(2)
+    opcode = head[0] & 0x0F
+    length = head[1] & 0x7F
+    if length == 126:
+        length = struct.unpack(">H", await reader.readexactly(2))[0]
+    elif length == 127:
+        length = struct.unpack(">Q", await reader.readexactly(8))[0]
+    mask = await reader.readexactly(4) if head[1] & 0x80 else b"\0\0\0\0"
+    payload = bytearray(await reader.readexactly(length))
+    for i in range(length):
+        payload[i] ^= mask[i & 3]
+    return opcode, bytes(payload)
+
+
+def frame(opcode, payload):
+    if len(payload) < 126:
+        head = struct.pack(">BB", 0x80 | opcode, len(payload))
+    elif len(payload) < 65536:
+        head = struct.pack(">BBH", 0x80 | opcode, 126, len(payload))
+    else:
+        head = struct.pack(">BBQ", 0x80 | opcode, 127, len(payload))
+    return head + payload
+
+
+def send(writer, message):
+    writer.write(frame(0x1, json.dumps(message, ensure_ascii=False).encode()))
+
+
+async def respond(writer, heard, since):
+    await asyncio.sleep(args.delay_ms / 1000)
+    if heard:
+        send(writer, {"type": "transcript", "text": heard, "final": True})
+    send(writer, {"type": "response.start", "format": "audio/pcm;rate=%d;channels=%d" % (rate, channels)})
+    if args.emotion:
+        send(writer, {"type": "response.emotion", "emotion": args.emotion})
+    send(writer, {"type": "response.text", "text": args.text})
+
+    chunk = rate * channels * 2 * args.chunk_ms // 1000
+    start = time.monotonic()
+    for offset in range(0, len(reply), chunk):
+        writer.write(frame(0x2, reply[offset:offset + chunk]))
+        if offset == 0:
+            print("first audio %.0f ms after the end of speech" % ((time.monotonic() - since) * 1000))
+        await writer.drain()
+        # Ahead of real time like a streaming model, the client buffers
+        ahead = (offset + chunk) / (rate * channels * 2) / args.speed - (time.monotonic() - start)
+        if ahead > 0:
+            await asyncio.sleep(ahead)
+    send(writer, {"type": "response.end"})
+
+
+async def session(reader, writer):
+    request = (await reader.readuntil(b"\r\n\r\n")).decode()
+    key = [line.split(":", 1)[1].strip() for line in request.split("\r\n") if line.lower().startswith("sec-websocket-key")][0]
+    accept = base64.b64encode(hashlib.sha1((key + GUID).encode()).digest()).decode()
+    writer.write(("HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                  "Sec-WebSocket-Accept: " + accept + "\r\n\r\n").encode())
+    print("client connected")
+
+    sample_rate = 16000
+    received = 0
+    response = None
+    try:
+        while True:
+            opcode, payload = await read_frame(reader)
+            if opcode == 0x8:
+                break
+            if opcode == 0x2:
+                received += len(payload) // 2
+                continue
+            if opcode != 0x1:
+                continue
+            message = json.loads(payload)
+            kind = message.get("type")
+            if kind == "session.start":
+                sample_rate = message.get("sample_rate", sample_rate)
+            elif kind == "speech.start":
+                received = 0
+                if response and not response.done():
+                    response.cancel()
+                    send(writer, {"type": "response.end"})
+                    print("reply interrupted")
+            elif kind == "speech.end":
+                print("utterance of %.2f s" % (received / sample_rate))
+                response = asyncio.ensure_future(respond(writer, args.transcript, time.monotonic()))
+            elif kind == "text":
+                print("text: %s" % message.get("text"))
+                response = asyncio.ensure_future(respond(writer, "", time.monotonic()))
+        writer.write(frame(0x8, struct.pack(">H", 1000)))
+        await writer.drain()
+    except (asyncio.IncompleteReadError, ConnectionError):
+        pass
+    if response:
+        response.cancel()
+    writer.close()
+    print("client disconnected")
+
+
+async def main():
+    server = await asyncio.start_server(session, "127.0.0.1", args.port)
+    print("listening on ws://127.0.0.1:%d" % args.port)
+    async with server:
+        await server.serve_forever()
+
+asyncio.run(main())
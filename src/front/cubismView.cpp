@@ -17,11 +17,17 @@ CCubismView::CCubismView()
     m_device2Screen = new Csm::CubismMatrix44();
     m_viewMatrix = new Csm::CubismViewMatrix();
 
-    m_clearColor[0] = 1.0f;
-    m_clearColor[1] = 1.0f;
-    m_clearColor[2] = 1.0f;
+    // Transparent black, the model renders premultiplied alpha over it
+    m_clearColor[0] = 0.0f;
+    m_clearColor[1] = 0.0f;
+    m_clearColor[2] = 0.0f;
     m_clearColor[3] = 0.0f;
 
+    m_renderTarget = SelectTarget_None;
+    m_cacheValid = false;
+    m_cacheHits = m_modelDraws = 0;
+    m_positionLocation = m_uvLocation = m_textureLocation = m_colorLocation = 0;
+
     m_live2DManager = new CLive2DManager();
 }
 
@@ -74,15 +80,56 @@ void CCubismView::Initialize()
         2.0f
     );
 
+    GLuint programId = CWindow::GetInstance()->GetBaseShader();
+    m_positionLocation = glGetAttribLocation(programId, "position");
+    m_uvLocation = glGetAttribLocation(programId, "uv");
+    m_textureLocation = glGetUniformLocation(programId, "texture");
+    m_colorLocation = glGetUniformLocation(programId, "baseColor");
+
     m_live2DManager->LoadModel();
 }
 
 void CCubismView::Render()
 {
+    // Still frames composite the model's last image instead of drawing it again
+    SelectTarget target = CWorld::GetInstance()->m_configImage.cacheModel ? SelectTarget_ViewFrameBuffer : SelectTarget_None;
+    if (target != m_renderTarget)
+    {
+        m_renderTarget = target;
+        m_cacheValid = false;
+    }
+
     m_live2DManager->SetViewMatrix(m_viewMatrix);
     m_live2DManager->Render();
 }
 
+bool CCubismView::IsAnimating()
+{
+    return m_live2DManager->IsAnimating();
+}
+
+bool CCubismView::NeedsModelDraw(CLive2DModel* refModel, Csm::CubismMatrix44& projection)
+{
+    // Always asked, so the model knows what the target holds
+    bool changed = refModel->ChangedSinceDrawn(projection);
+    if (m_renderTarget == SelectTarget_None)
+    {
+        m_modelDraws++;
+        return true;
+    }
+
+    Csm::Rendering::CubismOffscreenSurface_OpenGLES2* useTarget = (m_renderTarget == SelectTarget_ViewFrameBuffer) ? &m_renderBuffer : &(refModel->GetRenderBuffer());
+    int bufWidth, bufHeight;
+    glfwGetFramebufferSize(CWindow::GetInstance()->GetGLWindow(), &bufWidth, &bufHeight);
+    bool draw = changed || !m_cacheValid || !useTarget->IsValid() ||
+                !useTarget->IsSameSize(static_cast<Csm::csmUint32>(bufWidth), static_cast<Csm::csmUint32>(bufHeight));
+    if (draw)
+        m_modelDraws++;
+    else
+        m_cacheHits++;
+    return draw;
+}
+
 void CCubismView::PreModelDraw(CLive2DModel* refModel)
 {
     Csm::Rendering::CubismOffscreenSurface_OpenGLES2* useTarget = NULL;
@@ -90,11 +137,10 @@ void CCubismView::PreModelDraw(CLive2DModel* refModel)
     {
         useTarget = (m_renderTarget == SelectTarget_ViewFrameBuffer) ? &m_renderBuffer : &(refModel->GetRenderBuffer());
 
-        if (!useTarget->IsValid())
+        int bufWidth, bufHeight;
+        glfwGetFramebufferSize(CWindow::GetInstance()->GetGLWindow(), &bufWidth, &bufHeight);
+        if (!useTarget->IsValid() || !useTarget->IsSameSize(static_cast<Csm::csmUint32>(bufWidth), static_cast<Csm::csmUint32>(bufHeight)))
         {
-            int bufWidth, bufHeight;
-            glfwGetFramebufferSize(CWindow::GetInstance()->GetGLWindow(), &bufWidth, &bufHeight);
-
             if(bufWidth!=0 && bufHeight!=0)
             {
                 useTarget->CreateOffscreenSurface(static_cast<Csm::csmUint32>(bufWidth), static_cast<Csm::csmUint32>(bufHeight));
@@ -114,5 +160,36 @@ void CCubismView::PostModelDraw(CLive2DModel* refModel)
     {
         useTarget = (m_renderTarget == SelectTarget_ViewFrameBuffer) ? &m_renderBuffer : &(refModel->GetRenderBuffer());
         useTarget->EndDraw();
+        m_cacheValid = useTarget->IsValid();
+        DrawModelCache(refModel);
     }
+}
+
+void CCubismView::DrawModelCache(CLive2DModel* refModel)
+{
+    if (m_renderTarget == SelectTarget_None)
+        return;
+
+    Csm::Rendering::CubismOffscreenSurface_OpenGLES2* useTarget = (m_renderTarget == SelectTarget_ViewFrameBuffer) ? &m_renderBuffer : &(refModel->GetRenderBuffer());
+    if (!useTarget->IsValid())
+        return;
+
+    // The whole window, the target has its size
+    const GLfloat positionVertex[] = {1.0f, -1.0f, -1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f};
+    const GLfloat uvVertex[] = {1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f};
+
+    glUseProgram(CWindow::GetInstance()->GetBaseShader());
+    glEnableVertexAttribArray(m_positionLocation);
+    glEnableVertexAttribArray(m_uvLocation);
+    glVertexAttribPointer(m_positionLocation, 2, GL_FLOAT, false, 0, positionVertex);
+    glVertexAttribPointer(m_uvLocation, 2, GL_FLOAT, false, 0, uvVertex);
+    glUniform1i(m_textureLocation, 0);
+    glUniform4f(m_colorLocation, 1.0f, 1.0f, 1.0f, 1.0f);
+
+    // Premultiplied like the model's own blending, then back to the window's
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, useTarget->GetColorBuffer());
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 }
\ No newline at end of file
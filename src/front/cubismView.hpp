@@ -23,9 +23,19 @@ public:
 
     void Initialize();
     void Render();
+    // Motions or the head following the cursor change the next frame
+    bool IsAnimating();
 
+    // After the model's update. False when the render target still holds the frame `projection` would draw.
+    bool NeedsModelDraw(class CLive2DModel* refModel, Csm::CubismMatrix44& projection);
     void PreModelDraw(class CLive2DModel* refModel);
     void PostModelDraw(class CLive2DModel* refModel);
+    // Composites the render target's image, one quad
+    void DrawModelCache(class CLive2DModel* refModel);
+    // Frames that composited the cached image and frames that drew the model, since the last reset
+    int GetCacheHits() { return m_cacheHits; }
+    int GetModelDraws() { return m_modelDraws; }
+    void ResetCacheStats() { m_cacheHits = m_modelDraws = 0; }
 
     void SwitchRenderingTarget(SelectTarget targetType) { m_renderTarget = targetType; }
 
@@ -37,6 +47,14 @@ private:
     Csm::Rendering::CubismOffscreenSurface_OpenGLES2 m_renderBuffer;
 
     float m_clearColor[4];
+    bool m_cacheValid; // The render target holds a complete frame
+    int m_cacheHits;
+    int m_modelDraws;
+
+    GLuint m_positionLocation; // Of the window's base shader, for the composited quad
+    GLuint m_uvLocation;
+    GLuint m_textureLocation;
+    GLuint m_colorLocation;
 
     class CLive2DManager* m_live2DManager;
 };
\ No newline at end of file
@@ -41,6 +41,11 @@ void CLive2DManager::ReleaseModel()
     }
 }
 
+bool CLive2DManager::IsAnimating()
+{
+    return m_model != nullptr && m_model->IsAnimating();
+}
+
 void CLive2DManager::Render()
 {
     if (m_model == nullptr) return;
@@ -76,8 +81,6 @@ void CLive2DManager::Render()
 
     if (m_viewMatrix != NULL) projection.MultiplyByMatrix(m_viewMatrix);
 
-    window->GetView()->PreModelDraw(m_model);
-
     // Draging
     int wx, wy;
     glfwGetWindowPos(window->GetGLWindow(), &wx, &wy);
@@ -91,8 +94,15 @@ void CLive2DManager::Render()
     m_model->SetDragging((mouseX - headx) / height, (mouseY - heady) / height);
 
     m_model->Update();
-    m_model->Draw(projection);
 
-    window->GetView()->PostModelDraw(m_model);
+    CCubismView *view = window->GetView();
+    if (view->NeedsModelDraw(m_model, projection))
+    {
+        view->PreModelDraw(m_model);
+        m_model->Draw(projection);
+        view->PostModelDraw(m_model);
+    }
+    else
+        view->DrawModelCache(m_model);
 }
 
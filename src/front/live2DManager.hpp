@@ -15,6 +15,7 @@ public:
     void LoadModel();
     void ReleaseModel();
     void Render();
+    bool IsAnimating();
 
     void SetViewMatrix(Csm::CubismMatrix44 *m)
     {
@@ -7,6 +7,9 @@
 #include <fstream>
 #include <vector>
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <CubismModelSettingJson.hpp>
 #include <Motion/CubismMotion.hpp>
 #include <Physics/CubismPhysics.hpp>
@@ -27,6 +30,15 @@ using namespace Live2D::Cubism::Framework;
 
 namespace
 {
+    // Mouth opening and form per vowel, a i u e o
+    const float VISEME_MOUTH[VISEME_COUNT][2] = {
+        {1.0f, 0.0f},
+        {0.3f, 1.0f},
+        {0.35f, -1.0f},
+        {0.6f, 0.5f},
+        {0.8f, -0.7f},
+    };
+
     csmByte *CreateBuffer(const csmChar *path, csmSizeInt *size)
     {
         CPlat::PrintLogLn("create buffer: %s", path);
@@ -41,8 +53,9 @@ namespace
 }
 
 CLive2DModel::CLive2DModel()
-    : CubismUserModel(), m_modelSetting(NULL), m_userTimeSeconds(0.0f)
+    : CubismUserModel(), m_modelSetting(NULL), m_userTimeSeconds(0.0f), m_soundsPrepared(false), m_eyesOpen(true), m_tickTime(0.0), m_ticked(false), m_animating(false), m_drawnOpacity(-1.0f)
 {
+    memset(m_drawnMatrix, 0, sizeof(m_drawnMatrix));
     using namespace Live2D::Cubism::Framework::DefaultParameterId;
     m_idParamAngleX = CubismFramework::GetIdManager()->GetId(ParamAngleX);
     m_idParamAngleY = CubismFramework::GetIdManager()->GetId(ParamAngleY);
@@ -50,6 +63,7 @@ CLive2DModel::CLive2DModel()
     m_idParamBodyAngleX = CubismFramework::GetIdManager()->GetId(ParamBodyAngleX);
     m_idParamEyeBallX = CubismFramework::GetIdManager()->GetId(ParamEyeBallX);
     m_idParamEyeBallY = CubismFramework::GetIdManager()->GetId(ParamEyeBallY);
+    m_idParamMouthForm = CubismFramework::GetIdManager()->GetId(ParamMouthForm);
 }
 
 CLive2DModel::~CLive2DModel()
@@ -278,19 +292,34 @@ void CLive2DModel::PreloadMotionGroup(const csmChar *group)
         }
 
         DeleteBuffer(buffer, path.GetRawString());
+
+        // Decoded now, converted to the output rate by the mixer off the render thread
+        csmString voice = m_modelSetting->GetMotionSoundFileName(group, i);
+        if (strcmp(voice.GetRawString(), "") != 0)
+        {
+            csmString soundPath = m_modelHomeDir + voice;
+            CPlat::PrintLogLn("load motion sound: %s => [%s_%d]", soundPath.GetRawString(), group, i);
+            CAudioClip *sound = CAudioClip::Load(soundPath.GetRawString());
+            if (sound)
+            {
+                delete m_sounds[name];
+                m_sounds[name] = sound;
+                m_soundsPrepared = false;
+            }
+        }
     }
 }
 
-void CLive2DModel::ReleaseMotionGroup(const csmChar *group) const
+void CLive2DModel::ReleaseMotionGroup(const csmChar *group)
 {
     const csmInt32 count = m_modelSetting->GetMotionCount(group);
     for (csmInt32 i = 0; i < count; i++)
     {
-        csmString voice = m_modelSetting->GetMotionSoundFileName(group, i);
-        if (strcmp(voice.GetRawString(), "") != 0)
+        csmString name = Utils::CubismString::GetFormatedString("%s_%d", group, i);
+        if (m_sounds.IsExist(name))
         {
-            csmString path = voice;
-            path = m_modelHomeDir + path;
+            delete m_sounds[name];
+            m_sounds[name] = NULL;
         }
     }
 }
@@ -317,9 +346,102 @@ void CLive2DModel::ReleaseExpressions()
 
 void CLive2DModel::Update()
 {
-    const csmFloat32 deltaTimeSeconds = CPlat::GetDeltaTime();
+    // The chat starts after the model loaded, the first plays then only enqueue
+    CChat *chat = CWorld::GetInstance()->GetChat();
+    if (!m_soundsPrepared && chat)
+    {
+        for (csmMap<csmString, CAudioClip *>::const_iterator iter = m_sounds.Begin(); iter != m_sounds.End(); ++iter)
+        {
+            if (iter->Second != NULL)
+                chat->PrepareClip(*iter->Second);
+        }
+        m_soundsPrepared = true;
+    }
+
+    int hz = std::min(std::max(CWorld::GetInstance()->m_configImage.simulationHz, MODEL_TICK_HZ_MIN), MODEL_TICK_HZ_MAX);
+    const double tick = 1.0 / hz;
+
+    // The first frame ticks at once, later ones when a tick's worth of time passed
+    m_tickTime = std::min(m_tickTime + (m_ticked ? CPlat::GetDeltaTime() : tick), tick * MODEL_TICK_MAX);
+    while (m_tickTime >= tick)
+    {
+        m_tickTime -= tick;
+        Tick(static_cast<csmFloat32>(tick));
+    }
+
+    // Between the last two ticks, the frame rate only changes how finely they are sampled
+    const float alpha = static_cast<float>(m_tickTime / tick);
+    for (csmInt32 i = 0; i < _model->GetParameterCount(); i++)
+        _model->SetParameterValue(i, m_lastParameters[i] + (m_parameters[i] - m_lastParameters[i]) * alpha);
+    for (csmInt32 i = 0; i < _model->GetPartCount(); i++)
+        _model->SetPartOpacity(i, m_lastPartOpacities[i] + (m_partOpacities[i] - m_lastPartOpacities[i]) * alpha);
+
+    // The mouth follows the audio heard now, not the last tick, so it is added after interpolating
+    if (chat)
+    {
+        float lipEnergy = chat->GetLipValue();
+
+        // Vowel shape, without a vowel the mouth opens fully with the loudness as before
+        float visemes[VISEME_COUNT];
+        chat->GetLipVisemes(visemes);
+        float mouthOpen = 0.0f, mouthForm = 0.0f, weight = 0.0f;
+        for (int v = 0; v < VISEME_COUNT; v++)
+        {
+            mouthOpen += visemes[v] * VISEME_MOUTH[v][0];
+            mouthForm += visemes[v] * VISEME_MOUTH[v][1];
+            weight += visemes[v];
+        }
+        if (weight > 0.0f)
+            lipEnergy *= mouthOpen / weight;
+
+        for (csmUint32 i = 0; i < m_lipSyncIds.GetSize(); ++i)
+        {
+            _model->AddParameterValue(m_lipSyncIds[i], lipEnergy, 0.8f);
+        }
+        if (weight > 0.0f)
+            _model->AddParameterValue(m_idParamMouthForm, mouthForm / weight * std::min(1.0f, lipEnergy * 4.0f), 0.5f);
+    }
+
+    _model->Update();
+}
+
+bool CLive2DModel::ChangedSinceDrawn(CubismMatrix44 &matrix)
+{
+    CubismMatrix44 mvp;
+    mvp.SetMatrix(matrix.GetArray());
+    mvp.MultiplyByMatrix(_modelMatrix);
+
+    const csmInt32 parameterCount = _model->GetParameterCount();
+    const csmInt32 partCount = _model->GetPartCount();
+    bool changed = m_drawnParameters.size() != (size_t)parameterCount || m_drawnPartOpacities.size() != (size_t)partCount ||
+                   memcmp(m_drawnMatrix, mvp.GetArray(), sizeof(m_drawnMatrix)) != 0 || m_drawnOpacity != _model->GetModelOpacity();
+    for (csmInt32 i = 0; i < parameterCount && !changed; i++)
+        changed = std::fabs(_model->GetParameterValue(i) - m_drawnParameters[i]) > MODEL_CACHE_EPSILON;
+    for (csmInt32 i = 0; i < partCount && !changed; i++)
+        changed = std::fabs(_model->GetPartOpacity(i) - m_drawnPartOpacities[i]) > MODEL_CACHE_EPSILON;
+    if (!changed)
+        return false;
+
+    m_drawnParameters.resize(parameterCount);
+    m_drawnPartOpacities.resize(partCount);
+    for (csmInt32 i = 0; i < parameterCount; i++)
+        m_drawnParameters[i] = _model->GetParameterValue(i);
+    for (csmInt32 i = 0; i < partCount; i++)
+        m_drawnPartOpacities[i] = _model->GetPartOpacity(i);
+    memcpy(m_drawnMatrix, mvp.GetArray(), sizeof(m_drawnMatrix));
+    m_drawnOpacity = _model->GetModelOpacity();
+    return true;
+}
+
+void CLive2DModel::Tick(csmFloat32 deltaTimeSeconds)
+{
     m_userTimeSeconds += deltaTimeSeconds;
 
+    // LoadParameters() below restores the parameters, the pose fades from the last tick's opacities
+    for (csmInt32 i = 0; i < (csmInt32)m_partOpacities.size(); i++)
+        _model->SetPartOpacity(i, m_partOpacities[i]);
+
+    const csmFloat32 lastDragX = _dragX, lastDragY = _dragY;
     _dragManager->Update(deltaTimeSeconds);
     _dragX = _dragManager->GetX();
     _dragY = _dragManager->GetY();
@@ -359,13 +481,24 @@ void CLive2DModel::Update()
     }
     _model->SaveParameters();
 
+    // With the still frame cache breath and blinks stand still while the window idles, so its frames composite the cached image.
+    // A blink under way still ends, the eyes are held open. Without the cache holding them gains nothing,
+    // they keep the window at full rate like a motion, or they would step at the idle rate.
+    const bool cacheModel = world->m_configImage.cacheModel;
+    const bool hold = cacheModel && CWindow::GetInstance()->IsIdle();
+    m_animating = !_motionManager->IsFinished() || std::fabs(_dragX - lastDragX) + std::fabs(_dragY - lastDragY) > 0.001f ||
+                  (!cacheModel && (_breath != NULL || _eyeBlink != NULL));
+
     _opacity = _model->GetModelOpacity();
 
     if (!motionUpdated)
     {
         if (_eyeBlink != NULL)
         {
-            _eyeBlink->UpdateParameters(_model, deltaTimeSeconds);
+            _eyeBlink->UpdateParameters(_model, hold && m_eyesOpen ? 0.0f : deltaTimeSeconds);
+            m_eyesOpen = true;
+            for (csmUint32 i = 0; i < m_eyeBlinkIds.GetSize(); ++i)
+                m_eyesOpen = m_eyesOpen && _model->GetParameterValue(m_eyeBlinkIds[i]) >= 1.0f;
         }
     }
 
@@ -383,16 +516,9 @@ void CLive2DModel::Update()
     _model->AddParameterValue(m_idParamEyeBallX, _dragX);
     _model->AddParameterValue(m_idParamEyeBallY, _dragY);
 
-    float lipEnergy = (float)(world->GetChat()->m_lipEnergyShow) / 16384.0f / 2.0f;
-    // std::cout << "lipEnergy: " << lipEnergy << std::endl;
-    for (csmUint32 i = 0; i < m_lipSyncIds.GetSize(); ++i)
-    {
-        _model->AddParameterValue(m_lipSyncIds[i], lipEnergy, 0.8f);
-    }
-
     if (_breath != NULL)
     {
-        _breath->UpdateParameters(_model, deltaTimeSeconds);
+        _breath->UpdateParameters(_model, hold ? 0.0f : deltaTimeSeconds);
     }
 
     if (_physics != NULL)
@@ -400,24 +526,26 @@ void CLive2DModel::Update()
         _physics->Evaluate(_model, deltaTimeSeconds);
     }
 
-    if (_lipSync)
-    {
-        // csmFloat32 value = 0.0f;
-        // _wavFileHandler.Update(deltaTimeSeconds);
-        // value = _wavFileHandler.GetRms();
-
-        // for (csmUint32 i = 0; i < m_lipSyncIds.GetSize(); ++i)
-        // {
-        //     _model->AddParameterValue(m_lipSyncIds[i], value, 0.8f);
-        // }
-    }
-
     if (_pose != NULL)
     {
         _pose->UpdateParameters(_model, deltaTimeSeconds);
     }
 
-    _model->Update();
+    // The next tick starts from the saved parameters, what the frames interpolate in between does not leak into it
+    m_lastParameters.swap(m_parameters);
+    m_lastPartOpacities.swap(m_partOpacities);
+    m_parameters.resize(_model->GetParameterCount());
+    m_partOpacities.resize(_model->GetPartCount());
+    for (csmInt32 i = 0; i < _model->GetParameterCount(); i++)
+        m_parameters[i] = _model->GetParameterValue(i);
+    for (csmInt32 i = 0; i < _model->GetPartCount(); i++)
+        m_partOpacities[i] = _model->GetPartOpacity(i);
+    if (!m_ticked)
+    {
+        m_lastParameters = m_parameters;
+        m_lastPartOpacities = m_partOpacities;
+        m_ticked = true;
+    }
 }
 
 CubismMotionQueueEntryHandle CLive2DModel::StartMotion(const csmChar *group, csmInt32 no, csmInt32 priority, ACubismMotion::FinishedMotionCallback onFinishedMotionHandler)
@@ -473,14 +601,10 @@ CubismMotionQueueEntryHandle CLive2DModel::StartMotion(const csmChar *group, csm
         motion->SetFinishedMotionHandler(onFinishedMotionHandler);
     }
 
-    // voice
-    // csmString voice = m_modelSetting->GetMotionSoundFileName(group, no);
-    // if (strcmp(voice.GetRawString(), "") != 0)
-    // {
-    //     csmString path = voice;
-    //     path = m_modelHomeDir + path;
-    //     _wavFileHandler.Start(path);
-    // }
+    // Sound effect, replaces the one of the motion before
+    CChat *chat = CWorld::GetInstance()->GetChat();
+    if (chat && m_sounds.IsExist(name) && m_sounds[name] != NULL)
+        chat->PlayClip(MIXER_VOICE_MOTION, *m_sounds[name]);
 
     CPlat::PrintLogLn("start motion: [%s_%d]", group, no);
     return _motionManager->StartMotionPriority(motion, autoDelete, priority);
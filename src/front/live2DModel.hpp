@@ -11,6 +11,12 @@
 #include <Rendering/OpenGL/CubismOffscreenSurface_OpenGLES2.hpp>
 
 #include <string>
+#include <vector>
+
+#define MODEL_TICK_HZ_MIN 30 // Simulation rate, independent of the frame rate
+#define MODEL_TICK_HZ_MAX 60
+#define MODEL_TICK_MAX 8     // Ticks caught up in one frame, a longer stall slows the simulation down instead
+#define MODEL_CACHE_EPSILON 0.001f // Parameter change a cached frame still stands for
 
 
 class CLive2DModel : public Csm::CubismUserModel
@@ -21,8 +27,14 @@ public:
 
     void LoadAssets(const Csm::csmChar* dir, const  Csm::csmChar* fileName);
     void ReloadRenderer();
+    // Every frame. Runs the simulation's fixed ticks that are due and interpolates the frame between the last two.
     void Update();
     void Draw(Csm::CubismMatrix44& matrix);
+    // A motion plays or the head still moves towards the cursor, as of the last update
+    bool IsAnimating() { return m_animating; }
+    // After Update. True when the parameters, part opacities or the matrix Draw() would use moved
+    // beyond MODEL_CACHE_EPSILON since the last time it returned true.
+    bool ChangedSinceDrawn(Csm::CubismMatrix44& matrix);
 
     Csm::CubismMotionQueueEntryHandle StartMotion(const Csm::csmChar* group, Csm::csmInt32 no, Csm::csmInt32 priority, Csm::ACubismMotion::FinishedMotionCallback onFinishedMotionHandler = NULL);
     Csm::CubismMotionQueueEntryHandle StartRandomMotion(const Csm::csmChar* group, Csm::csmInt32 priority, Csm::ACubismMotion::FinishedMotionCallback onFinishedMotionHandler = NULL);
@@ -34,12 +46,14 @@ public:
 
 protected:
     void DoDraw();
+    // Motions, blinks, expressions, breath, physics and pose, one step of `deltaTimeSeconds`
+    void Tick(Csm::csmFloat32 deltaTimeSeconds);
 
 private:
     void SetupModel(Csm::ICubismModelSetting* setting);
     void SetupTextures();
     void PreloadMotionGroup(const Csm::csmChar* group);
-    void ReleaseMotionGroup(const Csm::csmChar* group) const;
+    void ReleaseMotionGroup(const Csm::csmChar* group);
     void ReleaseMotions();
     void ReleaseExpressions();
 
@@ -57,10 +71,26 @@ private:
     const Csm::CubismId* m_idParamBodyAngleX;
     const Csm::CubismId* m_idParamEyeBallX;
     const Csm::CubismId* m_idParamEyeBallY;
+    const Csm::CubismId* m_idParamMouthForm;
 
-    // LAppWavFileHandler _wavFileHandler; ///< wavファイルハンドラ
+    Csm::csmMap<Csm::csmString, class CAudioClip*> m_sounds; // Motion sounds by motion name, played through the chat's mixer
+    bool m_soundsPrepared;                  // Handed to the mixer to convert, once the chat exists
 
     Csm::Rendering::CubismOffscreenSurface_OpenGLES2 m_renderBuffer;
 
     std::string m_lastChatEmotion;
+
+    bool m_eyesOpen;                        // After the last blink update, a held blink waits for it
+    double m_tickTime;                      // Not simulated yet, under one tick after Update
+    bool m_ticked;
+    std::vector<float> m_lastParameters;    // Parameters and part opacities of the last two ticks
+    std::vector<float> m_parameters;
+    std::vector<float> m_lastPartOpacities;
+    std::vector<float> m_partOpacities;
+
+    std::vector<float> m_drawnParameters;   // What the last drawn frame showed
+    std::vector<float> m_drawnPartOpacities;
+    float m_drawnMatrix[16];
+    float m_drawnOpacity;
+    bool m_animating;
 };
@@ -3,8 +3,18 @@
  */
 
 #include <iostream>
+#include <fstream>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cstdlib>
 
 #include <Math/CubismMatrix44.hpp>
+#if defined(USE_EGL)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 
 #include "window.hpp"
 #include "texManager.hpp"
@@ -12,6 +22,7 @@
 #include "cubismView.hpp"
 #include "statebar.hpp"
 #include "../plat.hpp"
+#include "../server/chat.hpp"
 
 #include "GUI/imgui.h"
 #include "GUI/imgui_impl_glfw.h"
@@ -19,6 +30,18 @@
 
 CWindow::CWindow() : m_window(nullptr),
                      m_isEnd(false),
+                     m_headless(false),
+                     m_fbo(0),
+                     m_fboColor(0),
+                     m_fboDepth(0),
+                     m_fboWidth(0),
+                     m_fboHeight(0),
+                     m_eglDisplay(nullptr),
+                     m_eglContext(nullptr),
+                     m_wake(false),
+                     m_activeUntil(0.0),
+                     m_idle(false),
+                     m_hidden(false),
                      m_mouseWinXPx(0),
                      m_mouseWinYPx(0),
                      m_mouseWinX(0.0f),
@@ -42,7 +65,22 @@ CWindow::CWindow() : m_window(nullptr),
 
 CWindow::~CWindow()
 {
+    if (m_fbo)
+    {
+        glDeleteFramebuffers(1, &m_fbo);
+        glDeleteRenderbuffers(1, &m_fboColor);
+        glDeleteRenderbuffers(1, &m_fboDepth);
+    }
     glfwDestroyWindow(m_window);
+#if defined(USE_EGL)
+    if (m_eglContext)
+    {
+        eglMakeCurrent(m_eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(m_eglDisplay, m_eglContext);
+    }
+    if (m_eglDisplay)
+        eglTerminate(m_eglDisplay);
+#endif
 
     glfwTerminate();
 
@@ -59,6 +97,24 @@ CWindow::~CWindow()
 
 bool CWindow::Initialize()
 {
+#if defined(USE_OSMESA)
+    // An OSMesa context never reaches a display
+    m_headless = true;
+#endif
+    if (m_headless)
+    {
+#if (GLFW_VERSION_MAJOR > 3 || GLFW_VERSION_MINOR >= 4) && (defined(USE_EGL) || defined(USE_OSMESA))
+        // Without a display the null platform keeps the window's size and position for everyone asking GLFW
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+        // Mesa's llvmpipe unless a driver was picked already
+        setenv("LIBGL_ALWAYS_SOFTWARE", "1", 0);
+        setenv("GALLIUM_DRIVER", "llvmpipe", 0);
+#else
+        CPlat::PrintLogLn("Headless rendering needs GLFW 3.4 and a build with USE_EGL or USE_OSMESA");
+        return false;
+#endif
+    }
+
     if (glfwInit() == false)
     {
         CPlat::PrintLogLn("Failed to initialize GLFW");
@@ -71,6 +127,16 @@ bool CWindow::Initialize()
     glfwWindowHint(GLFW_TRANSPARENT_FRAMEBUFFER, GLFW_TRUE);
     glfwWindowHint(GLFW_DECORATED, GLFW_FALSE);
     glfwWindowHint(GLFW_FLOATING, GLFW_TRUE);
+    // GLEW loads through the same API, see the CMake options
+#if defined(USE_EGL)
+    // The null platform has no native window for an EGL surface, the headless context is made surfaceless below
+    if (m_headless)
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+    else
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+#elif defined(USE_OSMESA)
+    glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+#endif
 
     std::string resolution = CONFIG_IMAGE_RESOLUTIONS[CWorld::GetInstance()->m_configImage.resolution];
     int width, height;
@@ -83,8 +149,18 @@ bool CWindow::Initialize()
         return false;
     }
 
-    glfwMakeContextCurrent(m_window);
-    glfwSwapInterval(1);
+#if defined(USE_EGL)
+    if (m_headless)
+    {
+        if (!CreateSurfacelessContext())
+            return false;
+    }
+    else
+#endif
+        glfwMakeContextCurrent(m_window);
+    // A surfaceless context has nothing to swap
+    if (!m_headless)
+        glfwSwapInterval(1);
 
     if (glewInit() != GLEW_OK)
     {
@@ -92,6 +168,13 @@ bool CWindow::Initialize()
         return false;
     }
 
+    if (m_headless)
+    {
+        if (!UpdateFramebuffer(width, height))
+            return false;
+        CPlat::PrintLogLn("Headless rendering %dx%d on %s", width, height, (const char *)glGetString(GL_RENDERER));
+    }
+
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 
@@ -125,6 +208,14 @@ bool CWindow::Initialize()
     ImGui::StyleColorsDark();
     // ImGui::StyleColorsLight();
 
+    // Input renders at full rate again, ImGui chains its callbacks to these
+    glfwSetCursorPosCallback(m_window, [](GLFWwindow *, double, double) { CWindow::GetInstance()->m_wake = true; });
+    glfwSetMouseButtonCallback(m_window, [](GLFWwindow *, int, int, int) { CWindow::GetInstance()->m_wake = true; });
+    glfwSetScrollCallback(m_window, [](GLFWwindow *, double, double) { CWindow::GetInstance()->m_wake = true; });
+    glfwSetKeyCallback(m_window, [](GLFWwindow *, int, int, int, int) { CWindow::GetInstance()->m_wake = true; });
+    glfwSetCharCallback(m_window, [](GLFWwindow *, unsigned int) { CWindow::GetInstance()->m_wake = true; });
+    glfwSetWindowFocusCallback(m_window, [](GLFWwindow *, int) { CWindow::GetInstance()->m_wake = true; });
+
     // Setup Platform/Renderer backends
     ImGui_ImplGlfw_InitForOpenGL(m_window, true);
     const char *glsl_version = "#version 120";
@@ -133,6 +224,106 @@ bool CWindow::Initialize()
     return GL_TRUE;
 }
 
+#if defined(USE_EGL)
+bool CWindow::CreateSurfacelessContext()
+{
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    EGLDisplay display = getPlatformDisplay ? getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL) : EGL_NO_DISPLAY;
+    EGLint major, minor;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+    {
+        CPlat::PrintLogLn("No surfaceless EGL display, headless rendering needs Mesa's EGL_MESA_platform_surfaceless");
+        return false;
+    }
+    m_eglDisplay = display;
+
+    // Desktop GL as on a display, the shaders are GLSL 1.20
+    const EGLint configAttribs[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                                    EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8, EGL_NONE};
+    EGLConfig config;
+    EGLint configs = 0;
+    if (!eglBindAPI(EGL_OPENGL_API) || !eglChooseConfig(display, configAttribs, &config, 1, &configs) || configs < 1)
+    {
+        CPlat::PrintLogLn("No EGL config for desktop OpenGL");
+        return false;
+    }
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+    if (context == EGL_NO_CONTEXT)
+    {
+        CPlat::PrintLogLn("Failed to create the EGL context, 0x%x", eglGetError());
+        return false;
+    }
+    m_eglContext = context;
+
+    // The frames go to the framebuffer from UpdateFramebuffer()
+    if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+    {
+        CPlat::PrintLogLn("Failed to make the EGL context current without a surface, 0x%x", eglGetError());
+        return false;
+    }
+    CPlat::PrintLogLn("EGL %d.%d, surfaceless", major, minor);
+    return true;
+}
+#endif
+
+bool CWindow::UpdateFramebuffer(int width, int height)
+{
+    if (m_fbo && m_fboWidth == width && m_fboHeight == height)
+        return true;
+
+    if (!m_fbo)
+    {
+        glGenFramebuffers(1, &m_fbo);
+        glGenRenderbuffers(1, &m_fboColor);
+        glGenRenderbuffers(1, &m_fboDepth);
+    }
+
+    // The default framebuffer of the headless window, Cubism's offscreen surfaces and masks return to it
+    glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_fboColor);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_fboColor);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_fboDepth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, m_fboDepth);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        CPlat::PrintLogLn("Failed to create the %dx%d offscreen framebuffer", width, height);
+        return false;
+    }
+
+    // Without a surface the viewport starts empty
+    glViewport(0, 0, width, height);
+    m_fboWidth = width;
+    m_fboHeight = height;
+    return true;
+}
+
+bool CWindow::SaveFrame(const std::string &path)
+{
+    int width, height;
+    glfwGetFramebufferSize(m_window, &width, &height);
+    if (m_headless)
+        glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+    std::vector<unsigned char> pixels((size_t)width * height * 4);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+    {
+        std::cout << "Render: unable to write " << path << std::endl;
+        return false;
+    }
+    file << "P7\nWIDTH " << width << "\nHEIGHT " << height << "\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n";
+    // GL's rows start at the bottom
+    for (int y = height - 1; y >= 0; y--)
+        file.write((const char *)pixels.data() + (size_t)y * width * 4, (std::streamsize)width * 4);
+    return (bool)file;
+}
+
 GLuint CWindow::CreateBaseShader()
 {
     GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
@@ -237,61 +428,227 @@ void CWindow::msgBoxRender()
 
 void CWindow::Run()
 {
+    m_activeUntil = glfwGetTime() + WINDOW_IDLE_HOLD_S;
     while (glfwWindowShouldClose(m_window) == GL_FALSE && !m_isEnd)
     {
-        glfwPollEvents();
+        if (IsHidden())
+        {
+            // Nothing to see, only events until it shows again
+            m_hidden = true;
+            glfwWaitEventsTimeout(WINDOW_HIDDEN_POLL_S);
+            continue;
+        }
+        if (m_hidden)
+        {
+            m_hidden = false;
+            m_wake = true;
+        }
+
+        double frameStart = glfwGetTime();
+        Frame();
+        WaitNextFrame(frameStart);
+    }
+}
+
+void CWindow::Wake()
+{
+    if (m_window == nullptr)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_wakeMutex);
+        m_wake = true;
+    }
+    if (m_headless)
+        m_wakeCond.notify_one();
+    else
+        glfwPostEmptyEvent();
+}
+
+bool CWindow::IsHidden()
+{
+    if (m_headless)
+        return false;
+    return glfwGetWindowAttrib(m_window, GLFW_ICONIFIED) || !glfwGetWindowAttrib(m_window, GLFW_VISIBLE) || CPlat::IsWindowOccluded(m_window);
+}
 
-        int width, height;
-        glfwGetWindowSize(m_window, &width, &height);
-        auto world = CWorld::GetInstance();
-        if (world->m_configChanged)
+bool CWindow::IsActive(double now)
+{
+    auto world = CWorld::GetInstance();
+    CChat *chat = world->GetChat();
+    bool busy = world->m_configImage.idleFps <= 0 || world->m_showPanel || m_showMessageBox || m_mousePressed ||
+                m_cubismView->IsAnimating() || (chat && chat->GetLipValue() > WINDOW_IDLE_LIP);
+    if (m_wake.exchange(false) || busy)
+        m_activeUntil = now + WINDOW_IDLE_HOLD_S;
+    return now < m_activeUntil;
+}
+
+void CWindow::WaitNextFrame(double frameStart)
+{
+    double now = glfwGetTime();
+    double interval;
+    m_idle = !IsActive(now);
+    if (!m_idle)
+    {
+        // The swap waits for the display
+        if (!m_headless)
+            return;
+        interval = 1.0 / WINDOW_HEADLESS_FPS;
+    }
+    else
+        interval = 1.0 / CWorld::GetInstance()->m_configImage.idleFps;
+
+    // Input, audio or an emotion ends the wait early
+    double deadline = frameStart + interval;
+    while (now < deadline && !m_wake && glfwWindowShouldClose(m_window) == GL_FALSE)
+    {
+        if (m_headless)
         {
-            std::string resolution = CONFIG_IMAGE_RESOLUTIONS[world->m_configImage.resolution];
-            sscanf(resolution.c_str(), "%dx%d", &width, &height);
-            glfwSetWindowSize(m_window, width, height);
+            std::unique_lock<std::mutex> lock(m_wakeMutex);
+            m_wakeCond.wait_for(lock, std::chrono::duration<double>(deadline - now), [this]() { return m_wake.load(); });
         }
+        else
+            glfwWaitEventsTimeout(deadline - now);
+        now = glfwGetTime();
+    }
+}
 
-        if (world->m_showPanel  && width < 720)
-            glfwSetWindowSize(m_window, 720, height);
+void CWindow::Frame()
+{
+    glfwPollEvents();
 
-        CPlat::UpdateTime();
+    int width, height;
+    glfwGetWindowSize(m_window, &width, &height);
+    auto world = CWorld::GetInstance();
+    if (world->m_configChanged)
+    {
+        std::string resolution = CONFIG_IMAGE_RESOLUTIONS[world->m_configImage.resolution];
+        sscanf(resolution.c_str(), "%dx%d", &width, &height);
+        glfwSetWindowSize(m_window, width, height);
+    }
 
-        glClearColor(0.0f, 0.0f, 0.0f, world->m_configImage.showBk ? 0.8f : 0.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glClearDepth(1.0);
+    if (world->m_showPanel  && width < 720)
+        glfwSetWindowSize(m_window, 720, height);
 
-        m_cubismView->Render();
-        m_stateBar->Render();
+    if (m_headless)
+    {
+        int bufWidth, bufHeight;
+        glfwGetFramebufferSize(m_window, &bufWidth, &bufHeight);
+        if (!UpdateFramebuffer(bufWidth, bufHeight))
+        {
+            m_isEnd = true;
+            return;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+    }
+
+    CPlat::UpdateTime();
 
-        // ImGUI
-        ImGui_ImplOpenGL3_NewFrame();
-        ImGui_ImplGlfw_NewFrame();
-        ImGui::NewFrame();
+    glClearColor(0.0f, 0.0f, 0.0f, world->m_configImage.showBk ? 0.8f : 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glClearDepth(1.0);
 
-        // Record mouse event
-        ImVec2 mousePositionAbsolute = ImGui::GetMousePos();
-        m_mouseWinXPx = mousePositionAbsolute.x;
-        m_mouseWinYPx = mousePositionAbsolute.y;
+    m_cubismView->Render();
+    m_stateBar->Render();
 
-        if (m_mouseWinXPx < -65536)
-            m_mouseWinXPx = 0; // Fix mac switch desktop issue
-        if (m_mouseWinYPx < -65536)
-            m_mouseWinYPx = 0;
+    // ImGUI
+    ImGui_ImplOpenGL3_NewFrame();
+    ImGui_ImplGlfw_NewFrame();
+    ImGui::NewFrame();
 
-        m_mouseWinX = (float)m_mouseWinXPx / (float)width * 2.0f - 1.0f;
-        m_mouseWinY = (float)m_mouseWinYPx / (float)height * -2.0f + 1.0f;
+    // Record mouse event
+    ImVec2 mousePositionAbsolute = ImGui::GetMousePos();
+    m_mouseWinXPx = mousePositionAbsolute.x;
+    m_mouseWinYPx = mousePositionAbsolute.y;
 
-        m_mousePressed = ImGui::IsMouseDown(ImGuiMouseButton_Left);
+    if (m_mouseWinXPx < -65536)
+        m_mouseWinXPx = 0; // Fix mac switch desktop issue
+    if (m_mouseWinYPx < -65536)
+        m_mouseWinYPx = 0;
 
-        msgBoxRender();
+    m_mouseWinX = (float)m_mouseWinXPx / (float)width * 2.0f - 1.0f;
+    m_mouseWinY = (float)m_mouseWinYPx / (float)height * -2.0f + 1.0f;
 
-        world->Render(width, height);
+    m_mousePressed = ImGui::IsMouseDown(ImGuiMouseButton_Left);
 
-        ImGui::Render();
-        int display_w, display_h;
+    msgBoxRender();
 
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    world->Render(width, height);
 
+    ImGui::Render();
+    int display_w, display_h;
+
+    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+
+    if (m_headless)
+        glFlush();
+    else
         glfwSwapBuffers(m_window);
+}
+
+void CWindow::Benchmark(int frames, const char *path)
+{
+    auto world = CWorld::GetInstance();
+    CWindow *window = world->GetWindow();
+    window->SetHeadless(true);
+
+    // The same frames every run, blinks and idle motions draw from rand()
+    srand(1);
+    CPlat::SetFixedDeltaTime(1.0 / WINDOW_HEADLESS_FPS);
+
+    world->Initialize();
+    if (window->m_window == nullptr)
+    {
+        std::cout << "Render: no headless window, see the log; a first run only writes config.xml" << std::endl;
+        return;
+    }
+
+    // Drawn directly, then through the cache. The idle rule is followed on the simulated clock as in the frame loop:
+    // drawn directly breath and blinks keep it active, cached they hold after WINDOW_IDLE_HOLD_S of stillness.
+    CCubismView *view = window->GetView();
+    const bool cacheModel = world->m_configImage.cacheModel;
+    for (int pass = 0; pass < 2 && !window->m_isEnd; pass++)
+    {
+        world->m_configImage.cacheModel = pass == 1;
+        view->ResetCacheStats();
+        window->m_activeUntil = WINDOW_IDLE_HOLD_S;
+        window->m_idle = false;
+
+        std::vector<double> times;
+        double hitTotal = 0.0, drawTotal = 0.0;
+        for (int i = 0; i < frames; i++)
+        {
+            int hits = view->GetCacheHits();
+            auto start = std::chrono::steady_clock::now();
+            window->Frame();
+            glFinish();
+            times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            (view->GetCacheHits() > hits ? hitTotal : drawTotal) += times.back();
+            window->m_idle = !window->IsActive((i + 1) / (double)WINDOW_HEADLESS_FPS);
+            if (window->m_isEnd)
+                break;
+        }
+        if (times.empty())
+            break;
+
+        double total = 0.0;
+        for (double t : times)
+            total += t;
+        std::sort(times.begin(), times.end());
+        int hits = view->GetCacheHits(), draws = view->GetModelDraws();
+        if (pass == 0)
+            std::cout << "Render: " << window->m_fboWidth << "x" << window->m_fboHeight << " on " << (const char *)glGetString(GL_RENDERER) << std::endl;
+        std::cout << "Render: " << (pass == 1 ? "cached" : "direct") << ", " << times.size() << " frames, mean " << total / times.size() << " ms, p50 " << times[times.size() / 2]
+                  << " ms, p99 " << times[std::min(times.size() - 1, times.size() * 99 / 100)] << " ms, " << times.size() * 1000.0 / total << " fps" << std::endl;
+        std::cout << "Render: " << hits << " cache hits, " << draws << " model draws";
+        if (hits > 0)
+            std::cout << ", composited frames mean " << hitTotal / hits << " ms";
+        if (draws > 0)
+            std::cout << ", drawn frames mean " << drawTotal / draws << " ms";
+        std::cout << std::endl;
     }
-}
\ No newline at end of file
+    world->m_configImage.cacheModel = cacheModel;
+
+    if (path && window->SaveFrame(path))
+        std::cout << "Render: last frame written to " << path << std::endl;
+}
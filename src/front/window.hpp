@@ -10,10 +10,18 @@
 #include "../server/world.hpp"
 
 #include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 #define _STRINGIZE(...) #__VA_ARGS__
 #define STRINGIZE(...) _STRINGIZE(__VA_ARGS__)
 
+#define WINDOW_HEADLESS_FPS 60 // Frames rendered per second without a display to pace them
+#define WINDOW_IDLE_HOLD_S 2.0 // Full rate this long after the last activity, fades and physics settle
+#define WINDOW_HIDDEN_POLL_S 0.25 // Iconified or occluded, how often to look again
+#define WINDOW_IDLE_LIP 0.01f // Lip value above which audio counts as playing
+
 class CWindow
 {
 public:
@@ -24,7 +32,14 @@ public:
 
     void Run();
 
+    // Before Initialize. Renders offscreen without a display, needs a build with USE_EGL or USE_OSMESA.
+    void SetHeadless(bool headless) { m_headless = headless; }
+    bool IsHeadless() { return m_headless; }
 
+    // Any thread. Back to full rate, at once when the frame loop waits at the idle rate.
+    void Wake();
+    // The last frame waited at the idle rate, the model holds its breath and blinks meanwhile
+    bool IsIdle() { return m_idle; }
 
     bool Initialize();
     void InitializeCubism();
@@ -51,11 +66,43 @@ public:
         std::string message,
         std::function<void()> confirmCallback = nullptr,
         std::function<void()> cancelCallback = nullptr);
+
+    // The last frame as a PAM image with alpha, top row first
+    bool SaveFrame(const std::string &path);
+
+    // Frame times of the headless renderer, writes the last frame to `path` for golden image comparisons.
+    static void Benchmark(int frames, const char *path);
+
 private:
+    void Frame();
+    bool CreateSurfacelessContext();
+    bool UpdateFramebuffer(int width, int height);
+    bool IsHidden();
+    bool IsActive(double now);
+    void WaitNextFrame(double frameStart);
+
     GLFWwindow* m_window;
     class CTexManager* m_texManager;
     bool m_isEnd; 
 
+    // Headless, the frames go to an offscreen framebuffer of the window's size
+    bool m_headless;
+    GLuint m_fbo;
+    GLuint m_fboColor;
+    GLuint m_fboDepth;
+    int m_fboWidth;
+    int m_fboHeight;
+    void* m_eglDisplay; // USE_EGL, the context is ours, GLFW's null platform only keeps the window's size
+    void* m_eglContext;
+
+    // Frame pacing, the loop drops to the configured idle rate while nothing visible changes
+    std::atomic<bool> m_wake;
+    double m_activeUntil;
+    bool m_idle;
+    bool m_hidden;
+    std::mutex m_wakeMutex;
+    std::condition_variable m_wakeCond; // Headless, the null platform's event wait returns at once
+
     GLuint m_baseShader;
 
     class CCubismAllocator* m_cubismAllocator;
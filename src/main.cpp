@@ -3,12 +3,76 @@
  */
 
 #include <iostream>
+#include <cstdlib>
+#include <cstring>
 #include "server/world.hpp"
+#include "server/audioRing.hpp"
+#include "server/audioResampler.hpp"
+#include "server/audioOutput.hpp"
+#include "server/audioViseme.hpp"
+#include "server/audioCapture.hpp"
+#include "server/audioEcho.hpp"
+#include "server/audioMixer.hpp"
+#include "server/rtc.hpp"
+#include "server/chat.hpp"
 #include "front/window.hpp"
 
-int main()
+int main(int argc, char *argv[])
 {
+    if (argc > 1 && strcmp(argv[1], "--bench-ring") == 0)
+    {
+        return AudioRingBenchmark(argc > 2 ? atoi(argv[2]) : 5) ? 0 : 1;
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-resampler") == 0)
+    {
+        CAudioResampler::Benchmark();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-output") == 0)
+    {
+        AudioOutputBenchmark();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-viseme") == 0)
+    {
+        CVisemeAnalyzer::Benchmark();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-vad") == 0)
+    {
+        CAudioCapture::Benchmark(argc > 2 ? argv[2] : nullptr);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-aec") == 0)
+    {
+        CEchoCanceller::Benchmark(argc > 3 ? argv[2] : nullptr, argc > 3 ? argv[3] : nullptr);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-mixer") == 0)
+    {
+        CAudioMixer::Benchmark();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-playback") == 0)
+    {
+        CChat::BenchmarkPlayback(argc > 2 ? argv[2] : nullptr, argc > 3 ? argv[3] : nullptr);
+        return 0;
+    }
+    if (argc > 2 && strcmp(argv[1], "--bench-rtc") == 0)
+    {
+        CRtcClient::Benchmark(argv[2], argc > 3 ? argv[3] : "ws://127.0.0.1:2800");
+        return 0;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--bench-render") == 0)
+    {
+        CWindow::Benchmark(argc > 2 ? atoi(argv[2]) : 300, argc > 3 ? argv[3] : nullptr);
+        return 0;
+    }
+
     auto world = CWorld::GetInstance();
+    if (argc > 1 && strcmp(argv[1], "--headless") == 0)
+        world->GetWindow()->SetHeadless(true);
     
     world->Initialize();
     world->GetWindow()->Run();
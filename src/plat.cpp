@@ -6,7 +6,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
-#include <os/log.h>
 #include <sys/stat.h>
 #include <iostream>
 #include <fstream>
@@ -14,9 +13,19 @@
 #include <GLFW/glfw3.h>
 #include <Model/CubismMoc.hpp>
 #include "plat.hpp"
-#include <mach-o/dyld.h>
 #include <libgen.h>
+
+#if defined(__APPLE__)
+#include <os/log.h>
+#include <mach-o/dyld.h>
 #include <CoreGraphics/CGEvent.h>
+#include <objc/message.h>
+
+// From glfw3native.h, whose own `id` clashes with the Objective-C runtime's
+extern "C" id glfwGetCocoaWindow(GLFWwindow* window);
+#else
+#include <unistd.h>
+#endif
 
 using std::endl;
 using namespace Csm;
@@ -25,6 +34,7 @@ using namespace std;
 double CPlat::s_currentFrame = 0.0;
 double CPlat::s_lastFrame = 0.0;
 double CPlat::s_deltaTime = 0.0;
+double CPlat::s_fixedDeltaTime = 0.0;
 
 csmByte* CPlat::LoadFileAsBytes(const string filePath, csmSizeInt* outSize)
 {
@@ -77,7 +87,10 @@ csmFloat32  CPlat::GetDeltaTime()
 
 void CPlat::UpdateTime()
 {
-    s_currentFrame = glfwGetTime();
+    if (s_fixedDeltaTime > 0.0)
+        s_currentFrame = s_lastFrame + s_fixedDeltaTime;
+    else
+        s_currentFrame = glfwGetTime();
     s_deltaTime = s_currentFrame - s_lastFrame;
     s_lastFrame = s_currentFrame;
 }
@@ -88,7 +101,11 @@ void CPlat::PrintLogLn(const csmChar* format, ...)
     csmChar buf[256];
     va_start(args, format);
     vsnprintf(buf, sizeof(buf), format, args); 
+#if defined(__APPLE__)
     os_log(OS_LOG_DEFAULT, "%s", buf);
+#else
+    std::cout << buf << std::endl;
+#endif
     va_end(args);
 }
 
@@ -100,17 +117,51 @@ void CPlat::PrintMessageLn(const csmChar* message)
 std::string CPlat::GetExecuteAbsolutePath()
 {
     char path[1024];
+#if defined(__APPLE__)
     uint32_t size = sizeof(path);
     _NSGetExecutablePath(path, &size);
+#else
+    ssize_t size = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    path[size > 0 ? size : 0] = '\0';
+#endif
     return (std::string(dirname(path)) + "/");
 }
 
 void CPlat::GetCursorPos(float* x, float* y)
 {
+#if defined(__APPLE__)
     CGPoint cursor;
     CGEventRef event = CGEventCreate(NULL);
     cursor = CGEventGetLocation(event);
     *x = cursor.x;
     *y = cursor.y;
     CFRelease(event);
-}
\ No newline at end of file
+#else
+    // Screen coordinates, through the window of the current context
+    double cursorX = 0.0, cursorY = 0.0;
+    int winX = 0, winY = 0;
+    GLFWwindow* window = glfwGetCurrentContext();
+    if (window)
+    {
+        glfwGetCursorPos(window, &cursorX, &cursorY);
+        glfwGetWindowPos(window, &winX, &winY);
+    }
+    *x = (float)(winX + cursorX);
+    *y = (float)(winY + cursorY);
+#endif
+}
+
+bool CPlat::IsWindowOccluded(GLFWwindow* window)
+{
+#if defined(__APPLE__)
+    const unsigned long visible = 1UL << 1; // NSWindowOcclusionStateVisible
+    id nsWindow = glfwGetCocoaWindow(window);
+    if (nsWindow == nil)
+        return false;
+    unsigned long state = ((unsigned long (*)(id, SEL))objc_msgSend)(nsWindow, sel_registerName("occlusionState"));
+    return (state & visible) == 0;
+#else
+    (void)window;
+    return false;
+#endif
+}
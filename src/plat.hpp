@@ -15,15 +15,20 @@ public:
     static Csm::csmFloat32 GetDeltaTime();
 
     static void UpdateTime();
+    // Every update advances the time by `seconds` instead of the clock, 0 follows the clock
+    static void SetFixedDeltaTime(double seconds) { s_fixedDeltaTime = seconds; }
     static void PrintLogLn(const Csm::csmChar* format, ...);
     static void PrintMessageLn(const Csm::csmChar* message);
     static std::string GetExecuteAbsolutePath();
 
     static void GetCursorPos(float* x, float* y);
+    // Covered by other windows or on another space, false where the platform can not tell
+    static bool IsWindowOccluded(struct GLFWwindow* window);
 
 private:
     static double s_currentFrame;
     static double s_lastFrame;
     static double s_deltaTime;
+    static double s_fixedDeltaTime;
 };
 
@@ -0,0 +1,247 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+
+#include "asrClient.hpp"
+#include "audioCapture.hpp"
+
+#include <iostream>
+#include <sstream>
+#include <json/json.h>
+
+static double MsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+CAsrClient::CAsrClient()
+    : m_capture(nullptr), m_thread(nullptr), m_recognitionSum(0.0), m_totalSum(0.0)
+{
+    m_quit = false;
+    m_stats = {};
+}
+
+CAsrClient::~CAsrClient()
+{
+    Stop();
+}
+
+void CAsrClient::Start(CAudioCapture *capture, const std::string &url)
+{
+    Stop();
+    m_capture = capture;
+    m_url = url;
+    m_quit = false;
+    m_thread = new std::thread(&CAsrClient::Thread, this);
+}
+
+void CAsrClient::Stop()
+{
+    if (!m_thread)
+        return;
+    m_quit = true;
+    m_thread->join();
+    delete m_thread;
+    m_thread = nullptr;
+}
+
+bool CAsrClient::PollResult(SAsrResult &result)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_results.empty())
+        return false;
+    result = std::move(m_results.front());
+    m_results.pop_front();
+    return true;
+}
+
+void CAsrClient::GetStats(SAsrStats &stats) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    stats = m_stats;
+}
+
+void CAsrClient::Push(SAsrResult &&result)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_results.push_back(std::move(result));
+}
+
+void CAsrClient::Thread()
+{
+    while (!m_quit)
+    {
+        SVoiceEvent event;
+        while (m_capture->PollEvent(event))
+            OnVoiceEvent(event);
+
+        if (m_sessions.empty())
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(CAPTURE_POLL_MS));
+            continue;
+        }
+
+        // Blocks on the newest connection, answers are read the moment they arrive
+        for (size_t i = 0; i < m_sessions.size();)
+        {
+            SSession *session = m_sessions[i];
+            if (PollSession(*session, i + 1 == m_sessions.size() ? CAPTURE_POLL_MS : 0))
+                i++;
+            else
+            {
+                delete session;
+                m_sessions.erase(m_sessions.begin() + i);
+            }
+        }
+    }
+
+    for (SSession *session : m_sessions)
+        delete session;
+    m_sessions.clear();
+}
+
+void CAsrClient::OnVoiceEvent(SVoiceEvent &event)
+{
+    SSession *session = !m_sessions.empty() && m_sessions.back()->utterance == event.utterance && !m_sessions.back()->ended ? m_sessions.back() : nullptr;
+
+    if (event.type == VOICE_EVENT_START)
+    {
+        if (m_sessions.size() >= ASR_MAX_SESSIONS)
+        {
+            std::cout << "ASR: utterance " << m_sessions.front()->utterance << " dropped, too many waiting" << std::endl;
+            delete m_sessions.front();
+            m_sessions.pop_front();
+        }
+
+        // Connected while the user speaks, the audio queues up in the capture meanwhile
+        session = new SSession();
+        session->utterance = event.utterance;
+        session->ended = false;
+        session->answersPending = 0;
+        session->endpointMs = 0.0;
+        auto start = std::chrono::steady_clock::now();
+        std::string error;
+        if (!session->socket.Connect(m_url, ASR_CONNECT_TIMEOUT_MS, error) ||
+            !session->socket.SendText("{\"config\": {\"sample_rate\": " + std::to_string(VAD_SAMPLE_RATE) + "}}"))
+        {
+            std::cout << "ASR: " << m_url << ": " << (error.empty() ? "send failed" : error) << std::endl;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stats.errors++;
+            delete session;
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stats.connectMs = MsSince(start);
+        }
+        m_sessions.push_back(session);
+    }
+    if (!session)
+        return; // Not connected
+
+    bool sent = true;
+    if (event.type == VOICE_EVENT_START || event.type == VOICE_EVENT_AUDIO)
+    {
+        sent = session->socket.SendBinary(event.pcm.data(), event.pcm.size() * sizeof(short));
+        session->answersPending++;
+    }
+    else if (event.type == VOICE_EVENT_END)
+    {
+        sent = session->socket.SendText("{\"eof\": 1}");
+        session->answersPending++;
+        session->ended = true;
+        session->endpointMs = event.endpointMs;
+        session->speechEnd = event.speechEnd;
+        session->eofSent = std::chrono::steady_clock::now();
+    }
+    else if (event.type == VOICE_EVENT_CANCEL)
+    {
+        // Clears the partial shown for it
+        Push({session->utterance, "", false, 0.0, 0.0});
+        session->socket.Close();
+        delete session;
+        m_sessions.pop_back();
+        return;
+    }
+
+    if (!sent)
+    {
+        std::cout << "ASR: connection lost during utterance " << session->utterance << std::endl;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats.errors++;
+        delete session;
+        m_sessions.pop_back();
+    }
+}
+
+bool CAsrClient::PollSession(SSession &session, int timeoutMs)
+{
+    std::vector<SWebSocketMessage> messages;
+    bool open = session.socket.Poll(messages, timeoutMs);
+
+    for (auto &message : messages)
+    {
+        Json::Value value;
+        Json::CharReaderBuilder builder;
+        std::string errors;
+        std::istringstream stream(message.data);
+        if (message.binary || !Json::parseFromStream(builder, stream, &value, &errors) || !value.isObject())
+            continue;
+
+        session.answersPending--;
+        if (value.isMember("text"))
+        {
+            // A finished part, the server's own endpointer may split long utterances
+            std::string text = value["text"].asString();
+            if (!text.empty())
+                session.text += (session.text.empty() ? "" : " ") + text;
+            session.partial.clear();
+        }
+        else if (value.isMember("partial"))
+        {
+            std::string partial = value["partial"].asString();
+            if (partial == session.partial)
+                continue;
+            session.partial = partial;
+            Push({session.utterance, session.text + (session.text.empty() || partial.empty() ? "" : " ") + partial, false, 0.0, 0.0});
+        }
+    }
+
+    if (session.ended && (session.answersPending <= 0 || !open))
+    {
+        Finish(session);
+        return false;
+    }
+    if (!open || (session.ended && MsSince(session.eofSent) > ASR_FINAL_TIMEOUT_MS))
+    {
+        std::cout << "ASR: no transcript for utterance " << session.utterance << (open ? ", timed out" : ", connection closed") << std::endl;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats.errors++;
+        return false;
+    }
+    return true;
+}
+
+void CAsrClient::Finish(SSession &session)
+{
+    session.socket.Close();
+
+    SAsrResult result;
+    result.utterance = session.utterance;
+    result.text = session.text;
+    result.final = true;
+    result.endpointMs = session.endpointMs;
+    result.recognitionMs = MsSince(session.eofSent);
+
+    double totalMs = MsSince(session.speechEnd);
+    m_recognitionSum += result.recognitionMs;
+    m_totalSum += totalMs;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats.finals++;
+        m_stats.recognitionMs = result.recognitionMs;
+        m_stats.meanRecognitionMs = m_recognitionSum / m_stats.finals;
+        m_stats.meanTotalMs = m_totalSum / m_stats.finals;
+    }
+    Push(std::move(result));
+}
@@ -0,0 +1,93 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+#pragma once
+
+#include <string>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include "webSocket.hpp"
+
+#define ASR_CONNECT_TIMEOUT_MS 2000
+#define ASR_FINAL_TIMEOUT_MS 5000 // After the end of speech
+#define ASR_MAX_SESSIONS 4        // Utterances still waiting for their transcript
+
+struct SAsrResult
+{
+    int utterance;
+    std::string text;
+    bool final;
+    double endpointMs;    // Final: end of speech until the endpoint was detected
+    double recognitionMs; // Final: endpoint until the transcript arrived
+};
+
+struct SAsrStats
+{
+    int finals;
+    int errors;
+    double connectMs;       // Of the last utterance
+    double recognitionMs;   // Endpoint to transcript of the last utterance
+    double meanRecognitionMs;
+    double meanTotalMs;     // End of speech to transcript
+};
+
+/**
+ * Streaming speech recognition over the Vosk server WebSocket protocol.
+ * Every utterance gets its own connection, opened at the start of speech:
+ * a {"config"} message, the PCM as binary messages while the user speaks,
+ * then {"eof": 1}. The server answers every message with {"partial"} or
+ * {"text"}, the answer to the eof is the final transcript. Only the eof
+ * round trip is left after the endpoint. Consumes the events of a
+ * CAudioCapture on its own thread.
+ */
+class CAsrClient
+{
+public:
+    CAsrClient();
+    ~CAsrClient();
+
+    // Restarts when running
+    void Start(class CAudioCapture *capture, const std::string &url);
+    void Stop();
+
+    bool PollResult(SAsrResult &result);
+    void GetStats(SAsrStats &stats) const;
+
+private:
+    struct SSession
+    {
+        CWebSocket socket;
+        int utterance;
+        bool ended;          // eof sent
+        int answersPending;  // Messages sent and not answered yet
+        std::string text;    // Finished parts, servers may split an utterance
+        std::string partial;
+        double endpointMs;
+        std::chrono::steady_clock::time_point speechEnd;
+        std::chrono::steady_clock::time_point eofSent;
+    };
+
+    void Thread();
+    void OnVoiceEvent(struct SVoiceEvent &event);
+    bool PollSession(SSession &session, int timeoutMs); // False when done
+    void Finish(SSession &session);
+    void Push(SAsrResult &&result);
+
+    class CAudioCapture *m_capture;
+    std::string m_url;
+    std::thread *m_thread;
+    std::atomic<bool> m_quit;
+
+    // Thread only
+    std::deque<SSession *> m_sessions;
+    double m_recognitionSum;
+    double m_totalSum;
+
+    mutable std::mutex m_mutex;
+    std::deque<SAsrResult> m_results;
+    SAsrStats m_stats;
+};
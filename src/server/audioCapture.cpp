@@ -0,0 +1,795 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+
+#include "audioCapture.hpp"
+#include "audioDecoder.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <algorithm>
+#include <soundio/soundio.h>
+
+#define CAPTURE_READ_SAMPLES 4096
+#define CAPTURE_CALLBACK_FRAMES 512
+
+static int64_t NowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+CAudioCapture::CAudioCapture()
+    : m_devicesChanged(false), m_backendLost(false), m_captureThread(nullptr), m_processThread(nullptr), m_source(CAPTURE_SOURCE_MIC),
+      m_echoReference(nullptr), m_params({12.0f, 400, 150, VAD_MAX_SPEECH_MS, VAD_PRE_ROLL_MS}), m_processRate(0), m_paramsSeen(0),
+      m_historyFrame(0), m_sent(0), m_lastVoicedNs(0), m_utterance(0), m_endpointSum(0.0), m_echoActive(false), m_echoWarned(false),
+      m_echoBusy(0.0)
+{
+    m_sampleRate.store(0, std::memory_order_relaxed);
+    m_lastWriteNs.store(0, std::memory_order_relaxed);
+    m_inputLatency.store(0.0, std::memory_order_relaxed);
+    m_soundio.store(nullptr, std::memory_order_relaxed);
+    m_reopen.store(false, std::memory_order_relaxed);
+    m_lastError.store(0, std::memory_order_relaxed);
+    m_quit.store(false, std::memory_order_relaxed);
+    m_paramsSerial.store(0, std::memory_order_relaxed);
+    m_speaking.store(false, std::memory_order_relaxed);
+    m_levelDb.store(VAD_MIN_FLOOR_DB, std::memory_order_relaxed);
+    m_noiseDb.store(VAD_MIN_FLOOR_DB, std::memory_order_relaxed);
+    m_utterances.store(0, std::memory_order_relaxed);
+    m_cancelled.store(0, std::memory_order_relaxed);
+    m_overflows.store(0, std::memory_order_relaxed);
+    m_lastEndpointMs.store(0.0, std::memory_order_relaxed);
+    m_meanEndpointMs.store(0.0, std::memory_order_relaxed);
+    m_load.store(0.0, std::memory_order_relaxed);
+    m_echoCancel.store(false, std::memory_order_relaxed);
+    m_echoRunning.store(false, std::memory_order_relaxed);
+    m_echoErleDb.store(0.0f, std::memory_order_relaxed);
+    m_echoLoad.store(0.0, std::memory_order_relaxed);
+    m_echo.Configure();
+}
+
+CAudioCapture::~CAudioCapture()
+{
+    Stop();
+}
+
+void CAudioCapture::Start(int source, const std::string &file)
+{
+    Stop();
+
+    if (!m_ring.Capacity())
+        m_ring.Allocate(CAPTURE_MAX_RATE, CAPTURE_BUFFER_MS);
+    m_sampleRate.store(0, std::memory_order_relaxed);
+    m_inputLatency.store(0.0, std::memory_order_relaxed);
+    m_processRate = 0;
+    m_source = source;
+    m_quit = false;
+
+    if (source == CAPTURE_SOURCE_FILE)
+        m_captureThread = new std::thread(&CAudioCapture::FileThread, this, file);
+    else
+        m_captureThread = new std::thread(&CAudioCapture::MicThread, this);
+    m_processThread = new std::thread(&CAudioCapture::ProcessThread, this);
+}
+
+void CAudioCapture::Stop()
+{
+    if (!m_processThread)
+        return;
+
+    m_quit = true;
+    // The mic thread may be in soundio_wait_events(), or about to enter it
+    while (m_sampleRate.load() >= 0)
+    {
+        struct SoundIo *soundio = m_soundio.load();
+        if (soundio)
+            soundio_wakeup(soundio);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    m_captureThread->join();
+    m_processThread->join();
+    delete m_captureThread;
+    delete m_processThread;
+    m_captureThread = nullptr;
+    m_processThread = nullptr;
+
+    struct SoundIo *soundio = m_soundio.exchange(nullptr);
+    if (soundio)
+        soundio_destroy(soundio);
+    if (m_echoActive)
+        m_echoReference->Detach();
+    m_echoActive = false;
+    m_sampleRate.store(0, std::memory_order_relaxed);
+    m_speaking.store(false, std::memory_order_relaxed);
+    m_echoRunning.store(false, std::memory_order_relaxed);
+}
+
+void CAudioCapture::SetParams(const SVadParams &params)
+{
+    std::lock_guard<std::mutex> lock(m_paramsMutex);
+    if (!memcmp(&params, &m_params, sizeof(params)))
+        return;
+    m_params = params;
+    m_paramsSerial.fetch_add(1, std::memory_order_release);
+}
+
+bool CAudioCapture::PollEvent(SVoiceEvent &event)
+{
+    std::lock_guard<std::mutex> lock(m_eventsMutex);
+    if (m_events.empty())
+        return false;
+    event = std::move(m_events.front());
+    m_events.pop_front();
+    return true;
+}
+
+void CAudioCapture::GetStats(SCaptureStats &stats) const
+{
+    stats.sampleRate = std::max(m_sampleRate.load(std::memory_order_relaxed), 0);
+    stats.inputLatencyMs = m_inputLatency.load(std::memory_order_relaxed) * 1000.0;
+    stats.speaking = m_speaking.load(std::memory_order_relaxed);
+    stats.levelDb = m_levelDb.load(std::memory_order_relaxed);
+    stats.noiseDb = m_noiseDb.load(std::memory_order_relaxed);
+    stats.utterances = m_utterances.load(std::memory_order_relaxed);
+    stats.cancelled = m_cancelled.load(std::memory_order_relaxed);
+    stats.overflows = m_overflows.load(std::memory_order_relaxed);
+    stats.lastEndpointMs = m_lastEndpointMs.load(std::memory_order_relaxed);
+    stats.meanEndpointMs = m_meanEndpointMs.load(std::memory_order_relaxed);
+    stats.load = m_load.load(std::memory_order_relaxed);
+    stats.echoCancel = m_echoRunning.load(std::memory_order_relaxed);
+    stats.echoErleDb = m_echoErleDb.load(std::memory_order_relaxed);
+    stats.echoLoad = m_echoLoad.load(std::memory_order_relaxed);
+}
+
+bool CAudioCapture::ReadFile(const std::string &path, std::vector<short> &pcm, int &sampleRate)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+    std::vector<char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    CAudioDecoder *decoder = CAudioDecoder::Create("", data.data(), data.size());
+    if (!decoder)
+        return false;
+
+    short frame[AUDIO_DECODER_MAX_FRAME_SAMPLES];
+    size_t offset = 0;
+    pcm.clear();
+    while (offset < data.size())
+    {
+        size_t consumed = 0;
+        int samples = decoder->DecodeFrame((const uint8_t *)data.data() + offset, data.size() - offset, true, frame, consumed);
+        if (samples < 0 || (!samples && !consumed))
+            break;
+        pcm.insert(pcm.end(), frame, frame + samples);
+        offset += consumed;
+    }
+    sampleRate = decoder->GetSampleRate();
+    delete decoder;
+    return sampleRate > 0 && !pcm.empty();
+}
+
+/*
+ * Microphone
+ */
+void CAudioCapture::ReadCallback(struct SoundIoInStream *instream, int frameCountMin, int frameCountMax)
+{
+    CAudioCapture *capture = (CAudioCapture *)instream->userdata;
+    const int channels = instream->layout.channel_count;
+    const bool f32 = instream->format == SoundIoFormatFloat32NE;
+    const float scale = (f32 ? 32767.0f : 1.0f) / channels;
+    short mono[CAPTURE_CALLBACK_FRAMES];
+    bool lost = false;
+    int err;
+
+    int framesLeft = frameCountMax;
+    while (framesLeft > 0)
+    {
+        struct SoundIoChannelArea *areas;
+        int frameCount = framesLeft;
+        if ((err = soundio_instream_begin_read(instream, &areas, &frameCount)))
+        {
+            ErrorCallback(instream, err);
+            return;
+        }
+        if (!frameCount)
+            break;
+
+        // Downmix to mono, a hole in the stream reads as silence
+        for (int done = 0; done < frameCount;)
+        {
+            int count = std::min(frameCount - done, CAPTURE_CALLBACK_FRAMES);
+            if (!areas)
+                memset(mono, 0, count * sizeof(short));
+            else
+            {
+                for (int i = 0; i < count; i++)
+                {
+                    float sum = 0.0f;
+                    for (int ch = 0; ch < channels; ch++)
+                    {
+                        const char *sample = areas[ch].ptr + areas[ch].step * (done + i);
+                        sum += f32 ? *(const float *)sample : *(const short *)sample;
+                    }
+                    mono[i] = (short)std::min(std::max(sum * scale, -32768.0f), 32767.0f);
+                }
+            }
+            if ((int)capture->m_ring.Write(mono, count) < count)
+                lost = true;
+            done += count;
+        }
+
+        if ((err = soundio_instream_end_read(instream)))
+        {
+            ErrorCallback(instream, err);
+            return;
+        }
+        framesLeft -= frameCount;
+    }
+
+    if (lost)
+        capture->m_overflows.fetch_add(1, std::memory_order_relaxed);
+
+    // How long the next frame has been waiting in the device
+    double latency = 0.0;
+    if (!soundio_instream_get_latency(instream, &latency))
+        capture->m_inputLatency.store(latency, std::memory_order_relaxed);
+    capture->m_lastWriteNs.store(NowNs(), std::memory_order_release);
+}
+
+void CAudioCapture::OverflowCallback(struct SoundIoInStream *instream)
+{
+    ((CAudioCapture *)instream->userdata)->m_overflows.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CAudioCapture::ErrorCallback(struct SoundIoInStream *instream, int err)
+{
+    CAudioCapture *capture = (CAudioCapture *)instream->userdata;
+    capture->m_lastError.store(err, std::memory_order_relaxed);
+    capture->m_reopen.store(true, std::memory_order_release);
+    struct SoundIo *soundio = capture->m_soundio.load();
+    if (soundio)
+        soundio_wakeup(soundio);
+}
+
+// Called on the mic thread from soundio_wait_events()
+void CAudioCapture::DevicesChange(struct SoundIo *soundio)
+{
+    ((CAudioCapture *)soundio->userdata)->m_devicesChanged = true;
+}
+
+void CAudioCapture::BackendDisconnect(struct SoundIo *soundio, int err)
+{
+    CAudioCapture *capture = (CAudioCapture *)soundio->userdata;
+    capture->m_backendLost = true;
+    capture->m_lastError.store(err, std::memory_order_relaxed);
+}
+
+// Opens the default input device, nullptr on failure
+struct SoundIoInStream *CAudioCapture::OpenInput(struct SoundIo *soundio, std::string &deviceId)
+{
+    int err;
+    int index = soundio_default_input_device_index(soundio);
+    if (index < 0)
+    {
+        std::cout << "Capture: no input device found" << std::endl;
+        return nullptr;
+    }
+
+    struct SoundIoDevice *device = soundio_get_input_device(soundio, index);
+    if (!device)
+    {
+        std::cout << "Capture: out of memory" << std::endl;
+        return nullptr;
+    }
+
+    std::cout << "Capture: Input device: " << device->name << std::endl;
+    deviceId = device->id;
+
+    struct SoundIoInStream *instream = soundio_instream_create(device);
+    if (!instream)
+    {
+        std::cout << "Capture: out of memory" << std::endl;
+        soundio_device_unref(device);
+        return nullptr;
+    }
+    instream->format = soundio_device_supports_format(device, SoundIoFormatFloat32NE) ? SoundIoFormatFloat32NE : SoundIoFormatS16NE;
+    instream->read_callback = ReadCallback;
+    instream->overflow_callback = OverflowCallback;
+    instream->error_callback = ErrorCallback;
+    instream->userdata = this;
+    // Capture at the VAD rate when the device has it, saves the resampling
+    instream->sample_rate = std::min(soundio_device_nearest_sample_rate(device, VAD_SAMPLE_RATE), CAPTURE_MAX_RATE);
+    // Short periods, every one of them is waited for before the endpoint is seen
+    instream->software_latency = CAPTURE_LATENCY_MS / 1000.0;
+    soundio_device_unref(device); // The stream holds its own reference
+
+    if ((err = soundio_instream_open(instream)))
+    {
+        std::cout << "Capture: unable to open device: " << soundio_strerror(err) << std::endl;
+        soundio_instream_destroy(instream);
+        return nullptr;
+    }
+    if (instream->layout.channel_count < 1)
+    {
+        std::cout << "Capture: device has no channels" << std::endl;
+        soundio_instream_destroy(instream);
+        return nullptr;
+    }
+
+    m_ring.Flush(); // Captured at the old rate
+    m_inputLatency.store(instream->software_latency, std::memory_order_relaxed);
+    m_reopen.store(false, std::memory_order_relaxed);
+
+    if ((err = soundio_instream_start(instream)))
+    {
+        std::cout << "Capture: unable to start device: " << soundio_strerror(err) << std::endl;
+        soundio_instream_destroy(instream);
+        return nullptr;
+    }
+
+    m_sampleRate.store(instream->sample_rate, std::memory_order_release);
+    std::cout << "Capture: sample rate: " << instream->sample_rate << ", latency: " << instream->software_latency * 1000.0
+              << " ms, " << instream->layout.channel_count << " channels" << std::endl;
+    return instream;
+}
+
+void CAudioCapture::MicThread()
+{
+    int err;
+    struct SoundIo *soundio = soundio_create();
+    if (!soundio)
+    {
+        std::cout << "Capture: out of memory" << std::endl;
+        m_sampleRate = -1;
+        return;
+    }
+    soundio->userdata = this;
+    soundio->on_devices_change = DevicesChange;
+    soundio->on_backend_disconnect = BackendDisconnect;
+    m_soundio.store(soundio);
+
+    struct SoundIoInStream *instream = nullptr;
+    std::string deviceId;
+    bool connected = false;
+
+    while (!m_quit)
+    {
+        if (!connected)
+        {
+            if ((err = soundio_connect(soundio)))
+            {
+                std::cout << "Capture: error connecting: " << soundio_strerror(err) << std::endl;
+                for (int i = 0; i < CAPTURE_RETRY_MS / 10 && !m_quit; i++)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            connected = true;
+            m_backendLost = false;
+            soundio_flush_events(soundio);
+            m_devicesChanged = false;
+        }
+
+        if (!instream)
+            instream = OpenInput(soundio, deviceId); // Tried again when the devices change
+
+        soundio_wait_events(soundio);
+
+        bool reopen = m_reopen.exchange(false, std::memory_order_acquire);
+        if (reopen)
+            std::cout << "Capture: stream error: " << soundio_strerror(m_lastError.load(std::memory_order_relaxed)) << std::endl;
+        if (m_backendLost)
+            std::cout << "Capture: backend disconnected: " << soundio_strerror(m_lastError.load(std::memory_order_relaxed)) << std::endl;
+        if (m_devicesChanged)
+        {
+            // Follow the default device
+            m_devicesChanged = false;
+            int index = soundio_default_input_device_index(soundio);
+            struct SoundIoDevice *device = index >= 0 ? soundio_get_input_device(soundio, index) : nullptr;
+            if (!instream || !device || deviceId != device->id)
+                reopen = true;
+            if (device)
+                soundio_device_unref(device);
+        }
+
+        if ((reopen || m_backendLost || m_quit) && instream)
+        {
+            m_sampleRate = 0;
+            soundio_instream_destroy(instream);
+            instream = nullptr;
+        }
+        if (m_backendLost)
+        {
+            soundio_disconnect(soundio);
+            connected = false;
+        }
+    }
+
+    // Destroyed by Stop(), which may still be waking this thread
+    m_sampleRate = -1;
+}
+
+/*
+ * File
+ */
+void CAudioCapture::FileThread(std::string path)
+{
+    std::vector<short> pcm;
+    int sampleRate;
+    if (!ReadFile(path, pcm, sampleRate) || sampleRate > CAPTURE_MAX_RATE)
+    {
+        std::cout << "Capture: unable to read " << path << std::endl;
+        m_sampleRate = -1;
+        return;
+    }
+    std::cout << "Capture: playing " << path << ", " << sampleRate << " Hz, " << (double)pcm.size() / sampleRate << " s" << std::endl;
+
+    m_ring.Flush();
+    m_sampleRate.store(sampleRate, std::memory_order_release);
+
+    // Periods like a device would deliver them, silence after the file
+    const int period = sampleRate * CAPTURE_LATENCY_MS / 1000;
+    std::vector<short> silence(period, 0);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t pos = 0; !m_quit; pos += period)
+    {
+        std::this_thread::sleep_until(start + std::chrono::nanoseconds((int64_t)((pos + period) * 1e9 / sampleRate)));
+        const short *data = pos + period <= pcm.size() ? pcm.data() + pos : silence.data();
+        if ((int)m_ring.Write(data, period) < period)
+            m_overflows.fetch_add(1, std::memory_order_relaxed);
+        m_lastWriteNs.store(NowNs(), std::memory_order_release);
+    }
+
+    m_sampleRate = -1;
+}
+
+/*
+ * VAD
+ */
+void CAudioCapture::ProcessThread()
+{
+    double busy = 0.0;
+    double audio = 0.0;
+
+    while (!m_quit)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(CAPTURE_POLL_MS));
+        int sampleRate = m_sampleRate.load(std::memory_order_acquire);
+        if (sampleRate <= 0)
+            continue;
+
+        int64_t start = NowNs();
+        if (sampleRate != m_processRate)
+        {
+            m_ring.Skip(m_ring.Available());
+            Reconfigure(sampleRate);
+        }
+        if (m_paramsSerial.load(std::memory_order_acquire) != m_paramsSeen && !m_vad.InSpeech())
+        {
+            std::lock_guard<std::mutex> lock(m_paramsMutex);
+            m_vad.Configure(m_params);
+            m_paramsSeen = m_paramsSerial.load(std::memory_order_relaxed);
+        }
+
+        // A file has no echo of the output in it
+        bool echoCancel = m_echoReference && m_source == CAPTURE_SOURCE_MIC && m_echoCancel.load(std::memory_order_relaxed);
+        if (echoCancel != m_echoActive)
+        {
+            if (echoCancel)
+            {
+                m_echo.Reset();
+                m_echoReference->Attach();
+            }
+            else
+            {
+                m_echoReference->Detach();
+                m_frames.insert(m_frames.end(), m_echoIn.begin(), m_echoIn.end());
+                m_echoIn.clear();
+            }
+            m_echoActive = echoCancel;
+            m_echoRunning.store(echoCancel, std::memory_order_relaxed);
+        }
+
+        // Time first, any sample written since is taken as older than it is
+        int64_t arrivalNs = m_lastWriteNs.load(std::memory_order_acquire);
+        uint64_t available = m_ring.Available();
+        audio += (double)available / sampleRate;
+        while (available)
+        {
+            int count = (int)m_ring.Read(m_readBuffer.data(), std::min<uint64_t>(available, m_readBuffer.size()));
+            available -= count;
+            ProcessBlock(m_readBuffer.data(), count, arrivalNs - (int64_t)(available * 1e9 / sampleRate), start);
+        }
+
+        busy += (NowNs() - start) / 1e9;
+        if (audio >= 1.0)
+        {
+            m_load.store(busy / audio, std::memory_order_relaxed);
+            m_echoLoad.store(m_echoBusy / audio, std::memory_order_relaxed);
+            if (m_echoBusy / audio > AEC_RTF_BUDGET && !m_echoWarned)
+            {
+                std::cout << "Capture: echo canceller at real time factor " << m_echoBusy / audio << ", over its budget of " << AEC_RTF_BUDGET << std::endl;
+                m_echoWarned = true;
+            }
+            busy = audio = m_echoBusy = 0.0;
+        }
+    }
+}
+
+void CAudioCapture::Reconfigure(int sampleRate)
+{
+    if (m_vad.InSpeech())
+        Emit(VOICE_EVENT_CANCEL, nullptr, 0);
+
+    m_resampler.Configure(sampleRate, VAD_SAMPLE_RATE, RESAMPLE_QUALITY_MEDIUM);
+    m_readBuffer.resize(CAPTURE_READ_SAMPLES);
+    m_resampled.resize(m_resampler.GetMaxOutput(CAPTURE_READ_SAMPLES));
+    m_frames.clear();
+    m_echoIn.clear();
+    m_echo.Reset();
+    m_history.clear();
+    m_historyFrame = 0;
+    m_sent = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_paramsMutex);
+        m_vad.Configure(m_params);
+        m_paramsSeen = m_paramsSerial.load(std::memory_order_relaxed);
+    }
+    m_vad.Reset();
+    m_speaking.store(false, std::memory_order_relaxed);
+    m_processRate = sampleRate;
+}
+
+void CAudioCapture::ProcessBlock(const short *pcm, int count, int64_t arrivalNs, int64_t nowNs)
+{
+    int produced = m_resampler.Process(pcm, count, m_resampled.data());
+    if (m_echoActive)
+        CancelEcho(produced, arrivalNs);
+    else
+        m_frames.insert(m_frames.end(), m_resampled.begin(), m_resampled.begin() + produced);
+    const size_t held = m_echoIn.size(); // Newer than the frames, waiting for a whole block
+
+    size_t offset = 0;
+    while (m_frames.size() - offset >= VAD_FRAME)
+    {
+        const float *frame = m_frames.data() + offset;
+        offset += VAD_FRAME;
+        for (int i = 0; i < VAD_FRAME; i++)
+            m_history.push_back((short)std::min(std::max(frame[i] * 32768.0f, -32768.0f), 32767.0f));
+
+        EVadEvent event = m_vad.Process(frame);
+        if (m_vad.IsVoiced())
+            m_lastVoicedNs = arrivalNs - (int64_t)((m_frames.size() - offset + held) * 1e9 / VAD_SAMPLE_RATE);
+
+        if (event == VAD_EVENT_START)
+        {
+            // Pre-roll and onset frames go out with the start
+            size_t drop = std::min<size_t>((m_vad.GetStartFrame() - m_historyFrame) * VAD_FRAME, m_history.size());
+            m_history.erase(m_history.begin(), m_history.begin() + drop);
+            m_historyFrame += drop / VAD_FRAME;
+            m_utterance++;
+            Emit(VOICE_EVENT_START, m_history.data(), m_history.size());
+            m_sent = m_history.size();
+        }
+        else if (event == VAD_EVENT_END)
+        {
+            Emit(VOICE_EVENT_AUDIO, m_history.data() + m_sent, m_history.size() - m_sent);
+
+            int64_t speechEndNs = m_lastVoicedNs - (int64_t)(m_inputLatency.load(std::memory_order_relaxed) * 1e9);
+            double endpointMs = (nowNs - speechEndNs) / 1e6;
+            size_t length = std::min<size_t>((m_vad.GetEndFrame() - m_historyFrame) * VAD_FRAME + VAD_SAMPLE_RATE * CAPTURE_TAIL_MS / 1000, m_history.size());
+            Emit(VOICE_EVENT_END, m_history.data(), length, speechEndNs, endpointMs);
+
+            int utterances = m_utterances.fetch_add(1, std::memory_order_relaxed) + 1;
+            m_endpointSum += endpointMs;
+            m_lastEndpointMs.store(endpointMs, std::memory_order_relaxed);
+            m_meanEndpointMs.store(m_endpointSum / utterances, std::memory_order_relaxed);
+        }
+        else if (event == VAD_EVENT_CANCEL)
+        {
+            Emit(VOICE_EVENT_CANCEL, nullptr, 0);
+            m_cancelled.fetch_add(1, std::memory_order_relaxed);
+        }
+        else if (m_vad.InSpeech() && m_history.size() - m_sent >= VAD_SAMPLE_RATE * CAPTURE_CHUNK_MS / 1000)
+        {
+            Emit(VOICE_EVENT_AUDIO, m_history.data() + m_sent, m_history.size() - m_sent);
+            m_sent = m_history.size();
+        }
+
+        // Between utterances only the pre-roll is kept, trimmed in batches
+        size_t keep = (size_t)(m_vad.GetParams().preRollMs / VAD_FRAME_MS + VAD_ONSET_FRAMES) * VAD_FRAME;
+        if (!m_vad.InSpeech() && m_history.size() >= keep * 2)
+        {
+            size_t drop = m_history.size() - keep;
+            m_history.erase(m_history.begin(), m_history.begin() + drop);
+            m_historyFrame += drop / VAD_FRAME;
+            m_sent = 0;
+        }
+    }
+    m_frames.erase(m_frames.begin(), m_frames.begin() + offset);
+
+    m_speaking.store(m_vad.InSpeech(), std::memory_order_relaxed);
+    m_levelDb.store(m_vad.GetLevelDb(), std::memory_order_relaxed);
+    m_noiseDb.store(m_vad.GetNoiseDb(), std::memory_order_relaxed);
+}
+
+void CAudioCapture::CancelEcho(int count, int64_t arrivalNs)
+{
+    int64_t start = NowNs();
+    m_echoIn.insert(m_echoIn.end(), m_resampled.begin(), m_resampled.begin() + count);
+    int64_t latencyNs = (int64_t)(m_inputLatency.load(std::memory_order_relaxed) * 1e9);
+
+    size_t offset = 0;
+    float reference[AEC_BLOCK];
+    float output[AEC_BLOCK];
+    while (m_echoIn.size() - offset >= AEC_BLOCK)
+    {
+        // Captured when its last sample reached the microphone
+        size_t newer = m_echoIn.size() - offset - AEC_BLOCK;
+        int64_t capturedNs = arrivalNs - (int64_t)(newer * 1e9 / VAD_SAMPLE_RATE) - latencyNs;
+        m_echoReference->Read(reference, AEC_BLOCK, capturedNs);
+        m_echo.Process(m_echoIn.data() + offset, reference, output);
+        m_frames.insert(m_frames.end(), output, output + AEC_BLOCK);
+        offset += AEC_BLOCK;
+    }
+    m_echoIn.erase(m_echoIn.begin(), m_echoIn.begin() + offset);
+
+    m_echoErleDb.store(m_echo.GetErleDb(), std::memory_order_relaxed);
+    m_echoBusy += (NowNs() - start) / 1e9;
+}
+
+void CAudioCapture::Emit(EVoiceEvent type, const short *pcm, size_t count, int64_t speechEndNs, double endpointMs)
+{
+    if (type == VOICE_EVENT_AUDIO && !count)
+        return;
+
+    SVoiceEvent event;
+    event.type = type;
+    event.utterance = m_utterance;
+    event.pcm.assign(pcm, pcm + count);
+    event.speechEnd = std::chrono::steady_clock::time_point(std::chrono::nanoseconds(speechEndNs));
+    event.endpointMs = endpointMs;
+
+    std::lock_guard<std::mutex> lock(m_eventsMutex);
+    m_events.push_back(std::move(event));
+    if (m_events.size() > CAPTURE_MAX_EVENTS)
+        m_events.pop_front();
+}
+
+/*
+ * Benchmark
+ */
+struct SBenchUtterance
+{
+    double start;
+    double end;
+    bool voiced; // false for a click that should be cancelled
+};
+
+// Vowel-like harmonics with a syllable rate envelope, a fricative onset and a click, in pink-ish noise
+static void SynthesizeSpeech(std::vector<short> &pcm, int sampleRate, std::vector<SBenchUtterance> &truth)
+{
+    truth = {{1.0, 2.2, true}, {3.5, 3.55, false}, {5.0, 6.5, true}, {8.0, 8.9, true}, {10.5, 11.3, true}};
+    pcm.assign(sampleRate * 13, 0);
+
+    uint32_t seed = 1;
+    float lowpass = 0.0f;
+    for (size_t i = 0; i < pcm.size(); i++)
+    {
+        double t = (double)i / sampleRate;
+        seed = seed * 1664525u + 1013904223u;
+        float white = (int32_t)seed / 2147483648.0f;
+        lowpass += (white - lowpass) * 0.3f;
+        float sample = lowpass * 0.01f; // Around -50 dBFS
+
+        for (auto &utterance : truth)
+        {
+            if (t < utterance.start || t >= utterance.end)
+                continue;
+            if (!utterance.voiced)
+            {
+                sample += white * 0.5f;
+                continue;
+            }
+            double local = t - utterance.start;
+            // A 250 ms pause inside the third utterance, shorter than the hangover
+            if (utterance.start == 5.0 && local > 0.6 && local < 0.85)
+                continue;
+            // The fourth starts with 150 ms of /s/, weak but noisy
+            if (utterance.start == 8.0 && local < 0.15)
+            {
+                sample += (white - lowpass) * 0.02f;
+                continue;
+            }
+            double syllable = 0.55 + 0.45 * sin(2.0 * M_PI * 4.0 * local - M_PI / 2);
+            double voice = 0.0;
+            for (int h = 1; h <= 20; h++)
+            {
+                double f = 130.0 * h;
+                double formant = exp(-pow((f - 700.0) / 300.0, 2)) + 0.5 * exp(-pow((f - 1200.0) / 400.0, 2)) + 0.05;
+                voice += formant * sin(2.0 * M_PI * f * t + h);
+            }
+            sample += (float)(voice * syllable * 0.06);
+        }
+        pcm[i] = (short)std::min(std::max(sample * 32768.0f, -32768.0f), 32767.0f);
+    }
+}
+
+void CAudioCapture::Benchmark(const char *file)
+{
+    std::vector<short> pcm;
+    std::vector<SBenchUtterance> truth;
+    int sampleRate = 48000;
+    if (file)
+    {
+        if (!ReadFile(file, pcm, sampleRate))
+        {
+            std::cout << "Unable to read " << file << std::endl;
+            return;
+        }
+    }
+    else
+        SynthesizeSpeech(pcm, sampleRate, truth);
+
+    std::cout << "VAD: " << (file ? file : "synthesized speech in noise") << ", " << sampleRate << " Hz, " << (double)pcm.size() / sampleRate << " s" << std::endl;
+
+    const int hangovers[] = {200, 300, 400, 600};
+    for (int hangoverMs : hangovers)
+    {
+        CAudioCapture capture;
+        capture.m_params.hangoverMs = hangoverMs;
+        capture.Reconfigure(sampleRate);
+
+        // Fed in device periods, each arrives when its last sample was captured
+        const int period = sampleRate * CAPTURE_LATENCY_MS / 1000;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t pos = 0; pos + period <= pcm.size(); pos += period)
+        {
+            int64_t arrivalNs = (int64_t)((pos + period) * 1e9 / sampleRate);
+            for (int offset = 0; offset < period; offset += CAPTURE_READ_SAMPLES)
+                capture.ProcessBlock(pcm.data() + pos + offset, std::min(period - offset, CAPTURE_READ_SAMPLES), arrivalNs, arrivalNs);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "hangover " << hangoverMs << " ms" << std::endl;
+        SVoiceEvent event;
+        size_t streamed = 0;
+        int found = 0;
+        while (capture.PollEvent(event))
+        {
+            if (event.type == VOICE_EVENT_START || event.type == VOICE_EVENT_AUDIO)
+                streamed += event.pcm.size();
+            else if (event.type == VOICE_EVENT_CANCEL)
+            {
+                printf("  %d: cancelled after %.2f s\n", event.utterance, (double)streamed / VAD_SAMPLE_RATE);
+                streamed = 0;
+            }
+            else
+            {
+                double end = event.speechEnd.time_since_epoch().count() / 1e9;
+                double detected = end + event.endpointMs / 1000.0;
+                printf("  %d: %.2f s long, speech ended %.2f s, endpoint %.0f ms", event.utterance, (double)event.pcm.size() / VAD_SAMPLE_RATE, end, event.endpointMs);
+                // Against the synthesized end
+                for (auto &utterance : truth)
+                {
+                    if (utterance.voiced && detected > utterance.end && detected < utterance.end + 1.5)
+                    {
+                        printf(", %.0f ms after the true end", (detected - utterance.end) * 1000.0);
+                        found++;
+                    }
+                }
+                printf("\n");
+                streamed = 0;
+            }
+        }
+        SCaptureStats stats;
+        capture.GetStats(stats);
+        printf("  %d utterances, %d cancelled, mean endpoint %.0f ms, real time factor %.5f\n",
+               stats.utterances, stats.cancelled, stats.meanEndpointMs, seconds * sampleRate / pcm.size());
+        if (!truth.empty())
+            printf("  %d of 4 synthesized utterances found\n", found);
+    }
+}
@@ -0,0 +1,187 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include "audioRing.hpp"
+#include "audioResampler.hpp"
+#include "audioVad.hpp"
+#include "audioEcho.hpp"
+
+#define CAPTURE_MAX_RATE 192000
+#define CAPTURE_BUFFER_MS 1000  // Ring between the capture callback and the VAD thread
+#define CAPTURE_LATENCY_MS 20   // Requested device period, part of the endpoint latency
+#define CAPTURE_POLL_MS 5       // VAD thread wakeups, also part of it
+#define CAPTURE_CHUNK_MS 100    // Audio handed downstream while speaking
+#define CAPTURE_TAIL_MS 100     // Kept after the last voiced frame of a segment
+#define CAPTURE_MAX_EVENTS 256  // Oldest are dropped when nobody polls
+#define CAPTURE_RETRY_MS 1000
+
+enum ECaptureSource
+{
+    CAPTURE_SOURCE_MIC = 0,
+    CAPTURE_SOURCE_FILE, // Played once in real time, then silence
+    CAPTURE_SOURCE_COUNT,
+};
+
+enum EVoiceEvent
+{
+    VOICE_EVENT_START = 0,
+    VOICE_EVENT_AUDIO,
+    VOICE_EVENT_END,
+    VOICE_EVENT_CANCEL, // Too short to be speech, drop what was sent
+};
+
+struct SVoiceEvent
+{
+    EVoiceEvent type;
+    int utterance;          // Shared by the events of one utterance
+    std::vector<short> pcm; // Mono at VAD_SAMPLE_RATE. START and AUDIO: not sent before, END: the whole segment
+    std::chrono::steady_clock::time_point speechEnd; // END: the last voiced frame reached the microphone
+    double endpointMs;      // END: from speechEnd until detected
+};
+
+struct SCaptureStats
+{
+    int sampleRate;        // 0 while not capturing
+    double inputLatencyMs; // Microphone to ring
+    bool speaking;
+    float levelDb;
+    float noiseDb;
+    int utterances;
+    int cancelled;
+    int overflows;         // Ring full or device overrun, audio was lost
+    double lastEndpointMs;
+    double meanEndpointMs;
+    double load;           // Processing time per audio time of the VAD thread
+    bool echoCancel;       // Running on the microphone
+    float echoErleDb;
+    double echoLoad;       // Of the echo canceller, part of load
+};
+
+/**
+ * Voice input: a capture thread feeds a lock-free ring, the VAD thread
+ * resamples it to VAD_SAMPLE_RATE, runs CVoiceActivityDetector and queues
+ * endpointed utterances as SVoiceEvent. The microphone is read through its
+ * own libsoundio context and reopened on errors and default device changes.
+ * The endpoint latency, end of speech until the END event, is measured per
+ * utterance from the arrival time of every frame plus the input latency.
+ * With an echo reference the microphone goes through CEchoCanceller before
+ * the VAD, the reference aligned to the capture time of every block.
+ */
+class CAudioCapture
+{
+public:
+    CAudioCapture();
+    ~CAudioCapture();
+
+    CAudioCapture(const CAudioCapture &) = delete;
+    CAudioCapture &operator=(const CAudioCapture &) = delete;
+
+    // Restarts when running. `file` is read for CAPTURE_SOURCE_FILE, any format CAudioDecoder knows.
+    void Start(int source, const std::string &file);
+    void Stop();
+    bool IsRunning() const { return m_processThread != nullptr; }
+
+    // Any thread, applied between utterances
+    void SetParams(const SVadParams &params);
+
+    // Before Start(), filled by the output callback, nullptr for none
+    void SetEchoReference(CEchoReference *reference) { m_echoReference = reference; }
+    // Any thread, the microphone source only
+    void SetEchoCancel(bool enabled) { m_echoCancel.store(enabled, std::memory_order_relaxed); }
+
+    bool PollEvent(SVoiceEvent &event);
+    void GetStats(SCaptureStats &stats) const;
+
+    // Decodes a whole file to mono PCM
+    static bool ReadFile(const std::string &path, std::vector<short> &pcm, int &sampleRate);
+
+    // Runs a file, or synthesized utterances in noise, through the VAD path faster than real time.
+    static void Benchmark(const char *file);
+
+private:
+    static void ReadCallback(struct SoundIoInStream *instream, int frameCountMin, int frameCountMax);
+    static void OverflowCallback(struct SoundIoInStream *instream);
+    static void ErrorCallback(struct SoundIoInStream *instream, int err);
+    static void DevicesChange(struct SoundIo *soundio);
+    static void BackendDisconnect(struct SoundIo *soundio, int err);
+
+    void MicThread();
+    struct SoundIoInStream *OpenInput(struct SoundIo *soundio, std::string &deviceId);
+    void FileThread(std::string path);
+    void ProcessThread();
+
+    // VAD thread, also driven by the benchmark
+    void Reconfigure(int sampleRate);
+    void ProcessBlock(const short *pcm, int count, int64_t arrivalNs, int64_t nowNs);
+    void CancelEcho(int count, int64_t arrivalNs); // The resampled block into m_frames
+    void Emit(EVoiceEvent type, const short *pcm, size_t count, int64_t speechEndNs = 0, double endpointMs = 0.0);
+
+    // Capture side
+    CAudioRing<short> m_ring;
+    std::atomic<int> m_sampleRate;      // Of the ring, 0 while opening
+    std::atomic<int64_t> m_lastWriteNs; // Arrival of the newest sample in the ring
+    std::atomic<double> m_inputLatency; // Seconds
+    std::atomic<struct SoundIo *> m_soundio;
+    std::atomic<bool> m_reopen;
+    std::atomic<int> m_lastError;
+    bool m_devicesChanged; // Mic thread only
+    bool m_backendLost;
+
+    std::thread *m_captureThread;
+    std::thread *m_processThread;
+    std::atomic<bool> m_quit;
+    int m_source; // Set before the threads start
+
+    CEchoReference *m_echoReference;
+    std::atomic<bool> m_echoCancel;
+
+    std::mutex m_paramsMutex;
+    SVadParams m_params;
+    std::atomic<uint32_t> m_paramsSerial;
+
+    // VAD thread only
+    CVoiceActivityDetector m_vad;
+    CAudioResampler m_resampler;
+    int m_processRate;
+    uint32_t m_paramsSeen;
+    std::vector<short> m_readBuffer;
+    std::vector<float> m_resampled;
+    std::vector<float> m_frames;  // Resampled, not yet a whole frame
+    std::vector<short> m_history; // Pre-roll while silent, the utterance while speaking
+    long long m_historyFrame;     // VAD frame index of m_history[0]
+    size_t m_sent;                // Of m_history, already queued
+    int64_t m_lastVoicedNs;
+    int m_utterance;
+    double m_endpointSum;
+    CEchoCanceller m_echo;
+    bool m_echoActive;
+    bool m_echoWarned;
+    std::vector<float> m_echoIn; // Resampled, not yet a whole block
+    double m_echoBusy;           // Seconds since the last load update
+
+    mutable std::mutex m_eventsMutex;
+    std::deque<SVoiceEvent> m_events;
+
+    std::atomic<bool> m_speaking;
+    std::atomic<float> m_levelDb;
+    std::atomic<float> m_noiseDb;
+    std::atomic<int> m_utterances;
+    std::atomic<int> m_cancelled;
+    std::atomic<int> m_overflows;
+    std::atomic<double> m_lastEndpointMs;
+    std::atomic<double> m_meanEndpointMs;
+    std::atomic<double> m_load;
+    std::atomic<bool> m_echoRunning;
+    std::atomic<float> m_echoErleDb;
+    std::atomic<double> m_echoLoad;
+};
@@ -0,0 +1,436 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+
+#define MINIMP3_ONLY_MP3
+#define MINIMP3_IMPLEMENTATION
+#include "audioDecoder.hpp"
+
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <iostream>
+
+#ifdef USE_OPUS
+#include <opus.h>
+#endif
+
+#define MP3_ID3V2_HEADER_SIZE 10
+#define PCM_DEFAULT_SAMPLE_RATE 24000
+#define PCM_DECODE_MS 20
+#define OGG_PAGE_HEADER_SIZE 27
+#define OPUS_SAMPLE_RATE 48000
+
+static uint32_t ReadLE32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+static uint16_t ReadLE16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+// "audio/L16; rate=24000; channels=1" -> 24000
+static int GetContentTypeParam(const std::string &contentType, const char *name, int defaultValue)
+{
+    auto pos = contentType.find(name);
+    if (pos == std::string::npos)
+        return defaultValue;
+    pos = contentType.find('=', pos);
+    if (pos == std::string::npos)
+        return defaultValue;
+    int value = atoi(contentType.c_str() + pos + 1);
+    return value > 0 ? value : defaultValue;
+}
+
+CAudioDecoder *CAudioDecoder::Create(const std::string &contentType, const char *data, size_t size)
+{
+    bool mp3 = contentType.find("audio/mpeg") != std::string::npos || contentType.find("audio/mp3") != std::string::npos;
+    bool wav = contentType.find("wav") != std::string::npos || contentType.find("wave") != std::string::npos;
+    bool pcm = contentType.find("audio/l16") != std::string::npos || contentType.find("audio/pcm") != std::string::npos;
+    bool ogg = contentType.find("ogg") != std::string::npos || contentType.find("opus") != std::string::npos;
+
+    if (!mp3 && !wav && !pcm && !ogg && size >= 4)
+    {
+        const uint8_t *bytes = (const uint8_t *)data;
+        if (!memcmp(data, "RIFF", 4))
+            wav = true;
+        else if (!memcmp(data, "OggS", 4))
+            ogg = true;
+        else if (!memcmp(data, "ID3", 3) || (bytes[0] == 0xff && (bytes[1] & 0xe0) == 0xe0))
+            mp3 = true;
+    }
+
+    if (wav || pcm)
+        return new CPCMDecoder(wav, GetContentTypeParam(contentType, "rate", PCM_DEFAULT_SAMPLE_RATE), GetContentTypeParam(contentType, "channels", 1));
+    if (ogg)
+    {
+#ifdef USE_OPUS
+        return new COpusDecoder();
+#else
+        std::cout << "AudioDecoder: built without USE_OPUS, can not decode " << contentType << std::endl;
+        return nullptr;
+#endif
+    }
+    if (mp3)
+        return new CMP3Decoder();
+    return nullptr;
+}
+
+/*
+ * MP3
+ */
+CMP3Decoder::CMP3Decoder()
+{
+    Reset();
+}
+
+void CMP3Decoder::Reset()
+{
+    mp3dec_init(&m_decoder);
+    m_skipBytes = 0;
+    m_sampleRate = 0;
+}
+
+size_t CMP3Decoder::GetFrameNeed(const uint8_t *data, size_t size) const
+{
+    if (size < HDR_SIZE)
+        return HDR_SIZE;
+
+    // minimp3 treats an incomplete frame as garbage and skips it, so only
+    // hand it a frame once the frame and the next header are buffered.
+    if (hdr_valid(data))
+    {
+        int frameBytes = hdr_frame_bytes(data, m_decoder.free_format_bytes);
+        if (frameBytes)
+            return frameBytes + hdr_padding(data) + HDR_SIZE;
+    }
+    // Free format or out of sync, let minimp3 scan a window big enough to resync
+    return AUDIO_DECODER_MAX_NEED;
+}
+
+int CMP3Decoder::DecodeFrame(const uint8_t *data, size_t size, bool lastChunk, short *pcm, size_t &consumed)
+{
+    consumed = 0;
+    if (size == 0)
+        return -1;
+
+    if (m_skipBytes > 0)
+    {
+        consumed = std::min(m_skipBytes, size);
+        m_skipBytes -= consumed;
+        return 0;
+    }
+
+    // Skip ID3v2 tag
+    if (size >= MP3_ID3V2_HEADER_SIZE && !memcmp(data, "ID3", 3))
+    {
+        m_skipBytes = (((data[6] & 0x7f) << 21) | ((data[7] & 0x7f) << 14) | ((data[8] & 0x7f) << 7) | (data[9] & 0x7f)) + MP3_ID3V2_HEADER_SIZE;
+        if (data[5] & 0x10)
+            m_skipBytes += MP3_ID3V2_HEADER_SIZE; // footer
+        consumed = std::min(m_skipBytes, size);
+        m_skipBytes -= consumed;
+        return 0;
+    }
+
+    if (!lastChunk && size < GetFrameNeed(data, size))
+        return -1;
+
+    mp3dec_frame_info_t info;
+    int samples = mp3dec_decode_frame(&m_decoder, data, (int)size, m_framePCM, &info);
+    if (samples == 0 && info.frame_bytes == 0)
+        return -1;
+
+    consumed = info.frame_bytes;
+    if (samples == 0)
+        return 0;
+
+    m_sampleRate = info.hz;
+    if (info.channels == 2)
+    {
+        for (int i = 0; i < samples; i++)
+            pcm[i] = (short)(((int)m_framePCM[2 * i] + (int)m_framePCM[2 * i + 1]) / 2);
+    }
+    else
+        memcpy(pcm, m_framePCM, samples * sizeof(short));
+    return samples;
+}
+
+/*
+ * PCM / WAV
+ */
+CPCMDecoder::CPCMDecoder(bool wav, int sampleRate, int channels)
+    : m_wav(wav), m_defaultSampleRate(sampleRate), m_defaultChannels(channels)
+{
+    Reset();
+}
+
+void CPCMDecoder::Reset()
+{
+    m_state = m_wav ? PCM_STATE_RIFF : PCM_STATE_DATA;
+    m_skipBytes = 0;
+    m_sampleRate = m_defaultSampleRate;
+    m_channels = m_defaultChannels;
+    m_bitsPerSample = 16;
+    m_float = false;
+}
+
+int CPCMDecoder::ParseHeader(const uint8_t *data, size_t size, size_t &consumed)
+{
+    if (m_skipBytes > 0)
+    {
+        consumed = std::min(m_skipBytes, size);
+        m_skipBytes -= consumed;
+        return 0;
+    }
+
+    if (m_state == PCM_STATE_RIFF)
+    {
+        if (size < 12)
+            return -1;
+        if (memcmp(data, "RIFF", 4) || memcmp(data + 8, "WAVE", 4))
+        {
+            // Not a RIFF header after all, treat it as raw PCM
+            std::cout << "AudioDecoder: missing WAV header, playing as raw PCM" << std::endl;
+            m_state = PCM_STATE_DATA;
+            return 0;
+        }
+        consumed = 12;
+        m_state = PCM_STATE_CHUNK;
+        return 0;
+    }
+
+    // Chunk header
+    if (size < 8)
+        return -1;
+    uint32_t chunkSize = ReadLE32(data + 4);
+    if (!memcmp(data, "data", 4))
+    {
+        consumed = 8;
+        m_state = PCM_STATE_DATA;
+        return 0;
+    }
+    if (!memcmp(data, "fmt ", 4))
+    {
+        if (size < 8 + 16)
+            return -1;
+        uint16_t format = ReadLE16(data + 8);
+        if (format == 0xfffe && chunkSize >= 40)
+        {
+            // WAVE_FORMAT_EXTENSIBLE, the sub format follows the base fields
+            if (size < 8 + 40)
+                return -1;
+            format = ReadLE16(data + 8 + 24);
+        }
+        m_channels = std::max<int>(1, ReadLE16(data + 10));
+        m_sampleRate = ReadLE32(data + 12);
+        m_bitsPerSample = ReadLE16(data + 22);
+        m_float = (format == 3);
+        bool supported = format == 1 ? (m_bitsPerSample == 8 || m_bitsPerSample == 16 || m_bitsPerSample == 24 || m_bitsPerSample == 32)
+                                     : (m_float && (m_bitsPerSample == 32 || m_bitsPerSample == 64));
+        if (!supported)
+        {
+            std::cout << "AudioDecoder: unsupported WAV format " << format << "/" << m_bitsPerSample << std::endl;
+            m_state = PCM_STATE_ERROR;
+            return AUDIO_DECODER_ERROR;
+        }
+    }
+    // Skip the chunk body, word aligned
+    consumed = 8;
+    m_skipBytes = chunkSize + (chunkSize & 1);
+    return 0;
+}
+
+int CPCMDecoder::DecodeFrame(const uint8_t *data, size_t size, bool lastChunk, short *pcm, size_t &consumed)
+{
+    consumed = 0;
+    if (m_state == PCM_STATE_ERROR)
+        return AUDIO_DECODER_ERROR;
+    if (m_state != PCM_STATE_DATA || m_skipBytes > 0)
+        return size == 0 ? -1 : ParseHeader(data, size, consumed);
+
+    int blockAlign = m_channels * m_bitsPerSample / 8;
+    if (blockAlign <= 0)
+        return -1;
+
+    int frames = std::min<int>((int)(size / blockAlign), m_sampleRate * PCM_DECODE_MS / 1000);
+    frames = std::min(frames, AUDIO_DECODER_MAX_FRAME_SAMPLES);
+    if (frames == 0)
+    {
+        // Dangling partial sample at the end of the stream
+        if (lastChunk)
+            consumed = size;
+        return size && lastChunk ? 0 : -1;
+    }
+
+    for (int i = 0; i < frames; i++)
+    {
+        const uint8_t *frame = data + i * blockAlign;
+        const int bytes = m_bitsPerSample / 8;
+        int sum = 0;
+        for (int channel = 0; channel < m_channels; channel++)
+        {
+            const uint8_t *sample = frame + channel * bytes;
+            if (m_float && bytes == 8)
+            {
+                double value;
+                memcpy(&value, sample, 8);
+                sum += (int)(std::max(-1.0, std::min(1.0, value)) * 32767.0);
+            }
+            else if (m_float)
+            {
+                float value;
+                memcpy(&value, sample, 4);
+                sum += (int)(std::max(-1.0f, std::min(1.0f, value)) * 32767.0f);
+            }
+            else if (bytes == 1)
+                sum += ((int)sample[0] - 128) << 8; // Unsigned
+            else if (bytes == 2)
+                sum += (int16_t)ReadLE16(sample);
+            else if (bytes == 3)
+                sum += (int32_t)((uint32_t)sample[0] << 8 | (uint32_t)sample[1] << 16 | (uint32_t)sample[2] << 24) >> 16;
+            else
+                sum += (int32_t)ReadLE32(sample) >> 16;
+        }
+        pcm[i] = (short)(sum / m_channels);
+    }
+
+    consumed = frames * blockAlign;
+    return frames;
+}
+
+/*
+ * Opus / Ogg
+ */
+#ifdef USE_OPUS
+COpusDecoder::COpusDecoder()
+    : m_decoder(nullptr)
+{
+    m_packet.reserve(AUDIO_DECODER_MAX_NEED);
+    Reset();
+}
+
+COpusDecoder::~COpusDecoder()
+{
+    if (m_decoder)
+        opus_decoder_destroy(m_decoder);
+}
+
+void COpusDecoder::Reset()
+{
+    if (m_decoder)
+        opus_decoder_destroy(m_decoder);
+    m_decoder = nullptr;
+    m_sampleRate = OPUS_SAMPLE_RATE;
+    m_channels = 1;
+    m_preSkip = 0;
+    m_packetCount = 0;
+    m_segmentCount = 0;
+    m_segmentIndex = 0;
+    m_segmentLeft = 0;
+    m_inPage = false;
+    m_packet.clear();
+}
+
+int COpusDecoder::DecodePacket(short *pcm)
+{
+    int packetIndex = m_packetCount++;
+
+    if (packetIndex == 0)
+    {
+        // OpusHead
+        if (m_packet.size() < 19 || memcmp(m_packet.data(), "OpusHead", 8))
+        {
+            std::cout << "AudioDecoder: Ogg stream is not Opus" << std::endl;
+            return 0;
+        }
+        m_channels = std::min<int>(2, std::max<int>(1, m_packet[9]));
+        m_preSkip = ReadLE16(m_packet.data() + 10);
+
+        int err;
+        m_decoder = opus_decoder_create(OPUS_SAMPLE_RATE, m_channels, &err);
+        if (err != OPUS_OK)
+        {
+            std::cout << "AudioDecoder: opus_decoder_create failed: " << opus_strerror(err) << std::endl;
+            m_decoder = nullptr;
+        }
+        return 0;
+    }
+    if (packetIndex == 1 || !m_decoder)
+        return 0; // OpusTags
+
+    int frames = opus_decode(m_decoder, m_packet.data(), (opus_int32)m_packet.size(), m_packetPCM, AUDIO_DECODER_MAX_FRAME_SAMPLES, 0);
+    if (frames <= 0)
+        return 0;
+
+    int skip = std::min(frames, m_preSkip);
+    m_preSkip -= skip;
+    for (int i = skip; i < frames; i++)
+    {
+        if (m_channels == 2)
+            pcm[i - skip] = (short)(((int)m_packetPCM[2 * i] + (int)m_packetPCM[2 * i + 1]) / 2);
+        else
+            pcm[i - skip] = m_packetPCM[i];
+    }
+    return frames - skip;
+}
+
+int COpusDecoder::DecodeFrame(const uint8_t *data, size_t size, bool lastChunk, short *pcm, size_t &consumed)
+{
+    consumed = 0;
+
+    if (!m_inPage)
+    {
+        if (size < OGG_PAGE_HEADER_SIZE)
+        {
+            if (lastChunk && size)
+                consumed = size;
+            return lastChunk && size ? 0 : -1;
+        }
+        if (memcmp(data, "OggS", 4))
+        {
+            // Resync on the next capture pattern
+            const uint8_t *found = (const uint8_t *)memmem(data + 1, size - 1, "OggS", 4);
+            consumed = found ? found - data : size - 3;
+            return 0;
+        }
+        int segmentCount = data[26];
+        if (size < (size_t)(OGG_PAGE_HEADER_SIZE + segmentCount))
+            return -1;
+
+        memcpy(m_lacing, data + OGG_PAGE_HEADER_SIZE, segmentCount);
+        m_segmentCount = segmentCount;
+        m_segmentIndex = 0;
+        m_segmentLeft = segmentCount ? m_lacing[0] : 0;
+        m_inPage = segmentCount > 0;
+        consumed = OGG_PAGE_HEADER_SIZE + segmentCount;
+        return 0;
+    }
+
+    // Copy what is there of the current segment, packets may span pages
+    size_t count = std::min(m_segmentLeft, size);
+    m_packet.insert(m_packet.end(), data, data + count);
+    m_segmentLeft -= count;
+    consumed = count;
+    if (m_segmentLeft > 0)
+        return count ? 0 : -1;
+
+    bool packetEnd = m_lacing[m_segmentIndex] < 255;
+    if (++m_segmentIndex < m_segmentCount)
+        m_segmentLeft = m_lacing[m_segmentIndex];
+    else
+        m_inPage = false;
+
+    if (!packetEnd)
+        return 0;
+
+    int samples = DecodePacket(pcm);
+    m_packet.clear();
+    return samples;
+}
+#else
+COpusDecoder::COpusDecoder() : m_decoder(nullptr) { Reset(); }
+COpusDecoder::~COpusDecoder() {}
+void COpusDecoder::Reset() { m_sampleRate = OPUS_SAMPLE_RATE; }
+int COpusDecoder::DecodePacket(short *pcm) { return 0; }
+int COpusDecoder::DecodeFrame(const uint8_t *data, size_t size, bool lastChunk, short *pcm, size_t &consumed)
+{
+    // Never created without USE_OPUS, drain the stream if it happens anyway
+    consumed = size;
+    return size ? 0 : -1;
+}
+#endif
@@ -0,0 +1,134 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "minimp3.h"
+
+#define AUDIO_DECODER_MAX_FRAME_SAMPLES 5760 // 120 ms at 48 kHz, the longest Opus packet
+#define AUDIO_DECODER_MAX_NEED (2304 * 2)    // Every decoder makes progress with this many bytes
+#define AUDIO_DECODER_ERROR -2                 // DecodeFrame(), the stream can not be decoded
+
+struct OpusDecoder;
+
+/**
+ * Streaming decoder interface, one instance lives for a whole stream.
+ * Decoders do not own the input: the caller passes the unread bytes and
+ * advances by `consumed`, so bytes can be decoded in place. Output is
+ * mono PCM at GetSampleRate().
+ */
+class CAudioDecoder
+{
+public:
+    CAudioDecoder() : m_sampleRate(0) {}
+    virtual ~CAudioDecoder() {}
+
+    // Picks a decoder from the Content-Type, sniffing the first bytes when it is not conclusive.
+    // Returns nullptr when the format is not supported.
+    static CAudioDecoder *Create(const std::string &contentType, const char *data, size_t size);
+
+    virtual const char *GetName() const = 0;
+    virtual void Reset() = 0;
+
+    // Decodes the next frame or packet into mono PCM, at most AUDIO_DECODER_MAX_FRAME_SAMPLES.
+    // Returns samples written, 0 when non audio bytes were consumed, -1 when more data is needed,
+    // AUDIO_DECODER_ERROR from then on when the stream turned out to be in a format it can not decode.
+    virtual int DecodeFrame(const uint8_t *data, size_t size, bool lastChunk, short *pcm, size_t &consumed) = 0;
+
+    int GetSampleRate() const { return m_sampleRate; }
+
+protected:
+    int m_sampleRate;
+};
+
+class CMP3Decoder : public CAudioDecoder
+{
+public:
+    CMP3Decoder();
+
+    const char *GetName() const override { return "mp3"; }
+    void Reset() override;
+    int DecodeFrame(const uint8_t *data, size_t size, bool lastChunk, short *pcm, size_t &consumed) override;
+
+private:
+    size_t GetFrameNeed(const uint8_t *data, size_t size) const;
+
+    mp3dec_t m_decoder;
+    size_t m_skipBytes; // Rest of an ID3v2 tag
+
+    short m_framePCM[MINIMP3_MAX_SAMPLES_PER_FRAME];
+};
+
+/**
+ * Raw little endian PCM (audio/L16, audio/pcm) or a WAV stream.
+ * WAV streams may carry a zero or 0xFFFFFFFF data size, data runs to the end.
+ * WAV samples are 8 bit unsigned, 16, 24 or 32 bit integers, or 32 or 64 bit floats.
+ */
+class CPCMDecoder : public CAudioDecoder
+{
+public:
+    CPCMDecoder(bool wav, int sampleRate, int channels);
+
+    const char *GetName() const override { return m_wav ? "wav" : "pcm"; }
+    void Reset() override;
+    int DecodeFrame(const uint8_t *data, size_t size, bool lastChunk, short *pcm, size_t &consumed) override;
+
+private:
+    int ParseHeader(const uint8_t *data, size_t size, size_t &consumed);
+
+    enum EState
+    {
+        PCM_STATE_RIFF = 0,
+        PCM_STATE_CHUNK,
+        PCM_STATE_DATA,
+        PCM_STATE_ERROR, // Unsupported format
+    };
+
+    bool m_wav;
+    int m_defaultSampleRate;
+    int m_defaultChannels;
+
+    EState m_state;
+    size_t m_skipBytes;
+    int m_channels;
+    int m_bitsPerSample;
+    bool m_float;
+};
+
+/**
+ * Opus in an Ogg container. Pages are parsed incrementally, packets are
+ * assembled across segments and pages and decoded at 48 kHz.
+ * Needs libopus, built with USE_OPUS.
+ */
+class COpusDecoder : public CAudioDecoder
+{
+public:
+    COpusDecoder();
+    ~COpusDecoder();
+
+    const char *GetName() const override { return "opus"; }
+    void Reset() override;
+    int DecodeFrame(const uint8_t *data, size_t size, bool lastChunk, short *pcm, size_t &consumed) override;
+
+private:
+    int DecodePacket(short *pcm);
+
+    OpusDecoder *m_decoder;
+    int m_channels;
+    int m_preSkip;
+    int m_packetCount;
+
+    uint8_t m_lacing[255];
+    int m_segmentCount;
+    int m_segmentIndex;
+    size_t m_segmentLeft; // Bytes of the current segment run not yet copied
+    bool m_inPage;
+
+    std::vector<uint8_t> m_packet;
+    short m_packetPCM[AUDIO_DECODER_MAX_FRAME_SAMPLES * 2];
+};
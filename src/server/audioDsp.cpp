@@ -0,0 +1,209 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+
+#include "audioDsp.hpp"
+#include "audioSimd.hpp"
+#include "audioRealtime.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+// x[i] *= start + i * step
+static void ApplyRamp(float *x, int count, float start, float step)
+{
+    int i = 0;
+#if defined(AUDIO_SIMD_SSE)
+    __m128 gain = _mm_setr_ps(start, start + step, start + 2 * step, start + 3 * step);
+    const __m128 step4 = _mm_set1_ps(4 * step);
+    for (; i + 4 <= count; i += 4)
+    {
+        _mm_storeu_ps(x + i, _mm_mul_ps(_mm_loadu_ps(x + i), gain));
+        gain = _mm_add_ps(gain, step4);
+    }
+#elif defined(AUDIO_SIMD_NEON)
+    const float lanes[4] = {start, start + step, start + 2 * step, start + 3 * step};
+    float32x4_t gain = vld1q_f32(lanes);
+    const float32x4_t step4 = vdupq_n_f32(4 * step);
+    for (; i + 4 <= count; i += 4)
+    {
+        vst1q_f32(x + i, vmulq_f32(vld1q_f32(x + i), gain));
+        gain = vaddq_f32(gain, step4);
+    }
+#endif
+    for (; i < count; i++)
+        x[i] *= start + i * step;
+}
+
+static float AbsMax(const float *x, int count)
+{
+    int i = 0;
+    float peak = 0.0f;
+#if defined(AUDIO_SIMD_SSE)
+    const __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128 vpeak = _mm_setzero_ps();
+    for (; i + 4 <= count; i += 4)
+        vpeak = _mm_max_ps(vpeak, _mm_and_ps(_mm_loadu_ps(x + i), mask));
+    vpeak = _mm_max_ps(vpeak, _mm_movehl_ps(vpeak, vpeak));
+    vpeak = _mm_max_ss(vpeak, _mm_shuffle_ps(vpeak, vpeak, 1));
+    peak = _mm_cvtss_f32(vpeak);
+#elif defined(AUDIO_SIMD_NEON)
+    float32x4_t vpeak = vdupq_n_f32(0.0f);
+    for (; i + 4 <= count; i += 4)
+        vpeak = vmaxq_f32(vpeak, vabsq_f32(vld1q_f32(x + i)));
+    float32x2_t half = vpmax_f32(vget_low_f32(vpeak), vget_high_f32(vpeak));
+    peak = vget_lane_f32(vpmax_f32(half, half), 0);
+#endif
+    for (; i < count; i++)
+        peak = std::max(peak, fabsf(x[i]));
+    return peak;
+}
+
+CAudioDsp::CAudioDsp()
+    : m_lookahead(0), m_gainCoef(1.0f), m_releaseCoef(1.0f),
+      m_outputRingPos(0), m_outputPos(0), m_outputCount(0), m_outputSilent(true),
+      m_gain(1.0f), m_envelope(1.0f), m_fadeIn(0.0f), m_silent(true), m_audioEnd(0), m_flushSeen(0)
+{
+    m_targetGain.store(1.0f, std::memory_order_relaxed);
+    m_limiterEnabled.store(true, std::memory_order_relaxed);
+    m_flushSerial.store(0, std::memory_order_relaxed);
+}
+
+void CAudioDsp::Configure(int sampleRate)
+{
+    m_lookahead = (sampleRate * DSP_LOOKAHEAD_MS / 1000 + DSP_SUB_BLOCK - 1) / DSP_SUB_BLOCK * DSP_SUB_BLOCK;
+    m_gainCoef = 1.0f - expf(-DSP_SUB_BLOCK / (DSP_GAIN_SMOOTH_MS * 0.001f * sampleRate));
+    m_releaseCoef = 1.0f - expf(-DSP_SUB_BLOCK / (DSP_RELEASE_MS * 0.001f * sampleRate));
+
+    m_line.assign(m_lookahead + DSP_QUANTUM, 0.0f);
+    m_peaks.assign((m_lookahead + DSP_QUANTUM) / DSP_SUB_BLOCK, 0.0f);
+    AudioRtLockMemory(m_line.data(), m_line.size() * sizeof(float));
+    AudioRtLockMemory(m_peaks.data(), m_peaks.size() * sizeof(float));
+    m_outputPos = m_outputCount = 0;
+    m_outputSilent = true;
+
+    m_gain = m_targetGain.load(std::memory_order_relaxed);
+    m_envelope = 1.0f;
+    m_fadeIn = 0.0f;
+    m_silent = true;
+    m_audioEnd = 0;
+    m_flushSeen = m_flushSerial.load(std::memory_order_acquire);
+}
+
+void CAudioDsp::FadeOut(int end)
+{
+    // The look-ahead frames before `end` have not been played yet, ramp them to zero
+    float step = 1.0f / m_lookahead;
+    ApplyRamp(m_line.data() + end - m_lookahead, m_lookahead, 1.0f - step, -step);
+    std::fill(m_line.begin() + end, m_line.end(), 0.0f);
+    m_audioEnd = std::min(m_audioEnd, end);
+    m_silent = true;
+    m_fadeIn = 0.0f;
+}
+
+void CAudioDsp::ProcessQuantum(CAudioRing<float> *ring, bool hold)
+{
+    const int lookahead = m_lookahead;
+    float *incoming = m_line.data() + lookahead;
+
+    uint32_t flushSerial = m_flushSerial.load(std::memory_order_acquire);
+    if (flushSerial != m_flushSeen)
+    {
+        m_flushSeen = flushSerial;
+        if (!m_silent)
+            FadeOut(lookahead);
+    }
+
+    int got = hold ? 0 : (int)ring->Read(incoming, DSP_QUANTUM);
+    // Timeline of the output, across a flush it is off for the faded look-ahead only
+    m_outputRingPos = ring->ReadPos() - got - lookahead;
+    if (got > 0)
+    {
+        if (m_fadeIn < 1.0f)
+        {
+            float step = 1.0f / lookahead;
+            int count = std::min(got, (int)ceilf((1.0f - m_fadeIn) * lookahead));
+            ApplyRamp(incoming, count, m_fadeIn + step, step);
+            m_fadeIn = std::min(1.0f, m_fadeIn + count * step);
+        }
+        m_silent = false;
+        m_audioEnd = lookahead + got;
+    }
+    if (got < DSP_QUANTUM)
+    {
+        // Gap, fade out what is still in the look-ahead
+        memset(incoming + got, 0, (DSP_QUANTUM - got) * sizeof(float));
+        if (!m_silent)
+            FadeOut(lookahead + got);
+    }
+
+    const int subBlocks = DSP_QUANTUM / DSP_SUB_BLOCK;
+    const int window = lookahead / DSP_SUB_BLOCK;
+    for (int k = 0; k < subBlocks; k++)
+        m_peaks[window + k] = AbsMax(incoming + k * DSP_SUB_BLOCK, DSP_SUB_BLOCK);
+
+    float target = m_targetGain.load(std::memory_order_relaxed);
+    bool limiter = m_limiterEnabled.load(std::memory_order_relaxed);
+    m_outputSilent = m_audioEnd <= 0;
+
+    if (m_outputSilent)
+    {
+        // Nothing audible, settle the state at once
+        m_gain = target;
+        m_envelope = 1.0f;
+    }
+    else
+    {
+        for (int j = 0; j < subBlocks; j++)
+        {
+            float gainStart = m_gain;
+            m_gain += (target - m_gain) * m_gainCoef;
+            if (fabsf(target - m_gain) < 1e-4f)
+                m_gain = target;
+
+            float envelopeStart = m_envelope;
+            float want = 1.0f;
+            if (limiter)
+            {
+                // Loudest sub-block from here to the end of the look-ahead
+                float peak = *std::max_element(m_peaks.begin() + j, m_peaks.begin() + j + window + 1) * std::max(gainStart, m_gain);
+                if (peak > DSP_CEILING)
+                    want = DSP_CEILING / peak;
+            }
+            if (want < m_envelope)
+                m_envelope = want; // Reached within this sub-block, before the peak plays
+            else
+                m_envelope += (want - m_envelope) * m_releaseCoef;
+
+            float start = gainStart * envelopeStart;
+            float step = (m_gain * m_envelope - start) / DSP_SUB_BLOCK;
+            ApplyRamp(m_line.data() + j * DSP_SUB_BLOCK, DSP_SUB_BLOCK, start + step, step);
+        }
+    }
+
+    memcpy(m_output, m_line.data(), DSP_QUANTUM * sizeof(float));
+    memmove(m_line.data(), m_line.data() + DSP_QUANTUM, lookahead * sizeof(float));
+    memmove(m_peaks.data(), m_peaks.data() + subBlocks, window * sizeof(float));
+    m_audioEnd = std::max(0, m_audioEnd - DSP_QUANTUM);
+}
+
+int CAudioDsp::Render(CAudioRing<float> *ring, int frames, const float **data, bool hold)
+{
+    if (m_outputPos == m_outputCount)
+    {
+        ProcessQuantum(ring, hold);
+        m_outputPos = 0;
+        m_outputCount = DSP_QUANTUM;
+    }
+
+    int count = std::min(frames, m_outputCount - m_outputPos);
+    *data = m_outputSilent ? nullptr : m_output + m_outputPos;
+    m_outputPos += count;
+    return count;
+}
+
+int CAudioDsp::GetPending() const
+{
+    return (m_outputSilent ? 0 : m_outputCount - m_outputPos) + m_audioEnd;
+}
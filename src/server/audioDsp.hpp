@@ -0,0 +1,79 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "audioRing.hpp"
+
+#define DSP_QUANTUM 128          // Frames processed per pass
+#define DSP_SUB_BLOCK 32         // Gain envelope resolution
+#define DSP_LOOKAHEAD_MS 3       // Limiter look-ahead, also the fade length
+#define DSP_GAIN_SMOOTH_MS 20.0f // Volume changes glide over about this long
+#define DSP_RELEASE_MS 80.0f     // Limiter recovery
+#define DSP_CEILING 0.891f       // -1 dBFS
+
+/**
+ * Output DSP chain, pulled by the audio callback from the playback ring:
+ * fades, then smoothed volume and a look-ahead peak limiter.
+ * Audio is delayed by the look-ahead, so a gap (underflow, end of segment
+ * or a flush of the ring) can still fade out the audio before it, and the
+ * audio after a gap fades in.
+ * Setters are lock-free and may be called from any thread, everything else
+ * belongs to the audio thread once Configure() returned.
+ */
+class CAudioDsp
+{
+public:
+    CAudioDsp();
+
+    // Not thread safe, call before the audio callback starts.
+    void Configure(int sampleRate);
+
+    // Any thread
+    void SetVolume(float volume) { m_targetGain.store(volume, std::memory_order_relaxed); }
+    void SetLimiter(bool enabled) { m_limiterEnabled.store(enabled, std::memory_order_relaxed); }
+    // Call right after flushing the ring, the audio still in the look-ahead fades out.
+    void NotifyFlush() { m_flushSerial.fetch_add(1, std::memory_order_release); }
+
+    // Audio thread. Returns up to `frames` processed frames in `*data`,
+    // or sets `*data` to nullptr when they are all silent.
+    // With `hold` the ring is left alone and treated as a gap.
+    int Render(CAudioRing<float> *ring, int frames, const float **data, bool hold = false);
+
+    // Audio thread. Frames of audio still held in the look-ahead and the processed quantum.
+    int GetPending() const;
+
+    // Audio thread. Ring position of the next frame Render() hands out.
+    uint64_t GetEmitPos() const { return m_outputRingPos + m_outputPos; }
+
+private:
+    void ProcessQuantum(CAudioRing<float> *ring, bool hold);
+    void FadeOut(int end);
+
+    int m_lookahead; // Frames, multiple of DSP_SUB_BLOCK
+    float m_gainCoef;
+    float m_releaseCoef;
+
+    std::vector<float> m_line;  // Look-ahead followed by the incoming quantum
+    std::vector<float> m_peaks; // Absolute peak per sub-block of m_line
+    float m_output[DSP_QUANTUM];
+    uint64_t m_outputRingPos; // Ring position of m_output[0]
+    int m_outputPos;
+    int m_outputCount;
+    bool m_outputSilent;
+
+    float m_gain;       // Smoothed volume
+    float m_envelope;   // Limiter gain
+    float m_fadeIn;     // 1 once faded in
+    bool m_silent;      // Last quantum ended in a gap
+    int m_audioEnd;     // m_line holds audio up to here, silence after
+    uint32_t m_flushSeen;
+
+    alignas(AUDIO_CACHE_LINE_SIZE) std::atomic<float> m_targetGain;
+    std::atomic<bool> m_limiterEnabled;
+    std::atomic<uint32_t> m_flushSerial;
+};
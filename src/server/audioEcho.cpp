@@ -0,0 +1,683 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+
+#include "audioEcho.hpp"
+#include "audioSimd.hpp"
+#include "audioCapture.hpp"
+#include "audioRealtime.hpp"
+
+#include <cmath>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <algorithm>
+
+#define AEC_DRIFT_SMOOTH 0.01   // Per block, about 800 ms
+#define AEC_JUMP_FACTOR 10      // Drift this many times AEC_REALIGN_MS is a jump, realigned at once
+#define AEC_FAR_POWER 1e-6f     // Mean square of a reference block that plays, -60 dBFS
+#define AEC_POWER_FLOOR 1e-6f   // Added to the per bin powers, keeps the steps finite in silence
+#define AEC_MIN_LEAK 0.005f
+#define AEC_DIVERGED_BLOCKS 50  // Error above the microphone this long resets the filter
+#define AEC_ERLE_SMOOTH 0.05f
+#define AEC_CONSTRAIN_BLOCKS 8  // Every partition constrained this often, rarer leaves a floor on the ERLE
+
+/*
+ * Reference
+ */
+CEchoReference::CEchoReference()
+    : m_truncated(false), m_rate(0), m_aligned(false), m_pos(0), m_drift(0.0), m_realigns(0)
+{
+    m_clockSeq.store(0, std::memory_order_relaxed);
+    m_clockRate.store(0, std::memory_order_relaxed);
+    m_clockPos.store(0, std::memory_order_relaxed);
+    m_clockNs.store(0, std::memory_order_relaxed);
+    m_active.store(false, std::memory_order_relaxed);
+}
+
+void CEchoReference::Allocate()
+{
+    m_ring.Allocate(AEC_MAX_RATE, AEC_REFERENCE_MS);
+    AudioRtLockMemory(m_ring.Data(), m_ring.Capacity() * sizeof(float)); // Written by the audio callback
+}
+
+void CEchoReference::Write(const float *data, int count)
+{
+    if ((int)m_ring.Write(data, count) < count)
+        m_truncated = true;
+}
+
+void CEchoReference::WriteSilence(int count)
+{
+    static const float zeros[256] = {};
+    for (int done = 0; done < count;)
+    {
+        int chunk = std::min(count - done, 256);
+        Write(zeros, chunk);
+        done += chunk;
+    }
+}
+
+void CEchoReference::Publish(int sampleRate, int64_t audibleAtNs)
+{
+    // The newest frames are missing, the clock of the ones before still holds
+    if (m_truncated)
+    {
+        m_truncated = false;
+        return;
+    }
+    uint32_t seq = m_clockSeq.load(std::memory_order_relaxed);
+    m_clockSeq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_clockRate.store(sampleRate, std::memory_order_relaxed);
+    m_clockPos.store(m_ring.WritePos(), std::memory_order_relaxed);
+    m_clockNs.store(audibleAtNs, std::memory_order_relaxed);
+    m_clockSeq.store(seq + 2, std::memory_order_release);
+}
+
+void CEchoReference::Attach()
+{
+    m_aligned = false;
+    m_drift = 0.0;
+    m_fifo.clear();
+    m_ring.Flush();
+    m_active.store(true, std::memory_order_relaxed);
+}
+
+void CEchoReference::Detach()
+{
+    m_active.store(false, std::memory_order_relaxed);
+}
+
+void CEchoReference::Fill(float *out, int frames)
+{
+    uint64_t available = m_ring.Available();
+    uint64_t readPos = m_ring.ReadPos();
+    if (m_pos > readPos)
+    {
+        m_ring.Skip(std::min(m_pos - readPos, available));
+        readPos = m_ring.ReadPos();
+    }
+
+    // Already dropped, then what the ring has, then not written yet
+    int done = 0;
+    if (m_pos < readPos)
+    {
+        done = (int)std::min<uint64_t>(frames, readPos - m_pos);
+        std::fill(out, out + done, 0.0f);
+    }
+    if (m_pos + done == readPos)
+        done += (int)m_ring.Read(out + done, frames - done);
+    std::fill(out + done, out + frames, 0.0f);
+    m_pos += frames;
+}
+
+bool CEchoReference::Read(float *out, int count, int64_t lastNs)
+{
+    uint32_t seq;
+    int rate;
+    uint64_t clockPos;
+    int64_t clockNs;
+    do
+    {
+        seq = m_clockSeq.load(std::memory_order_acquire);
+        rate = m_clockRate.load(std::memory_order_relaxed);
+        clockPos = m_clockPos.load(std::memory_order_relaxed);
+        clockNs = m_clockNs.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) || seq != m_clockSeq.load(std::memory_order_relaxed));
+
+    if (rate <= 0 || !m_active.load(std::memory_order_relaxed))
+    {
+        std::fill(out, out + count, 0.0f);
+        return false;
+    }
+    if (rate != m_rate)
+    {
+        m_resampler.Configure(rate, AEC_SAMPLE_RATE, RESAMPLE_QUALITY_MEDIUM);
+        m_rate = rate;
+        m_aligned = false;
+    }
+
+    // Ring position heard when the last sample was captured, ahead by the lead
+    const double ratio = (double)rate / AEC_SAMPLE_RATE;
+    double target = clockPos + (lastNs + AEC_LEAD_MS * 1000000LL - clockNs) * 1e-9 * rate;
+    if (!m_aligned)
+    {
+        if (target < count * ratio)
+        {
+            // Captured before the output started
+            std::fill(out, out + count, 0.0f);
+            return true;
+        }
+        m_pos = (uint64_t)(target - count * ratio);
+        m_drift = 0.0;
+        m_fifo.clear();
+        m_resampler.Reset();
+        m_aligned = true;
+    }
+
+    while ((int)m_fifo.size() < count)
+    {
+        int frames = std::min((int)ceil((count - m_fifo.size()) * ratio) + 1, RESAMPLER_BLOCK);
+        m_frames.resize(frames);
+        m_pcm.resize(frames);
+        m_resampled.resize(m_resampler.GetMaxOutput(frames));
+        Fill(m_frames.data(), frames);
+        for (int i = 0; i < frames; i++)
+            m_pcm[i] = (short)std::min(std::max(m_frames[i] * 32768.0f, -32768.0f), 32767.0f);
+        int produced = m_resampler.Process(m_pcm.data(), frames, m_resampled.data());
+        m_fifo.insert(m_fifo.end(), m_resampled.begin(), m_resampled.begin() + produced);
+    }
+    std::copy(m_fifo.begin(), m_fifo.begin() + count, out);
+    m_fifo.erase(m_fifo.begin(), m_fifo.begin() + count);
+
+    // Capture and output clocks drift apart, the timestamps jitter by a device period
+    double error = ((double)m_pos - m_fifo.size() * ratio) - target;
+    m_drift += (error - m_drift) * AEC_DRIFT_SMOOTH;
+    double limit = AEC_REALIGN_MS * rate / 1000.0;
+    if (fabs(m_drift) > limit || fabs(error) > limit * AEC_JUMP_FACTOR)
+    {
+        double shift = fabs(error) > limit * AEC_JUMP_FACTOR ? error : m_drift;
+        m_pos = (uint64_t)std::max(0.0, (double)m_pos - shift);
+        m_drift = 0.0;
+        m_realigns++;
+    }
+    return true;
+}
+
+/*
+ * Canceller
+ */
+
+// acc += a * b, complex
+static void ComplexMac(float *accRe, float *accIm, const float *aRe, const float *aIm, const float *bRe, const float *bIm, int count)
+{
+    int i = 0;
+#if defined(AUDIO_SIMD_SSE)
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 ar = _mm_loadu_ps(aRe + i), ai = _mm_loadu_ps(aIm + i);
+        __m128 br = _mm_loadu_ps(bRe + i), bi = _mm_loadu_ps(bIm + i);
+        __m128 re = _mm_sub_ps(_mm_mul_ps(ar, br), _mm_mul_ps(ai, bi));
+        __m128 im = _mm_add_ps(_mm_mul_ps(ar, bi), _mm_mul_ps(ai, br));
+        _mm_storeu_ps(accRe + i, _mm_add_ps(_mm_loadu_ps(accRe + i), re));
+        _mm_storeu_ps(accIm + i, _mm_add_ps(_mm_loadu_ps(accIm + i), im));
+    }
+#elif defined(AUDIO_SIMD_NEON)
+    for (; i + 4 <= count; i += 4)
+    {
+        float32x4_t ar = vld1q_f32(aRe + i), ai = vld1q_f32(aIm + i);
+        float32x4_t br = vld1q_f32(bRe + i), bi = vld1q_f32(bIm + i);
+        float32x4_t re = vmlsq_f32(vmlaq_f32(vld1q_f32(accRe + i), ar, br), ai, bi);
+        float32x4_t im = vmlaq_f32(vmlaq_f32(vld1q_f32(accIm + i), ar, bi), ai, br);
+        vst1q_f32(accRe + i, re);
+        vst1q_f32(accIm + i, im);
+    }
+#endif
+    for (; i < count; i++)
+    {
+        accRe[i] += aRe[i] * bRe[i] - aIm[i] * bIm[i];
+        accIm[i] += aRe[i] * bIm[i] + aIm[i] * bRe[i];
+    }
+}
+
+// w += conj(x) * g, complex
+static void ConjugateMac(float *wRe, float *wIm, const float *xRe, const float *xIm, const float *gRe, const float *gIm, int count)
+{
+    int i = 0;
+#if defined(AUDIO_SIMD_SSE)
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 xr = _mm_loadu_ps(xRe + i), xi = _mm_loadu_ps(xIm + i);
+        __m128 gr = _mm_loadu_ps(gRe + i), gi = _mm_loadu_ps(gIm + i);
+        __m128 re = _mm_add_ps(_mm_mul_ps(xr, gr), _mm_mul_ps(xi, gi));
+        __m128 im = _mm_sub_ps(_mm_mul_ps(xr, gi), _mm_mul_ps(xi, gr));
+        _mm_storeu_ps(wRe + i, _mm_add_ps(_mm_loadu_ps(wRe + i), re));
+        _mm_storeu_ps(wIm + i, _mm_add_ps(_mm_loadu_ps(wIm + i), im));
+    }
+#elif defined(AUDIO_SIMD_NEON)
+    for (; i + 4 <= count; i += 4)
+    {
+        float32x4_t xr = vld1q_f32(xRe + i), xi = vld1q_f32(xIm + i);
+        float32x4_t gr = vld1q_f32(gRe + i), gi = vld1q_f32(gIm + i);
+        float32x4_t re = vmlaq_f32(vmlaq_f32(vld1q_f32(wRe + i), xr, gr), xi, gi);
+        float32x4_t im = vmlsq_f32(vmlaq_f32(vld1q_f32(wIm + i), xr, gi), xi, gr);
+        vst1q_f32(wRe + i, re);
+        vst1q_f32(wIm + i, im);
+    }
+#endif
+    for (; i < count; i++)
+    {
+        wRe[i] += xRe[i] * gRe[i] + xIm[i] * gIm[i];
+        wIm[i] += xRe[i] * gIm[i] - xIm[i] * gRe[i];
+    }
+}
+
+CEchoCanceller::CEchoCanceller()
+    : m_partitions(0), m_newest(0), m_constrain(0), m_davg1(0.0f), m_davg2(0.0f), m_dvar1(0.0f), m_dvar2(0.0f), m_adapt(0.0), m_adapted(false), m_pey(0.0f), m_pyy(0.0f),
+      m_leak(0.0f), m_diverged(0), m_echoPower(0.0f), m_residualPower(0.0f), m_erleDb(0.0f)
+{
+}
+
+void CEchoCanceller::Configure()
+{
+    const int bins = AEC_BLOCK + 1;
+    m_fft.Configure(2 * AEC_BLOCK);
+    m_partitions = ((AEC_TAIL_MS + AEC_LEAD_MS) * AEC_SAMPLE_RATE / 1000 + AEC_BLOCK - 1) / AEC_BLOCK;
+
+    m_reference.resize(2 * AEC_BLOCK);
+    m_xRe.resize(m_partitions * bins);
+    m_xIm.resize(m_partitions * bins);
+    m_wRe.resize(m_partitions * bins);
+    m_wIm.resize(m_partitions * bins);
+    m_fRe.resize(m_partitions * bins);
+    m_fIm.resize(m_partitions * bins);
+    for (auto *v : {&m_yRe, &m_yIm, &m_eRe, &m_eIm, &m_power, &m_eSmooth, &m_ySmooth})
+        v->resize(bins);
+    m_fftRe.resize(2 * AEC_BLOCK);
+    m_fftIm.resize(2 * AEC_BLOCK);
+    m_time.resize(2 * AEC_BLOCK);
+    Reset();
+}
+
+void CEchoCanceller::Reset()
+{
+    for (auto *v : {&m_reference, &m_xRe, &m_xIm, &m_wRe, &m_wIm, &m_fRe, &m_fIm, &m_power, &m_eSmooth, &m_ySmooth})
+        std::fill(v->begin(), v->end(), 0.0f);
+    m_newest = 0;
+    m_constrain = 0;
+    m_davg1 = m_davg2 = m_dvar1 = m_dvar2 = 0.0f;
+    m_adapt = 0.0;
+    m_adapted = false;
+    m_pey = m_pyy = 0.0f;
+    m_leak = 0.0f;
+    m_diverged = 0;
+    m_echoPower = m_residualPower = 0.0f;
+    m_erleDb = 0.0f;
+}
+
+void CEchoCanceller::Spectrum(const float *time, float *re, float *im)
+{
+    const int *bitReverse = m_fft.GetBitReverse();
+    for (int i = 0; i < 2 * AEC_BLOCK; i++)
+    {
+        m_fftRe[bitReverse[i]] = time[i];
+        m_fftIm[i] = 0.0f;
+    }
+    m_fft.Transform(m_fftRe.data(), m_fftIm.data());
+    std::copy(m_fftRe.begin(), m_fftRe.begin() + AEC_BLOCK + 1, re);
+    std::copy(m_fftIm.begin(), m_fftIm.begin() + AEC_BLOCK + 1, im);
+}
+
+void CEchoCanceller::Time(const float *re, const float *im, float *time)
+{
+    // The spectrum of a real signal is conjugate symmetric
+    const int size = 2 * AEC_BLOCK;
+    std::copy(re, re + AEC_BLOCK + 1, m_fftRe.begin());
+    std::copy(im, im + AEC_BLOCK + 1, m_fftIm.begin());
+    for (int k = AEC_BLOCK + 1; k < size; k++)
+    {
+        m_fftRe[k] = re[size - k];
+        m_fftIm[k] = -im[size - k];
+    }
+    m_fft.Inverse(m_fftRe.data(), m_fftIm.data());
+    std::copy(m_fftRe.begin(), m_fftRe.end(), time);
+}
+
+void CEchoCanceller::Constrain(int partition)
+{
+    // Circular wrap of the frequency domain gradient, taps past the block are dropped
+    const int bins = AEC_BLOCK + 1;
+    float *re = m_wRe.data() + partition * bins;
+    float *im = m_wIm.data() + partition * bins;
+    Time(re, im, m_time.data());
+    std::fill(m_time.begin() + AEC_BLOCK, m_time.end(), 0.0f);
+    Spectrum(m_time.data(), re, im);
+}
+
+void CEchoCanceller::Filter(const float *wRe, const float *wIm, float *echo)
+{
+    // Overlap-save, partition p filters the reference p blocks back
+    const int bins = AEC_BLOCK + 1;
+    std::fill(m_yRe.begin(), m_yRe.end(), 0.0f);
+    std::fill(m_yIm.begin(), m_yIm.end(), 0.0f);
+    for (int p = 0; p < m_partitions; p++)
+    {
+        int slot = (m_newest + p) % m_partitions;
+        ComplexMac(m_yRe.data(), m_yIm.data(), wRe + p * bins, wIm + p * bins, m_xRe.data() + slot * bins, m_xIm.data() + slot * bins, bins);
+    }
+    Time(m_yRe.data(), m_yIm.data(), m_time.data());
+    std::copy(m_time.begin() + AEC_BLOCK, m_time.end(), echo);
+}
+
+void CEchoCanceller::Process(const float *mic, const float *reference, float *out)
+{
+    const int bins = AEC_BLOCK + 1;
+    const int partitions = m_partitions;
+    const float floor = AEC_BLOCK * AEC_POWER_FLOOR;
+
+    // Newest reference spectrum over the last two blocks
+    std::copy(m_reference.begin() + AEC_BLOCK, m_reference.end(), m_reference.begin());
+    std::copy(reference, reference + AEC_BLOCK, m_reference.begin() + AEC_BLOCK);
+    m_newest = (m_newest + partitions - 1) % partitions;
+    float *xRe = m_xRe.data() + m_newest * bins;
+    float *xIm = m_xIm.data() + m_newest * bins;
+    Spectrum(m_reference.data(), xRe, xIm);
+
+    // The adapting filter and the one heard, the adapting one takes over when it does better
+    float echo[AEC_BLOCK], background[AEC_BLOCK], error[AEC_BLOCK];
+    Filter(m_wRe.data(), m_wIm.data(), background);
+    Filter(m_fRe.data(), m_fIm.data(), echo);
+    float sxx = 0.0f, sdd = 0.0f, see = 0.0f, sff = 0.0f, dbf = 0.0f;
+    for (int i = 0; i < AEC_BLOCK; i++)
+    {
+        background[i] = mic[i] - background[i];
+        error[i] = mic[i] - echo[i];
+        sxx += reference[i] * reference[i];
+        sdd += mic[i] * mic[i];
+        see += background[i] * background[i];
+        sff += error[i] * error[i];
+        dbf += (background[i] - error[i]) * (background[i] - error[i]);
+    }
+
+    // Diverged or fed garbage, start over
+    if (!std::isfinite(see) || !std::isfinite(sff))
+    {
+        Reset();
+        std::copy(mic, mic + AEC_BLOCK, out);
+        return;
+    }
+
+    float diff = sff - see;
+    m_davg1 = 0.6f * m_davg1 + 0.4f * diff;
+    m_davg2 = 0.85f * m_davg2 + 0.15f * diff;
+    m_dvar1 = 0.36f * m_dvar1 + 0.16f * sff * dbf;
+    m_dvar2 = 0.7225f * m_dvar2 + 0.0225f * sff * dbf;
+    if (diff * fabsf(diff) > sff * dbf || m_davg1 * fabsf(m_davg1) > 0.5f * m_dvar1 || m_davg2 * fabsf(m_davg2) > 0.25f * m_dvar2)
+    {
+        m_fRe = m_wRe;
+        m_fIm = m_wIm;
+        std::copy(background, background + AEC_BLOCK, error);
+        sff = see;
+        m_davg1 = m_davg2 = m_dvar1 = m_dvar2 = 0.0f;
+    }
+    else if (-diff * fabsf(diff) > 4.0f * sff * dbf || -m_davg1 * fabsf(m_davg1) > 2.0f * m_dvar1 || -m_davg2 * fabsf(m_davg2) > 4.0f * m_dvar2)
+    {
+        // Thrown off by double talk, back to what was heard
+        m_wRe = m_fRe;
+        m_wIm = m_fIm;
+        std::copy(error, error + AEC_BLOCK, background);
+        see = sff;
+        m_davg1 = m_davg2 = m_dvar1 = m_dvar2 = 0.0f;
+    }
+
+    m_diverged = sff > sdd + floor ? m_diverged + 1 : 0;
+    if (m_diverged >= AEC_DIVERGED_BLOCKS)
+    {
+        Reset();
+        std::copy(mic, mic + AEC_BLOCK, out);
+        return;
+    }
+
+    // Spectra of the output error and its echo estimate, padded like the filter output
+    float syy = 0.0f, sey = 0.0f;
+    std::fill(m_time.begin(), m_time.begin() + AEC_BLOCK, 0.0f);
+    for (int i = 0; i < AEC_BLOCK; i++)
+    {
+        echo[i] = mic[i] - error[i];
+        syy += echo[i] * echo[i];
+        sey += error[i] * echo[i];
+    }
+    std::copy(error, error + AEC_BLOCK, m_time.begin() + AEC_BLOCK);
+    Spectrum(m_time.data(), m_eRe.data(), m_eIm.data());
+    std::copy(echo, echo + AEC_BLOCK, m_time.begin() + AEC_BLOCK);
+    Spectrum(m_time.data(), m_yRe.data(), m_yIm.data());
+
+    // Leak of the echo estimate into the error, from how their powers vary together
+    const float average = (float)AEC_BLOCK / AEC_SAMPLE_RATE;
+    const float powerSmooth = 0.35f / partitions;
+    float pey = 0.0f, pyy = 0.0f;
+    for (int k = 0; k < bins; k++)
+    {
+        float ef = m_eRe[k] * m_eRe[k] + m_eIm[k] * m_eIm[k];
+        float yf = m_yRe[k] * m_yRe[k] + m_yIm[k] * m_yIm[k];
+        pey += (ef - m_eSmooth[k]) * (yf - m_ySmooth[k]);
+        pyy += (yf - m_ySmooth[k]) * (yf - m_ySmooth[k]);
+        m_eSmooth[k] += (ef - m_eSmooth[k]) * average;
+        m_ySmooth[k] += (yf - m_ySmooth[k]) * average;
+        m_power[k] += (xRe[k] * xRe[k] + xIm[k] * xIm[k] - m_power[k]) * powerSmooth;
+    }
+    float alpha = std::min(2.0f * average * syy / (sff + floor), 0.5f * average);
+    m_pey += (pey - m_pey) * alpha;
+    m_pyy += (pyy - m_pyy) * alpha;
+    m_pyy = std::max(m_pyy, 1e-12f);
+    m_pey = std::min(std::max(m_pey, AEC_MIN_LEAK * m_pyy), m_pyy);
+    m_leak = m_pey / m_pyy;
+    if (m_leak > 0.5f)
+        m_leak = 1.0f;
+
+    // Residual echo to error ratio, the optimal step when nothing else is in the error
+    float rer = (0.0001f * sxx + 3.0f * m_leak * syy) / (sff + floor);
+    rer = std::min(std::max(rer, sey * sey / (1e-12f + sff * syy)), 0.5f);
+
+    bool far = sxx > AEC_BLOCK * AEC_FAR_POWER;
+    if (far)
+    {
+        // Per bin steps from the output error, applied to the gradient of the adapting filter
+        float steps[AEC_BLOCK + 1];
+        if (!m_adapted)
+        {
+            // Until converged the leak is not known, the step follows how much the far end dominates
+            float rate = 0.25f * std::min(sxx, sff) / (sff + floor);
+            m_adapt += rate;
+            if (m_adapt > partitions && m_leak > 0.03f)
+                m_adapted = true;
+            for (int k = 0; k < bins; k++)
+                steps[k] = rate / (partitions * m_power[k] + AEC_POWER_FLOOR);
+        }
+        else
+        {
+            for (int k = 0; k < bins; k++)
+            {
+                float ef = m_eRe[k] * m_eRe[k] + m_eIm[k] * m_eIm[k] + AEC_POWER_FLOOR;
+                float residual = std::min(m_leak * (m_yRe[k] * m_yRe[k] + m_yIm[k] * m_yIm[k]), 0.5f * ef);
+                steps[k] = (0.7f * residual / ef + 0.3f * rer) / (partitions * m_power[k] + AEC_POWER_FLOOR);
+            }
+        }
+
+        std::fill(m_time.begin(), m_time.begin() + AEC_BLOCK, 0.0f);
+        std::copy(background, background + AEC_BLOCK, m_time.begin() + AEC_BLOCK);
+        Spectrum(m_time.data(), m_eRe.data(), m_eIm.data());
+        for (int k = 0; k < bins; k++)
+        {
+            m_eRe[k] *= steps[k];
+            m_eIm[k] *= steps[k];
+        }
+        for (int p = 0; p < partitions; p++)
+        {
+            int slot = (m_newest + p) % partitions;
+            ConjugateMac(m_wRe.data() + p * bins, m_wIm.data() + p * bins, m_xRe.data() + slot * bins, m_xIm.data() + slot * bins,
+                         m_eRe.data(), m_eIm.data(), bins);
+        }
+        // Constraining every partition every block costs two FFTs each, the first always and the rest in turn
+        Constrain(0);
+        for (int p = 0; p < (partitions + AEC_CONSTRAIN_BLOCKS - 2) / AEC_CONSTRAIN_BLOCKS; p++)
+        {
+            Constrain(1 + m_constrain);
+            m_constrain = (m_constrain + 1) % (partitions - 1);
+        }
+
+        m_echoPower += (sdd - m_echoPower) * AEC_ERLE_SMOOTH;
+        m_residualPower += (std::min(sff, sdd) - m_residualPower) * AEC_ERLE_SMOOTH;
+        m_erleDb = 10.0f * log10f((m_echoPower + 1e-12f) / (m_residualPower + 1e-12f));
+    }
+
+    // Worse than the microphone until it converged again
+    if (sff > sdd)
+        std::copy(mic, mic + AEC_BLOCK, out);
+    else
+        std::copy(error, error + AEC_BLOCK, out);
+}
+
+/*
+ * Benchmark
+ */
+
+// Vowel-like harmonics with breath noise, a syllable every 250 ms with its own formants and a fricative onset, f0 gliding
+static void SynthesizeVoice(std::vector<float> &pcm, double start, double end, double f0, double gain, uint32_t seed)
+{
+    static const float FORMANTS[5][2] = {{800, 1300}, {300, 2500}, {350, 1400}, {500, 2100}, {500, 900}};
+    double phase[30] = {};
+    float previous = 0.0f;
+    for (size_t i = (size_t)(start * AEC_SAMPLE_RATE); i < std::min(pcm.size(), (size_t)(end * AEC_SAMPLE_RATE)); i++)
+    {
+        double t = (double)i / AEC_SAMPLE_RATE - start;
+        int syllable = (int)(t / 0.25);
+        const float *formant = FORMANTS[(syllable * 7 + seed) % 5];
+        double pitch = f0 * (1.0 + 0.15 * sin(2.0 * M_PI * 0.7 * t + seed));
+        double envelope = 0.55 + 0.45 * sin(2.0 * M_PI * 4.0 * t - M_PI / 2);
+        double voice = 0.0;
+        for (int h = 1; h < 30 && h * pitch < AEC_SAMPLE_RATE * 0.45; h++)
+        {
+            double f = h * pitch;
+            phase[h] += 2.0 * M_PI * f / AEC_SAMPLE_RATE;
+            double weight = exp(-pow((f - formant[0]) / 200.0, 2)) + 0.5 * exp(-pow((f - formant[1]) / 300.0, 2)) + 0.05;
+            voice += weight / h * sin(phase[h]);
+        }
+        seed = seed * 1664525u + 1013904223u;
+        float white = (int32_t)seed / 2147483648.0f;
+        float hiss = white - previous; // High passed
+        previous = white;
+        double local = t - syllable * 0.25;
+        voice = local < 0.06 ? 0.3 * hiss : voice * envelope + 0.05 * hiss;
+        pcm[i] += (float)(voice * gain);
+    }
+}
+
+static bool ReadFile16k(const char *path, std::vector<float> &pcm)
+{
+    std::vector<short> samples;
+    int sampleRate;
+    if (!CAudioCapture::ReadFile(path, samples, sampleRate))
+        return false;
+    CAudioResampler resampler;
+    resampler.Configure(sampleRate, AEC_SAMPLE_RATE, RESAMPLE_QUALITY_HIGH);
+    pcm.resize(resampler.GetMaxOutput((int)samples.size()));
+    pcm.resize(resampler.Process(samples.data(), (int)samples.size(), pcm.data()));
+    for (float &sample : pcm)
+        sample /= 32768.0f;
+    return true;
+}
+
+void CEchoCanceller::Benchmark(const char *farFile, const char *nearFile)
+{
+    std::vector<float> farEnd, nearEnd;
+    if (farFile && nearFile)
+    {
+        std::vector<float> speech;
+        if (!ReadFile16k(farFile, farEnd) || !ReadFile16k(nearFile, speech))
+        {
+            std::cout << "Unable to read " << farFile << " or " << nearFile << std::endl;
+            return;
+        }
+        // The near end starts halfway through the far end, double talk and then alone
+        size_t offset = farEnd.size() / 2;
+        nearEnd.assign(std::max(farEnd.size(), offset + speech.size()), 0.0f);
+        std::copy(speech.begin(), speech.end(), nearEnd.begin() + offset);
+        farEnd.resize(nearEnd.size());
+    }
+    else
+    {
+        farEnd.assign(12 * AEC_SAMPLE_RATE, 0.0f);
+        nearEnd.assign(farEnd.size(), 0.0f);
+        SynthesizeVoice(farEnd, 0.5, 6.5, 140.0, 0.25, 1);
+        SynthesizeVoice(farEnd, 8.0, 11.5, 140.0, 0.25, 2);
+        SynthesizeVoice(nearEnd, 4.5, 6.0, 220.0, 0.08, 3);
+        SynthesizeVoice(nearEnd, 7.0, 7.8, 220.0, 0.08, 4);
+    }
+
+    // Room echo path: a direct path after the lead and acoustic delay, then a tail decaying 60 dB in 150 ms
+    const int delay = (AEC_LEAD_MS + 2) * AEC_SAMPLE_RATE / 1000;
+    const int length = AEC_SAMPLE_RATE * 150 / 1000;
+    std::vector<float> path(delay + length, 0.0f);
+    uint32_t seed = 7;
+    path[delay] = 0.4f;
+    for (int i = 1; i < length; i++)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        path[delay + i] = (int32_t)seed / 2147483648.0f * 0.08f * expf(-6.9f * i / length);
+    }
+
+    const size_t blocks = farEnd.size() / AEC_BLOCK;
+    std::vector<float> echo(blocks * AEC_BLOCK, 0.0f), mic(echo.size()), out(echo.size());
+    for (size_t i = 0; i < echo.size(); i++)
+    {
+        double sum = 0.0;
+        for (size_t j = 0; j < path.size() && j <= i; j++)
+            sum += path[j] * farEnd[i - j];
+        seed = seed * 1664525u + 1013904223u;
+        echo[i] = (float)sum + (int32_t)seed / 2147483648.0f * 0.0003f; // Microphone noise, -70 dBFS
+        mic[i] = echo[i] + nearEnd[i];
+    }
+
+    std::cout << "AEC: " << (farFile && nearFile ? farFile : "synthesized far end") << " and " << (farFile && nearFile ? nearFile : "near end")
+              << ", " << (double)echo.size() / AEC_SAMPLE_RATE << " s, " << AEC_TAIL_MS << " ms tail, simd: " << AUDIO_SIMD_NAME << std::endl;
+
+    CEchoCanceller canceller;
+    canceller.Configure();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t b = 0; b < blocks; b++)
+        canceller.Process(mic.data() + b * AEC_BLOCK, farEnd.data() + b * AEC_BLOCK, out.data() + b * AEC_BLOCK);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Blocks sorted by who talks, -50 dBFS
+    const double active = AEC_BLOCK * 1e-5;
+    double echoOnly = 0.0, residualOnly = 0.0, echoLate = 0.0, residualLate = 0.0, nearPower = 0.0, distortion = 0.0;
+    double convergedAt = -1.0;
+    int streak = 0, doubleBlocks = 0;
+    for (size_t b = 0; b < blocks; b++)
+    {
+        double far = 0.0, near = 0.0, d = 0.0, e = 0.0, n = 0.0;
+        for (size_t i = b * AEC_BLOCK; i < (b + 1) * AEC_BLOCK; i++)
+        {
+            far += farEnd[i] * farEnd[i];
+            near += nearEnd[i] * nearEnd[i];
+            d += echo[i] * echo[i];
+            e += (out[i] - nearEnd[i]) * (out[i] - nearEnd[i]);
+            n += nearEnd[i] * nearEnd[i];
+        }
+        if (far > active && near <= active)
+        {
+            echoOnly += d;
+            residualOnly += e;
+            if (b * 2 >= blocks)
+            {
+                echoLate += d;
+                residualLate += e;
+            }
+            // 15 dB for 200 ms in a row
+            streak = d > e * 31.6 ? streak + 1 : 0;
+            if (convergedAt < 0.0 && streak >= 25)
+                convergedAt = (double)(b + 1) * AEC_BLOCK / AEC_SAMPLE_RATE;
+        }
+        else if (far > active && near > active)
+        {
+            nearPower += n;
+            distortion += e;
+            doubleBlocks++;
+        }
+    }
+
+    double audio = (double)blocks * AEC_BLOCK / AEC_SAMPLE_RATE;
+    printf("  ERLE %.1f dB over the far end alone, %.1f dB in the second half\n", 10.0 * log10(echoOnly / residualOnly), 10.0 * log10(echoLate / residualLate));
+    if (convergedAt >= 0.0)
+        printf("  15 dB held from %.2f s\n", convergedAt);
+    else
+        printf("  15 dB never held\n");
+    if (doubleBlocks)
+        printf("  double talk %.2f s: near end %.1f dB above the residual echo\n", (double)doubleBlocks * AEC_BLOCK / AEC_SAMPLE_RATE, 10.0 * log10(nearPower / distortion));
+    printf("  live ERLE estimate %.1f dB\n", canceller.GetErleDb());
+    printf("  real time factor %.5f, %.2f us per %d sample block, budget %.3f: %s\n", seconds / audio, seconds * 1e6 / blocks, AEC_BLOCK,
+           AEC_RTF_BUDGET, seconds / audio <= AEC_RTF_BUDGET ? "ok" : "over");
+}
@@ -0,0 +1,142 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "audioRing.hpp"
+#include "audioResampler.hpp"
+#include "audioFft.hpp"
+
+#define AEC_SAMPLE_RATE 16000   // Of the capture processing, VAD_SAMPLE_RATE
+#define AEC_BLOCK 128           // Samples per block, 8 ms, FFTs of twice this
+#define AEC_TAIL_MS 200         // Echo path covered after the lead
+#define AEC_LEAD_MS 10          // Reference taken this early, covers an output latency reported late
+#define AEC_REFERENCE_MS 1000   // Ring between the audio callback and the capture processing
+#define AEC_MAX_RATE 192000
+#define AEC_REALIGN_MS 3.0      // Smoothed drift of the reference against the clock before it is moved
+#define AEC_RTF_BUDGET 0.02     // Real time factor the canceller is allowed on the capture processing thread
+
+/**
+ * Far-end reference for the echo canceller, tapped from the output callback.
+ * The callback writes every frame it hands the device, audio or silence,
+ * after the DSP, then publishes when the frame after them is heard.
+ * The capture processing reads it resampled to AEC_SAMPLE_RATE, aligned to
+ * when its microphone samples were captured: the ring position heard at
+ * that time is taken from the clock, a drift beyond AEC_REALIGN_MS moves
+ * the read position, audio missing from the ring reads as silence.
+ * Written only while a reader is attached.
+ */
+class CEchoReference
+{
+public:
+    CEchoReference();
+
+    // Not thread safe, call before the audio callback starts.
+    void Allocate();
+
+    // Audio callback
+    bool IsActive() const { return m_active.load(std::memory_order_relaxed); }
+    void Write(const float *data, int count);
+    void WriteSilence(int count);
+    // The frame after the last one written is heard at `audibleAtNs`, steady clock
+    void Publish(int sampleRate, int64_t audibleAtNs);
+
+    // Capture processing thread
+    void Attach();
+    void Detach();
+    // `count` samples at AEC_SAMPLE_RATE, the last heard at `lastNs`, steady clock. False while there is no output.
+    bool Read(float *out, int count, int64_t lastNs);
+    int GetRealigns() const { return m_realigns; }
+
+private:
+    void Fill(float *out, int frames);
+
+    CAudioRing<float> m_ring;
+    bool m_truncated; // Callback only, the ring was full, the clock is not published
+
+    alignas(AUDIO_CACHE_LINE_SIZE) std::atomic<uint32_t> m_clockSeq;
+    std::atomic<int> m_clockRate;
+    std::atomic<uint64_t> m_clockPos;
+    std::atomic<int64_t> m_clockNs;
+    std::atomic<bool> m_active;
+
+    // Reader only
+    CAudioResampler m_resampler;
+    int m_rate;
+    bool m_aligned;
+    uint64_t m_pos;       // Ring position of the next frame resampled, may be past the ring either way
+    double m_drift;       // Smoothed, frames
+    int m_realigns;
+    std::vector<float> m_frames;
+    std::vector<short> m_pcm;
+    std::vector<float> m_resampled;
+    std::vector<float> m_fifo; // Resampled, not yet read
+};
+
+/**
+ * Acoustic echo canceller, multidelay block frequency domain adaptive filter.
+ * The echo path is AEC_TAIL_MS split into partitions of AEC_BLOCK taps,
+ * each a frequency domain filter on the reference spectra of its delay.
+ * Overlap-save filtering, the gradient of every partition normalized per
+ * bin by the reference power and constrained to causal taps one partition
+ * per block in turn. The step follows the residual echo estimate, a leak
+ * of the filtered reference into the error from their correlation, so the
+ * filter keeps still through double talk. A second filter is the one heard,
+ * it takes the adapting filter when that one does better and gives it back
+ * when double talk threw it off. Diverged filters are reset.
+ * Runs on the capture processing thread, real time safe once configured.
+ */
+class CEchoCanceller
+{
+public:
+    CEchoCanceller();
+
+    // Allocates, not real time safe.
+    void Configure();
+    void Reset();
+
+    // AEC_BLOCK samples each, `out` may be `mic`
+    void Process(const float *mic, const float *reference, float *out);
+
+    // Smoothed echo return loss enhancement while the far end plays, dB
+    float GetErleDb() const { return m_erleDb; }
+
+    // Mixes far-end and near-end files through a synthesized echo path, or synthesized speech,
+    // prints ERLE, near-end distortion and real time factor.
+    static void Benchmark(const char *farFile, const char *nearFile);
+
+private:
+    void Spectrum(const float *time, float *re, float *im); // Bins 0..AEC_BLOCK of 2 * AEC_BLOCK real samples
+    void Time(const float *re, const float *im, float *time); // Inverse, the real part of all 2 * AEC_BLOCK samples
+    void Filter(const float *wRe, const float *wIm, float *echo); // Echo estimate of the newest block
+    void Constrain(int partition);
+
+    CAudioFFT m_fft;
+    int m_partitions;
+    int m_newest;   // Partition slot of the newest reference spectrum
+    int m_constrain;
+
+    std::vector<float> m_reference; // Last two blocks
+    std::vector<float> m_xRe, m_xIm; // Reference spectra, partition slots in a ring
+    std::vector<float> m_wRe, m_wIm; // Adapting filter, per partition
+    std::vector<float> m_fRe, m_fIm; // Filter heard, the adapting one once it does better
+    std::vector<float> m_yRe, m_yIm;
+    std::vector<float> m_eRe, m_eIm;
+    std::vector<float> m_power;      // Smoothed reference power per bin
+    std::vector<float> m_eSmooth, m_ySmooth;
+    std::vector<float> m_fftRe, m_fftIm, m_time;
+
+    float m_davg1, m_davg2, m_dvar1, m_dvar2; // Error difference of the two filters, short and long term
+
+    double m_adapt;   // Sum of early steps, converged past the partition count
+    bool m_adapted;
+    float m_pey, m_pyy; // Correlation of error and filtered reference power
+    float m_leak;
+    int m_diverged;
+    float m_echoPower, m_residualPower; // While the far end plays
+    float m_erleDb;
+};
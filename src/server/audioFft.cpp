@@ -0,0 +1,133 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+
+#include "audioFft.hpp"
+#include "audioSimd.hpp"
+
+#include <cmath>
+#include <utility>
+
+// One radix-2 stage, z[k + j] and z[k + j + half] for j < half, w = twiddles of the stage
+static void Butterflies(float *re, float *im, const float *wr, const float *wi, int half)
+{
+    int j = 0;
+    float *re2 = re + half;
+    float *im2 = im + half;
+#if defined(AUDIO_SIMD_SSE)
+    for (; j + 4 <= half; j += 4)
+    {
+        __m128 br = _mm_loadu_ps(re2 + j), bi = _mm_loadu_ps(im2 + j);
+        __m128 cr = _mm_loadu_ps(wr + j), ci = _mm_loadu_ps(wi + j);
+        __m128 tr = _mm_sub_ps(_mm_mul_ps(br, cr), _mm_mul_ps(bi, ci));
+        __m128 ti = _mm_add_ps(_mm_mul_ps(br, ci), _mm_mul_ps(bi, cr));
+        __m128 ar = _mm_loadu_ps(re + j), ai = _mm_loadu_ps(im + j);
+        _mm_storeu_ps(re + j, _mm_add_ps(ar, tr));
+        _mm_storeu_ps(im + j, _mm_add_ps(ai, ti));
+        _mm_storeu_ps(re2 + j, _mm_sub_ps(ar, tr));
+        _mm_storeu_ps(im2 + j, _mm_sub_ps(ai, ti));
+    }
+#elif defined(AUDIO_SIMD_NEON)
+    for (; j + 4 <= half; j += 4)
+    {
+        float32x4_t br = vld1q_f32(re2 + j), bi = vld1q_f32(im2 + j);
+        float32x4_t cr = vld1q_f32(wr + j), ci = vld1q_f32(wi + j);
+        float32x4_t tr = vmlsq_f32(vmulq_f32(br, cr), bi, ci);
+        float32x4_t ti = vmlaq_f32(vmulq_f32(br, ci), bi, cr);
+        float32x4_t ar = vld1q_f32(re + j), ai = vld1q_f32(im + j);
+        vst1q_f32(re + j, vaddq_f32(ar, tr));
+        vst1q_f32(im + j, vaddq_f32(ai, ti));
+        vst1q_f32(re2 + j, vsubq_f32(ar, tr));
+        vst1q_f32(im2 + j, vsubq_f32(ai, ti));
+    }
+#endif
+    for (; j < half; j++)
+    {
+        float tr = re2[j] * wr[j] - im2[j] * wi[j];
+        float ti = re2[j] * wi[j] + im2[j] * wr[j];
+        float ar = re[j], ai = im[j];
+        re[j] = ar + tr;
+        im[j] = ai + ti;
+        re2[j] = ar - tr;
+        im2[j] = ai - ti;
+    }
+}
+
+CAudioFFT::CAudioFFT()
+    : m_size(0)
+{
+}
+
+void CAudioFFT::Configure(int size)
+{
+    m_size = size;
+
+    int bits = 0;
+    while ((1 << bits) < size)
+        bits++;
+    m_bitReverse.resize(size);
+    for (int i = 0; i < size; i++)
+    {
+        int r = 0;
+        for (int b = 0; b < bits; b++)
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        m_bitReverse[i] = r;
+    }
+
+    m_twiddleRe.clear();
+    m_twiddleIm.clear();
+    for (int len = 2; len <= size; len <<= 1)
+    {
+        for (int j = 0; j < len / 2; j++)
+        {
+            m_twiddleRe.push_back((float)cos(-2.0 * M_PI * j / len));
+            m_twiddleIm.push_back((float)sin(-2.0 * M_PI * j / len));
+        }
+    }
+}
+
+void CAudioFFT::Transform(float *re, float *im) const
+{
+    const float *wr = m_twiddleRe.data();
+    const float *wi = m_twiddleIm.data();
+    for (int len = 2; len <= m_size; len <<= 1)
+    {
+        int half = len / 2;
+        for (int k = 0; k < m_size; k += len)
+            Butterflies(re + k, im + k, wr, wi, half);
+        wr += half;
+        wi += half;
+    }
+}
+
+void CAudioFFT::Permute(float *re, float *im) const
+{
+    for (int i = 0; i < m_size; i++)
+    {
+        int r = m_bitReverse[i];
+        if (i < r)
+        {
+            std::swap(re[i], re[r]);
+            std::swap(im[i], im[r]);
+        }
+    }
+}
+
+void CAudioFFT::Forward(float *re, float *im) const
+{
+    Permute(re, im);
+    Transform(re, im);
+}
+
+void CAudioFFT::Inverse(float *re, float *im) const
+{
+    // Swapping real and imaginary parts around the forward transform conjugates it
+    Permute(im, re);
+    Transform(im, re);
+    float scale = 1.0f / m_size;
+    for (int i = 0; i < m_size; i++)
+    {
+        re[i] *= scale;
+        im[i] *= scale;
+    }
+}
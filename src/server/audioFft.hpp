@@ -0,0 +1,39 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+#pragma once
+
+#include <vector>
+
+/**
+ * Radix-2 complex FFT on split real and imaginary arrays.
+ * The butterflies of every stage are vectorized over contiguous per stage
+ * twiddles. Callers packing their input anyway write it straight to the
+ * bit reversed indices and call Transform(), Forward() and Inverse() take
+ * natural order. Real time safe once configured.
+ */
+class CAudioFFT
+{
+public:
+    CAudioFFT();
+
+    // `size` complex points, a power of two. Allocates the tables, not real time safe.
+    void Configure(int size);
+    int GetSize() const { return m_size; }
+    const int *GetBitReverse() const { return m_bitReverse.data(); }
+
+    // In place, input at the bit reversed indices, output in natural order
+    void Transform(float *re, float *im) const;
+
+    // In place, natural order both ways. Inverse() scales by 1 / size.
+    void Forward(float *re, float *im) const;
+    void Inverse(float *re, float *im) const;
+
+private:
+    void Permute(float *re, float *im) const;
+
+    int m_size;
+    std::vector<int> m_bitReverse;
+    std::vector<float> m_twiddleRe; // Per stage, contiguous for the vectorized butterflies
+    std::vector<float> m_twiddleIm;
+};
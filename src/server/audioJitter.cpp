@@ -0,0 +1,133 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+
+#include "audioJitter.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+CJitterBuffer::CJitterBuffer()
+    : m_mean(0.0), m_variance(0.0), m_framesWritten(0), m_required(0.0), m_overrunning(false), m_inputOpen(false),
+      m_playing(false), m_carryOver(false), m_beginSeen(0)
+{
+    m_sampleRate.store(0, std::memory_order_relaxed);
+    m_minPrebufferMs.store(0, std::memory_order_relaxed);
+    m_beginSerial.store(0, std::memory_order_relaxed);
+    m_inputComplete.store(true, std::memory_order_relaxed);
+    m_targetFrames.store(0, std::memory_order_relaxed);
+    m_requiredMs.store(0, std::memory_order_relaxed);
+    m_throughput.store(0.0, std::memory_order_relaxed);
+    m_underruns.store(0, std::memory_order_relaxed);
+    m_overruns.store(0, std::memory_order_relaxed);
+}
+
+void CJitterBuffer::Configure(int sampleRate)
+{
+    m_sampleRate.store(sampleRate, std::memory_order_relaxed);
+    m_playing = false;
+    m_carryOver = false;
+    m_beginSeen = m_beginSerial.load(std::memory_order_acquire);
+}
+
+void CJitterBuffer::BeginInput()
+{
+    double target = m_mean + JITTER_DEVIATIONS * sqrt(m_variance);
+    target = std::min<double>(std::max<double>(target, m_minPrebufferMs.load(std::memory_order_relaxed)), JITTER_MAX_MS);
+    m_targetFrames.store(MsToFrames((int)ceil(target)), std::memory_order_relaxed);
+
+    m_framesWritten = 0;
+    m_required = 0.0;
+    m_overrunning = false;
+    m_inputOpen = true;
+    m_underruns.store(0, std::memory_order_relaxed);
+    m_overruns.store(0, std::memory_order_relaxed);
+    m_inputComplete.store(false, std::memory_order_relaxed);
+    m_beginSerial.fetch_add(1, std::memory_order_release);
+}
+
+void CJitterBuffer::OnWrite(int frames)
+{
+    const int sampleRate = m_sampleRate.load(std::memory_order_relaxed);
+    if (!sampleRate || !m_inputOpen)
+        return;
+
+    auto now = std::chrono::steady_clock::now();
+    if (!m_framesWritten)
+        m_firstWrite = now;
+
+    // Started at the first chunk, playback would need this chunk after the audio before it
+    double lag = std::chrono::duration<double, std::milli>(now - m_firstWrite).count() - m_framesWritten * 1000.0 / sampleRate;
+    m_required = std::max(m_required, lag);
+    m_framesWritten += frames;
+    m_overrunning = false;
+}
+
+void CJitterBuffer::OnOverrun()
+{
+    // Once per full ring, not per retry
+    if (!m_inputOpen)
+        return;
+    if (!m_overrunning)
+        m_overruns.fetch_add(1, std::memory_order_relaxed);
+    m_overrunning = true;
+}
+
+void CJitterBuffer::EndInput()
+{
+    m_inputComplete.store(true, std::memory_order_release);
+    m_inputOpen = false;
+    const int sampleRate = m_sampleRate.load(std::memory_order_relaxed);
+    if (!m_framesWritten || !sampleRate)
+        return;
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_firstWrite).count();
+    m_throughput.store(elapsed > 0.0 ? m_framesWritten / (double)sampleRate / elapsed : 0.0, std::memory_order_relaxed);
+    m_requiredMs.store((int)ceil(m_required), std::memory_order_relaxed);
+
+    double delta = m_required - m_mean;
+    m_mean += JITTER_HISTORY_WEIGHT * delta;
+    m_variance = (1.0 - JITTER_HISTORY_WEIGHT) * (m_variance + JITTER_HISTORY_WEIGHT * delta * delta);
+}
+
+bool CJitterBuffer::Update(uint64_t available)
+{
+    uint32_t beginSerial = m_beginSerial.load(std::memory_order_acquire);
+    if (beginSerial != m_beginSeen)
+    {
+        m_beginSeen = beginSerial;
+        // Appended behind audio still playing, it plays out first, then the new input prebuffers
+        m_playing = m_playing && available > 0;
+        m_carryOver = m_playing;
+    }
+
+    bool complete = m_inputComplete.load(std::memory_order_acquire);
+    int target = m_targetFrames.load(std::memory_order_relaxed);
+    if (!m_playing)
+    {
+        m_playing = complete || available >= (uint64_t)target;
+    }
+    else if (!available && m_carryOver)
+    {
+        m_carryOver = false;
+        m_playing = complete;
+    }
+    else if (!available && !complete)
+    {
+        // Ran dry mid-turn, wait for more than last time
+        m_underruns.fetch_add(1, std::memory_order_relaxed);
+        m_targetFrames.store(std::min(target + MsToFrames(JITTER_REBUFFER_STEP_MS), MsToFrames(JITTER_MAX_MS)), std::memory_order_relaxed);
+        m_playing = false;
+    }
+    return m_playing;
+}
+
+void CJitterBuffer::GetStats(SJitterStats &stats) const
+{
+    const int sampleRate = m_sampleRate.load(std::memory_order_relaxed);
+    stats.targetMs = sampleRate ? (int)((int64_t)m_targetFrames.load(std::memory_order_relaxed) * 1000 / sampleRate) : 0;
+    stats.requiredMs = m_requiredMs.load(std::memory_order_relaxed);
+    stats.throughput = m_throughput.load(std::memory_order_relaxed);
+    stats.underruns = m_underruns.load(std::memory_order_relaxed);
+    stats.overruns = m_overruns.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,86 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <chrono>
+
+#include "audioRing.hpp"
+
+#define JITTER_MAX_MS 3000         // Target fill never exceeds this
+#define JITTER_REBUFFER_STEP_MS 100 // Target raise on an underrun
+#define JITTER_HISTORY_WEIGHT 0.25  // EWMA weight of the latest turn
+#define JITTER_DEVIATIONS 2.0       // Target covers the mean need plus this many deviations
+
+struct SJitterStats
+{
+    int targetMs;      // Fill that starts playback
+    int requiredMs;    // What the last turn would have needed to play without a gap
+    double throughput; // Audio seconds received per second of the last turn
+    int underruns;     // Ring ran dry before the input was complete
+    int overruns;      // Ring was full, the decoder had to wait
+};
+
+/**
+ * Prebuffer gate between the decode thread and the audio callback.
+ * Playback of a turn starts once the target fill is buffered or the input is
+ * complete. An underrun stops playback until the (raised) target is buffered
+ * again, so a slow stream plays as a few longer pauses instead of crackle.
+ * The decode thread measures every turn's arrival against real time: the
+ * largest lag of a chunk behind the playback it would have fed is the
+ * prebuffer that turn needed. Its running mean and deviation set the next
+ * turn's target, never below the configured minimum.
+ */
+class CJitterBuffer
+{
+public:
+    CJitterBuffer();
+
+    // Not thread safe, call before the audio callback starts.
+    void Configure(int sampleRate);
+
+    // Any thread
+    void SetMinPrebuffer(int ms) { m_minPrebufferMs.store(ms, std::memory_order_relaxed); }
+    void GetStats(SJitterStats &stats) const;
+
+    // Producer side, from BeginInput() to EndInput(). BeginInput() right after flushing the ring,
+    // or behind the previous input, which then plays out before the new one prebuffers.
+    // Writes outside an input, like a segment tail released between turns, are not measured.
+    void BeginInput();
+    void OnWrite(int frames);
+    void OnOverrun();
+    void EndInput();
+
+    // Audio thread. `false` while the ring is held back to fill up.
+    bool Update(uint64_t available);
+
+private:
+    int MsToFrames(int ms) const { return (int)((int64_t)ms * m_sampleRate.load(std::memory_order_relaxed) / 1000); }
+
+    std::atomic<int> m_sampleRate;
+    std::atomic<int> m_minPrebufferMs;
+
+    // Producer only
+    double m_mean;     // Needed prebuffer over recent turns, ms
+    double m_variance;
+    std::chrono::steady_clock::time_point m_firstWrite;
+    int64_t m_framesWritten;
+    double m_required; // Largest lag of this turn, ms
+    bool m_overrunning;
+    bool m_inputOpen;
+
+    // Audio thread only
+    bool m_playing;
+    bool m_carryOver; // Still playing the input before the last BeginInput()
+    uint32_t m_beginSeen;
+
+    alignas(AUDIO_CACHE_LINE_SIZE) std::atomic<uint32_t> m_beginSerial;
+    std::atomic<bool> m_inputComplete;
+    std::atomic<int> m_targetFrames;
+    std::atomic<int> m_requiredMs;
+    std::atomic<double> m_throughput;
+    std::atomic<int> m_underruns;
+    std::atomic<int> m_overruns;
+};
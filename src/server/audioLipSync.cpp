@@ -0,0 +1,210 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+
+#include "audioLipSync.hpp"
+#include "audioSimd.hpp"
+
+#include <cmath>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+
+static float SumSquares(const float *x, int count)
+{
+    int i = 0;
+    float sum = 0.0f;
+#if defined(AUDIO_SIMD_SSE)
+    __m128 acc = _mm_setzero_ps();
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 value = _mm_loadu_ps(x + i);
+        acc = _mm_add_ps(acc, _mm_mul_ps(value, value));
+    }
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    sum = _mm_cvtss_f32(acc);
+#elif defined(AUDIO_SIMD_NEON)
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    for (; i + 4 <= count; i += 4)
+    {
+        float32x4_t value = vld1q_f32(x + i);
+        acc = vmlaq_f32(acc, value, value);
+    }
+    float32x2_t half = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    sum = vget_lane_f32(vpadd_f32(half, half), 0);
+#endif
+    for (; i < count; i++)
+        sum += x[i] * x[i];
+    return sum;
+}
+
+static int64_t SteadyNowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+CLipEnvelope::CLipEnvelope()
+    : m_hopIndex(UINT64_MAX), m_sum(0.0), m_count(0), m_historyPos(0)
+{
+    m_sampleRate.store(0, std::memory_order_relaxed);
+    m_hop.store(0, std::memory_order_relaxed);
+    m_writtenPos.store(0, std::memory_order_relaxed);
+    for (auto &value : m_values)
+        value.store(0.0f, std::memory_order_relaxed);
+    m_analyzedPos.store(0, std::memory_order_relaxed);
+    for (auto &visemes : m_visemes)
+        visemes.store(0, std::memory_order_relaxed);
+    m_clockSeq.store(0, std::memory_order_relaxed);
+    m_headPos.store(0, std::memory_order_relaxed);
+    m_audibleAtNs.store(0, std::memory_order_relaxed);
+}
+
+void CLipEnvelope::Configure(int sampleRate)
+{
+    if (sampleRate == m_sampleRate.load(std::memory_order_relaxed))
+        return;
+
+    m_hopIndex = UINT64_MAX;
+    m_analyzer.Configure(sampleRate);
+    m_history.assign(m_analyzer.GetWindowSize(), 0.0f);
+    m_frame.resize(m_history.size());
+    m_historyPos = 0;
+    m_sampleRate.store(sampleRate, std::memory_order_relaxed);
+    m_hop.store(std::max(1, sampleRate * LIP_HOP_MS / 1000), std::memory_order_release);
+}
+
+void CLipEnvelope::Push(uint64_t pos, const float *samples, int count)
+{
+    const uint64_t hop = m_hop.load(std::memory_order_relaxed);
+    if (!hop)
+        return;
+
+    for (int i = 0; i < count;)
+    {
+        uint64_t index = (pos + i) / hop;
+        if (index != m_hopIndex)
+        {
+            m_hopIndex = index;
+            m_sum = 0.0;
+            m_count = 0;
+        }
+
+        // Up to the end of this hop, the running value is published for partial hops too
+        int n = (int)std::min<uint64_t>(count - i, (index + 1) * hop - (pos + i));
+        m_sum += SumSquares(samples + i, n);
+        m_count += n;
+        m_values[index & (LIP_ENVELOPE_SIZE - 1)].store((float)sqrt(m_sum / m_count), std::memory_order_relaxed);
+
+        const int size = (int)m_history.size();
+        for (int done = 0; done < n;)
+        {
+            int chunk = std::min(n - done, size - m_historyPos);
+            memcpy(m_history.data() + m_historyPos, samples + i + done, chunk * sizeof(float));
+            m_historyPos = (m_historyPos + chunk) % size;
+            done += chunk;
+        }
+        i += n;
+        if ((pos + i) % hop == 0)
+            AnalyzeHop(pos + i);
+    }
+    m_writtenPos.store(pos + count, std::memory_order_release);
+}
+
+void CLipEnvelope::AnalyzeHop(uint64_t endPos)
+{
+    const int size = (int)m_history.size();
+    if (endPos < (uint64_t)size)
+        return;
+
+    memcpy(m_frame.data(), m_history.data() + m_historyPos, (size - m_historyPos) * sizeof(float));
+    memcpy(m_frame.data() + size - m_historyPos, m_history.data(), m_historyPos * sizeof(float));
+
+    float weights[VISEME_COUNT];
+    m_analyzer.Analyze(m_frame.data(), weights);
+    uint64_t packed = 0;
+    for (int v = 0; v < VISEME_COUNT; v++)
+        packed |= (uint64_t)lrintf(weights[v] * 255.0f) << (8 * v);
+
+    uint64_t centre = endPos - size / 2;
+    m_visemes[(centre / m_hop.load(std::memory_order_relaxed)) & (LIP_ENVELOPE_SIZE - 1)].store(packed, std::memory_order_relaxed);
+    m_analyzedPos.store(centre, std::memory_order_release);
+}
+
+void CLipEnvelope::UpdateClock(uint64_t headPos, int64_t audibleAtNs)
+{
+    uint32_t seq = m_clockSeq.load(std::memory_order_relaxed);
+    m_clockSeq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_headPos.store(headPos, std::memory_order_relaxed);
+    m_audibleAtNs.store(audibleAtNs, std::memory_order_relaxed);
+    m_clockSeq.store(seq + 2, std::memory_order_release);
+}
+
+bool CLipEnvelope::GetHeardPos(double &pos, uint64_t &writtenPos) const
+{
+    const int hop = m_hop.load(std::memory_order_acquire);
+    if (!hop)
+        return false;
+
+    uint32_t seq;
+    uint64_t headPos;
+    int64_t audibleAtNs;
+    do
+    {
+        seq = m_clockSeq.load(std::memory_order_acquire);
+        headPos = m_headPos.load(std::memory_order_relaxed);
+        audibleAtNs = m_audibleAtNs.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) || seq != m_clockSeq.load(std::memory_order_relaxed));
+
+    if (!headPos)
+        return false;
+
+    // headPos is heard at audibleAtNs, earlier positions before it at the sample rate
+    pos = headPos - (audibleAtNs - SteadyNowNs()) * 1e-9 * m_sampleRate.load(std::memory_order_relaxed);
+    if (pos < 0.0 || pos >= headPos)
+        return false; // Everything played was heard, a gap or the end of the turn
+
+    writtenPos = m_writtenPos.load(std::memory_order_acquire);
+    return pos < writtenPos && writtenPos - pos <= (double)(LIP_ENVELOPE_SIZE / 2) * hop;
+}
+
+float CLipEnvelope::Sample() const
+{
+    double pos;
+    uint64_t writtenPos;
+    if (!GetHeardPos(pos, writtenPos))
+        return 0.0f;
+    const int hop = m_hop.load(std::memory_order_relaxed);
+
+    // Linear between hop centres
+    double hopPos = std::max(0.0, pos / hop - 0.5);
+    uint64_t index = (uint64_t)hopPos;
+    float frac = (float)(hopPos - index);
+    float value = Value(index);
+    if ((index + 1) * hop < writtenPos)
+        value += (Value(index + 1) - value) * frac;
+
+    return std::min(1.0f, value * LIP_RMS_SCALE);
+}
+
+void CLipEnvelope::SampleVisemes(float weights[VISEME_COUNT]) const
+{
+    std::fill(weights, weights + VISEME_COUNT, 0.0f);
+    double pos;
+    uint64_t writtenPos;
+    if (!GetHeardPos(pos, writtenPos))
+        return;
+    const int hop = m_hop.load(std::memory_order_relaxed);
+
+    // The latest window may still be centred before what is heard, hold it
+    uint64_t analyzedPos = m_analyzedPos.load(std::memory_order_acquire);
+    if (analyzedPos + (uint64_t)(LIP_ENVELOPE_SIZE / 2) * hop < pos)
+        return;
+    uint64_t index = std::min((uint64_t)pos, analyzedPos) / hop;
+
+    uint64_t packed = m_visemes[index & (LIP_ENVELOPE_SIZE - 1)].load(std::memory_order_relaxed);
+    for (int v = 0; v < VISEME_COUNT; v++)
+        weights[v] = ((packed >> (8 * v)) & 0xff) / 255.0f;
+}
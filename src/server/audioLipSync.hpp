@@ -0,0 +1,69 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "audioViseme.hpp"
+
+#define LIP_HOP_MS 10
+#define LIP_ENVELOPE_SIZE 4096 // Hops kept, power of two, longer than the playback ring
+#define LIP_RMS_SCALE 2.83f    // Same mouth opening as the old peak-to-peak meter for a sine
+
+/**
+ * Lip-sync envelope on the playback ring timeline.
+ * The decode thread stores the RMS of every LIP_HOP_MS hop, keyed by the ring
+ * position of its samples. The audio callback publishes which ring position
+ * becomes audible when, from the stream's reported output latency. The
+ * renderer samples the envelope at the position audible right now, so the
+ * mouth follows the sound whatever the buffer size.
+ * Each completed hop also runs the viseme analyzer over the window ending
+ * there, the vowel weights are keyed by the window centre on the same timeline.
+ */
+class CLipEnvelope
+{
+public:
+    CLipEnvelope();
+
+    // Decode thread
+    void Configure(int sampleRate);
+    void Push(uint64_t pos, const float *samples, int count);
+
+    // Audio thread. Ring position `headPos` is heard at `audibleAtNs` on the steady clock.
+    void UpdateClock(uint64_t headPos, int64_t audibleAtNs);
+
+    // Any thread. Mouth opening for what is heard now, 0 in silence.
+    float Sample() const;
+    // Any thread. Vowel weights for what is heard now, all 0 in silence.
+    void SampleVisemes(float weights[VISEME_COUNT]) const;
+
+private:
+    float Value(uint64_t hop) const { return m_values[hop & (LIP_ENVELOPE_SIZE - 1)].load(std::memory_order_relaxed); }
+    bool GetHeardPos(double &pos, uint64_t &writtenPos) const;
+    void AnalyzeHop(uint64_t endPos);
+
+    std::atomic<int> m_sampleRate;
+    std::atomic<int> m_hop; // Frames per hop, 0 until configured
+
+    // Decode thread only
+    uint64_t m_hopIndex;
+    double m_sum;
+    int m_count;
+    CVisemeAnalyzer m_analyzer;
+    std::vector<float> m_history; // Last window of samples, circular
+    std::vector<float> m_frame;   // m_history in order
+    int m_historyPos;
+
+    std::atomic<uint64_t> m_writtenPos;
+    std::atomic<float> m_values[LIP_ENVELOPE_SIZE];
+    std::atomic<uint64_t> m_analyzedPos;                // Visemes are valid up to the hop holding this position
+    std::atomic<uint64_t> m_visemes[LIP_ENVELOPE_SIZE]; // 8 bit weights, a in the low byte
+
+    // Seqlock, odd while the audio thread writes
+    std::atomic<uint32_t> m_clockSeq;
+    std::atomic<uint64_t> m_headPos;
+    std::atomic<int64_t> m_audibleAtNs;
+};
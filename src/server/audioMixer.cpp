@@ -0,0 +1,328 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+
+#include "audioMixer.hpp"
+#include "audioSimd.hpp"
+#include "audioRealtime.hpp"
+#include "audioResampler.hpp"
+#include "audioCapture.hpp"
+
+#include <cmath>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+// out[i] += x[i] * (start + i * step)
+static void MixRamp(float *out, const float *x, int count, float start, float step)
+{
+    int i = 0;
+#if defined(AUDIO_SIMD_SSE)
+    __m128 gain = _mm_setr_ps(start, start + step, start + 2 * step, start + 3 * step);
+    const __m128 step4 = _mm_set1_ps(4 * step);
+    for (; i + 4 <= count; i += 4)
+    {
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(x + i), gain)));
+        gain = _mm_add_ps(gain, step4);
+    }
+#elif defined(AUDIO_SIMD_NEON)
+    const float lanes[4] = {start, start + step, start + 2 * step, start + 3 * step};
+    float32x4_t gain = vld1q_f32(lanes);
+    const float32x4_t step4 = vdupq_n_f32(4 * step);
+    for (; i + 4 <= count; i += 4)
+    {
+        vst1q_f32(out + i, vmlaq_f32(vld1q_f32(out + i), vld1q_f32(x + i), gain));
+        gain = vaddq_f32(gain, step4);
+    }
+#endif
+    for (; i < count; i++)
+        out[i] += x[i] * (start + i * step);
+}
+
+// Voices add up past full scale, where the F32 writers do not clamp
+static void Clamp(float *x, int count)
+{
+    int i = 0;
+#if defined(AUDIO_SIMD_SSE)
+    const __m128 lo = _mm_set1_ps(-1.0f), hi = _mm_set1_ps(1.0f);
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_ps(x + i, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(x + i), lo), hi));
+#elif defined(AUDIO_SIMD_NEON)
+    const float32x4_t lo = vdupq_n_f32(-1.0f), hi = vdupq_n_f32(1.0f);
+    for (; i + 4 <= count; i += 4)
+        vst1q_f32(x + i, vminq_f32(vmaxq_f32(vld1q_f32(x + i), lo), hi));
+#endif
+    for (; i < count; i++)
+        x[i] = std::min(std::max(x[i], -1.0f), 1.0f);
+}
+
+CAudioClip *CAudioClip::Load(const std::string &path)
+{
+    CAudioClip *clip = new CAudioClip();
+    if (!CAudioCapture::ReadFile(path, clip->m_pcm, clip->m_sampleRate))
+    {
+        std::cout << "Mixer: unable to read " << path << std::endl;
+        delete clip;
+        return nullptr;
+    }
+    clip->m_path = path;
+    return clip;
+}
+
+CAudioMixer::CAudioMixer()
+    : m_convertedRate(0), m_rate(0), m_gainRate(0.0f), m_attackRate(0.0f), m_releaseRate(0.0f), m_declick(0), m_active(false), m_speech(false)
+{
+    m_volume.store(1.0f, std::memory_order_relaxed);
+    for (int i = 0; i < MIXER_VOICE_COUNT; i++)
+    {
+        m_gains[i].store(1.0f, std::memory_order_relaxed);
+        m_ducking[i].store(1.0f, std::memory_order_relaxed);
+        m_voices[i] = SVoice{nullptr, 0, 0, 0.0f, 1.0f, nullptr, 0, 0.0f, 0.0f};
+    }
+    m_sampleRate.store(0, std::memory_order_relaxed);
+    m_prepared.store(false, std::memory_order_relaxed);
+}
+
+void CAudioMixer::Allocate()
+{
+    m_commands.Allocate((uint64_t)MIXER_COMMANDS);
+    AudioRtLockMemory(m_commands.Data(), m_commands.Capacity() * sizeof(SCommand));
+}
+
+void CAudioMixer::Prepare(const CAudioClip &clip)
+{
+    if (clip.GetPCM().empty())
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_sources.count(clip.GetPath()))
+        return;
+    m_sources[clip.GetPath()] = SSource{clip.GetSampleRate(), clip.GetPCM()};
+    m_prepared.store(true, std::memory_order_release);
+}
+
+void CAudioMixer::Convert()
+{
+    int sampleRate = m_sampleRate.load(std::memory_order_acquire);
+    if (sampleRate <= 0 || (sampleRate == m_convertedRate && !m_prepared.load(std::memory_order_acquire)))
+        return;
+    m_prepared.store(false, std::memory_order_relaxed);
+    m_convertedRate = sampleRate;
+
+    // Copied out, Play() only waits for the lookups and inserts
+    std::vector<std::pair<std::string, SSource>> missing;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto &source : m_sources)
+            if (!m_clips.count({source.first, sampleRate}))
+                missing.push_back(source);
+    }
+
+    for (auto &source : missing)
+    {
+        // The resampler's history is flushed with silence
+        const SSource &in = source.second;
+        CAudioResampler resampler;
+        resampler.Configure(in.sampleRate, sampleRate, RESAMPLE_QUALITY_HIGH);
+        std::vector<short> padded(in.pcm);
+        padded.resize(in.pcm.size() + in.sampleRate / 100, 0);
+        std::vector<float> pcm(resampler.GetMaxOutput((int)padded.size()));
+        pcm.resize(resampler.Process(padded.data(), (int)padded.size(), pcm.data()));
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<float> &clip = m_clips[{source.first, sampleRate}];
+        clip = std::move(pcm);
+        AudioRtLockMemory(clip.data(), clip.size() * sizeof(float));
+    }
+}
+
+bool CAudioMixer::Play(int voice, const CAudioClip &clip)
+{
+    int sampleRate = m_sampleRate.load(std::memory_order_acquire);
+    if (sampleRate <= 0)
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto pcm = m_clips.find({clip.GetPath(), sampleRate});
+    if (pcm == m_clips.end())
+        return false;
+
+    SCommand command = {voice, pcm->second.data(), (int)pcm->second.size(), sampleRate};
+    return m_commands.Write(&command, 1) == 1;
+}
+
+void CAudioMixer::Stop(int voice)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    SCommand command = {voice, nullptr, 0, 0};
+    m_commands.Write(&command, 1);
+}
+
+void CAudioMixer::Configure(int sampleRate)
+{
+    m_rate = sampleRate;
+    m_gainRate = 1000.0f / (MIXER_GAIN_SMOOTH_MS * sampleRate);
+    m_attackRate = 1000.0f / (MIXER_DUCK_ATTACK_MS * sampleRate);
+    m_releaseRate = 1000.0f / (MIXER_DUCK_RELEASE_MS * sampleRate);
+    m_declick = std::max(sampleRate * MIXER_DECLICK_MS / 1000, 1);
+    m_active = false;
+    m_speech = false;
+    for (SVoice &voice : m_voices)
+        voice = SVoice{nullptr, 0, 0, 0.0f, 1.0f, nullptr, 0, 0.0f, 0.0f};
+    m_sampleRate.store(sampleRate, std::memory_order_release);
+}
+
+void CAudioMixer::Release(SVoice &voice)
+{
+    if (!voice.pcm)
+        return;
+    voice.tail = voice.pcm + voice.pos;
+    voice.tailLeft = std::min(m_declick, voice.frames - voice.pos);
+    voice.tailGain = voice.gain * voice.duck;
+    voice.tailStep = -voice.tailGain / m_declick;
+    voice.pcm = nullptr;
+}
+
+bool CAudioMixer::Update()
+{
+    SCommand command;
+    while (m_commands.Read(&command, 1))
+    {
+        SVoice &voice = m_voices[command.voice];
+        Release(voice);
+        // Converted for an output that was closed since
+        if (!command.pcm || command.sampleRate != m_rate)
+            continue;
+        voice.pcm = command.pcm;
+        voice.frames = command.frames;
+        voice.pos = 0;
+        voice.gain = m_volume.load(std::memory_order_relaxed) * m_gains[command.voice].load(std::memory_order_relaxed);
+        voice.duck = m_speech ? m_ducking[command.voice].load(std::memory_order_relaxed) : 1.0f;
+    }
+
+    m_active = false;
+    for (const SVoice &voice : m_voices)
+        m_active = m_active || voice.pcm || voice.tailLeft > 0;
+    return m_active;
+}
+
+const float *CAudioMixer::Mix(const float *speech, int count)
+{
+    m_speech = speech != nullptr;
+    if (!m_active)
+        return speech;
+
+    if (speech)
+        memcpy(m_out, speech, count * sizeof(float));
+    else
+        memset(m_out, 0, count * sizeof(float));
+
+    const float volume = m_volume.load(std::memory_order_relaxed);
+    m_active = false;
+    for (int i = 0; i < MIXER_VOICE_COUNT; i++)
+    {
+        SVoice &voice = m_voices[i];
+        if (voice.tailLeft > 0)
+        {
+            int mixed = std::min(count, voice.tailLeft);
+            MixRamp(m_out, voice.tail, mixed, voice.tailGain, voice.tailStep);
+            voice.tail += mixed;
+            voice.tailLeft -= mixed;
+            voice.tailGain += mixed * voice.tailStep;
+        }
+        if (voice.pcm)
+        {
+            // Both glide across the run, ducking faster down than up
+            float target = volume * m_gains[i].load(std::memory_order_relaxed);
+            float duck = m_speech ? m_ducking[i].load(std::memory_order_relaxed) : 1.0f;
+            float start = voice.gain * voice.duck;
+            voice.gain = target + (voice.gain - target) * expf(-count * m_gainRate);
+            voice.duck = duck + (voice.duck - duck) * expf(-count * (duck < voice.duck ? m_attackRate : m_releaseRate));
+            int mixed = std::min(count, voice.frames - voice.pos);
+            MixRamp(m_out, voice.pcm + voice.pos, mixed, start, (voice.gain * voice.duck - start) / count);
+            voice.pos += mixed;
+            if (voice.pos == voice.frames)
+                voice.pcm = nullptr;
+        }
+        m_active = m_active || voice.pcm || voice.tailLeft > 0;
+    }
+
+    Clamp(m_out, count);
+    return m_out;
+}
+
+void CAudioMixer::Benchmark()
+{
+    const int sampleRate = 48000;
+    const int iterations = 200000;
+    const int run = MIXER_RUN_MAX;
+
+    CAudioMixer mixer;
+    mixer.Allocate();
+    mixer.Configure(sampleRate);
+    mixer.SetGain(MIXER_VOICE_MOTION, 0.8f);
+    mixer.SetGain(MIXER_VOICE_FILLER, 0.5f);
+    mixer.SetDucking(MIXER_VOICE_MOTION, 0.5f);
+    mixer.SetDucking(MIXER_VOICE_FILLER, 0.1f);
+
+    // Clips longer than the benchmark, a tone each
+    std::vector<float> speech(run), clip((size_t)run * 64);
+    for (int i = 0; i < run; i++)
+        speech[i] = 0.3f * sinf(i * 0.07f);
+    for (size_t i = 0; i < clip.size(); i++)
+        clip[i] = 0.3f * sinf(i * 0.05f);
+    auto play = [&](int voice)
+    {
+        SCommand command = {voice, clip.data(), (int)clip.size(), sampleRate};
+        mixer.m_commands.Write(&command, 1);
+    };
+
+    std::cout << "Mixer benchmark, " << MIXER_VOICE_COUNT << " voices on speech, " << run << " frames per run, simd: " << AUDIO_SIMD_NAME << std::endl;
+
+    // The glides settle within a second of speech
+    play(MIXER_VOICE_MOTION);
+    play(MIXER_VOICE_FILLER);
+    mixer.Update();
+    for (int i = 0; i < sampleRate / run; i++)
+        mixer.Mix(speech.data(), run);
+    for (int i = 0; i < MIXER_VOICE_COUNT; i++)
+        printf("  voice %d ducked to %.3f of %.3f\n", i, mixer.m_voices[i].gain * mixer.m_voices[i].duck, mixer.m_voices[i].gain);
+
+    volatile float keep = 0.0f; // Results stay observable
+    int runs = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (runs < iterations)
+    {
+        play(MIXER_VOICE_MOTION);
+        play(MIXER_VOICE_FILLER);
+        mixer.Update();
+        for (int i = 0; i < 32; i++, runs++)
+            keep = mixer.Mix(runs & 64 ? speech.data() : nullptr, run)[i];
+    }
+    double simd = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / runs;
+
+    // Per sample, gain and ducking computed for every frame
+    std::vector<float> out(run);
+    float gains[MIXER_VOICE_COUNT] = {0.8f, 0.5f}, ducks[MIXER_VOICE_COUNT] = {1.0f, 1.0f};
+    const float attack = expf(-1000.0f / (MIXER_DUCK_ATTACK_MS * sampleRate));
+    start = std::chrono::steady_clock::now();
+    for (int n = 0; n < iterations; n++)
+    {
+        for (int i = 0; i < run; i++)
+        {
+            float value = speech[i];
+            for (int v = 0; v < MIXER_VOICE_COUNT; v++)
+            {
+                ducks[v] = 0.3f + (ducks[v] - 0.3f) * attack;
+                value += clip[(size_t)(n & 63) * run + i] * gains[v] * ducks[v];
+            }
+            out[i] = std::min(std::max(value, -1.0f), 1.0f);
+        }
+        keep = out[n & (run - 1)];
+    }
+    double reference = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+    printf("  %.0f ns/run, per sample loop %.0f ns/run, %.1fx\n", simd, reference, reference / simd);
+    (void)keep;
+}
@@ -0,0 +1,148 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "audioRing.hpp"
+
+#define MIXER_RUN_MAX 128              // Frames mixed per call, the DSP's quantum
+#define MIXER_COMMANDS 64              // Play / stop, between the callers and the audio callback
+#define MIXER_GAIN_SMOOTH_MS 20.0f     // Gain changes glide over about this long
+#define MIXER_DUCK_ATTACK_MS 30.0f     // Down once speech is heard
+#define MIXER_DUCK_RELEASE_MS 400.0f   // Back up after it ended, short pauses stay ducked
+#define MIXER_DECLICK_MS 5             // A stopped or replaced clip fades out over this
+
+// Clip voices, each plays one clip at a time on top of the speech
+enum EMixerVoice
+{
+    MIXER_VOICE_MOTION = 0, // Sound effect of a Live2D motion
+    MIXER_VOICE_FILLER,     // While a reply is on its way
+    MIXER_VOICE_COUNT,
+};
+
+// A sound file decoded once to mono PCM, at its own rate
+class CAudioClip
+{
+public:
+    // nullptr when the file can not be read or decoded
+    static CAudioClip *Load(const std::string &path);
+
+    const std::string &GetPath() const { return m_path; }
+    int GetSampleRate() const { return m_sampleRate; }
+    const std::vector<short> &GetPCM() const { return m_pcm; }
+
+private:
+    std::string m_path;
+    int m_sampleRate;
+    std::vector<short> m_pcm;
+};
+
+/**
+ * Mixes the clip voices into the speech the DSP rendered, in the audio
+ * callback. Clips are prepared once, converted to the output rate by the
+ * thread that calls Convert() and kept by the mixer for its lifetime, so the
+ * callback only reads memory nobody frees or resizes and playing only
+ * enqueues; play and stop reach it through a lock-free queue. Every voice has its own gain and is ducked while speech is heard.
+ * Speech keeps the volume and limiter of the DSP, the volume also applies to
+ * the voices. Nothing in the callback path allocates or locks.
+ */
+class CAudioMixer
+{
+public:
+    CAudioMixer();
+
+    // Not thread safe, before the audio callback starts
+    void Allocate();
+
+    // Any thread
+    void SetVolume(float volume) { m_volume.store(volume, std::memory_order_relaxed); }
+    void SetGain(int voice, float gain) { m_gains[voice].store(gain, std::memory_order_relaxed); }
+    // Gain while speech is heard, 1 leaves the voice alone
+    void SetDucking(int voice, float gain) { m_ducking[voice].store(gain, std::memory_order_relaxed); }
+
+    // Any thread but the audio callback. Keeps a copy of `clip` to convert at every output rate.
+    void Prepare(const CAudioClip &clip);
+    // Converts the prepared clips still missing at the output rate, a no-op when there are none.
+    // On a thread that may take a while, never the render thread or the audio callback.
+    void Convert();
+
+    // Any thread but the audio callback. Plays `clip` on `voice` from its start, what it played fades out.
+    // Returns false without an output or while the clip is not converted for it yet.
+    bool Play(int voice, const CAudioClip &clip);
+    void Stop(int voice);
+
+    // Sound thread, before the audio callback starts at `sampleRate`. Voices stop.
+    void Configure(int sampleRate);
+
+    // Audio callback. At the start of a pass, takes the queued commands, returns true while a voice plays.
+    bool Update();
+    // Audio callback. Mixes the voices into `count` frames of speech, nullptr for silent speech.
+    // Returns the mixed frames, nullptr when they are all silent.
+    const float *Mix(const float *speech, int count);
+
+    // Cost of a mixed run against a per sample loop, and the ducking depth it reaches.
+    static void Benchmark();
+
+private:
+    struct SCommand
+    {
+        int voice;
+        const float *pcm; // nullptr stops
+        int frames;
+        int sampleRate;   // Converted for
+    };
+
+    struct SVoice
+    {
+        const float *pcm; // nullptr when idle
+        int frames;
+        int pos;
+        float gain;       // Smoothed voice gain
+        float duck;       // Smoothed ducking
+        const float *tail; // Stopped or replaced clip, fading out
+        int tailLeft;
+        float tailGain;
+        float tailStep;
+    };
+
+    void Release(SVoice &voice);
+
+    std::atomic<float> m_volume;
+    std::atomic<float> m_gains[MIXER_VOICE_COUNT];
+    std::atomic<float> m_ducking[MIXER_VOICE_COUNT];
+    std::atomic<int> m_sampleRate;
+
+    struct SSource
+    {
+        int sampleRate;
+        std::vector<short> pcm;
+    };
+
+    // Callers, the converted clips live until the mixer is destroyed
+    std::mutex m_mutex;
+    std::map<std::string, SSource> m_sources;
+    std::map<std::pair<std::string, int>, std::vector<float>> m_clips;
+    std::atomic<bool> m_prepared; // A source was added since the last Convert()
+    int m_convertedRate;          // Convert() only
+
+    CAudioRing<SCommand> m_commands;
+
+    // Audio callback only
+    int m_rate;
+    float m_gainRate;   // Per frame, of the one pole glides
+    float m_attackRate;
+    float m_releaseRate;
+    int m_declick;
+    bool m_active;
+    bool m_speech;      // Heard in the last run
+    SVoice m_voices[MIXER_VOICE_COUNT];
+    alignas(16) float m_out[MIXER_RUN_MAX];
+};
@@ -0,0 +1,327 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+
+#include "audioOutput.hpp"
+#include "audioSimd.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+
+template <typename _S>
+static inline _S ConvertSample(float value);
+
+// Clamps compile to min/max, no branch per sample
+template <>
+inline short ConvertSample<short>(float value)
+{
+    value *= 32768.0f;
+    value = value < -32768.0f ? -32768.0f : value;
+    value = value > 32767.0f ? 32767.0f : value;
+    return (short)value;
+}
+
+template <>
+inline float ConvertSample<float>(float value)
+{
+    return value;
+}
+
+template <typename _S>
+static inline void ConvertBlock(const float *src, int frames, _S *dst)
+{
+    for (int i = 0; i < frames; i++)
+        dst[i] = ConvertSample<_S>(src[i]);
+}
+
+// Saturating packs clamp for free
+template <>
+inline void ConvertBlock<short>(const float *src, int frames, short *dst)
+{
+    int i = 0;
+#if defined(AUDIO_SIMD_SSE)
+    const __m128 scale = _mm_set1_ps(32768.0f);
+    for (; i + 8 <= frames; i += 8)
+    {
+        __m128i low = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i), scale));
+        __m128i high = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i + 4), scale));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(low, high));
+    }
+#elif defined(AUDIO_SIMD_NEON)
+    const float32x4_t scale = vdupq_n_f32(32768.0f);
+    for (; i + 8 <= frames; i += 8)
+    {
+        int16x4_t low = vqmovn_s32(vcvtq_s32_f32(vmulq_f32(vld1q_f32(src + i), scale)));
+        int16x4_t high = vqmovn_s32(vcvtq_s32_f32(vmulq_f32(vld1q_f32(src + i + 4), scale)));
+        vst1q_s16(dst + i, vcombine_s16(low, high));
+    }
+#endif
+    for (; i < frames; i++)
+        dst[i] = ConvertSample<short>(src[i]);
+}
+
+template <>
+inline void ConvertBlock<float>(const float *src, int frames, float *dst)
+{
+    memcpy(dst, src, frames * sizeof(float));
+}
+
+// Mono to interleaved stereo
+template <typename _S>
+static inline void FanOutStereo(const float *src, int frames, _S *dst)
+{
+    for (int i = 0; i < frames; i++)
+        dst[i * 2] = dst[i * 2 + 1] = ConvertSample<_S>(src[i]);
+}
+
+template <>
+inline void FanOutStereo<short>(const float *src, int frames, short *dst)
+{
+    int i = 0;
+#if defined(AUDIO_SIMD_SSE)
+    const __m128 scale = _mm_set1_ps(32768.0f);
+    for (; i + 8 <= frames; i += 8)
+    {
+        __m128i low = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i), scale));
+        __m128i high = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i + 4), scale));
+        __m128i packed = _mm_packs_epi32(low, high);
+        _mm_storeu_si128((__m128i *)(dst + i * 2), _mm_unpacklo_epi16(packed, packed));
+        _mm_storeu_si128((__m128i *)(dst + i * 2 + 8), _mm_unpackhi_epi16(packed, packed));
+    }
+#elif defined(AUDIO_SIMD_NEON)
+    const float32x4_t scale = vdupq_n_f32(32768.0f);
+    for (; i + 8 <= frames; i += 8)
+    {
+        int16x4_t low = vqmovn_s32(vcvtq_s32_f32(vmulq_f32(vld1q_f32(src + i), scale)));
+        int16x4_t high = vqmovn_s32(vcvtq_s32_f32(vmulq_f32(vld1q_f32(src + i + 4), scale)));
+        int16x8_t packed = vcombine_s16(low, high);
+        vst2q_s16(dst + i * 2, (int16x8x2_t){{packed, packed}});
+    }
+#endif
+    for (; i < frames; i++)
+        dst[i * 2] = dst[i * 2 + 1] = ConvertSample<short>(src[i]);
+}
+
+template <>
+inline void FanOutStereo<float>(const float *src, int frames, float *dst)
+{
+    int i = 0;
+#if defined(AUDIO_SIMD_SSE)
+    for (; i + 4 <= frames; i += 4)
+    {
+        __m128 value = _mm_loadu_ps(src + i);
+        _mm_storeu_ps(dst + i * 2, _mm_unpacklo_ps(value, value));
+        _mm_storeu_ps(dst + i * 2 + 4, _mm_unpackhi_ps(value, value));
+    }
+#elif defined(AUDIO_SIMD_NEON)
+    for (; i + 4 <= frames; i += 4)
+    {
+        float32x4_t value = vld1q_f32(src + i);
+        vst2q_f32(dst + i * 2, (float32x4x2_t){{value, value}});
+    }
+#endif
+    for (; i < frames; i++)
+        dst[i * 2] = dst[i * 2 + 1] = src[i];
+}
+
+// All channels share one buffer, frame after frame
+template <typename _S, int _Channels>
+static inline bool IsInterleaved(const struct SoundIoChannelArea *areas)
+{
+    for (int channel = 0; channel < _Channels; channel++)
+    {
+        if (areas[channel].step != _Channels * (int)sizeof(_S) || areas[channel].ptr != areas[0].ptr + channel * sizeof(_S))
+            return false;
+    }
+    return true;
+}
+
+template <typename _S, int _Channels>
+static void WriteFrames(const float *src, int frames, int offset, const struct SoundIoChannelArea *areas)
+{
+    if (IsInterleaved<_S, _Channels>(areas))
+    {
+        _S *dst = (_S *)(areas[0].ptr + areas[0].step * offset);
+        if (_Channels == 1)
+        {
+            ConvertBlock<_S>(src, frames, dst);
+            return;
+        }
+        if (_Channels == 2)
+        {
+            FanOutStereo<_S>(src, frames, dst);
+            return;
+        }
+
+        // Mono fan-out, the channel loop is unrolled for the fixed count
+        for (int i = 0; i < frames; i++)
+        {
+            _S value = ConvertSample<_S>(src[i]);
+            for (int channel = 0; channel < _Channels; channel++)
+                dst[i * _Channels + channel] = value;
+        }
+        return;
+    }
+
+    // Planar or strided layout, one pass per channel
+    for (int channel = 0; channel < _Channels; channel++)
+    {
+        char *ptr = areas[channel].ptr + areas[channel].step * offset;
+        int step = areas[channel].step;
+        if (step == (int)sizeof(_S))
+        {
+            ConvertBlock<_S>(src, frames, (_S *)ptr);
+            continue;
+        }
+        for (int i = 0; i < frames; i++)
+            *(_S *)(ptr + step * i) = ConvertSample<_S>(src[i]);
+    }
+}
+
+template <typename _S, int _Channels>
+static void WriteSilence(int frames, int offset, const struct SoundIoChannelArea *areas)
+{
+    if (IsInterleaved<_S, _Channels>(areas))
+    {
+        memset(areas[0].ptr + areas[0].step * offset, 0, (size_t)frames * _Channels * sizeof(_S));
+        return;
+    }
+
+    for (int channel = 0; channel < _Channels; channel++)
+    {
+        char *ptr = areas[channel].ptr + areas[channel].step * offset;
+        int step = areas[channel].step;
+        if (step == (int)sizeof(_S))
+        {
+            memset(ptr, 0, (size_t)frames * sizeof(_S));
+            continue;
+        }
+        for (int i = 0; i < frames; i++)
+            *(_S *)(ptr + step * i) = 0;
+    }
+}
+
+#define AUDIO_WRITERS(_FUNC, _S) \
+    {_FUNC<_S, 1>, _FUNC<_S, 2>, _FUNC<_S, 3>, _FUNC<_S, 4>, _FUNC<_S, 5>, _FUNC<_S, 6>, _FUNC<_S, 7>, _FUNC<_S, 8>}
+
+static const AudioWriteFunc S16_WRITERS[AUDIO_OUTPUT_MAX_CHANNELS] = AUDIO_WRITERS(WriteFrames, short);
+static const AudioWriteFunc F32_WRITERS[AUDIO_OUTPUT_MAX_CHANNELS] = AUDIO_WRITERS(WriteFrames, float);
+static const AudioSilenceFunc S16_SILENCE[AUDIO_OUTPUT_MAX_CHANNELS] = AUDIO_WRITERS(WriteSilence, short);
+static const AudioSilenceFunc F32_SILENCE[AUDIO_OUTPUT_MAX_CHANNELS] = AUDIO_WRITERS(WriteSilence, float);
+
+static const char *S16_NAMES[] = {"s16 mono", "s16 stereo", "s16 multichannel"};
+static const char *F32_NAMES[] = {"f32 mono", "f32 stereo", "f32 multichannel"};
+
+enum SoundIoFormat AudioOutputSelectFormat(struct SoundIoDevice *device)
+{
+    if (soundio_device_supports_format(device, SoundIoFormatFloat32NE))
+        return SoundIoFormatFloat32NE;
+    return SoundIoFormatS16NE;
+}
+
+bool AudioOutputGetWriter(enum SoundIoFormat format, int channels, SAudioWriter &writer)
+{
+    if (channels < 1 || channels > AUDIO_OUTPUT_MAX_CHANNELS)
+        return false;
+
+    int name = std::min(channels, 3) - 1;
+    if (format == SoundIoFormatS16NE)
+    {
+        writer = {S16_WRITERS[channels - 1], S16_SILENCE[channels - 1], S16_NAMES[name]};
+        return true;
+    }
+    if (format == SoundIoFormatFloat32NE)
+    {
+        writer = {F32_WRITERS[channels - 1], F32_SILENCE[channels - 1], F32_NAMES[name]};
+        return true;
+    }
+    return false;
+}
+
+// The per sample, per channel loop the callback used before, as the benchmark baseline
+static void WriteReference(const float *src, int frames, int available, int channels, const struct SoundIoChannelArea *areas, float &minValue, float &maxValue)
+{
+    for (int i = 0; i < frames; i++)
+    {
+        short value = 0;
+        if (i < available)
+        {
+            value = ConvertSample<short>(src[i]);
+            minValue = std::min(minValue, src[i]);
+            maxValue = std::max(maxValue, src[i]);
+        }
+        for (int channel = 0; channel < channels; channel++)
+            *(short *)(areas[channel].ptr + areas[channel].step * i) = value;
+    }
+}
+
+void AudioOutputBenchmark()
+{
+    const int frames = 480; // 10 ms at 48 kHz
+    const int iterations = 200000;
+    const int available = frames * 3 / 4; // Last quarter underflows
+
+    std::vector<float> src(frames);
+    for (int i = 0; i < frames; i++)
+        src[i] = 0.8f * (float)sin(i * 0.05);
+    std::vector<char> buffer(frames * AUDIO_OUTPUT_MAX_CHANNELS * sizeof(float));
+
+    struct SCase
+    {
+        enum SoundIoFormat format;
+        int channels;
+        bool planar;
+    };
+    static const SCase CASES[] = {
+        {SoundIoFormatS16NE, 1, false},
+        {SoundIoFormatS16NE, 2, false},
+        {SoundIoFormatS16NE, 2, true},
+        {SoundIoFormatFloat32NE, 1, false},
+        {SoundIoFormatFloat32NE, 2, false},
+        {SoundIoFormatFloat32NE, 2, true},
+        {SoundIoFormatFloat32NE, 6, false},
+    };
+
+    std::cout << "Output callback benchmark, " << frames << " frames per callback, " << available << " available, simd: " << AUDIO_SIMD_NAME << std::endl;
+    for (auto &test : CASES)
+    {
+        int bytes = test.format == SoundIoFormatS16NE ? 2 : 4;
+        struct SoundIoChannelArea areas[AUDIO_OUTPUT_MAX_CHANNELS];
+        for (int channel = 0; channel < test.channels; channel++)
+        {
+            areas[channel].ptr = test.planar ? buffer.data() + channel * frames * bytes : buffer.data() + channel * bytes;
+            areas[channel].step = test.planar ? bytes : bytes * test.channels;
+        }
+
+        SAudioWriter writer;
+        AudioOutputGetWriter(test.format, test.channels, writer);
+
+        float lo = 0.0f, hi = 0.0f;
+        auto start = std::chrono::steady_clock::now();
+        for (int n = 0; n < iterations; n++)
+        {
+            writer.write(src.data(), available, 0, areas);
+            writer.silence(frames - available, available, areas);
+        }
+        double specialized = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+        double reference = 0.0;
+        if (test.format == SoundIoFormatS16NE)
+        {
+            start = std::chrono::steady_clock::now();
+            for (int n = 0; n < iterations; n++)
+                WriteReference(src.data(), frames, available, test.channels, areas, lo, hi);
+            reference = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+        }
+
+        printf("%-17s %-11s %8.0f ns/callback", writer.name, test.planar ? "planar" : "interleaved", specialized);
+        if (reference > 0.0)
+            printf(", per sample loop %8.0f ns (%.1fx)", reference, reference / specialized);
+        printf("\n");
+    }
+}
@@ -0,0 +1,35 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+#pragma once
+
+#include <soundio/soundio.h>
+
+#define AUDIO_OUTPUT_MAX_CHANNELS 8
+
+// Writes `frames` mono float samples to every channel of `areas`, starting at frame `offset`.
+typedef void (*AudioWriteFunc)(const float *src, int frames, int offset, const struct SoundIoChannelArea *areas);
+// Writes `frames` of silence, starting at frame `offset`.
+typedef void (*AudioSilenceFunc)(int frames, int offset, const struct SoundIoChannelArea *areas);
+
+/**
+ * Output path chosen once when the stream opens, so the real time callback
+ * never branches on the format or the channel count per sample.
+ * Specialized for S16 and F32, for mono, stereo and any other channel count,
+ * with a contiguous path for interleaved buffers and a strided one otherwise.
+ */
+struct SAudioWriter
+{
+    AudioWriteFunc write;
+    AudioSilenceFunc silence;
+    const char *name;
+};
+
+// Preferred output format of the device, F32 when it is supported, S16 otherwise.
+enum SoundIoFormat AudioOutputSelectFormat(struct SoundIoDevice *device);
+
+// Returns false for formats without a write path.
+bool AudioOutputGetWriter(enum SoundIoFormat format, int channels, SAudioWriter &writer);
+
+// Prints the nanoseconds per callback of every write path against the per sample loop it replaced.
+void AudioOutputBenchmark();
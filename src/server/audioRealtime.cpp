@@ -0,0 +1,330 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+
+#include "audioRealtime.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <sched.h>
+#include <sys/mman.h>
+
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <mach/thread_policy.h>
+#endif
+
+#if defined(AUDIO_RT_GUARD) && defined(__GLIBC__)
+#include <dlfcn.h>
+#include <unistd.h>
+#endif
+
+static inline int64_t NowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#if defined(AUDIO_RT_GUARD)
+
+// Initial exec, a dynamic TLS lookup could allocate from inside malloc
+#if defined(__GNUC__)
+#define AUDIO_RT_TLS __attribute__((tls_model("initial-exec")))
+#else
+#define AUDIO_RT_TLS
+#endif
+
+static thread_local int t_realtime AUDIO_RT_TLS = 0;
+static thread_local int t_allowed AUDIO_RT_TLS = 0;
+static std::atomic<int> s_violations[AUDIO_RT_VIOLATION_COUNT];
+
+static inline void AudioRtCheck(EAudioRtViolation kind)
+{
+    if (t_realtime && !t_allowed)
+        s_violations[kind].fetch_add(1, std::memory_order_relaxed);
+}
+
+CAudioRtScope::CAudioRtScope() { t_realtime++; }
+CAudioRtScope::~CAudioRtScope() { t_realtime--; }
+CAudioRtAllow::CAudioRtAllow() { t_allowed++; }
+CAudioRtAllow::~CAudioRtAllow() { t_allowed--; }
+
+int AudioRtViolations(EAudioRtViolation kind)
+{
+    return s_violations[kind].load(std::memory_order_relaxed);
+}
+
+#if defined(__GLIBC__)
+
+// Everything allocating, locking or writing ends up here, operator new included
+extern "C"
+{
+void *__libc_malloc(size_t size);
+void __libc_free(void *ptr);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+ssize_t __read(int fd, void *buf, size_t count);
+ssize_t __write(int fd, const void *buf, size_t count);
+size_t _IO_fwrite(const void *ptr, size_t size, size_t count, FILE *stream);
+
+void *malloc(size_t size)
+{
+    AudioRtCheck(AUDIO_RT_ALLOC);
+    return __libc_malloc(size);
+}
+
+void free(void *ptr)
+{
+    if (ptr)
+        AudioRtCheck(AUDIO_RT_ALLOC);
+    __libc_free(ptr);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    AudioRtCheck(AUDIO_RT_ALLOC);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    AudioRtCheck(AUDIO_RT_ALLOC);
+    return __libc_realloc(ptr, size);
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+    // Not versioned for linking, taken from libc at the first lock
+    static std::atomic<int (*)(pthread_mutex_t *)> s_lock(nullptr);
+    int (*lock)(pthread_mutex_t *) = s_lock.load(std::memory_order_relaxed);
+    if (!lock)
+    {
+        lock = (int (*)(pthread_mutex_t *))dlsym(RTLD_NEXT, "pthread_mutex_lock");
+        s_lock.store(lock, std::memory_order_relaxed);
+    }
+    AudioRtCheck(AUDIO_RT_LOCK);
+    return lock(mutex);
+}
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+    AudioRtCheck(AUDIO_RT_IO);
+    return __read(fd, buf, count);
+}
+
+ssize_t write(int fd, const void *buf, size_t count)
+{
+    AudioRtCheck(AUDIO_RT_IO);
+    return __write(fd, buf, count);
+}
+
+size_t fwrite(const void *ptr, size_t size, size_t count, FILE *stream)
+{
+    AudioRtCheck(AUDIO_RT_IO);
+    return _IO_fwrite(ptr, size, count, stream);
+}
+}
+
+#else
+
+// Elsewhere only C++ allocations are seen
+void *operator new(size_t size)
+{
+    AudioRtCheck(AUDIO_RT_ALLOC);
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    if (ptr)
+        AudioRtCheck(AUDIO_RT_ALLOC);
+    free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    operator delete(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+#endif
+
+#else
+
+CAudioRtScope::CAudioRtScope() {}
+CAudioRtScope::~CAudioRtScope() {}
+CAudioRtAllow::CAudioRtAllow() {}
+CAudioRtAllow::~CAudioRtAllow() {}
+
+int AudioRtViolations(EAudioRtViolation kind)
+{
+    return 0;
+}
+
+#endif
+
+bool AudioRtPromote(pthread_t thread, double periodSeconds)
+{
+#if defined(__APPLE__)
+    thread_port_t port = pthread_mach_thread_np(thread);
+    thread_time_constraint_policy_data_t policy;
+    mach_msg_type_number_t count = THREAD_TIME_CONSTRAINT_POLICY_COUNT;
+    boolean_t getDefault = false;
+    if (thread_policy_get(port, THREAD_TIME_CONSTRAINT_POLICY, (thread_policy_t)&policy, &count, &getDefault) == KERN_SUCCESS && !getDefault)
+    {
+        std::cout << "Audio: callback thread already real time" << std::endl;
+        return true;
+    }
+
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+    uint32_t period = (uint32_t)(periodSeconds * 1e9 * timebase.denom / timebase.numer);
+    policy.period = period;
+    policy.computation = (uint32_t)(period * AUDIO_RT_COMPUTATION);
+    policy.constraint = period;
+    policy.preemptible = 1;
+    kern_return_t err = thread_policy_set(port, THREAD_TIME_CONSTRAINT_POLICY, (thread_policy_t)&policy, THREAD_TIME_CONSTRAINT_POLICY_COUNT);
+    if (err != KERN_SUCCESS)
+    {
+        std::cout << "Audio: unable to set the time constraint policy: " << mach_error_string(err) << std::endl;
+        return false;
+    }
+    std::cout << "Audio: callback thread real time, period " << periodSeconds * 1000.0 << " ms" << std::endl;
+    return true;
+#else
+    int policy;
+    struct sched_param param;
+    if (pthread_getschedparam(thread, &policy, &param) == 0 && (policy == SCHED_FIFO || policy == SCHED_RR))
+    {
+        std::cout << "Audio: callback thread already real time, priority " << param.sched_priority << std::endl;
+        return true;
+    }
+
+    param.sched_priority = std::min(AUDIO_RT_PRIORITY, sched_get_priority_max(SCHED_FIFO));
+    int err = pthread_setschedparam(thread, SCHED_FIFO, &param);
+    if (err)
+    {
+        // Needs CAP_SYS_NICE or an rtprio limit, e.g. "@audio - rtprio 95" in /etc/security/limits.conf
+        std::cout << "Audio: real time priority not permitted: " << strerror(err) << std::endl;
+        return false;
+    }
+    std::cout << "Audio: callback thread SCHED_FIFO, priority " << param.sched_priority << std::endl;
+    return true;
+#endif
+}
+
+void AudioRtLockMemory(const void *data, size_t bytes)
+{
+    static std::atomic<bool> s_warned(false);
+    if (!data || !bytes)
+        return;
+    if (mlock(data, bytes) && !s_warned.exchange(true))
+        std::cout << "Audio: unable to lock " << bytes / 1024 << " KB of audio buffers: " << strerror(errno) << std::endl;
+}
+
+CAudioCallbackTimer::CAudioCallbackTimer()
+{
+    Reset();
+}
+
+void CAudioCallbackTimer::Reset()
+{
+    m_beginNs = 0;
+    m_lastBeginNs = 0;
+    m_windowStartNs = 0;
+    m_windows = 0;
+    m_callbacks = 0;
+    m_busy = m_audio = 0.0;
+    m_maxNs = 0;
+    m_minIntervalNs = INT64_MAX;
+    m_maxIntervalNs = 0;
+
+    m_statCallbacks.store(0, std::memory_order_relaxed);
+    m_statMeanUs.store(0.0, std::memory_order_relaxed);
+    m_statMaxUs.store(0.0, std::memory_order_relaxed);
+    m_statJitterMs.store(0.0, std::memory_order_relaxed);
+    m_statLoad.store(0.0, std::memory_order_relaxed);
+    m_statWorstUs.store(0.0, std::memory_order_relaxed);
+    m_statWorstJitterMs.store(0.0, std::memory_order_relaxed);
+}
+
+void CAudioCallbackTimer::Begin()
+{
+    m_beginNs = NowNs();
+    if (m_lastBeginNs)
+    {
+        int64_t interval = m_beginNs - m_lastBeginNs;
+        m_minIntervalNs = std::min(m_minIntervalNs, interval);
+        m_maxIntervalNs = std::max(m_maxIntervalNs, interval);
+    }
+    else
+        m_windowStartNs = m_beginNs;
+    m_lastBeginNs = m_beginNs;
+}
+
+void CAudioCallbackTimer::End(int frames, int sampleRate)
+{
+    int64_t endNs = NowNs();
+    int64_t duration = endNs - m_beginNs;
+    m_maxNs = std::max(m_maxNs, duration);
+    m_busy += duration / 1e9;
+    m_audio += (double)frames / sampleRate;
+    m_callbacks++;
+
+    if (endNs - m_windowStartNs < (int64_t)AUDIO_RT_STATS_MS * 1000000)
+        return;
+
+    double maxUs = m_maxNs / 1e3;
+    double jitterMs = m_maxIntervalNs >= m_minIntervalNs ? (m_maxIntervalNs - m_minIntervalNs) / 1e6 : 0.0;
+    m_statCallbacks.store(m_callbacks, std::memory_order_relaxed);
+    m_statMeanUs.store(m_busy * 1e6 / m_callbacks, std::memory_order_relaxed);
+    m_statMaxUs.store(maxUs, std::memory_order_relaxed);
+    m_statJitterMs.store(jitterMs, std::memory_order_relaxed);
+    m_statLoad.store(m_audio > 0.0 ? m_busy / m_audio : 0.0, std::memory_order_relaxed);
+    // Only the callback writes them, the first window holds the stream starting up
+    if (m_windows++ && maxUs > m_statWorstUs.load(std::memory_order_relaxed))
+        m_statWorstUs.store(maxUs, std::memory_order_relaxed);
+    if (m_windows > 1 && jitterMs > m_statWorstJitterMs.load(std::memory_order_relaxed))
+        m_statWorstJitterMs.store(jitterMs, std::memory_order_relaxed);
+
+    m_windowStartNs = endNs;
+    m_callbacks = 0;
+    m_busy = m_audio = 0.0;
+    m_maxNs = 0;
+    m_minIntervalNs = INT64_MAX;
+    m_maxIntervalNs = 0;
+}
+
+void CAudioCallbackTimer::GetStats(SAudioCallbackStats &stats) const
+{
+    stats.callbacks = m_statCallbacks.load(std::memory_order_relaxed);
+    stats.meanUs = m_statMeanUs.load(std::memory_order_relaxed);
+    stats.maxUs = m_statMaxUs.load(std::memory_order_relaxed);
+    stats.jitterMs = m_statJitterMs.load(std::memory_order_relaxed);
+    stats.load = m_statLoad.load(std::memory_order_relaxed);
+    stats.worstUs = m_statWorstUs.load(std::memory_order_relaxed);
+    stats.worstJitterMs = m_statWorstJitterMs.load(std::memory_order_relaxed);
+}
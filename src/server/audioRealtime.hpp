@@ -0,0 +1,112 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <pthread.h>
+
+#define AUDIO_RT_PRIORITY 70        // SCHED_FIFO priority on Linux, below the JACK server's threads
+#define AUDIO_RT_COMPUTATION 0.5    // Share of the period granted by the macOS time constraint policy
+#define AUDIO_RT_STATS_MS 1000      // Window of the callback timing statistics
+#define AUDIO_RT_PROMOTE_WAIT_MS 500 // For the first callback of a new stream
+
+enum EAudioRtViolation
+{
+    AUDIO_RT_ALLOC, // operator new / delete, malloc family
+    AUDIO_RT_LOCK,  // pthread_mutex_lock, std::mutex
+    AUDIO_RT_IO,    // read, write, fwrite, std::cout
+    AUDIO_RT_VIOLATION_COUNT,
+};
+
+/**
+ * The calling thread is a real time audio thread while one of these lives.
+ * With AUDIO_RT_GUARD (the CMake option of that name, off by default),
+ * allocation, mutex locks and I/O on such a thread are counted: operator new
+ * and delete on every platform, and on glibc malloc, free,
+ * pthread_mutex_lock, read, write and fwrite interposed process wide as well.
+ * The counts are read from another thread, nothing is printed on the audio
+ * thread. Without AUDIO_RT_GUARD these are empty.
+ */
+class CAudioRtScope
+{
+public:
+    CAudioRtScope();
+    ~CAudioRtScope();
+};
+
+// A rare path of an audio thread allowed to block, e.g. reporting a stream error
+class CAudioRtAllow
+{
+public:
+    CAudioRtAllow();
+    ~CAudioRtAllow();
+};
+
+// Any thread. Counted since start, always 0 without AUDIO_RT_GUARD.
+int AudioRtViolations(EAudioRtViolation kind);
+
+// Any thread. Real time scheduling for `thread`, called back `periodSeconds` apart:
+// SCHED_FIFO on Linux, the time constraint policy on macOS. A thread already
+// real time, like CoreAudio's or JACK's, is left alone. Prints the outcome.
+bool AudioRtPromote(pthread_t thread, double periodSeconds);
+
+// Keeps a buffer the audio thread touches out of swap, best effort, prints the first failure.
+void AudioRtLockMemory(const void *data, size_t bytes);
+
+struct SAudioCallbackStats
+{
+    int callbacks;        // In the last window
+    double meanUs;        // Callback duration
+    double maxUs;
+    double jitterMs;      // Longest minus shortest interval between callbacks
+    double load;          // Callback time per audio time
+    double worstUs;       // Since Reset()
+    double worstJitterMs;
+};
+
+/**
+ * Duration and jitter of an audio callback, measured by the callback.
+ * Kept in plain members by the callback and published through atomics
+ * every AUDIO_RT_STATS_MS, the worst cases until Reset(). Jitter is the
+ * spread of the intervals between callbacks, a backend handing over
+ * uneven periods shows up here before it underflows.
+ */
+class CAudioCallbackTimer
+{
+public:
+    CAudioCallbackTimer();
+
+    // Not thread safe, while no callback runs
+    void Reset();
+
+    // Callback, around everything it does
+    void Begin();
+    void End(int frames, int sampleRate);
+
+    // Any thread
+    void GetStats(SAudioCallbackStats &stats) const;
+
+private:
+    // Callback only
+    int64_t m_beginNs;
+    int64_t m_lastBeginNs;
+    int64_t m_windowStartNs;
+    int m_windows;
+    int m_callbacks;
+    double m_busy;  // Seconds
+    double m_audio; // Seconds
+    int64_t m_maxNs;
+    int64_t m_minIntervalNs;
+    int64_t m_maxIntervalNs;
+
+    std::atomic<int> m_statCallbacks;
+    std::atomic<double> m_statMeanUs;
+    std::atomic<double> m_statMaxUs;
+    std::atomic<double> m_statJitterMs;
+    std::atomic<double> m_statLoad;
+    std::atomic<double> m_statWorstUs;
+    std::atomic<double> m_statWorstJitterMs;
+};
@@ -0,0 +1,133 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+
+#include "audioRecorder.hpp"
+#include "audioWav.hpp"
+
+#include <ctime>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+
+CAudioRecorder::CAudioRecorder()
+    : m_thread(nullptr), m_quit(false), m_sequence(0)
+{
+}
+
+CAudioRecorder::~CAudioRecorder()
+{
+    Stop();
+}
+
+void CAudioRecorder::Submit(SRecordedTurn &&turn, const std::string &directory, int keepTurns)
+{
+    // Named now, so the files sort in turn order whenever they are written
+    char stamp[32];
+    time_t now = time(nullptr);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&now));
+    char sequence[16];
+    snprintf(sequence, sizeof(sequence), "_%04d", m_sequence++ % 10000);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_jobs.push_back({std::move(turn), directory + "/" + RECORDER_PREFIX + stamp + sequence, directory, keepTurns});
+    if (!m_thread)
+    {
+        m_quit = false;
+        m_thread = new std::thread(&CAudioRecorder::IOThread, this);
+    }
+    m_cond.notify_one();
+}
+
+void CAudioRecorder::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_thread)
+            return;
+        m_quit = true;
+    }
+    m_cond.notify_one();
+    m_thread->join();
+    delete m_thread;
+    m_thread = nullptr;
+}
+
+void CAudioRecorder::IOThread()
+{
+    for (;;)
+    {
+        SJob job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this]() { return m_quit || !m_jobs.empty(); });
+            if (m_jobs.empty())
+                return; // Quit once drained
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+
+        std::error_code error;
+        std::filesystem::create_directories(job.directory, error);
+        if (error)
+        {
+            std::cout << "Recorder: unable to create " << job.directory << ": " << error.message() << std::endl;
+            continue;
+        }
+
+        if (!job.turn.stream.empty())
+        {
+            std::ofstream out(job.stem + "_stream." + job.turn.streamFormat, std::ios::binary);
+            out.write(job.turn.stream.data(), job.turn.stream.size());
+        }
+        if (!job.turn.pcm.empty())
+            WriteWav(job.stem + "_pcm.wav", job.turn.pcm, job.turn.sampleRate);
+        std::cout << "Recorder: saved " << job.stem << std::endl;
+
+        Prune(job.directory, job.keepTurns);
+    }
+}
+
+void CAudioRecorder::WriteWav(const std::string &path, const std::vector<short> &pcm, int sampleRate)
+{
+    // A turn is minutes at most, far below what a header can describe
+    uint32_t fsize = (uint32_t)std::min<uint64_t>(pcm.size() * sizeof(short), WAV_MAX_DATA_BYTES);
+    wav_hdr wav = WavHeader(sampleRate, fsize);
+
+    std::ofstream out(path, std::ios::binary);
+    out.write(reinterpret_cast<const char *>(&wav), sizeof(wav));
+    out.write(reinterpret_cast<const char *>(pcm.data()), fsize);
+}
+
+void CAudioRecorder::Prune(const std::string &directory, int keepTurns)
+{
+    if (keepTurns <= 0)
+        return;
+
+    // Files of a turn share the stem before the last '_', stems sort by time
+    std::vector<std::pair<std::string, std::filesystem::path>> files;
+    std::error_code error;
+    for (auto &entry : std::filesystem::directory_iterator(directory, error))
+    {
+        std::string name = entry.path().filename().string();
+        if (name.compare(0, sizeof(RECORDER_PREFIX) - 1, RECORDER_PREFIX) == 0)
+            files.push_back({name.substr(0, name.rfind('_')), entry.path()});
+    }
+
+    std::vector<std::string> stems;
+    for (auto &file : files)
+        stems.push_back(file.first);
+    std::sort(stems.begin(), stems.end());
+    stems.erase(std::unique(stems.begin(), stems.end()), stems.end());
+    if ((int)stems.size() <= keepTurns)
+        return;
+
+    stems.resize(stems.size() - keepTurns);
+    for (auto &file : files)
+    {
+        if (std::binary_search(stems.begin(), stems.end(), file.first))
+            std::filesystem::remove(file.second, error);
+    }
+}
@@ -0,0 +1,59 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#define RECORDER_PREFIX "turn_"
+
+// Everything recorded of one turn, moved into the recorder without a copy
+struct SRecordedTurn
+{
+    std::vector<char> stream;  // Synthesis stream as received
+    std::string streamFormat;  // File extension for `stream`
+    std::vector<short> pcm;    // Mono, as sent to playback
+    int sampleRate;
+};
+
+/**
+ * Writes recorded turns on its own thread, so the chat thread never waits
+ * on the disk. Every turn gets its own timestamped files in `directory`,
+ * turns beyond the retention limit are deleted oldest first.
+ */
+class CAudioRecorder
+{
+public:
+    CAudioRecorder();
+    ~CAudioRecorder();
+
+    // Starts the I/O thread on first use
+    void Submit(SRecordedTurn &&turn, const std::string &directory, int keepTurns);
+    // Writes what is queued, then joins the I/O thread
+    void Stop();
+
+private:
+    struct SJob
+    {
+        SRecordedTurn turn;
+        std::string stem; // Path without the suffix
+        std::string directory;
+        int keepTurns;
+    };
+
+    void IOThread();
+    static void WriteWav(const std::string &path, const std::vector<short> &pcm, int sampleRate);
+    static void Prune(const std::string &directory, int keepTurns);
+
+    std::thread *m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::deque<SJob> m_jobs;
+    bool m_quit;
+    int m_sequence;
+};
@@ -0,0 +1,256 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+
+#include "audioResampler.hpp"
+#include "audioSimd.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <numeric>
+#include <iostream>
+
+#define RESAMPLER_ALIGN 32
+
+struct SResamplePreset
+{
+    int taps;     // Per phase
+    float cutoff; // Of the lower Nyquist
+    double beta;  // Kaiser window
+};
+
+static const SResamplePreset RESAMPLE_PRESETS[RESAMPLE_QUALITY_COUNT] = {
+    {8, 0.80f, 5.0},   // ~45 dB stopband, cheapest
+    {24, 0.90f, 7.0},  // ~70 dB
+    {64, 0.95f, 10.0}, // ~100 dB, transparent
+};
+
+// Zeroth order modified Bessel function of the first kind, for the Kaiser window
+static double BesselI0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 32; k++)
+    {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+CAudioResampler::CAudioResampler()
+    : m_inRate(0), m_outRate(0), m_quality(-1), m_scalar(false),
+      m_up(1), m_down(1), m_taps(0), m_bank(nullptr), m_bankMemory(nullptr),
+      m_index(0), m_phase(0)
+{
+}
+
+CAudioResampler::~CAudioResampler()
+{
+    delete[] m_bankMemory;
+}
+
+void CAudioResampler::Configure(int inRate, int outRate, int quality)
+{
+    quality = std::min(std::max(quality, 0), RESAMPLE_QUALITY_COUNT - 1);
+    if (inRate == m_inRate && outRate == m_outRate && quality == m_quality)
+    {
+        Reset();
+        return;
+    }
+
+    m_inRate = inRate;
+    m_outRate = outRate;
+    m_quality = quality;
+
+    int divisor = std::gcd(inRate, outRate);
+    m_up = outRate / divisor;
+    m_down = inRate / divisor;
+    if (m_up > RESAMPLER_MAX_PHASES)
+    {
+        // Odd rate pairs, keeps the table small at a pitch error below 0.1%
+        m_down = std::max(1, (int)std::lround((double)m_down * RESAMPLER_MAX_PHASES / m_up));
+        m_up = RESAMPLER_MAX_PHASES;
+    }
+
+    const SResamplePreset &preset = RESAMPLE_PRESETS[quality];
+    m_taps = preset.taps;
+
+    // Prototype runs at L * inRate, cutoff relative to that rate
+    int length = m_taps * m_up;
+    double cutoff = preset.cutoff * 0.5 * std::min(1.0, (double)m_up / m_down) / m_up;
+    double center = (length - 1) * 0.5;
+    double windowNorm = BesselI0(preset.beta);
+
+    delete[] m_bankMemory;
+    m_bankMemory = new float[length + RESAMPLER_ALIGN / sizeof(float)];
+    m_bank = (float *)(((uintptr_t)m_bankMemory + RESAMPLER_ALIGN - 1) & ~(uintptr_t)(RESAMPLER_ALIGN - 1));
+
+    for (int phase = 0; phase < m_up; phase++)
+    {
+        float *coefs = m_bank + phase * m_taps;
+        for (int tap = 0; tap < m_taps; tap++)
+        {
+            // Time reversed, so coefs[t] weights the t-th oldest sample of the window
+            double j = phase + (double)m_up * (m_taps - 1 - tap);
+            double x = j - center;
+            double sinc = x == 0.0 ? 2.0 * cutoff : sin(2.0 * M_PI * cutoff * x) / (M_PI * x);
+            double r = x / (center + 1.0);
+            double window = BesselI0(preset.beta * sqrt(std::max(0.0, 1.0 - r * r))) / windowNorm;
+            coefs[tap] = (float)(sinc * window * m_up);
+        }
+    }
+
+    m_buffer.assign(m_taps - 1 + RESAMPLER_BLOCK, 0.0f);
+    Reset();
+}
+
+void CAudioResampler::Reset()
+{
+    std::fill(m_buffer.begin(), m_buffer.end(), 0.0f);
+    m_index = 0;
+    m_phase = 0;
+}
+
+int CAudioResampler::GetMaxOutput(int inCount) const
+{
+    return (int)((int64_t)(inCount + 1) * m_up / m_down) + 1;
+}
+
+float CAudioResampler::Dot(const float *coefs, const float *samples) const
+{
+    int taps = m_taps;
+    if (!m_scalar)
+    {
+#if defined(AUDIO_SIMD_AVX)
+        __m256 acc = _mm256_setzero_ps();
+        for (int i = 0; i < taps; i += 8)
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_load_ps(coefs + i), _mm256_loadu_ps(samples + i)));
+        __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+        return _mm_cvtss_f32(sum);
+#elif defined(AUDIO_SIMD_SSE)
+        __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+        for (int i = 0; i < taps; i += 8)
+        {
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_load_ps(coefs + i), _mm_loadu_ps(samples + i)));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_load_ps(coefs + i + 4), _mm_loadu_ps(samples + i + 4)));
+        }
+        __m128 sum = _mm_add_ps(acc0, acc1);
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+        return _mm_cvtss_f32(sum);
+#elif defined(AUDIO_SIMD_NEON)
+        float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+        for (int i = 0; i < taps; i += 8)
+        {
+            acc0 = vmlaq_f32(acc0, vld1q_f32(coefs + i), vld1q_f32(samples + i));
+            acc1 = vmlaq_f32(acc1, vld1q_f32(coefs + i + 4), vld1q_f32(samples + i + 4));
+        }
+        float32x4_t sum = vaddq_f32(acc0, acc1);
+        float32x2_t half = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+        return vget_lane_f32(vpadd_f32(half, half), 0);
+#endif
+    }
+
+    float sum = 0.0f;
+    for (int i = 0; i < taps; i++)
+        sum += coefs[i] * samples[i];
+    return sum;
+}
+
+int CAudioResampler::ProcessBlock(int inCount, float *out)
+{
+    int produced = 0;
+    while (m_index < inCount)
+    {
+        // buffer[m_index] is the oldest of the taps samples ending at input m_index
+        out[produced++] = Dot(m_bank + m_phase * m_taps, m_buffer.data() + m_index);
+        m_phase += m_down;
+        m_index += m_phase / m_up;
+        m_phase %= m_up;
+    }
+    m_index -= inCount;
+
+    // Keep the newest taps - 1 samples as history for the next block
+    memmove(m_buffer.data(), m_buffer.data() + inCount, (m_taps - 1) * sizeof(float));
+    return produced;
+}
+
+int CAudioResampler::Process(const short *in, int inCount, float *out)
+{
+    const float scale = 1.0f / 32768.0f;
+    if (IsPassthrough())
+    {
+        for (int i = 0; i < inCount; i++)
+            out[i] = in[i] * scale;
+        return inCount;
+    }
+
+    int produced = 0;
+    while (inCount > 0)
+    {
+        int count = std::min(inCount, RESAMPLER_BLOCK);
+        float *block = m_buffer.data() + m_taps - 1;
+        for (int i = 0; i < count; i++)
+            block[i] = in[i] * scale;
+
+        produced += ProcessBlock(count, out + produced);
+        in += count;
+        inCount -= count;
+    }
+    return produced;
+}
+
+void CAudioResampler::Benchmark()
+{
+    static const int RATES[][2] = {{44100, 48000}, {24000, 48000}, {48000, 44100}, {22050, 48000}};
+    static const char *QUALITIES[RESAMPLE_QUALITY_COUNT] = {"low", "medium", "high"};
+    const int seconds = 20;
+    const int frame = 1152;
+    const double tone = 1000.0;
+
+    const char *simd = AUDIO_SIMD_NAME;
+    std::cout << "Resampler benchmark, " << seconds << " s of a " << tone << " Hz tone, simd: " << simd << std::endl;
+
+    for (auto &rate : RATES)
+    {
+        std::vector<short> input((size_t)rate[0] * seconds);
+        for (size_t i = 0; i < input.size(); i++)
+            input[i] = (short)(16384.0 * sin(2.0 * M_PI * tone * i / rate[0]));
+
+        for (int quality = 0; quality < RESAMPLE_QUALITY_COUNT; quality++)
+        {
+            for (int scalar = 1; scalar >= 0; scalar--)
+            {
+                CAudioResampler resampler;
+                resampler.m_scalar = scalar;
+                resampler.Configure(rate[0], rate[1], quality);
+                std::vector<float> output(resampler.GetMaxOutput((int)input.size()) + frame);
+
+                auto start = std::chrono::steady_clock::now();
+                int produced = 0;
+                for (size_t pos = 0; pos < input.size(); pos += frame)
+                    produced += resampler.Process(input.data() + pos, (int)std::min<size_t>(frame, input.size() - pos), output.data() + produced);
+                double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+                // Compare against the ideal tone, past the filter delay
+                double delay = (resampler.m_taps * resampler.m_up - 1) * 0.5 / resampler.m_up;
+                double signal = 0.0, noise = 0.0;
+                for (int n = resampler.m_taps * 2; n < produced; n++)
+                {
+                    double t = (double)n * resampler.m_down / resampler.m_up - delay;
+                    double ideal = 0.5 * sin(2.0 * M_PI * tone * t / rate[0]);
+                    signal += ideal * ideal;
+                    noise += (output[n] - ideal) * (output[n] - ideal);
+                }
+
+                printf("%6d -> %6d %-7s %-6s RTF %.5f (%6.0fx) SNR %5.1f dB\n", rate[0], rate[1], QUALITIES[quality],
+                       scalar ? "scalar" : simd, elapsed / seconds, seconds / elapsed, 10.0 * log10(signal / std::max(noise, 1e-20)));
+            }
+        }
+    }
+}
@@ -0,0 +1,70 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#define RESAMPLER_MAX_PHASES 512 // Larger L/M ratios are approximated
+#define RESAMPLER_BLOCK 1024     // Input samples filtered per pass
+
+enum EResampleQuality
+{
+    RESAMPLE_QUALITY_LOW = 0,
+    RESAMPLE_QUALITY_MEDIUM,
+    RESAMPLE_QUALITY_HIGH,
+    RESAMPLE_QUALITY_COUNT,
+};
+
+/**
+ * Rational polyphase resampler, mono float output.
+ * The windowed sinc prototype is split into L phases of `taps` coefficients,
+ * stored time reversed so every output sample is one contiguous dot product,
+ * vectorized with AVX, SSE or NEON when the target has them.
+ * Configure() allocates, Process() does not, so it can run on the decode thread per frame.
+ */
+class CAudioResampler
+{
+public:
+    CAudioResampler();
+    ~CAudioResampler();
+
+    CAudioResampler(const CAudioResampler &) = delete;
+    CAudioResampler &operator=(const CAudioResampler &) = delete;
+
+    // Rebuilds the filter bank when anything changed, otherwise only clears the history.
+    void Configure(int inRate, int outRate, int quality);
+    void Reset();
+
+    int GetInRate() const { return m_inRate; }
+    int GetOutRate() const { return m_outRate; }
+    bool IsPassthrough() const { return m_inRate == m_outRate; }
+
+    // Upper bound of the samples Process() produces for inCount input samples.
+    int GetMaxOutput(int inCount) const;
+
+    int Process(const short *in, int inCount, float *out);
+
+    // Prints the real time factor of every preset for the common rate pairs.
+    static void Benchmark();
+
+private:
+    int ProcessBlock(int inCount, float *out);
+    float Dot(const float *coefs, const float *samples) const;
+
+    int m_inRate;
+    int m_outRate;
+    int m_quality;
+    bool m_scalar; // Benchmark baseline
+
+    int m_up;   // L
+    int m_down; // M
+    int m_taps; // Multiple of 8
+    float *m_bank;
+    float *m_bankMemory;
+
+    std::vector<float> m_buffer; // taps - 1 history samples followed by the block
+    int m_index;                 // Input index of the next output, relative to the block
+    int m_phase;                 // 0 .. L - 1
+};
@@ -0,0 +1,162 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+
+#include "audioRing.hpp"
+
+#include <chrono>
+#include <thread>
+#include <random>
+#include <vector>
+#include <iostream>
+
+bool AudioRingBenchmark(int seconds)
+{
+    const uint64_t capacity = 1024; // Small so both sides wrap constantly
+    const uint64_t maxChunk = 700;
+
+    CAudioRing<uint64_t> ring;
+    ring.Allocate(capacity);
+
+    // A Skip after a flush must not consume what was written past it
+    {
+        std::vector<uint64_t> chunk(200);
+        for (uint64_t i = 0; i < chunk.size(); i++)
+            chunk[i] = i;
+        const uint64_t *data;
+        ring.Write(chunk.data(), 100);
+        uint64_t peeked = std::min<uint64_t>(ring.PeekContiguous(&data), 50);
+        ring.Flush();
+        ring.Write(chunk.data() + 100, 100);
+        uint64_t skipped = ring.Skip(peeked);
+        uint64_t first = 0;
+        if (skipped != 0 || ring.Read(&first, 1) != 1 || first != 100)
+        {
+            std::cout << "Ring: FAILED, Skip after a flush consumed " << skipped << " new samples" << std::endl;
+            return false;
+        }
+        ring.Allocate(capacity);
+    }
+
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> flushes(0), flushesDone(0);
+    uint64_t produced = 0;
+
+    // Every sample is its own ring position
+    std::thread producer([&]() {
+        std::mt19937 rng(1);
+        std::vector<uint64_t> chunk(maxChunk);
+        while (!stop.load(std::memory_order_relaxed))
+        {
+            uint64_t count = rng() % maxChunk + 1;
+            for (uint64_t i = 0; i < count; i++)
+                chunk[i] = produced + i;
+            uint64_t written = ring.Write(chunk.data(), count);
+            produced += written;
+            if (written < count)
+                std::this_thread::yield();
+        }
+    });
+
+    // Counted before and after the flush lands, so a gap the consumer sees can be accounted for
+    std::thread flusher([&]() {
+        std::mt19937 rng(2);
+        while (!stop.load(std::memory_order_relaxed))
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(rng() % 200));
+            flushes.fetch_add(1, std::memory_order_seq_cst);
+            ring.Flush();
+            flushesDone.fetch_add(1, std::memory_order_seq_cst);
+        }
+    });
+
+    std::mt19937 rng(3);
+    std::vector<uint64_t> buffer(maxChunk);
+    uint64_t next = 0, consumed = 0, reads = 0, peeks = 0, gaps = 0;
+    uint64_t doneBefore = 0, doneBeforeLast = 0;
+    bool failed = false;
+
+    auto check = [&](uint64_t start, const uint64_t *data, uint64_t count) {
+        if (start < next)
+        {
+            std::cout << "Ring: FAILED, read position moved back from " << next << " to " << start << std::endl;
+            return false;
+        }
+        if (start > next)
+        {
+            // Only a flush still pending when the last read began can land since
+            if (flushes.load(std::memory_order_seq_cst) == doneBeforeLast)
+            {
+                std::cout << "Ring: FAILED, samples " << next << " to " << start << " lost without a flush" << std::endl;
+                return false;
+            }
+            gaps++;
+        }
+        for (uint64_t i = 0; i < count; i++)
+        {
+            if (data[i] != start + i)
+            {
+                std::cout << "Ring: FAILED, position " << start + i << " holds sample " << data[i] << std::endl;
+                return false;
+            }
+        }
+        next = start + count;
+        consumed += count;
+        doneBeforeLast = doneBefore;
+        return true;
+    };
+
+    auto begin = std::chrono::steady_clock::now();
+    auto end = begin + std::chrono::seconds(seconds);
+    while (!failed && std::chrono::steady_clock::now() < end)
+    {
+        uint64_t count = rng() % maxChunk + 1;
+        doneBefore = flushesDone.load(std::memory_order_seq_cst);
+        if (rng() & 1)
+        {
+            uint64_t got = ring.Read(buffer.data(), count);
+            if (got == 0)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            failed = !check(ring.ReadPos() - got, buffer.data(), got);
+            reads++;
+        }
+        else
+        {
+            const uint64_t *data;
+            uint64_t got = std::min(ring.PeekContiguous(&data), count);
+            if (got == 0)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            failed = !check(ring.ReadPos(), data, got);
+            uint64_t skipped = ring.Skip(got);
+            if (!failed && skipped != got && skipped != 0)
+            {
+                std::cout << "Ring: FAILED, skipped " << skipped << " of " << got << " peeked samples" << std::endl;
+                failed = true;
+            }
+            peeks++;
+        }
+    }
+    stop.store(true);
+    producer.join();
+    flusher.join();
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    std::cout << "Ring: " << consumed << " samples checked (" << consumed / elapsed / 1e6 << " M/s), "
+              << reads << " reads, " << peeks << " peeks, " << flushes.load() << " flushes, "
+              << gaps << " flush gaps, " << produced << " written" << std::endl;
+    if (failed)
+        return false;
+    if (reads == 0 || peeks == 0 || gaps == 0)
+    {
+        std::cout << "Ring: FAILED, a path was never exercised" << std::endl;
+        return false;
+    }
+    std::cout << "Ring: OK" << std::endl;
+    return true;
+}
@@ -0,0 +1,174 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+#pragma once
+
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#define AUDIO_CACHE_LINE_SIZE 64
+
+/**
+ * Single producer / single consumer wraparound ring.
+ * Positions are monotonic 64-bit sample counters, so they double as
+ * sample timestamps. Write is producer only, Read and Skip consumer only.
+ * No allocation or locking after Allocate().
+ */
+template <typename _T>
+class CAudioRing
+{
+public:
+    CAudioRing()
+        : m_buffer(nullptr), m_capacity(0), m_mask(0)
+    {
+        m_writePos.store(0, std::memory_order_relaxed);
+        m_readPos.store(0, std::memory_order_relaxed);
+        m_flushPos.store(0, std::memory_order_relaxed);
+    }
+    ~CAudioRing() { delete[] m_buffer; }
+
+    CAudioRing(const CAudioRing &) = delete;
+    CAudioRing &operator=(const CAudioRing &) = delete;
+
+    // Not thread safe, call before the producer and consumer start.
+    void Allocate(int sampleRate, int milliseconds) { Allocate((uint64_t)sampleRate * milliseconds / 1000); }
+
+    void Allocate(uint64_t count)
+    {
+        uint64_t capacity = 1;
+        while (capacity < count)
+            capacity <<= 1;
+
+        delete[] m_buffer;
+        m_buffer = new _T[capacity];
+        memset(m_buffer, 0, capacity * sizeof(_T));
+        m_capacity = capacity;
+        m_mask = capacity - 1;
+        m_writePos.store(0, std::memory_order_relaxed);
+        m_readPos.store(0, std::memory_order_relaxed);
+        m_flushPos.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t Capacity() const { return m_capacity; }
+    const _T *Data() const { return m_buffer; } // For locking its pages
+    uint64_t WritePos() const { return m_writePos.load(std::memory_order_acquire); }
+    uint64_t ReadPos() const { return m_readPos.load(std::memory_order_acquire); }
+
+    // Producer side
+    uint64_t Free() const
+    {
+        return m_capacity - (m_writePos.load(std::memory_order_relaxed) - m_readPos.load(std::memory_order_acquire));
+    }
+
+    uint64_t Write(const _T *data, uint64_t count)
+    {
+        uint64_t writePos = m_writePos.load(std::memory_order_relaxed);
+        count = std::min(count, m_capacity - (writePos - m_readPos.load(std::memory_order_acquire)));
+        if (count == 0)
+            return 0;
+
+        uint64_t offset = writePos & m_mask;
+        uint64_t first = std::min(count, m_capacity - offset);
+        memcpy(m_buffer + offset, data, first * sizeof(_T));
+        memcpy(m_buffer, data + first, (count - first) * sizeof(_T));
+
+        m_writePos.store(writePos + count, std::memory_order_release);
+        return count;
+    }
+
+    // Drop everything written so far, applied by the consumer on its next read.
+    // Also safe from a third thread, a flush never moves back behind a later one.
+    void Flush()
+    {
+        uint64_t writePos = m_writePos.load(std::memory_order_acquire);
+        uint64_t flushPos = m_flushPos.load(std::memory_order_relaxed);
+        while (flushPos < writePos && !m_flushPos.compare_exchange_weak(flushPos, writePos, std::memory_order_release, std::memory_order_relaxed))
+            ;
+    }
+
+    // Consumer side
+    uint64_t Available()
+    {
+        ApplyFlush();
+        return m_writePos.load(std::memory_order_acquire) - m_readPos.load(std::memory_order_relaxed);
+    }
+
+    uint64_t Read(_T *data, uint64_t count)
+    {
+        ApplyFlush();
+        uint64_t readPos = m_readPos.load(std::memory_order_relaxed);
+        count = std::min(count, m_writePos.load(std::memory_order_acquire) - readPos);
+        if (count == 0)
+            return 0;
+
+        uint64_t offset = readPos & m_mask;
+        uint64_t first = std::min(count, m_capacity - offset);
+        memcpy(data, m_buffer + offset, first * sizeof(_T));
+        memcpy(data + first, m_buffer, (count - first) * sizeof(_T));
+
+        m_readPos.store(readPos + count, std::memory_order_release);
+        return count;
+    }
+
+    // Longest readable run before the wrap point, read in place then Skip().
+    uint64_t PeekContiguous(const _T **data)
+    {
+        ApplyFlush();
+        uint64_t readPos = m_readPos.load(std::memory_order_relaxed);
+        uint64_t offset = readPos & m_mask;
+        *data = m_buffer + offset;
+        return std::min(m_writePos.load(std::memory_order_acquire) - readPos, m_capacity - offset);
+    }
+
+    // Copies without consuming.
+    uint64_t Peek(_T *data, uint64_t count)
+    {
+        ApplyFlush();
+        uint64_t readPos = m_readPos.load(std::memory_order_relaxed);
+        count = std::min(count, m_writePos.load(std::memory_order_acquire) - readPos);
+
+        uint64_t offset = readPos & m_mask;
+        uint64_t first = std::min(count, m_capacity - offset);
+        memcpy(data, m_buffer + offset, first * sizeof(_T));
+        memcpy(data + first, m_buffer, (count - first) * sizeof(_T));
+        return count;
+    }
+
+    // Consumes what the last Peek or Available saw. Nothing when a flush
+    // landed since, the samples now at the read position are new.
+    uint64_t Skip(uint64_t count)
+    {
+        if (ApplyFlush())
+            return 0;
+        uint64_t readPos = m_readPos.load(std::memory_order_relaxed);
+        count = std::min(count, m_writePos.load(std::memory_order_acquire) - readPos);
+        m_readPos.store(readPos + count, std::memory_order_release);
+        return count;
+    }
+
+private:
+    bool ApplyFlush()
+    {
+        uint64_t flushPos = m_flushPos.load(std::memory_order_acquire);
+        if (flushPos <= m_readPos.load(std::memory_order_relaxed))
+            return false;
+        m_readPos.store(flushPos, std::memory_order_release);
+        return true;
+    }
+
+    _T *m_buffer;
+    uint64_t m_capacity;
+    uint64_t m_mask;
+
+    alignas(AUDIO_CACHE_LINE_SIZE) std::atomic<uint64_t> m_writePos;
+    alignas(AUDIO_CACHE_LINE_SIZE) std::atomic<uint64_t> m_readPos;
+    alignas(AUDIO_CACHE_LINE_SIZE) std::atomic<uint64_t> m_flushPos;
+};
+
+// Stresses one ring with a producer, a consumer alternating Read and
+// PeekContiguous + Skip, and a third thread flushing. Every sample carries
+// its own position, false on the first one read out of sequence or when a
+// Skip consumes samples written after a flush.
+bool AudioRingBenchmark(int seconds);
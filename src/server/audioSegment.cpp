@@ -0,0 +1,263 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+
+#include "audioSegment.hpp"
+#include "audioRealtime.hpp"
+
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+
+CSegmentQueue::CSegmentQueue()
+    : m_pending(0), m_current(0), m_closed(0), m_fading(0), m_fadePos(0), m_reachedCount(0)
+{
+    m_crossfadeMs.store(0, std::memory_order_relaxed);
+    m_nextId.store(1, std::memory_order_relaxed);
+}
+
+void CSegmentQueue::Allocate()
+{
+    m_marks.Allocate((uint64_t)SEGMENT_MARKS);
+    m_events.Allocate((uint64_t)SEGMENT_EVENTS);
+    AudioRtLockMemory(m_marks.Data(), m_marks.Capacity() * sizeof(SMark));
+    AudioRtLockMemory(m_events.Data(), m_events.Capacity() * sizeof(SRawEvent));
+}
+
+uint32_t CSegmentQueue::Begin(const SSegmentInfo &info)
+{
+    uint32_t id = m_nextId.fetch_add(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_infos[id] = info;
+    m_commands.push_back({false, id});
+    return id;
+}
+
+void CSegmentQueue::Interrupt()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_commands.push_back({true, 0});
+}
+
+void CSegmentQueue::PushMark(int type, uint32_t id, uint64_t pos)
+{
+    SMark mark = {type, id, pos};
+    if (!m_marks.Write(&mark, 1))
+        std::cout << "Playback: segment marks full, events of segment " << id << " lost" << std::endl;
+}
+
+void CSegmentQueue::ProcessCommands(uint64_t writePos)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    while (!m_commands.empty())
+    {
+        SCommand command = m_commands.front();
+        m_commands.pop_front();
+        if (command.flush)
+        {
+            // Everything open ends where the ring was flushed, the flush mark tells the callback
+            for (uint32_t id : {m_fading, m_closed, m_current, m_pending})
+            {
+                if (id)
+                    PushMark(MARK_END, id, writePos);
+            }
+            m_pending = m_current = m_closed = m_fading = 0;
+            m_tail.clear();
+            m_fade.clear();
+            PushMark(MARK_FLUSH, 0, writePos);
+        }
+        else
+        {
+            // Begun without audio, it finishes without starting
+            if (m_pending)
+                PushMark(MARK_END, m_pending, writePos + m_tail.size());
+            Close(writePos);
+            m_pending = command.id;
+        }
+    }
+}
+
+int CSegmentQueue::Feed(float *pcm, int count, int sampleRate, uint64_t writePos, const float **out)
+{
+    ProcessCommands(writePos);
+
+    if (m_pending)
+    {
+        // The held tail of the last segment fades out over the head of this one
+        Close(writePos);
+        if (m_closed)
+        {
+            m_fade.swap(m_tail);
+            m_tail.clear();
+            m_fadePos = 0;
+            m_fading = m_closed;
+            m_closed = 0;
+        }
+        PushMark(MARK_START, m_pending, writePos + m_tail.size());
+        m_current = m_pending;
+        m_pending = 0;
+    }
+
+    size_t held = m_tail.size();
+    if (m_fading)
+    {
+        // Equal power, the two voices are uncorrelated
+        int mixed = (int)std::min<size_t>(count, m_fade.size() - m_fadePos);
+        const float scale = (float)M_PI_2 / m_fade.size();
+        for (int i = 0; i < mixed; i++)
+        {
+            float t = (m_fadePos + i + 0.5f) * scale;
+            pcm[i] = pcm[i] * sinf(t) + m_fade[m_fadePos + i] * cosf(t);
+        }
+        m_fadePos += mixed;
+        if (m_fadePos == m_fade.size())
+        {
+            PushMark(MARK_END, m_fading, writePos + held + mixed);
+            m_fading = 0;
+        }
+    }
+
+    // Always hold the last crossfade of the segment, the end of the input is not known yet
+    int crossfadeMs = std::min(std::max(m_crossfadeMs.load(std::memory_order_relaxed), 0), SEGMENT_CROSSFADE_MAX_MS);
+    size_t keep = (size_t)sampleRate * crossfadeMs / 1000;
+    m_out.assign(m_tail.begin(), m_tail.end());
+    m_out.insert(m_out.end(), pcm, pcm + count);
+    keep = std::min(keep, m_out.size());
+    m_tail.assign(m_out.end() - keep, m_out.end());
+
+    *out = m_out.data();
+    return (int)(m_out.size() - keep);
+}
+
+void CSegmentQueue::End(uint64_t writePos)
+{
+    ProcessCommands(writePos);
+    if (m_pending)
+    {
+        PushMark(MARK_END, m_pending, writePos + m_tail.size());
+        m_pending = 0;
+    }
+    Close(writePos);
+}
+
+void CSegmentQueue::Close(uint64_t writePos)
+{
+    if (!m_current)
+        return;
+
+    if (m_fading)
+    {
+        // Shorter than the crossfade, the rest of the last tail fades out alone
+        const float scale = (float)M_PI_2 / m_fade.size();
+        for (size_t i = m_fadePos; i < m_fade.size(); i++)
+            m_tail.push_back(m_fade[i] * cosf((i + 0.5f) * scale));
+        PushMark(MARK_END, m_fading, writePos + m_tail.size());
+        m_fading = 0;
+    }
+
+    if (m_tail.empty())
+        PushMark(MARK_END, m_current, writePos);
+    else
+        m_closed = m_current;
+    m_current = 0;
+}
+
+int CSegmentQueue::Release(int sampleRate, uint64_t writePos, uint64_t buffered, const float **out)
+{
+    ProcessCommands(writePos);
+    if (!m_closed || buffered > (uint64_t)sampleRate * SEGMENT_TAIL_MARGIN_MS / 1000)
+        return 0;
+
+    // The next segment did not come in time, play the tail as it is
+    m_out.swap(m_tail);
+    m_tail.clear();
+    PushMark(MARK_END, m_closed, writePos + m_out.size());
+    m_closed = 0;
+
+    *out = m_out.data();
+    return (int)m_out.size();
+}
+
+void CSegmentQueue::Reach(const SMark &mark, int frame, bool interrupted)
+{
+    m_reached[m_reachedCount++] = {mark, frame, interrupted};
+}
+
+void CSegmentQueue::OnRun(uint64_t emitEnd, int count, uint64_t readPos, int frame)
+{
+    SMark marks[SEGMENT_CALLBACK_MARKS];
+    int marked = (int)m_marks.Peek(marks, SEGMENT_CALLBACK_MARKS - m_reachedCount);
+
+    // A flush the ring applied finishes everything queued before it
+    int flushed = -1;
+    for (int i = 0; i < marked; i++)
+    {
+        if (marks[i].type == MARK_FLUSH && marks[i].pos <= readPos)
+            flushed = i;
+    }
+
+    int used = 0;
+    for (; used < marked; used++)
+    {
+        const SMark &mark = marks[used];
+        if (used <= flushed)
+        {
+            if (mark.type == MARK_END)
+                Reach(mark, frame, true);
+            continue;
+        }
+        if (mark.type == MARK_FLUSH)
+            break;
+
+        // A start is heard with the frame at its position, an end right after the frame before it.
+        // Positions repeat through a gap, so either waits for the ring to be read past it.
+        // Signed, the DSP's positions start below 0 by its look-ahead.
+        int64_t ahead = (int64_t)(emitEnd - mark.pos);
+        bool reached = mark.type == MARK_START ? mark.pos < readPos && ahead > 0 : mark.pos <= readPos && ahead >= 0;
+        if (!reached)
+            break;
+        Reach(mark, frame + (int)std::max<int64_t>(count - ahead, 0), false);
+    }
+    m_marks.Skip(used);
+}
+
+void CSegmentQueue::Publish(int64_t firstFrameNs, int sampleRate)
+{
+    for (int i = 0; i < m_reachedCount; i++)
+    {
+        const SReached &reached = m_reached[i];
+        SRawEvent event;
+        event.type = reached.mark.type == MARK_START ? SEGMENT_STARTED : SEGMENT_FINISHED;
+        event.id = reached.mark.id;
+        event.interrupted = reached.interrupted;
+        event.pos = reached.mark.pos;
+        event.audibleNs = firstFrameNs + (int64_t)reached.frame * 1000000000 / sampleRate;
+        m_events.Write(&event, 1); // Dropped when the consumer stopped polling
+    }
+    m_reachedCount = 0;
+}
+
+bool CSegmentQueue::PollEvent(SSegmentEvent &event)
+{
+    SRawEvent raw;
+    if (!m_events.Read(&raw, 1))
+        return false;
+
+    event.type = raw.type;
+    event.id = raw.id;
+    event.interrupted = raw.interrupted;
+    event.pos = raw.pos;
+    event.audibleNs = raw.audibleNs;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_infos.find(raw.id);
+    if (it == m_infos.end())
+    {
+        event.info = SSegmentInfo{-1, -1, "", 0, 0};
+        return true;
+    }
+    event.info = it->second;
+    if (raw.type == SEGMENT_FINISHED)
+        m_infos.erase(it);
+    return true;
+}
@@ -0,0 +1,162 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "audioRing.hpp"
+
+#define SEGMENT_MARKS 256          // Boundaries between the ring writer and the audio callback
+#define SEGMENT_EVENTS 256         // Started / finished, between the audio callback and the chat thread
+#define SEGMENT_CALLBACK_MARKS 16  // Handled per callback run, the rest in the next one
+#define SEGMENT_CROSSFADE_MAX_MS 50
+#define SEGMENT_TAIL_MARGIN_MS 60  // A held tail is written alone once the ring is down to this
+
+enum ESegmentEvent
+{
+    SEGMENT_STARTED = 0,
+    SEGMENT_FINISHED,
+};
+
+// Chat side description of a segment, never seen by the audio callback
+struct SSegmentInfo
+{
+    int turn;
+    int index;            // Within the turn
+    std::string emotion;  // Cue for the model, shown once the segment is heard
+    int textBegin;        // Byte span of the spoken text in the turn's reply
+    int textEnd;
+};
+
+struct SSegmentEvent
+{
+    int type;             // ESegmentEvent
+    uint32_t id;
+    bool interrupted;     // Finished by a flush of the ring, not played out
+    uint64_t pos;         // Ring position of the boundary
+    int64_t audibleNs;    // Steady clock, when the boundary is heard
+    SSegmentInfo info;
+};
+
+/**
+ * Playback queue of PCM segments on the play ring.
+ * Segments are written back to back, so they play gaplessly; with a
+ * crossfade the last milliseconds of a segment are held back and mixed
+ * into the head of the next one, or written alone when the ring runs low
+ * before the next one arrives. The writer puts the ring position of every
+ * boundary into a lock-free queue, the audio callback matches them to the
+ * frames it renders and reports when each boundary is heard, to the sample,
+ * from the output clock. A flush of the ring finishes the segments queued
+ * before it as interrupted. Every begun segment finishes exactly once,
+ * started is reported only when it was heard.
+ */
+class CSegmentQueue
+{
+public:
+    CSegmentQueue();
+
+    // Not thread safe, before the audio callback starts
+    void Allocate();
+
+    // Any thread
+    void SetCrossfade(int ms) { m_crossfadeMs.store(ms, std::memory_order_relaxed); }
+
+    // Stream owners. The next audio written starts the segment, returns its id.
+    uint32_t Begin(const SSegmentInfo &info);
+    // Right after flushing the ring, everything queued finishes interrupted.
+    void Interrupt();
+
+    // Ring writer. Segment audio on its way to the ring at `writePos`, mixed in place with the held tail.
+    // Returns the frames to write now in `*out`, all of them, the following call continues behind them.
+    int Feed(float *pcm, int count, int sampleRate, uint64_t writePos, const float **out);
+    // The current segment is complete, its tail stays held for the next one
+    void End(uint64_t writePos);
+    // Call regularly. The held tail to write when the ring holds no more than the margin.
+    int Release(int sampleRate, uint64_t writePos, uint64_t buffered, const float **out);
+
+    // Audio callback. A run of `count` rendered frames at `frame` of the buffer,
+    // ending at ring position `emitEnd`, the ring read up to `readPos`. Once the
+    // DSP holds no more audio, a run of 0 frames at `readPos` reaches everything read.
+    void OnRun(uint64_t emitEnd, int count, uint64_t readPos, int frame);
+    bool HasReached() const { return m_reachedCount > 0; }
+    // After the buffer was handed over, frame 0 of it heard at `firstFrameNs`
+    void Publish(int64_t firstFrameNs, int sampleRate);
+
+    // Consumer thread
+    bool PollEvent(SSegmentEvent &event);
+
+private:
+    enum EMark
+    {
+        MARK_START = 0,
+        MARK_END,
+        MARK_FLUSH,
+    };
+
+    struct SMark
+    {
+        int type; // EMark
+        uint32_t id;
+        uint64_t pos;
+    };
+
+    struct SReached
+    {
+        SMark mark;
+        int frame;
+        bool interrupted;
+    };
+
+    struct SRawEvent
+    {
+        int type;
+        uint32_t id;
+        bool interrupted;
+        uint64_t pos;
+        int64_t audibleNs;
+    };
+
+    struct SCommand
+    {
+        bool flush;
+        uint32_t id; // Begin
+    };
+
+    void ProcessCommands(uint64_t writePos);
+    void Close(uint64_t writePos);
+    void PushMark(int type, uint32_t id, uint64_t pos);
+    void Reach(const SMark &mark, int frame, bool interrupted);
+
+    std::atomic<int> m_crossfadeMs;
+    std::atomic<uint32_t> m_nextId;
+
+    // Stream owners to the writer, and the infos for the consumer
+    std::mutex m_mutex;
+    std::deque<SCommand> m_commands;
+    std::map<uint32_t, SSegmentInfo> m_infos;
+
+    // Writer only
+    uint32_t m_pending;  // Starts with the next audio
+    uint32_t m_current;  // Being written
+    uint32_t m_closed;   // Complete, its tail still held
+    uint32_t m_fading;   // Tail being mixed into the current one
+    std::vector<float> m_tail;
+    std::vector<float> m_fade;
+    size_t m_fadePos;
+    std::vector<float> m_out;
+
+    CAudioRing<SMark> m_marks;
+
+    // Audio callback only
+    SReached m_reached[SEGMENT_CALLBACK_MARKS];
+    int m_reachedCount;
+
+    CAudioRing<SRawEvent> m_events;
+};
@@ -0,0 +1,29 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+#pragma once
+
+// Instruction sets the audio kernels are vectorized for, picked at compile time.
+// AUDIO_SIMD_SSE means SSE2, AVX builds define it too. Every kernel keeps a scalar fallback.
+#if defined(__AVX__)
+#include <immintrin.h>
+#define AUDIO_SIMD_AVX
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define AUDIO_SIMD_SSE
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define AUDIO_SIMD_NEON
+#endif
+
+#if defined(AUDIO_SIMD_AVX)
+#define AUDIO_SIMD_NAME "avx"
+#elif defined(AUDIO_SIMD_SSE)
+#define AUDIO_SIMD_NAME "sse"
+#elif defined(AUDIO_SIMD_NEON)
+#define AUDIO_SIMD_NAME "neon"
+#else
+#define AUDIO_SIMD_NAME "none"
+#endif
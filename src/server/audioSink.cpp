@@ -0,0 +1,164 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+
+#include "audioSink.hpp"
+#include "audioWav.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#define WAV_SINK_UPDATE_MS 1000 // The header follows the data, a killed process leaves a valid file
+
+static inline int64_t NowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+CAudioSink *CAudioSink::Create(int type, const std::string &file, bool realtime)
+{
+    if (type == AUDIO_SINK_NULL)
+        return new CNullSink(realtime);
+    if (type == AUDIO_SINK_FILE)
+        return new CWavFileSink(file, realtime);
+    return nullptr;
+}
+
+bool CAudioSink::Open(int sampleRate)
+{
+    m_sampleRate = sampleRate;
+    m_frames = 0;
+    // One period buffered, like a device at its software latency
+    m_startNs = NowNs() + (int64_t)AUDIO_SINK_PERIOD_MS * 1000000;
+    return true;
+}
+
+int64_t CAudioSink::Wait(int frames, bool &late)
+{
+    late = false;
+    int64_t firstNs = m_startNs + m_frames * 1000000000 / m_sampleRate;
+    if (!m_realtime)
+    {
+        m_frames += frames;
+        return firstNs;
+    }
+
+    int64_t nowNs = NowNs();
+    if (nowNs > firstNs)
+    {
+        // Should be playing already, the timeline restarts a period from now
+        late = true;
+        m_startNs += nowNs + (int64_t)AUDIO_SINK_PERIOD_MS * 1000000 - firstNs;
+        firstNs = nowNs + (int64_t)AUDIO_SINK_PERIOD_MS * 1000000;
+    }
+    else
+    {
+        // Due one period ahead of being heard
+        int64_t dueNs = firstNs - (int64_t)AUDIO_SINK_PERIOD_MS * 1000000;
+        if (nowNs < dueNs)
+            std::this_thread::sleep_for(std::chrono::nanoseconds(dueNs - nowNs));
+    }
+    m_frames += frames;
+    return firstNs;
+}
+
+CWavFileSink::CWavFileSink(const std::string &path, bool realtime)
+    : CAudioSink(realtime), m_path(path), m_part(0), m_file(nullptr), m_dataBytes(0), m_headerFrames(0)
+{
+}
+
+CWavFileSink::~CWavFileSink()
+{
+    Close();
+}
+
+bool CWavFileSink::Open(int sampleRate)
+{
+    Close();
+    CAudioSink::Open(sampleRate);
+    return OpenPart(0);
+}
+
+bool CWavFileSink::OpenPart(int part)
+{
+    m_partPath = m_path;
+    if (part > 0)
+    {
+        size_t dot = m_partPath.rfind('.');
+        size_t slash = m_partPath.find_last_of("/\\");
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+            dot = m_partPath.size();
+        m_partPath.insert(dot, "_" + std::to_string(part));
+    }
+
+    m_file = fopen(m_partPath.c_str(), "wb");
+    if (!m_file)
+    {
+        std::cout << "AudioSink: unable to write " << m_partPath << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    m_part = part;
+    m_dataBytes = 0;
+    m_headerFrames = 0;
+    WriteHeader();
+    std::cout << "AudioSink: writing " << m_partPath << std::endl;
+    return true;
+}
+
+void CWavFileSink::Close()
+{
+    if (!m_file)
+        return;
+    WriteHeader();
+    fclose(m_file);
+    m_file = nullptr;
+    std::cout << "AudioSink: wrote " << m_dataBytes / sizeof(short) / (double)m_sampleRate << " s to " << m_partPath << std::endl;
+}
+
+void CWavFileSink::Write(const float *pcm, int frames)
+{
+    if (!m_file)
+        return;
+
+    m_pcm.resize(frames);
+    for (int i = 0; i < frames; i++)
+        m_pcm[i] = (short)std::min(std::max(pcm[i] * 32768.0f, -32768.0f), 32767.0f);
+
+    // About 12 h of 48 kHz fill a part, a long running server goes on in the next one
+    const short *data = m_pcm.data();
+    while (frames > 0)
+    {
+        int count = (int)std::min<uint64_t>(frames, (WAV_MAX_DATA_BYTES - m_dataBytes) / sizeof(short));
+        if (count == 0)
+        {
+            int part = m_part + 1;
+            Close();
+            if (!OpenPart(part))
+                return;
+            continue;
+        }
+        m_dataBytes += (uint32_t)fwrite(data, sizeof(short), count, m_file) * sizeof(short);
+        data += count;
+        frames -= count;
+    }
+
+    int64_t written = m_dataBytes / sizeof(short);
+    if (written - m_headerFrames >= (int64_t)m_sampleRate * WAV_SINK_UPDATE_MS / 1000)
+        WriteHeader();
+}
+
+void CWavFileSink::WriteHeader()
+{
+    wav_hdr header = WavHeader(m_sampleRate, m_dataBytes);
+
+    // Back to the end rather than to a saved ftell(), whose long is 32 bit on some platforms
+    fseek(m_file, 0, SEEK_SET);
+    fwrite(&header, 1, sizeof(header), m_file);
+    fseek(m_file, 0, SEEK_END);
+    fflush(m_file);
+    m_headerFrames = m_dataBytes / sizeof(short);
+}
@@ -0,0 +1,96 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#define AUDIO_SINK_SAMPLE_RATE 48000 // Output rate without a device to follow
+#define AUDIO_SINK_PERIOD_MS 10      // Rendered per wakeup, also the reported latency
+
+enum EAudioSink
+{
+    AUDIO_SINK_DEVICE = 0, // Default output device through libsoundio
+    AUDIO_SINK_NULL,       // Discards the audio
+    AUDIO_SINK_FILE,       // Mono 16 bit WAV, continued in numbered files past the 4 GiB a header can describe
+    AUDIO_SINK_COUNT,
+};
+
+/**
+ * Output without sound hardware, for headless servers, CI and benchmarks.
+ * The sound thread drives a sink like a device: Wait() until the next
+ * period is due, render it through the same path as the device callback,
+ * Write() it. In real time a period is due one period before it would be
+ * heard and a late one counts as an underflow. Unthrottled, the audio is
+ * consumed as soon as it is buffered, without the silence in between, and
+ * time is counted in frames from Open(): the playback clock and the
+ * segment events follow the audio written, not the wall clock.
+ * The device stays with libsoundio, which calls the render path itself.
+ */
+class CAudioSink
+{
+public:
+    CAudioSink(bool realtime) : m_realtime(realtime), m_sampleRate(0), m_startNs(0), m_frames(0) {}
+    virtual ~CAudioSink() {}
+
+    // nullptr for AUDIO_SINK_DEVICE. `file` is written by AUDIO_SINK_FILE.
+    static CAudioSink *Create(int type, const std::string &file, bool realtime);
+
+    virtual const char *GetName() const = 0;
+
+    // Sound thread
+    virtual bool Open(int sampleRate);
+    virtual void Close() {}
+    // Blocks until `frames` more are due. Returns the steady clock time the first of them is heard,
+    // `late` when the previous ones were not rendered in time.
+    int64_t Wait(int frames, bool &late);
+    virtual void Write(const float *pcm, int frames) = 0;
+
+    bool IsRealtime() const { return m_realtime; }
+    double GetLatency() const { return AUDIO_SINK_PERIOD_MS / 1000.0; }
+
+protected:
+    bool m_realtime;
+    int m_sampleRate;
+
+private:
+    int64_t m_startNs; // Heard time of frame 0
+    int64_t m_frames;  // Due since Open()
+};
+
+class CNullSink : public CAudioSink
+{
+public:
+    CNullSink(bool realtime) : CAudioSink(realtime) {}
+
+    const char *GetName() const override { return m_realtime ? "null" : "null, unthrottled"; }
+    void Write(const float *pcm, int frames) override {}
+};
+
+class CWavFileSink : public CAudioSink
+{
+public:
+    CWavFileSink(const std::string &path, bool realtime);
+    ~CWavFileSink();
+
+    const char *GetName() const override { return m_realtime ? "wav file" : "wav file, unthrottled"; }
+    bool Open(int sampleRate) override;
+    void Close() override;
+    void Write(const float *pcm, int frames) override;
+
+private:
+    // `part` 0 is the configured path, later ones are numbered before the extension
+    bool OpenPart(int part);
+    void WriteHeader();
+
+    std::string m_path;
+    std::string m_partPath;
+    int m_part;
+    FILE *m_file;
+    uint32_t m_dataBytes;   // Of the current part, at most WAV_MAX_DATA_BYTES
+    int64_t m_headerFrames; // Written when the header was last updated
+    std::vector<short> m_pcm;
+};
@@ -0,0 +1,101 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+
+#include "audioVad.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+CVoiceActivityDetector::CVoiceActivityDetector()
+{
+    Configure({12.0f, 400, 150, VAD_MAX_SPEECH_MS, VAD_PRE_ROLL_MS});
+    Reset();
+}
+
+void CVoiceActivityDetector::Configure(const SVadParams &params)
+{
+    m_params = params;
+    // One pole weights per frame
+    m_riseWeight = 1.0f - expf(-(float)VAD_FRAME_MS / VAD_FLOOR_RISE_MS);
+    m_creepWeight = 1.0f - expf(-(float)VAD_FRAME_MS / VAD_FLOOR_CREEP_MS);
+    m_fallWeight = 1.0f - expf(-(float)VAD_FRAME_MS / VAD_FLOOR_FALL_MS);
+}
+
+void CVoiceActivityDetector::Reset()
+{
+    m_frame = 0;
+    m_levelDb = VAD_MIN_FLOOR_DB;
+    m_floorDb = VAD_MIN_FLOOR_DB;
+    m_voiced = false;
+    m_inSpeech = false;
+    m_onset = 0;
+    m_startFrame = 0;
+    m_lastVoiced = -1;
+    m_voicedFrames = 0;
+}
+
+EVadEvent CVoiceActivityDetector::Process(const float *frame)
+{
+    float energy = 0.0f;
+    int crossings = 0;
+    for (int i = 0; i < VAD_FRAME; i++)
+    {
+        energy += frame[i] * frame[i];
+        if (i && (frame[i] >= 0.0f) != (frame[i - 1] >= 0.0f))
+            crossings++;
+    }
+    m_levelDb = 10.0f * log10f(energy / VAD_FRAME + 1e-10f);
+    float zcr = (float)crossings / (VAD_FRAME - 1);
+
+    long long frameIndex = m_frame++;
+    if (frameIndex == 0)
+        m_floorDb = std::max(m_levelDb, VAD_MIN_FLOOR_DB);
+
+    float above = m_levelDb - m_floorDb;
+    float threshold = m_params.thresholdDb;
+    if (m_inSpeech)
+        m_voiced = above > threshold * 0.5f;
+    else
+        m_voiced = above > threshold || (above > threshold * 0.5f && zcr > VAD_FRICATIVE_ZCR);
+
+    // Learn fast at first, afterwards only a step in the noise moves the floor while speaking
+    float weight;
+    if (frameIndex < VAD_LEARN_MS / VAD_FRAME_MS)
+        weight = m_fallWeight;
+    else if (m_levelDb < m_floorDb)
+        weight = m_fallWeight;
+    else
+        weight = m_inSpeech || m_voiced ? m_creepWeight : m_riseWeight;
+    m_floorDb = std::max(m_floorDb + (m_levelDb - m_floorDb) * weight, VAD_MIN_FLOOR_DB);
+
+    if (!m_inSpeech)
+    {
+        m_onset = m_voiced ? m_onset + 1 : 0;
+        if (m_onset < VAD_ONSET_FRAMES)
+            return VAD_EVENT_NONE;
+
+        m_inSpeech = true;
+        m_startFrame = std::max(0LL, frameIndex - VAD_ONSET_FRAMES + 1 - MsToFrames(m_params.preRollMs));
+        m_lastVoiced = frameIndex;
+        m_voicedFrames = m_onset;
+        m_onset = 0;
+        return VAD_EVENT_START;
+    }
+
+    if (m_voiced)
+    {
+        m_lastVoiced = frameIndex;
+        m_voicedFrames++;
+    }
+
+    bool endpoint = frameIndex - m_lastVoiced >= std::max(1, MsToFrames(m_params.hangoverMs));
+    bool cut = frameIndex + 1 - m_startFrame >= MsToFrames(m_params.maxSpeechMs);
+    if (!endpoint && !cut)
+        return VAD_EVENT_NONE;
+
+    m_inSpeech = false;
+    if (m_voicedFrames < MsToFrames(m_params.minSpeechMs))
+        return VAD_EVENT_CANCEL;
+    return VAD_EVENT_END;
+}
@@ -0,0 +1,82 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+#pragma once
+
+#define VAD_SAMPLE_RATE 16000
+#define VAD_FRAME_MS 10
+#define VAD_FRAME (VAD_SAMPLE_RATE * VAD_FRAME_MS / 1000)
+#define VAD_ONSET_FRAMES 3        // Consecutive voiced frames that start an utterance
+#define VAD_MIN_FLOOR_DB -70.0f   // Digital silence would make any noise speech
+#define VAD_FRICATIVE_ZCR 0.25f   // Crossings per sample of a quiet voiced frame, /s/ and /f/ are weak but noisy
+#define VAD_FLOOR_RISE_MS 1000    // Noise floor time constant upwards, between utterances
+#define VAD_FLOOR_CREEP_MS 10000  // Upwards while in an utterance, recovers from a step in the noise
+#define VAD_FLOOR_FALL_MS 40      // Downwards, and both ways while the floor is learned
+#define VAD_LEARN_MS 200
+#define VAD_MAX_SPEECH_MS 30000
+#define VAD_PRE_ROLL_MS 200
+
+struct SVadParams
+{
+    float thresholdDb; // Frame energy above the noise floor that counts as speech
+    int hangoverMs;    // Silence that ends an utterance, most of the endpoint latency
+    int minSpeechMs;   // Shorter utterances are cancelled, clicks and coughs
+    int maxSpeechMs;   // Utterances are cut here
+    int preRollMs;     // Audio kept from before the onset
+};
+
+enum EVadEvent
+{
+    VAD_EVENT_NONE = 0,
+    VAD_EVENT_START,
+    VAD_EVENT_END,
+    VAD_EVENT_CANCEL,
+};
+
+/**
+ * Energy and zero-crossing voice activity detector on 10 ms frames of 16 kHz audio.
+ * A frame is voiced when its energy clears an adaptive noise floor by the
+ * threshold, or by half of it with a fricative zero-crossing rate. Inside an
+ * utterance half the threshold keeps it going, so decaying syllables are not
+ * cut. The floor follows the minimum quickly and rises slowly. Frame indices
+ * count from Reset(), the caller maps them back to its samples.
+ */
+class CVoiceActivityDetector
+{
+public:
+    CVoiceActivityDetector();
+
+    // Takes effect with the next frame, the noise floor is kept
+    void Configure(const SVadParams &params);
+    void Reset();
+    const SVadParams &GetParams() const { return m_params; }
+
+    // One VAD_FRAME frame, full scale 1.0
+    EVadEvent Process(const float *frame);
+
+    bool InSpeech() const { return m_inSpeech; }
+    bool IsVoiced() const { return m_voiced; } // The last frame
+    long long GetFrame() const { return m_frame; } // Frames processed
+    long long GetStartFrame() const { return m_startFrame; } // Of the utterance, pre-roll included
+    long long GetEndFrame() const { return m_lastVoiced + 1; } // After the last voiced frame
+    float GetLevelDb() const { return m_levelDb; }
+    float GetNoiseDb() const { return m_floorDb; }
+
+private:
+    static int MsToFrames(int ms) { return (ms + VAD_FRAME_MS - 1) / VAD_FRAME_MS; }
+
+    SVadParams m_params;
+    float m_riseWeight;
+    float m_creepWeight;
+    float m_fallWeight;
+
+    long long m_frame;
+    float m_levelDb;
+    float m_floorDb;
+    bool m_voiced;
+    bool m_inSpeech;
+    int m_onset;
+    long long m_startFrame;
+    long long m_lastVoiced;
+    int m_voicedFrames;
+};
@@ -0,0 +1,196 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+
+#include "audioViseme.hpp"
+#include "audioSimd.hpp"
+
+#include <cmath>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <algorithm>
+
+#define F1_MIN_HZ 200.0f
+#define F1_MAX_HZ 1000.0f
+#define F2_GAP_HZ 250.0f // F2 searched from F1 plus this
+#define F2_MIN_HZ 800.0f // and no lower, clear of F1 harmonics
+#define F2_MAX_HZ 3000.0f
+
+// First and second formant of a/i/u/e/o, Hz, spoken Japanese
+static const float VOWEL_FORMANTS[VISEME_COUNT][2] = {
+    {800.0f, 1300.0f},
+    {300.0f, 2500.0f},
+    {350.0f, 1400.0f},
+    {500.0f, 2100.0f},
+    {500.0f, 900.0f},
+};
+
+CVisemeAnalyzer::CVisemeAnalyzer()
+    : m_sampleRate(0), m_size(0), m_half(0), m_f1Begin(0), m_f1End(0), m_f2End(0)
+{
+}
+
+void CVisemeAnalyzer::Configure(int sampleRate)
+{
+    m_sampleRate = sampleRate;
+    m_size = 64;
+    while (m_size < sampleRate * VISEME_WINDOW_MS / 1000)
+        m_size <<= 1;
+    m_half = m_size / 2;
+
+    m_window.resize(m_size);
+    for (int i = 0; i < m_size; i++)
+        m_window[i] = (float)(0.5 - 0.5 * cos(2.0 * M_PI * i / m_size));
+
+    m_fft.Configure(m_half);
+
+    float binHz = (float)sampleRate / m_size;
+    m_f1Begin = std::max(1, (int)(F1_MIN_HZ / binHz));
+    m_f1End = (int)ceilf(F1_MAX_HZ / binHz);
+    m_f2End = std::min(m_half - 1, (int)ceilf(F2_MAX_HZ / binHz));
+
+    m_postRe.resize(m_f2End + 1);
+    m_postIm.resize(m_f2End + 1);
+    for (int k = 0; k <= m_f2End; k++)
+    {
+        m_postRe[k] = (float)cos(-2.0 * M_PI * k / m_size);
+        m_postIm[k] = (float)sin(-2.0 * M_PI * k / m_size);
+    }
+
+    m_re.resize(m_half);
+    m_im.resize(m_half);
+    m_power.resize(m_f2End + 1);
+}
+
+void CVisemeAnalyzer::Analyze(const float *frame, float weights[VISEME_COUNT])
+{
+    std::fill(weights, weights + VISEME_COUNT, 0.0f);
+    if (!m_size)
+        return;
+
+    // Even samples as real, odd as imaginary parts of a half size complex FFT
+    const int *bitReverse = m_fft.GetBitReverse();
+    double energy = 0.0;
+    for (int n = 0; n < m_half; n++)
+    {
+        float even = frame[2 * n], odd = frame[2 * n + 1];
+        energy += even * even + odd * odd;
+        m_re[bitReverse[n]] = even * m_window[2 * n];
+        m_im[bitReverse[n]] = odd * m_window[2 * n + 1];
+    }
+    if (sqrt(energy / m_size) < VISEME_MIN_RMS)
+        return;
+
+    m_fft.Transform(m_re.data(), m_im.data());
+
+    // Unpack the real spectrum, only the bins the formant search looks at
+    for (int k = 1; k <= m_f2End; k++)
+    {
+        float zr = m_re[k], zi = m_im[k];
+        float cr = m_re[m_half - k], ci = -m_im[m_half - k];
+        float er = 0.5f * (zr + cr), ei = 0.5f * (zi + ci);
+        float or_ = 0.5f * (zi - ci), oi = -0.5f * (zr - cr);
+        float xr = er + m_postRe[k] * or_ - m_postIm[k] * oi;
+        float xi = ei + m_postRe[k] * oi + m_postIm[k] * or_;
+        m_power[k] = (xr * xr + xi * xi) * (float)k * k; // Pre-emphasis, +6 dB per octave against the voice's spectral tilt
+    }
+
+    // Squared power weights the centroid towards the formant peak over the harmonics around it
+    auto centroid = [&](int begin, int end) {
+        double sum = 0.0, moment = 0.0;
+        for (int k = begin; k <= end; k++)
+        {
+            double weight = (double)m_power[k] * m_power[k];
+            sum += weight;
+            moment += weight * k;
+        }
+        return sum > 0.0 ? (float)(moment / sum) : (float)begin;
+    };
+
+    float binHz = (float)m_sampleRate / m_size;
+    float f1 = centroid(m_f1Begin, m_f1End) * binHz;
+    int f2Begin = std::min(m_f2End, (int)(std::max(f1 + F2_GAP_HZ, F2_MIN_HZ) / binHz));
+    float f2 = centroid(f2Begin, m_f2End) * binHz;
+
+    // Gaussian in log frequency around each vowel, normalised
+    float logF1 = logf(f1), logF2 = logf(f2);
+    float distance[VISEME_COUNT];
+    float nearest = 1e30f;
+    for (int v = 0; v < VISEME_COUNT; v++)
+    {
+        float d1 = logF1 - logf(VOWEL_FORMANTS[v][0]);
+        float d2 = logF2 - logf(VOWEL_FORMANTS[v][1]);
+        distance[v] = (d1 * d1 + d2 * d2) / (2.0f * VISEME_SIGMA * VISEME_SIGMA);
+        nearest = std::min(nearest, distance[v]);
+    }
+    float sum = 0.0f;
+    for (int v = 0; v < VISEME_COUNT; v++)
+    {
+        weights[v] = expf(nearest - distance[v]);
+        sum += weights[v];
+    }
+    for (int v = 0; v < VISEME_COUNT; v++)
+        weights[v] /= sum;
+}
+
+void CVisemeAnalyzer::Benchmark()
+{
+    static const char *NAMES[VISEME_COUNT] = {"a", "i", "u", "e", "o"};
+    static const float PITCHES[] = {110.0f, 160.0f, 220.0f, 280.0f};
+    const int sampleRate = 48000;
+    const int hop = sampleRate / 100;
+    const double seconds = 1.0;
+
+    CVisemeAnalyzer analyzer;
+    analyzer.Configure(sampleRate);
+    const int size = analyzer.GetWindowSize();
+    std::cout << "Viseme benchmark, " << size << " point FFT per " << hop << " frame hop at " << sampleRate
+              << " Hz, simd: " << AUDIO_SIMD_NAME << std::endl;
+
+    int hits = 0, total = 0, hops = 0;
+    double elapsed = 0.0;
+    for (int vowel = 0; vowel < VISEME_COUNT; vowel++)
+    {
+        printf("%s:", NAMES[vowel]);
+        for (float pitch : PITCHES)
+        {
+            // Harmonics of a glottal source falling 6 dB per octave, shaped by three formant resonances
+            const float formants[3] = {VOWEL_FORMANTS[vowel][0], VOWEL_FORMANTS[vowel][1], 3000.0f};
+            const float bandwidths[3] = {80.0f, 100.0f, 150.0f};
+            std::vector<float> signal((size_t)(sampleRate * seconds));
+            float peak = 0.0f;
+            for (int h = 1; h * pitch < sampleRate * 0.45f; h++)
+            {
+                double f = h * pitch, gain = 1.0 / h;
+                for (int k = 0; k < 3; k++)
+                    gain *= formants[k] * formants[k] / sqrt(pow(formants[k] * formants[k] - f * f, 2.0) + pow(bandwidths[k] * f, 2.0));
+                for (size_t i = 0; i < signal.size(); i++)
+                    signal[i] += (float)(gain * sin(2.0 * M_PI * f * i / sampleRate + h));
+            }
+            for (float sample : signal)
+                peak = std::max(peak, fabsf(sample));
+            for (float &sample : signal)
+                sample *= 0.5f / peak;
+
+            int correct = 0, count = 0;
+            float weights[VISEME_COUNT];
+            auto start = std::chrono::steady_clock::now();
+            for (size_t pos = 0; pos + size <= signal.size(); pos += hop)
+            {
+                analyzer.Analyze(signal.data() + pos, weights);
+                correct += std::max_element(weights, weights + VISEME_COUNT) - weights == vowel;
+                count++;
+            }
+            elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            printf(" %3.0f Hz %3d%%", pitch, correct * 100 / count);
+            hits += correct;
+            total += count;
+            hops += count;
+        }
+        printf("\n");
+    }
+
+    double audio = (double)hops * hop / sampleRate;
+    printf("Accuracy %d%%, RTF %.5f (%.0fx), %.2f us per hop\n", hits * 100 / total, elapsed / audio, audio / elapsed, elapsed * 1e6 / hops);
+}
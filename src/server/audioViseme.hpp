@@ -0,0 +1,61 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+#pragma once
+
+#include <vector>
+
+#include "audioFft.hpp"
+
+#define VISEME_WINDOW_MS 20   // FFT window, rounded up to a power of two
+#define VISEME_MIN_RMS 0.01f  // Quieter windows are silence
+#define VISEME_SIGMA 0.22f    // Spread of a vowel around its formants, natural log units
+
+enum EViseme
+{
+    VISEME_A = 0,
+    VISEME_I,
+    VISEME_U,
+    VISEME_E,
+    VISEME_O,
+    VISEME_COUNT,
+};
+
+/**
+ * Vowel estimation from one analysis window.
+ * A real FFT of the Hann windowed frame gives the power spectrum, the first
+ * two formants are taken as the peak weighted centroids of their bands and
+ * scored against the a/i/u/e/o formant targets. Runs on the decode thread.
+ */
+class CVisemeAnalyzer
+{
+public:
+    CVisemeAnalyzer();
+
+    // Allocates the tables, not real time safe.
+    void Configure(int sampleRate);
+    int GetWindowSize() const { return m_size; }
+
+    // `frame` holds GetWindowSize() samples. Writes weights summing to 1, or all 0 in silence.
+    void Analyze(const float *frame, float weights[VISEME_COUNT]);
+
+    // Classifies synthesized vowels and prints accuracy and real time factor.
+    static void Benchmark();
+
+private:
+    int m_sampleRate;
+    int m_size; // Real samples, N
+    int m_half; // Complex points, N / 2
+
+    CAudioFFT m_fft;
+    std::vector<float> m_window;
+    std::vector<float> m_postRe;    // Real FFT unpacking, e^(-2 pi i k / N)
+    std::vector<float> m_postIm;
+
+    std::vector<float> m_re;
+    std::vector<float> m_im;
+    std::vector<float> m_power;
+
+    int m_f1Begin, m_f1End; // Bins
+    int m_f2End;
+};
@@ -0,0 +1,44 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+#pragma once
+
+#include <cstdint>
+
+#define WAV_HEADER_BYTES 44
+// RIFF sizes are 32 bit, the most whole 16 bit samples one file can hold
+#define WAV_MAX_DATA_BYTES ((0xFFFFFFFFu - (WAV_HEADER_BYTES - 8)) & ~1u)
+
+// Canonical header of mono 16 bit PCM, little endian like every platform this runs on
+typedef struct WAV_HEADER {
+  /* RIFF Chunk Descriptor */
+  uint8_t RIFF[4] = {'R', 'I', 'F', 'F'}; // RIFF Header Magic header
+  uint32_t ChunkSize;                     // RIFF Chunk Size
+  uint8_t WAVE[4] = {'W', 'A', 'V', 'E'}; // WAVE Header
+  /* "fmt" sub-chunk */
+  uint8_t fmt[4] = {'f', 'm', 't', ' '}; // FMT header
+  uint32_t Subchunk1Size = 16;           // Size of the fmt chunk
+  uint16_t AudioFormat = 1; // Audio format 1=PCM,6=mulaw,7=alaw,     257=IBM
+                            // Mu-Law, 258=IBM A-Law, 259=ADPCM
+  uint16_t NumOfChan = 1;   // Number of channels 1=Mono 2=Sterio
+  uint32_t SamplesPerSec = 44100;   // Sampling Frequency in Hz
+  uint32_t bytesPerSec = 44100 * 2; // bytes per second
+  uint16_t blockAlign = 2;          // 2=16-bit mono, 4=16-bit stereo
+  uint16_t bitsPerSample = 16;      // Number of bits per sample
+  /* "data" sub-chunk */
+  uint8_t Subchunk2ID[4] = {'d', 'a', 't', 'a'}; // "data"  string
+  uint32_t Subchunk2Size;                        // Sampled data length
+} wav_hdr;
+
+static_assert(sizeof(wav_hdr) == WAV_HEADER_BYTES, "");
+
+// `dataBytes` at most WAV_MAX_DATA_BYTES
+inline wav_hdr WavHeader(int sampleRate, uint32_t dataBytes)
+{
+    wav_hdr wav;
+    wav.SamplesPerSec = sampleRate;
+    wav.bytesPerSec = sampleRate * sizeof(short);
+    wav.ChunkSize = dataBytes + sizeof(wav_hdr) - 8;
+    wav.Subchunk2Size = dataBytes;
+    return wav;
+}
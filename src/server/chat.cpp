@@ -7,124 +7,436 @@
 #include <iostream>
 #include <asio.hpp>
 #include <algorithm>
+#include <strings.h>
 #include "../plat.hpp"
-
-#define MINIMP3_ONLY_MP3
-#define MINIMP3_IMPLEMENTATION
-#include "minimp3.h"
+#include "../front/window.hpp"
 
 #include <soundio/soundio.h>
 
 using asio::ip::udp;
 #define DEFAULT_CHAT_UDP_PORT 12888
 
-#define MP3_SR 44100
+#define DEFAULT_PLAY_SR 48000
+#define SOUND_RETRY_MS 1000 // Between attempts to connect to the sound backend
+
+// Any thread. Wakes the sound thread to reopen the output.
+static void RequestReopen(SStreamPlayUserData* userdata, int err)
+{
+    CAudioRtAllow blocking; // The wakeup locks, the stream is replaced anyway
+    userdata->lastError.store(err, std::memory_order_relaxed);
+    userdata->reopen.store(true, std::memory_order_release);
+    struct SoundIo *soundio = userdata->soundio.load();
+    if (soundio)
+        soundio_wakeup(soundio);
+}
+
+// One buffer of the output, shared by the device callback and the sinks without hardware
+struct SOutputPass
+{
+    bool play;
+    CEchoReference* echo;
+    int audioEnd;     // After the last frame of audio, -1 without audio
+    uint64_t headPos; // Ring position at audioEnd
+};
+
+// Frames to write out of what the output asks for
+static int BeginOutputPass(SStreamPlayUserData* userdata, int frame_count_min, int frame_count_max, SOutputPass &pass)
+{
+    pass.echo = userdata->echoReference->IsActive() ? userdata->echoReference : nullptr;
+    pass.audioEnd = -1;
+    pass.headPos = 0;
+
+    // Hold the ring back until the jitter buffer filled up, also drain the audio held in the limiter look-ahead
+    uint64_t available = userdata->streamBuffer->Available();
+    pass.play = userdata->jitterBuffer->Update(available);
+    int buffer_frames_left = (int)std::min<uint64_t>((pass.play ? available : 0) + userdata->dsp->GetPending(), frame_count_max);
+    // A clip plays on through the gaps of the speech
+    if (userdata->mixer->Update())
+        buffer_frames_left = frame_count_max;
+    return std::max(buffer_frames_left, frame_count_min);
+}
+
+static_assert(MIXER_RUN_MAX >= DSP_QUANTUM, "The mixer takes the DSP's runs whole");
+
+static void RenderOutputPass(SStreamPlayUserData* userdata, int frames_left, struct SoundIoChannelArea *areas, SOutputPass &pass)
+{
+    CAudioRing<float>* streamPlayBuffer = userdata->streamBuffer;
+    const SAudioWriter &writer = userdata->writer;
+    CAudioDsp* dsp = userdata->dsp;
+
+    // The DSP pulls from the ring and hands back processed runs, or nullptr for silence.
+    // The lip clock follows the speech, the echo reference what is played.
+    int frame = 0;
+    while (frame < frames_left) {
+        const float *data;
+        int count = dsp->Render(streamPlayBuffer, frames_left - frame, &data, !pass.play);
+        userdata->segments->OnRun(dsp->GetEmitPos(), count, streamPlayBuffer->ReadPos(), frame);
+        if (data) {
+            pass.audioEnd = frame + count;
+            pass.headPos = dsp->GetEmitPos();
+        }
+        const float *mixed = userdata->mixer->Mix(data, count);
+        if (mixed) {
+            writer.write(mixed, count, frame, areas);
+            if (pass.echo)
+                pass.echo->Write(mixed, count);
+        }
+        else {
+            writer.silence(count, frame, areas);
+            if (pass.echo)
+                pass.echo->WriteSilence(count);
+        }
+        frame += count;
+    }
+
+    // Nothing left in the DSP, every boundary read was heard, on the timeline of the last audio
+    if (!dsp->GetPending()) {
+        uint64_t readPos = streamPlayBuffer->ReadPos();
+        int end = pass.audioEnd >= 0 ? pass.audioEnd + (int)(int64_t)(readPos - pass.headPos) : 0;
+        userdata->segments->OnRun(readPos, 0, readPos, std::max(end, 0));
+    }
+}
+
+// Only then the output clock is read
+static bool OutputPassNeedsClock(SStreamPlayUserData* userdata, const SOutputPass &pass)
+{
+    return pass.audioEnd >= 0 || pass.echo || userdata->segments->HasReached();
+}
+
+// The buffer was handed over, its first frame is heard at `firstFrameNs`
+static void EndOutputPass(SStreamPlayUserData* userdata, int frames_left, int sampleRate, int64_t firstFrameNs, const SOutputPass &pass)
+{
+    if (pass.audioEnd >= 0)
+        userdata->lipEnvelope->UpdateClock(pass.headPos, firstFrameNs + (int64_t)pass.audioEnd * 1000000000 / sampleRate);
+    if (pass.echo)
+        pass.echo->Publish(sampleRate, firstFrameNs + (int64_t)frames_left * 1000000000 / sampleRate);
+    if (userdata->segments->HasReached())
+        userdata->segments->Publish(firstFrameNs, sampleRate);
+}
 
 static void sound_write_callback(struct SoundIoOutStream *outstream,int frame_count_min, int frame_count_max)
 {
-    const struct SoundIoChannelLayout *layout = &outstream->layout;
-    int sample_rate = outstream->sample_rate;
     struct SoundIoChannelArea *areas;
     SStreamPlayUserData* userdata = (SStreamPlayUserData*)outstream->userdata;
-    SStreamBuffer<short>* streamPlayBuffer = userdata->streamBuffer;
-    int* lipEnergy = userdata->lipEnergy;
+    CAudioRtScope realtime; // Nothing below may allocate, lock or do I/O
+    userdata->callbackTimer.Begin();
+    if (!userdata->callbackThreadSet.load(std::memory_order_relaxed)) {
+        userdata->callbackThread = pthread_self();
+        userdata->callbackThreadSet.store(true, std::memory_order_release);
+    }
 
-    int buffer_frames_left = streamPlayBuffer->writePos - streamPlayBuffer->readPos;
-    int frames_left = std::min(frame_count_max, buffer_frames_left);
-    frames_left = std::max(frames_left, frame_count_min);
+    SOutputPass pass;
+    int frames_left = BeginOutputPass(userdata, frame_count_min, frame_count_max, pass);
     int err;
 
     if ((err = soundio_outstream_begin_write(outstream, &areas, &frames_left))) {
-        std::cout << "SoundPlay: begin write error: " << soundio_strerror(err) << std::endl;
-        exit(1);
+        userdata->errors.fetch_add(1, std::memory_order_relaxed);
+        RequestReopen(userdata, err);
+        return;
     }
 
     if (!frames_left) return;
 
-    short maxFrameValue = 0;
-    short minFrameValue = 0;
-    for (int frame = 0; frame < frames_left; frame += 1) {
-        for (int channel = 0; channel < layout->channel_count; channel += 1) {
-            short *ptr = (short*)(areas[channel].ptr + areas[channel].step * frame);
-            if (streamPlayBuffer->readPos < streamPlayBuffer->writePos) {
-                *ptr = streamPlayBuffer->buffer[streamPlayBuffer->readPos];
-                if (*ptr > maxFrameValue)
-                    maxFrameValue = *ptr;
-                if (*ptr < minFrameValue)
-                    minFrameValue = *ptr;
-            }
-            else
-                *ptr = 0;
+    RenderOutputPass(userdata, frames_left, areas, pass);
+
+    if ((err = soundio_outstream_end_write(outstream))) {
+        // Boundaries still get their events, timed as if heard right away
+        if (userdata->segments->HasReached())
+            userdata->segments->Publish(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(), outstream->sample_rate);
+        // An underflow leaves the stream usable, anything else needs a new one
+        if (err == SoundIoErrorUnderflow)
+            userdata->underflows.fetch_add(1, std::memory_order_relaxed);
+        else {
+            userdata->errors.fetch_add(1, std::memory_order_relaxed);
+            RequestReopen(userdata, err);
         }
-        if (streamPlayBuffer->readPos < streamPlayBuffer->writePos)
-            streamPlayBuffer->readPos++;
+        return;
     }
 
-    *lipEnergy = (maxFrameValue - minFrameValue);
+    // The frame after this write is heard in `latency`
+    if (OutputPassNeedsClock(userdata, pass)) {
+        double latency = 0.0;
+        soundio_outstream_get_latency(outstream, &latency);
+        int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        EndOutputPass(userdata, frames_left, outstream->sample_rate, now + (int64_t)((latency - (double)frames_left / outstream->sample_rate) * 1e9), pass);
+    }
+    userdata->callbackTimer.End(frames_left, outstream->sample_rate);
+}
 
-    // std::cout << streamPlayBuffer->readPos << " " << streamPlayBuffer->writePos << std::endl;
-    // std::cout << maxFrameValue << " " << minFrameValue << " " << *lipEnergy << std::endl;
+static void sound_underflow_callback(struct SoundIoOutStream *outstream)
+{
+    ((SStreamPlayUserData*)outstream->userdata)->underflows.fetch_add(1, std::memory_order_relaxed);
+}
 
-    if ((err = soundio_outstream_end_write(outstream))) {
-        std::cout << "SoundPlay: end write error: " << soundio_strerror(err) << std::endl;
-        exit(1);
-    }
+static void sound_error_callback(struct SoundIoOutStream *outstream, int err)
+{
+    SStreamPlayUserData* userdata = (SStreamPlayUserData*)outstream->userdata;
+    userdata->errors.fetch_add(1, std::memory_order_relaxed);
+    RequestReopen(userdata, err);
 }
-void SoundPlayThread(SStreamPlayUserData* userData)
+
+// Called on the sound thread from soundio_wait_events()
+static void sound_devices_change(struct SoundIo *soundio)
 {
-    int err;
-    struct SoundIo *soundio = soundio_create();
-    if (!soundio) {
-        std::cout << "SoundPlay: out of memory" << std::endl;
-        return;
-    }
+    ((SStreamPlayUserData*)soundio->userdata)->devicesChanged = true;
+}
 
-    if ((err = soundio_connect(soundio))) {
-        std::cout << "SoundPlay: error connecting: " << soundio_strerror(err) << std::endl;
-        return;
-    }
+static void sound_backend_disconnect(struct SoundIo *soundio, int err)
+{
+    SStreamPlayUserData* userdata = (SStreamPlayUserData*)soundio->userdata;
+    userdata->backendLost = true;
+    userdata->lastError.store(err, std::memory_order_relaxed);
+}
 
-    soundio_flush_events(soundio);
+// Sound thread, before the output starts at `sampleRate`
+static void PrepareOutput(SStreamPlayUserData* userData, int sampleRate)
+{
+    // The ring outlives reopens, its length in time changes with the rate
+    if (!userData->streamBuffer->Capacity()) {
+        userData->streamBuffer->Allocate(sampleRate, PLAY_BUFFER_MS);
+        AudioRtLockMemory(userData->streamBuffer->Data(), userData->streamBuffer->Capacity() * sizeof(float));
+    }
+    else if (sampleRate != userData->openedSampleRate)
+        userData->streamBuffer->Flush(); // Resampled for the old rate
+    userData->dsp->Configure(sampleRate);
+    userData->mixer->Configure(sampleRate);
+    userData->jitterBuffer->Configure(sampleRate);
+    userData->openedSampleRate = sampleRate;
+    userData->reopen.store(false, std::memory_order_relaxed);
+    userData->callbackTimer.Reset();
+    userData->callbackThreadSet.store(false, std::memory_order_relaxed);
+}
 
+// Opens the default output device, nullptr on failure
+static struct SoundIoOutStream *OpenSoundOutput(struct SoundIo *soundio, SStreamPlayUserData* userData, std::string &deviceId)
+{
+    int err;
     int default_out_device_index = soundio_default_output_device_index(soundio);
     if (default_out_device_index < 0) {
         std::cout << "SoundPlay: no output device found" << std::endl;
-        return;
+        return nullptr;
     }
 
     struct SoundIoDevice *device = soundio_get_output_device(soundio, default_out_device_index);
     if (!device) {
         std::cout << "SoundPlay: out of memory" << std::endl;
-        return;
+        return nullptr;
     }
 
     std::cout << "SoundPlay: Output device: " << device->name << std::endl;
+    deviceId = device->id;
 
     struct SoundIoOutStream *outstream = soundio_outstream_create(device);
-    outstream->format = SoundIoFormatS16NE;
+    if (!outstream) {
+        std::cout << "SoundPlay: out of memory" << std::endl;
+        soundio_device_unref(device);
+        return nullptr;
+    }
+    outstream->format = AudioOutputSelectFormat(device);
     outstream->write_callback = sound_write_callback;
+    outstream->underflow_callback = sound_underflow_callback;
+    outstream->error_callback = sound_error_callback;
     outstream->userdata = userData;
-    outstream->sample_rate = MP3_SR;
+    // Play at the rate the device runs at, the decode thread resamples to it
+    int sampleRate = device->sample_rate_current > 0 ? device->sample_rate_current : DEFAULT_PLAY_SR;
+    outstream->sample_rate = soundio_device_nearest_sample_rate(device, sampleRate);
+    // 0 keeps the backend default
+    int latencyMs = userData->targetLatencyMs.load(std::memory_order_relaxed);
+    if (latencyMs > 0)
+        outstream->software_latency = latencyMs / 1000.0;
+    userData->openedLatencyMs = latencyMs;
+    soundio_device_unref(device); // The stream holds its own reference
 
     if ((err = soundio_outstream_open(outstream))) {
         std::cout << "SoundPlay: unable to open device: " << soundio_strerror(err) << std::endl;
-        return;
+        soundio_outstream_destroy(outstream);
+        return nullptr;
+    }
+
+    if (!AudioOutputGetWriter(outstream->format, outstream->layout.channel_count, userData->writer)) {
+        std::cout << "SoundPlay: unsupported output layout: " << outstream->layout.channel_count << " channels" << std::endl;
+        soundio_outstream_destroy(outstream);
+        return nullptr;
     }
 
     if (outstream->layout_error)
         std::cout << "SoundPlay: unable to set channel layout: " << soundio_strerror(outstream->layout_error) << std::endl;
 
+    PrepareOutput(userData, outstream->sample_rate);
+
     if ((err = soundio_outstream_start(outstream))) {
         std::cout << "SoundPlay: unable to start device: " << soundio_strerror(err) << std::endl;
+        soundio_outstream_destroy(outstream);
+        return nullptr;
+    }
+
+    // Achieved, not requested, the backend rounds to what the device can do
+    userData->latency.store(outstream->software_latency, std::memory_order_relaxed);
+    userData->sampleRate.store(outstream->sample_rate, std::memory_order_release);
+    std::cout << "SoundPlay: sample rate: " << outstream->sample_rate << ", latency: " << outstream->software_latency * 1000.0
+              << " ms, " << userData->writer.name << std::endl;
+
+    // The callback runs on the backend's thread, known once it was called
+    for (int i = 0; i < AUDIO_RT_PROMOTE_WAIT_MS / 5 && !userData->callbackThreadSet.load(std::memory_order_acquire); i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    if (userData->callbackThreadSet.load(std::memory_order_acquire))
+        AudioRtPromote(userData->callbackThread, outstream->software_latency);
+    else
+        std::cout << "SoundPlay: no callback within " << AUDIO_RT_PROMOTE_WAIT_MS << " ms, priority left to the backend" << std::endl;
+    return outstream;
+}
+
+// Drives a sink without sound hardware through the same render path, at the sink's pace
+static void SinkPlayThread(SStreamPlayUserData* userData)
+{
+    CAudioSink *sink = userData->sink;
+    const int sampleRate = AUDIO_SINK_SAMPLE_RATE;
+    const int period = sampleRate * AUDIO_SINK_PERIOD_MS / 1000;
+    if (!AudioOutputGetWriter(SoundIoFormatFloat32NE, 1, userData->writer) || !sink->Open(sampleRate)) {
+        userData->sampleRate = -1;
+        userData->exited = true;
         return;
     }
 
-    for (;;)
+    std::vector<float> buffer(period);
+    struct SoundIoChannelArea area = {(char *)buffer.data(), (int)sizeof(float)};
+    PrepareOutput(userData, sampleRate);
+    AudioRtLockMemory(buffer.data(), buffer.size() * sizeof(float));
+    userData->callbackThread = pthread_self();
+    userData->callbackThreadSet.store(true, std::memory_order_release);
+    userData->latency.store(sink->GetLatency(), std::memory_order_relaxed);
+    userData->sampleRate.store(sampleRate, std::memory_order_release);
+    std::cout << "SoundPlay: " << sink->GetName() << " sink, sample rate: " << sampleRate << ", latency: " << sink->GetLatency() * 1000.0 << " ms" << std::endl;
+    if (sink->IsRealtime())
+        AudioRtPromote(pthread_self(), sink->GetLatency());
+
+    while (!userData->quit) {
+        SOutputPass pass;
+        bool late;
+        int64_t firstFrameNs;
+        int frames;
+        if (sink->IsRealtime()) {
+            // Whole periods when they are due, like a device
+            firstFrameNs = sink->Wait(period, late);
+            frames = BeginOutputPass(userData, period, period, pass);
+        }
+        else {
+            // Only the audio there is, as fast as it is buffered
+            frames = BeginOutputPass(userData, 0, period, pass);
+            if (!frames) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+            firstFrameNs = sink->Wait(frames, late);
+        }
+        if (late)
+            userData->underflows.fetch_add(1, std::memory_order_relaxed);
+        {
+            CAudioRtScope realtime;
+            userData->callbackTimer.Begin();
+            RenderOutputPass(userData, frames, &area, pass);
+            EndOutputPass(userData, frames, sampleRate, firstFrameNs, pass);
+            userData->callbackTimer.End(frames, sampleRate);
+        }
+        sink->Write(buffer.data(), frames);
+    }
+
+    userData->sampleRate = 0;
+    sink->Close();
+    SAudioCallbackStats callbackStats;
+    userData->callbackTimer.GetStats(callbackStats);
+    std::cout << "SoundPlay: worst render " << callbackStats.worstUs << " us, worst jitter " << callbackStats.worstJitterMs << " ms" << std::endl;
+    userData->sampleRate = -1;
+    userData->exited = true;
+}
+
+void SoundPlayThread(SStreamPlayUserData* userData)
+{
+    if (userData->sink) {
+        SinkPlayThread(userData);
+        return;
+    }
+
+    int err;
+    struct SoundIo *soundio = soundio_create();
+    if (!soundio) {
+        std::cout << "SoundPlay: out of memory" << std::endl;
+        userData->sampleRate = -1;
+        return;
+    }
+    soundio->userdata = userData;
+    soundio->on_devices_change = sound_devices_change;
+    soundio->on_backend_disconnect = sound_backend_disconnect;
+    userData->soundio.store(soundio);
+
+    struct SoundIoOutStream *outstream = nullptr;
+    std::string deviceId;
+    bool connected = false;
+    int opens = 0;
+
+    while (!userData->quit) {
+        if (!connected) {
+            if ((err = soundio_connect(soundio))) {
+                std::cout << "SoundPlay: error connecting: " << soundio_strerror(err) << std::endl;
+                userData->sampleRate = -1;
+                for (int i = 0; i < SOUND_RETRY_MS / 10 && !userData->quit; i++)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            connected = true;
+            userData->backendLost = false;
+            soundio_flush_events(soundio);
+            userData->devicesChanged = false;
+        }
+
+        if (!outstream) {
+            outstream = OpenSoundOutput(soundio, userData, deviceId);
+            if (!outstream)
+                userData->sampleRate = -1; // Tried again when the devices change
+            else if (opens++) {
+                userData->reopens.fetch_add(1, std::memory_order_relaxed);
+                std::cout << "SoundPlay: output reopened" << std::endl;
+            }
+        }
+
         soundio_wait_events(soundio);
 
-    soundio_outstream_destroy(outstream);
-    soundio_device_unref(device);
-    soundio_destroy(soundio);
+        bool reopen = userData->reopen.exchange(false, std::memory_order_acquire);
+        if (reopen)
+            std::cout << "SoundPlay: stream error: " << soundio_strerror(userData->lastError.load(std::memory_order_relaxed)) << std::endl;
+        if (userData->backendLost)
+            std::cout << "SoundPlay: backend disconnected: " << soundio_strerror(userData->lastError.load(std::memory_order_relaxed)) << std::endl;
+        if (userData->targetLatencyMs.load(std::memory_order_relaxed) != userData->openedLatencyMs)
+            reopen = true;
+        if (userData->devicesChanged) {
+            // Follow the default device, or retry a device that failed to open
+            userData->devicesChanged = false;
+            int index = soundio_default_output_device_index(soundio);
+            struct SoundIoDevice *device = index >= 0 ? soundio_get_output_device(soundio, index) : nullptr;
+            if (!outstream || !device || deviceId != device->id)
+                reopen = true;
+            if (device)
+                soundio_device_unref(device);
+        }
+
+        if ((reopen || userData->backendLost || userData->quit) && outstream) {
+            // The decode thread waits while the rate is 0
+            userData->sampleRate = 0;
+            soundio_outstream_destroy(outstream);
+            SAudioCallbackStats callbackStats;
+            userData->callbackTimer.GetStats(callbackStats);
+            std::cout << "SoundPlay: worst callback " << callbackStats.worstUs << " us, worst jitter " << callbackStats.worstJitterMs << " ms" << std::endl;
+            outstream = nullptr;
+        }
+        if (userData->backendLost) {
+            soundio_disconnect(soundio);
+            connected = false;
+        }
+    }
+
+    // Destroyed by StopSoundPlay(), which may still be waking this thread
+    userData->sampleRate = -1;
+    userData->exited = true;
 }
 
 CChat::CChat(CWorld *pWorld)
@@ -147,24 +459,406 @@ CChat::CChat(CWorld *pWorld)
         ChatContents2show();
     }
 
-    m_streamPlayUserData.lipEnergy = &m_lipEnergyShow;
-    m_streamPlayUserData.streamBuffer = &m_streamPlayBuffer;
+    m_synthesisStreamed = false;
+    m_turnTimings.Reset();
 
+    m_reechoSession.SetHeaderCallback(cpr::HeaderCallback{std::bind(&CChat::OnSynthesisHeader, this, std::placeholders::_1, std::placeholders::_2), (intptr_t)nullptr});
+    m_reechoSession.SetWriteCallback(cpr::WriteCallback{std::bind(&CChat::OnSynthesisData, this, std::placeholders::_1, std::placeholders::_2), (intptr_t)nullptr});
+    m_streamSession.SetHeaderCallback(cpr::HeaderCallback{std::bind(&CChat::OnStreamHeader, this, std::placeholders::_1, std::placeholders::_2), (intptr_t)nullptr});
+    m_streamSession.SetWriteCallback(cpr::WriteCallback{std::bind(&CChat::OnStreamData, this, std::placeholders::_1, std::placeholders::_2), (intptr_t)nullptr});
 
-    m_threadSoundPlay = new std::thread(&SoundPlayThread, &m_streamPlayUserData);
 
-    m_streamPlayBuffer.writePos = 0;
-    m_streamPlayBuffer.readPos = 0;
+    m_streamPlayUserData.lipEnvelope = &m_lipEnvelope;
+    m_streamPlayUserData.streamBuffer = &m_streamPlayBuffer;
+    m_streamPlayUserData.dsp = &m_audioDsp;
+    m_streamPlayUserData.jitterBuffer = &m_jitterBuffer;
+    m_echoReference.Allocate();
+    m_streamPlayUserData.echoReference = &m_echoReference;
+    m_segments.Allocate();
+    m_streamPlayUserData.segments = &m_segments;
+    m_mixer.Allocate();
+    m_streamPlayUserData.mixer = &m_mixer;
+    m_capture.SetEchoReference(&m_echoReference);
+    m_streamPlayUserData.sampleRate = 0;
+    m_streamPlayUserData.soundio = nullptr;
+    m_streamPlayUserData.quit = false;
+    m_streamPlayUserData.exited = false;
+    m_streamPlayUserData.reopen = false;
+    m_streamPlayUserData.lastError = 0;
+    m_streamPlayUserData.targetLatencyMs = m_pWorld->m_configAudio.outputLatencyMs;
+    m_streamPlayUserData.latency = 0.0;
+    m_streamPlayUserData.underflows = 0;
+    m_streamPlayUserData.errors = 0;
+    m_streamPlayUserData.reopens = 0;
+    m_streamPlayUserData.callbackThreadSet = false;
+    m_streamPlayUserData.devicesChanged = false;
+    m_streamPlayUserData.backendLost = false;
+    m_streamPlayUserData.openedLatencyMs = 0;
+    m_streamPlayUserData.openedSampleRate = 0;
+
+    // Chosen once, a headless run has no device to follow
+    m_audioSink = CAudioSink::Create(m_pWorld->m_configAudio.sink, m_pWorld->m_configAudio.sinkFile, m_pWorld->m_configAudio.sinkRealtime);
+    m_streamPlayUserData.sink = m_audioSink;
+    m_threadSoundPlay = new std::thread(&SoundPlayThread, &m_streamPlayUserData);
 
-    m_streamDecodeBuffer.writePos = 0;
-    m_streamDecodeBuffer.readPos = 0;
-    m_lipEnergyShow = 0;
+    m_streamBytes.Allocate((uint64_t)STREAM_BYTES_SIZE);
+    m_decoder = nullptr;
+    m_resampleQuality = RESAMPLE_QUALITY_MEDIUM;
+    m_resampleConfigured = false;
+    m_resampleOutRate = 0;
+    m_recordTurn = false;
+    m_mode = CHAT_MODE_TTS;
+    m_captureEnabled = false;
+    m_captureSource = -1;
+    m_fillerClip = nullptr;
+    m_rtcBargeIn = false;
+    m_turn = 0;
+    m_timedTurn = -1;
+    m_streamEnded = true;
+    m_decodeIdle = true;
+    m_decodeQuit = false;
+    m_decodeFailed = false;
+    m_threadDecode = new std::thread(&CChat::DecodeThread, this);
 }
 
 CChat::~CChat()
 {
+    if (m_warmUp.valid())
+        m_warmUp.wait();
+
+    m_decodeQuit = true;
+    m_threadDecode->join();
+    delete m_threadDecode;
+    delete m_decoder.load();
+
+    StopSoundPlay();
+    delete m_audioSink;
+    delete m_fillerClip;
+}
+
+void CChat::StopSoundPlay()
+{
+    if (!m_threadSoundPlay)
+        return;
+
+    // A wakeup before the thread waits may be lost, repeat until it is out
+    m_streamPlayUserData.quit = true;
+    while (!m_streamPlayUserData.exited)
+    {
+        struct SoundIo *soundio = m_streamPlayUserData.soundio.load();
+        if (soundio)
+            soundio_wakeup(soundio);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
     m_threadSoundPlay->join();
     delete m_threadSoundPlay;
+    m_threadSoundPlay = nullptr;
+
+    struct SoundIo *soundio = m_streamPlayUserData.soundio.exchange(nullptr);
+    if (soundio)
+        soundio_destroy(soundio);
+}
+
+void CChat::SetOutputLatency(int ms)
+{
+    if (m_streamPlayUserData.targetLatencyMs.exchange(ms) == ms)
+        return;
+    struct SoundIo *soundio = m_streamPlayUserData.soundio.load();
+    if (soundio)
+        soundio_wakeup(soundio);
+}
+
+void CChat::GetOutputStats(SOutputStats &stats)
+{
+    stats.sampleRate = std::max(m_streamPlayUserData.sampleRate.load(), 0);
+    stats.latencyMs = GetOutputLatency() * 1000.0;
+    stats.underflows = m_streamPlayUserData.underflows.load(std::memory_order_relaxed);
+    stats.errors = m_streamPlayUserData.errors.load(std::memory_order_relaxed);
+    stats.reopens = m_streamPlayUserData.reopens.load(std::memory_order_relaxed);
+    m_streamPlayUserData.callbackTimer.GetStats(stats.callback);
+    for (int i = 0; i < AUDIO_RT_VIOLATION_COUNT; i++)
+        stats.violations[i] = AudioRtViolations((EAudioRtViolation)i);
+}
+
+void CChat::BenchmarkPlayback(const char *inFile, const char *outFile)
+{
+    // Three segments of the file, or of synthesized vowels
+    std::vector<short> pcm;
+    int sampleRate = 24000;
+    if (inFile)
+    {
+        if (!CAudioCapture::ReadFile(inFile, pcm, sampleRate))
+        {
+            std::cout << "Unable to read " << inFile << std::endl;
+            return;
+        }
+    }
+    else
+    {
+        const float pitches[] = {180.0f, 220.0f, 150.0f};
+        for (float pitch : pitches)
+        {
+            for (int i = 0; i < sampleRate * 6 / 5; i++)
+            {
+                float t = (float)i / sampleRate;
+                float v = 0.3f * sinf(2.0f * (float)M_PI * pitch * t) + 0.1f * sinf(2.0f * (float)M_PI * pitch * 3.0f * t);
+                pcm.push_back((short)(v * 32767.0f));
+            }
+        }
+    }
+
+    CAudioRing<float> ring;
+    CAudioDsp dsp;
+    CJitterBuffer jitter;
+    CLipEnvelope lip;
+    CEchoReference echo;
+    CSegmentQueue segments;
+    segments.Allocate();
+    segments.SetCrossfade(10);
+    CAudioMixer mixer;
+    mixer.Allocate();
+    CAudioSink *sink = outFile ? CAudioSink::Create(AUDIO_SINK_FILE, outFile, false) : CAudioSink::Create(AUDIO_SINK_NULL, "", false);
+
+    SStreamPlayUserData userData;
+    userData.lipEnvelope = &lip;
+    userData.streamBuffer = &ring;
+    userData.dsp = &dsp;
+    userData.jitterBuffer = &jitter;
+    userData.echoReference = &echo;
+    userData.segments = &segments;
+    userData.mixer = &mixer;
+    userData.sink = sink;
+    userData.sampleRate = 0;
+    userData.soundio = nullptr;
+    userData.quit = false;
+    userData.exited = false;
+    userData.reopen = false;
+    userData.lastError = 0;
+    userData.targetLatencyMs = 0;
+    userData.latency = 0.0;
+    userData.underflows = 0;
+    userData.errors = 0;
+    userData.reopens = 0;
+    userData.callbackThreadSet = false;
+    userData.openedSampleRate = 0;
+
+    // Written before the sink starts, unthrottled it would catch up with the writer and play gaps.
+    // At most what the ring holds, with room for the last tail.
+    const int playRate = AUDIO_SINK_SAMPLE_RATE;
+    ring.Allocate(playRate, PLAY_BUFFER_MS);
+    userData.openedSampleRate = playRate; // The ring is kept
+    lip.Configure(playRate);
+    const int segmentCount = 3;
+    const int chunk = sampleRate / 50;
+    CAudioResampler resampler;
+    resampler.Configure(sampleRate, playRate, RESAMPLE_QUALITY_MEDIUM);
+    std::vector<float> resampled(resampler.GetMaxOutput((int)pcm.size()));
+    resampled.resize(resampler.Process(pcm.data(), (int)pcm.size(), resampled.data()));
+    resampled.resize(std::min<size_t>(resampled.size(), ring.Capacity() - playRate));
+
+    // As the decode thread does, in 20 ms chunks
+    const int playChunk = (int)((int64_t)chunk * playRate / sampleRate);
+    jitter.BeginInput();
+    for (int i = 0; i < segmentCount; i++)
+    {
+        size_t begin = resampled.size() * i / segmentCount, end = resampled.size() * (i + 1) / segmentCount;
+        segments.Begin({1, i, "", 0, 0});
+        for (size_t pos = begin; pos < end; pos += playChunk)
+        {
+            const float *out;
+            int count = segments.Feed(resampled.data() + pos, (int)std::min<size_t>(playChunk, end - pos), playRate, ring.WritePos(), &out);
+            ring.Write(out, count);
+        }
+        segments.End(ring.WritePos());
+    }
+    jitter.EndInput();
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread output(&SoundPlayThread, &userData);
+    while (userData.sampleRate.load(std::memory_order_acquire) == 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if (userData.sampleRate.load(std::memory_order_acquire) < 0)
+    {
+        output.join();
+        delete sink;
+        return;
+    }
+
+    // The last tail goes out once the ring runs low
+    std::vector<SSegmentEvent> events;
+    int finished = 0;
+    while (finished < segmentCount && std::chrono::steady_clock::now() - start < std::chrono::seconds(30))
+    {
+        const float *out;
+        uint64_t writePos = ring.WritePos();
+        int count = segments.Release(playRate, writePos, writePos - ring.ReadPos(), &out);
+        if (count > 0)
+            ring.Write(out, count);
+        SSegmentEvent event;
+        while (segments.PollEvent(event))
+        {
+            events.push_back(event);
+            finished += event.type == SEGMENT_FINISHED;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    userData.quit = true;
+    output.join();
+
+    // Every boundary must be heard as far from the first as its ring position is
+    double audio = (double)ring.WritePos() / playRate;
+    std::cout << "Playback: " << (inFile ? inFile : "synthesized vowels") << ", " << segmentCount << " segments, "
+              << audio << " s in " << seconds << " s, " << audio / seconds << "x real time" << std::endl;
+    double worstUs = 0.0;
+    for (const SSegmentEvent &event : events)
+    {
+        double heardMs = (event.audibleNs - events[0].audibleNs) / 1e6;
+        double ringMs = ((double)event.pos - (double)events[0].pos) * 1000.0 / playRate;
+        worstUs = std::max(worstUs, fabs(heardMs - ringMs) * 1000.0);
+        printf("  segment %d %s at %.3f ms, ring position %.3f ms%s\n", event.info.index, event.type == SEGMENT_STARTED ? "started " : "finished", heardMs, ringMs,
+               event.interrupted ? ", interrupted" : "");
+    }
+    printf("  events %zu of %d, largest clock error %.1f us, underflows %d\n", events.size(), segmentCount * 2, worstUs, userData.underflows.load());
+    delete sink;
+}
+
+void CChat::UpdateVoiceInput()
+{
+    const auto &config = m_pWorld->m_configVoice;
+    const auto &chatConfig = m_pWorld->m_configChat;
+    if (chatConfig.mode == m_mode && config.enabled == m_captureEnabled && config.source == m_captureSource && m_captureFile == config.inputFile &&
+        m_asrUrl == config.asrUrl && m_rtcUrl == chatConfig.rtcUrl && m_rtcBargeIn == chatConfig.rtcBargeIn)
+        return;
+
+    m_mode = chatConfig.mode;
+    m_captureEnabled = config.enabled;
+    m_captureSource = config.source;
+    m_captureFile = config.inputFile;
+    m_asrUrl = config.asrUrl;
+    m_rtcUrl = chatConfig.rtcUrl;
+    m_rtcBargeIn = chatConfig.rtcBargeIn;
+    m_rtc.Stop();
+    m_asr.Stop();
+    if (m_mode == CHAT_MODE_RTC)
+    {
+        // The realtime server listens itself, the microphone is always streamed
+        m_capture.Start(m_captureSource, m_captureFile);
+        SRtcAudioSink sink;
+        sink.begin = std::bind(&CChat::RtcAudioBegin, this);
+        sink.write = std::bind(&CChat::RtcAudioWrite, this, std::placeholders::_1, std::placeholders::_2);
+        sink.end = std::bind(&CChat::RtcAudioEnd, this, std::placeholders::_1);
+        m_rtc.Start(&m_capture, m_rtcUrl, sink, m_rtcBargeIn);
+    }
+    else if (m_captureEnabled)
+    {
+        m_capture.Start(m_captureSource, m_captureFile);
+        m_asr.Start(&m_capture, m_asrUrl);
+    }
+    else
+        m_capture.Stop();
+}
+
+void CChat::UpdateFiller()
+{
+    std::string file = m_pWorld->m_configAudio.fillerFile;
+    if (file == m_fillerFile)
+        return;
+
+    // The mixer keeps its own copy of a clip it prepared
+    delete m_fillerClip;
+    m_fillerClip = file.empty() ? nullptr : CAudioClip::Load(file);
+    m_fillerFile = file;
+    if (m_fillerClip)
+    {
+        m_mixer.Prepare(*m_fillerClip);
+        std::cout << "Chat: filler " << file << ", " << (double)m_fillerClip->GetPCM().size() / m_fillerClip->GetSampleRate() << " s" << std::endl;
+    }
+}
+
+void CChat::PollVoiceInput()
+{
+    SAsrResult result;
+    while (m_asr.PollResult(result))
+    {
+        m_voiceTextShow = result.text;
+        if (!result.final)
+            continue;
+
+        std::cout << "Voice: utterance " << result.utterance << ", endpoint " << result.endpointMs << " ms, recognition "
+                  << result.recognitionMs << " ms: " << result.text << std::endl;
+        // Same path as text from the UDP port
+        if (!result.text.empty())
+            SendCommand2Chat({CHAT_COMMAND_CHAT, result.text});
+    }
+}
+
+void CChat::RtcAudioBegin()
+{
+    // A new response replaces whatever is still playing
+    InterruptStream();
+    BeginStream({m_turn.fetch_add(1, std::memory_order_relaxed) + 1, 0, "", 0, 0}, false); // Only synthesis turns are recorded
+}
+
+bool CChat::RtcAudioWrite(const std::string &format, const std::string &data)
+{
+    if (!m_decoder.load(std::memory_order_relaxed) && !SelectDecoder(format, data))
+        return false;
+    return StreamDecode(data, (intptr_t)nullptr);
+}
+
+void CChat::RtcAudioEnd(bool interrupted)
+{
+    if (interrupted)
+        InterruptStream();
+    else
+        m_streamEnded.store(true, std::memory_order_release); // Played out, the decode thread goes idle once drained
+}
+
+void CChat::PollRtc()
+{
+    SRtcEvent event;
+    while (m_rtc.PollEvent(event))
+    {
+        if (event.type == RTC_EVENT_TRANSCRIPT)
+        {
+            m_voiceTextShow = event.text;
+            if (!event.final || event.text.empty())
+                continue;
+            Json::Value chatContent;
+            chatContent["role"] = "user";
+            chatContent["content"] = event.text;
+            m_chatContents.append(chatContent);
+            SaveChatContents();
+            ChatContents2show();
+        }
+        else if (event.type == RTC_EVENT_RESPONSE_TEXT)
+        {
+            // Shown while it arrives, kept in the history once the response ended
+            m_rtcResponseText += event.text;
+            ChatContents2show();
+            m_chatContentShow += "assistant: " + m_rtcResponseText + "\n";
+        }
+        else if (event.type == RTC_EVENT_EMOTION)
+        {
+            m_emotionShow = event.text;
+            CWindow::GetInstance()->Wake();
+        }
+        else if (event.type == RTC_EVENT_RESPONSE_END)
+        {
+            if (m_rtcResponseText.empty())
+                continue;
+            Json::Value chatContent;
+            chatContent["role"] = "assistant";
+            chatContent["content"] = m_rtcResponseText;
+            m_chatContents.append(chatContent);
+            m_rtcResponseText.clear();
+            SaveChatContents();
+            ChatContents2show();
+        }
+        else if (event.type == RTC_EVENT_ERROR)
+            AddChatCommand(&m_chatCommands2World, {CHAT_COMMAND_ERROR, event.text});
+    }
 }
 
 std::string CChat::CheckChatConfig()
@@ -172,6 +866,14 @@ std::string CChat::CheckChatConfig()
 
     std::string error;
 
+    if (m_pWorld->m_configChat.mode == CHAT_MODE_RTC)
+    {
+        // The realtime server does completion and synthesis
+        if (m_pWorld->m_configChat.rtcUrl[0] == '\0')
+            error += TRAN("! Realtime server url is not set.\n");
+        return error;
+    }
+
     // Check openai key
     if (m_pWorld->m_configGeneral.openAIAPIKey[0] == '\0' || m_pWorld->m_configLLM.LLMApiUrl[0] == '\0')
         error += TRAN("! LLM API key is not set.\n");
@@ -314,70 +1016,424 @@ bool CChat::ChatCompletion(SChatResponse &chatResponse)
     std::cout << chatResponse.text << std::endl;
     std::cout << chatResponse.emoMotion << std::endl;
 
-    m_emotionShow = chatResponse.emoMotion;
+    return true;
+}
+
+bool CChat::WritePlayBuffer(const short *pcm, int samples, int sampleRate)
+{
+    // The device rate is known once the sound thread opened the stream
+    int playRate = m_streamPlayUserData.sampleRate.load(std::memory_order_acquire);
+    while (playRate == 0 && !m_decodeQuit)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        playRate = m_streamPlayUserData.sampleRate.load(std::memory_order_acquire);
+    }
+    if (playRate < 0)
+        return false;
+
+    // First frame of a stream or the output was reopened at another rate,
+    // the filter bank is only rebuilt when the rates or quality changed
+    if (!m_resampleConfigured || playRate != m_resampleOutRate)
+    {
+        m_resampler.Configure(sampleRate, playRate, m_resampleQuality);
+        m_lipEnvelope.Configure(playRate);
+        m_resampleConfigured = true;
+        m_resampleOutRate = playRate;
+    }
+
+    m_resampleBuffer.resize(m_resampler.GetMaxOutput(samples));
+    int count = m_resampler.Process(pcm, samples, m_resampleBuffer.data());
+
+    if (m_recordTurn)
+    {
+        for (int i = 0; i < count; i++)
+            m_streamPCM.push_back((short)std::min(std::max(m_resampleBuffer[i] * 32768.0f, -32768.0f), 32767.0f));
+    }
 
+    // Mixed with the tail of the previous segment, the own tail held back for the next one
+    const float *out;
+    count = m_segments.Feed(m_resampleBuffer.data(), count, playRate, m_streamPlayBuffer.WritePos(), &out);
+    WriteRing(out, count);
     return true;
 }
 
-void CChat::DecodeMP3(bool last_chunk) {
-    mp3dec_frame_info_t info;
-    mp3dec_t mp3d;
-    while (true)
+void CChat::WriteRing(const float *out, int count)
+{
+    // Ring is bounded, wait for the playback to drain it
+    m_jitterBuffer.OnWrite(count);
+    while (count > 0 && !m_decodeQuit)
     {
-        auto input_buf = (const uint8_t *)(m_streamDecodeBuffer.buffer + m_streamDecodeBuffer.readPos);
-        int buf_size = m_streamDecodeBuffer.writePos - m_streamDecodeBuffer.readPos;
-        /*unsigned char *input_buf; - input byte stream*/
-        int samples = mp3dec_decode_frame(&mp3d, input_buf, buf_size, m_streamPlayBuffer.buffer + m_streamPlayBuffer.writePos, &info);
+        uint64_t pos = m_streamPlayBuffer.WritePos();
+        int written = (int)m_streamPlayBuffer.Write(out, count);
+        m_lipEnvelope.Push(pos, out, written);
+        out += written;
+        count -= written;
+        if (count > 0)
+        {
+            m_jitterBuffer.OnOverrun();
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+}
 
-        if (samples == 0 && info.frame_bytes == 0)
-            break;
-        m_streamPlayBuffer.writePos += samples;
-        m_streamDecodeBuffer.readPos += info.frame_bytes;
+void CChat::ReleaseSegmentTail()
+{
+    int playRate = m_streamPlayUserData.sampleRate.load(std::memory_order_acquire);
+    if (playRate <= 0)
+        return;
 
-        if (!last_chunk && buf_size < MP3_DECODE_CHUNK_SIZE / 2) // 32768 / 2
-            break;
+    // Written once the ring runs low and no next segment took it over
+    const float *out;
+    uint64_t writePos = m_streamPlayBuffer.WritePos();
+    int count = m_segments.Release(playRate, writePos, writePos - m_streamPlayBuffer.ReadPos(), &out);
+    if (count > 0)
+        WriteRing(out, count);
+}
+
+int CChat::DecodeStream(bool lastChunk, short *pcm)
+{
+    CAudioDecoder *decoder = m_decoder.load(std::memory_order_acquire);
+    if (!decoder)
+        return -1;
+
+    const char *data;
+    uint64_t available = m_streamBytes.Available();
+    uint64_t contiguous = m_streamBytes.PeekContiguous(&data);
+    size_t consumed = 0;
+
+    // Decode in place, the network thread wrote these bytes once
+    int samples = decoder->DecodeFrame((const uint8_t *)data, contiguous, lastChunk && contiguous == available, pcm, consumed);
+    if (samples < 0 && contiguous < available)
+    {
+        // Frame straddles the ring wrap, assemble it in the carry buffer
+        uint64_t count = m_streamBytes.Peek((char *)m_decodeCarry, sizeof(m_decodeCarry));
+        samples = decoder->DecodeFrame(m_decodeCarry, count, lastChunk && count == available, pcm, consumed);
+    }
+
+    if (samples >= 0)
+        m_streamBytes.Skip(consumed);
+    else if (samples == AUDIO_DECODER_ERROR)
+    {
+        // Nothing of it plays, drain the ring so the network thread never waits on it
+        m_streamBytes.Skip(available);
+        if (!m_decodeFailed)
+        {
+            m_decodeFailed = true;
+            AddChatCommand(&m_chatCommands2World, {CHAT_COMMAND_ERROR, m_pWorld->T("Unsupported audio format from synthesis.")});
+        }
+    }
+    return samples;
+}
+
+void CChat::DecodeThread()
+{
+    short pcm[AUDIO_DECODER_MAX_FRAME_SAMPLES];
+    bool idle = true;
+
+    while (!m_decodeQuit)
+    {
+        // BeginStream() only clears the flag, the turn's input begins on this thread before any of its audio
+        if (idle && !m_decodeIdle.load(std::memory_order_acquire))
+        {
+            m_jitterBuffer.BeginInput();
+            idle = false;
+        }
+
+        ReleaseSegmentTail();
+        if (idle)
+        {
+            // Between turns, so a conversion never holds up a stream
+            m_mixer.Convert();
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            continue;
+        }
+
+        // Read the flag first, every byte is in the ring once it is set
+        bool ended = m_streamEnded.load(std::memory_order_acquire);
+        int samples = DecodeStream(ended, pcm);
+
+        if (samples > 0)
+        {
+            if (m_turnTimings.firstAudio < 0)
+                m_turnTimings.Mark(m_turnTimings.firstAudio);
+            WritePlayBuffer(pcm, samples, m_decoder.load(std::memory_order_relaxed)->GetSampleRate());
+        }
+        else if (samples < 0)
+        {
+            if (ended)
+            {
+                m_segments.End(m_streamPlayBuffer.WritePos());
+                m_jitterBuffer.EndInput();
+                m_decodeIdle.store(true, std::memory_order_release);
+                idle = true;
+            }
+            else
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+    }
+}
+
+bool CChat::StreamDecode(const std::string &data, intptr_t userdata)
+{
+    if (m_recordTurn)
+        m_streamDecodeBuffer.insert(m_streamDecodeBuffer.end(), data.begin(), data.end());
+
+    // Hand off to the decode thread, wait only if it is a full ring behind
+    const char *bytes = data.data();
+    uint64_t size = data.size();
+    while (size > 0 && !m_decodeQuit)
+    {
+        uint64_t written = m_streamBytes.Write(bytes, size);
+        bytes += written;
+        size -= written;
+        if (size > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
     }
+    return true; // Return `true` on success, or `false` to **cancel** the transfer.
 }
 
-bool CChat::StreamDecode(std::string data, intptr_t userdata)
+bool CChat::SelectDecoder(const std::string &contentType, const std::string &data)
 {
-    if (m_streamDecodeBuffer.writePos + data.size() > STREAM_BUFFER_SIZE)
+    CAudioDecoder *decoder = CAudioDecoder::Create(contentType, data.data(), data.size());
+    if (!decoder)
     {
-        std::cout << "StreamDecode buffer overflow!" << std::endl;
+        // Nothing of the turn plays, TTS() reports it failed
+        if (!m_decodeFailed)
+        {
+            m_decodeFailed = true;
+            std::cout << "Unsupported synthesis stream: " << contentType << std::endl;
+            AddChatCommand(&m_chatCommands2World, {CHAT_COMMAND_ERROR, m_pWorld->T("Unsupported audio format from synthesis.")});
+        }
         return false;
     }
+    std::cout << "Synthesis stream: " << contentType << " -> " << decoder->GetName() << std::endl;
 
-    memcpy(m_streamDecodeBuffer.buffer + m_streamDecodeBuffer.writePos, data.c_str(), data.size());
-    m_streamDecodeBuffer.writePos += data.size();
+    // Published before the first byte reaches the ring
+    m_decoder.store(decoder, std::memory_order_release);
+    return true;
+}
 
-    int buf_size = m_streamDecodeBuffer.writePos - m_streamDecodeBuffer.readPos;
+void CChat::BeginStream(const SSegmentInfo &info, bool record)
+{
+    // The decode thread is idle, it only releases segment tails until the flag below is cleared.
+    // Nothing reset here is touched on that path, segments are queued and the jitter input begins on its side.
+    m_streamDecodeBuffer.clear();
+    m_streamPCM.clear();
+    delete m_decoder.exchange(nullptr);
+    m_resampleQuality = m_pWorld->m_configAudio.resampleQuality;
+    m_resampleConfigured = false;
+    m_recordTurn = record && m_pWorld->m_configAudio.record;
+    m_streamBytes.Flush();
+    m_segments.Begin(info); // Behind what is still playing, InterruptStream() to replace it
+
+    m_streamEnded.store(false, std::memory_order_release);
+    m_decodeFailed = false;
+    m_decodeIdle.store(false, std::memory_order_release);
+}
 
-    if (buf_size > MP3_DECODE_CHUNK_SIZE) 
-        DecodeMP3();
-    return true; // Return `true` on success, or `false` to **cancel** the transfer.
+void CChat::EndStream()
+{
+    m_streamEnded.store(true, std::memory_order_release);
+    while (!m_decodeIdle.load(std::memory_order_acquire) && !m_decodeQuit)
+    {
+        PollPlayback(); // The turn is heard while it is still arriving
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+}
+
+void CChat::InterruptStream()
+{
+    // The decode thread may wait for room in the play ring, keep both rings empty until it is idle
+    m_streamEnded.store(true, std::memory_order_release);
+    while (!m_decodeIdle.load(std::memory_order_acquire) && !m_decodeQuit)
+    {
+        m_streamBytes.Flush();
+        m_streamPlayBuffer.Flush();
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    m_streamPlayBuffer.Flush();
+    m_audioDsp.NotifyFlush();
+    m_segments.Interrupt();
+}
+
+void CChat::PollPlayback()
+{
+    SSegmentEvent event;
+    while (m_segments.PollEvent(event))
+    {
+        const SSegmentInfo &info = event.info;
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::time_point(std::chrono::nanoseconds(event.audibleNs)) - std::chrono::steady_clock::now()).count();
+        if (event.type == SEGMENT_STARTED)
+        {
+            std::cout << "Playback: turn " << info.turn << " segment " << info.index << " started, audible in " << ms << " ms" << std::endl;
+            m_mixer.Stop(MIXER_VOICE_FILLER);
+            if (!info.emotion.empty())
+                m_emotionShow = info.emotion;
+            // Lips and the emotion move from now, the window may idle
+            CWindow::GetInstance()->Wake();
+            if (info.turn == m_timedTurn && m_turnTimings.heard < 0)
+                m_turnTimings.heard = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::time_point(std::chrono::nanoseconds(event.audibleNs)) - m_turnTimings.start).count();
+        }
+        else
+            std::cout << "Playback: turn " << info.turn << " segment " << info.index << (event.interrupted ? " interrupted" : " finished")
+                      << ", audible in " << ms << " ms" << std::endl;
+    }
+}
+
+void CChat::STurnTimings::Reset()
+{
+    start = std::chrono::steady_clock::now();
+    llm = ttsRequest = streamFirstByte = firstAudio = total = heard = -1;
 }
 
-typedef struct WAV_HEADER {
-  /* RIFF Chunk Descriptor */
-  uint8_t RIFF[4] = {'R', 'I', 'F', 'F'}; // RIFF Header Magic header
-  uint32_t ChunkSize;                     // RIFF Chunk Size
-  uint8_t WAVE[4] = {'W', 'A', 'V', 'E'}; // WAVE Header
-  /* "fmt" sub-chunk */
-  uint8_t fmt[4] = {'f', 'm', 't', ' '}; // FMT header
-  uint32_t Subchunk1Size = 16;           // Size of the fmt chunk
-  uint16_t AudioFormat = 1; // Audio format 1=PCM,6=mulaw,7=alaw,     257=IBM
-                            // Mu-Law, 258=IBM A-Law, 259=ADPCM
-  uint16_t NumOfChan = 1;   // Number of channels 1=Mono 2=Sterio
-  uint32_t SamplesPerSec = 44100;   // Sampling Frequency in Hz
-  uint32_t bytesPerSec = 44100 * 2; // bytes per second
-  uint16_t blockAlign = 2;          // 2=16-bit mono, 4=16-bit stereo
-  uint16_t bitsPerSample = 16;      // Number of bits per sample
-  /* "data" sub-chunk */
-  uint8_t Subchunk2ID[4] = {'d', 'a', 't', 'a'}; // "data"  string
-  uint32_t Subchunk2Size;                        // Sampled data length
-} wav_hdr;
-
-void CChat::TTS(SChatResponse &chatResponse)
+double CChat::STurnTimings::Mark(double &stage)
+{
+    stage = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return stage;
+}
+
+void CChat::STurnTimings::Print()
+{
+    std::cout << "Turn timings(ms): llm " << llm
+              << ", tts request " << ttsRequest
+              << ", stream first byte " << streamFirstByte
+              << ", first audio " << firstAudio
+              << ", total " << total
+              << ", heard " << heard << std::endl;
+}
+
+static std::string GetUrlOrigin(const std::string &url)
+{
+    auto schemeEnd = url.find("://");
+    if (schemeEnd == std::string::npos)
+        return "";
+    auto pathStart = url.find('/', schemeEnd + 3);
+    return url.substr(0, pathStart);
+}
+
+void CChat::WarmUpTTS()
+{
+    if (m_warmUp.valid())
+        m_warmUp.wait();
+
+    // Runs while the LLM is thinking, so the TLS handshakes are done before synthesis starts
+    std::string streamOrigin = m_streamOrigin;
+    m_warmUp = std::async(std::launch::async, [this, streamOrigin]()
+    {
+        m_reechoSession.SetUrl(cpr::Url{REECHO_API_URL});
+        m_reechoSession.SetTimeout(cpr::Timeout{3000});
+        m_reechoSession.Head();
+
+        if (!streamOrigin.empty())
+        {
+            m_streamSession.SetUrl(cpr::Url{streamOrigin});
+            m_streamSession.SetTimeout(cpr::Timeout{3000});
+            m_streamSession.Head();
+        }
+    });
+}
+
+static void ParseContentType(const std::string &header, std::string &contentType)
+{
+    const std::string key = "content-type:";
+    if (header.size() > key.size() && strncasecmp(header.c_str(), key.c_str(), key.size()) == 0)
+    {
+        contentType = header.substr(key.size());
+        std::transform(contentType.begin(), contentType.end(), contentType.begin(), ::tolower);
+    }
+}
+
+bool CChat::OnSynthesisHeader(const std::string &header, intptr_t userdata)
+{
+    ParseContentType(header, m_synthesisContentType);
+    return true;
+}
+
+bool CChat::OnStreamHeader(const std::string &header, intptr_t userdata)
+{
+    ParseContentType(header, m_streamContentType);
+    return true;
+}
+
+bool CChat::OnSynthesisData(const std::string &data, intptr_t userdata)
+{
+    // Direct streaming: the synthesis response itself is the audio stream
+    if (m_synthesisContentType.find("audio/") != std::string::npos)
+    {
+        if (!m_synthesisStreamed)
+        {
+            m_synthesisStreamed = true;
+            m_turnTimings.Mark(m_turnTimings.ttsRequest);
+            m_turnTimings.Mark(m_turnTimings.streamFirstByte);
+            if (!SelectDecoder(m_synthesisContentType, data))
+                return false;
+        }
+        return StreamDecode(data, userdata);
+    }
+
+    m_synthesisBody += data;
+    return true;
+}
+
+bool CChat::OnStreamData(const std::string &data, intptr_t userdata)
+{
+    if (m_turnTimings.streamFirstByte < 0)
+    {
+        m_turnTimings.Mark(m_turnTimings.streamFirstByte);
+        if (!SelectDecoder(m_streamContentType, data))
+            return false;
+    }
+    return StreamDecode(data, userdata);
+}
+
+long CChat::PostSynthesis(Json::Value &data, Json::Value &response)
+{
+    if (!m_pWorld->CheckReechoRequestConfig())
+        return -1;
+
+    bool directStream = m_pWorld->m_configChat.directStream;
+    cpr::Header header{{"Authorization", std::string("Bearer ") + m_pWorld->m_configGeneral.reechoKey},
+                       {"Content-Type", "application/json"}};
+    if (directStream)
+        header["Accept"] = std::string(CONFIG_STREAM_FORMAT_TYPES[m_pWorld->m_configChat.streamFormat]) + ", application/json";
+
+    m_synthesisContentType = "";
+    m_synthesisBody = "";
+    m_synthesisStreamed = false;
+
+    m_reechoSession.SetUrl(cpr::Url{std::string(REECHO_API_URL) + "/tts/simple-generate"});
+    m_reechoSession.SetHeader(header);
+    m_reechoSession.SetBody(cpr::Body{data.toStyledString()});
+    m_reechoSession.SetTimeout(cpr::Timeout{directStream ? 100000 : 10000});
+
+    cpr::Response r = m_reechoSession.Post();
+
+    if (m_synthesisStreamed)
+        return r.status_code;
+
+    // Callback consumed the body, hand it back for the regular JSON path
+    r.text = m_synthesisBody;
+    return m_pWorld->ParseReechoResponse(r, response);
+}
+
+bool CChat::FetchStream(const std::string &url)
+{
+    m_streamOrigin = GetUrlOrigin(url);
+    m_streamContentType = "";
+
+    m_streamSession.SetUrl(cpr::Url{url});
+    m_streamSession.SetTimeout(cpr::Timeout{100000}); // Max 100s
+    cpr::Response r = m_streamSession.Get();
+
+    if (r.status_code != 200)
+    {
+        std::cout << "Stream fetch failed: " << r.status_code << " " << r.error.message << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool CChat::TTS(SChatResponse &chatResponse)
 {
     // TTS
     Json::Value response = Json::Value();
@@ -411,53 +1467,68 @@ void CChat::TTS(SChatResponse &chatResponse)
     data["break_clone"] = false;
     data["flash"] = true;
     data["stream"] = true;
+    if (m_pWorld->m_configChat.streamFormat != 0)
+        data["format"] = CONFIG_STREAM_FORMATS[m_pWorld->m_configChat.streamFormat];
 
     std::cout << "Request to synthesis: " << data << std::endl;
 
-    std::string url = "/tts/simple-generate";
-    auto parameters = cpr::Parameters();
-    auto state_code = m_pWorld->ReechoPost(url, data, response);
-    std::cout << "Response from synthesis: " << response << std::endl;
-
-    if ((state_code != 200) || (response["status"] && response["status"] != 200))
-    {
-        AddChatCommand(&m_chatCommands2World, {CHAT_COMMAND_ERROR, m_pWorld->T("Failed to synthesis voice.")});
-        return;
-    }
-
-    cpr::Session session;
-    session.SetUrl(cpr::Url{(response["data"]["streamUrl"].asString())});
-    // session.SetTimeout(cpr::Timeout{100000}); // Max 100s
-
-    m_streamDecodeBuffer.writePos = 0;
-    m_streamDecodeBuffer.readPos = 0;
-
-    m_streamPlayBuffer.writePos = 0; // Set write index to 0 first
-    m_streamPlayBuffer.readPos = 0;
-
-    session.SetWriteCallback(cpr::WriteCallback{std::bind(&CChat::StreamDecode, this, std::placeholders::_1, std::placeholders::_2), (intptr_t)nullptr});
-    cpr::Response r = session.Get();
-    DecodeMP3(true); // Decode the remaining data
+    m_timedTurn = m_turn.fetch_add(1, std::memory_order_relaxed) + 1;
+    BeginStream({m_timedTurn, 0, chatResponse.emoMotion, 0, (int)chatResponse.text.size()});
 
-    // Save m_streamDecodeBuffer to mp3
-    std::ofstream outMP3("test.mp3", std::ios::binary);
-    outMP3.write(reinterpret_cast<const char *>(m_streamDecodeBuffer.buffer), m_streamDecodeBuffer.writePos);
-    outMP3.close();
+    if (m_warmUp.valid())
+        m_warmUp.wait();
 
-    // Save m_streamPlayBuffer to wav
-    static_assert(sizeof(wav_hdr) == 44, "");
-    wav_hdr wav;
-    uint32_t fsize = m_streamPlayBuffer.writePos * 2;
-    wav.ChunkSize = fsize + sizeof(wav_hdr) - 8;
-    wav.Subchunk2Size = fsize + sizeof(wav_hdr) - 44;
+    auto state_code = PostSynthesis(data, response);
 
-    std::ofstream out("test.wav", std::ios::binary);
-    out.write(reinterpret_cast<const char *>(&wav), sizeof(wav));
-
-    out.write(reinterpret_cast<const char *>(m_streamPlayBuffer.buffer), fsize);
+    if (!m_synthesisStreamed)
+    {
+        m_turnTimings.Mark(m_turnTimings.ttsRequest);
+        std::cout << "Response from synthesis: " << response << std::endl;
 
-    out.close();
+        if ((state_code != 200) || (response["status"] && response["status"] != 200))
+        {
+            AddChatCommand(&m_chatCommands2World, {CHAT_COMMAND_ERROR, m_pWorld->T("Failed to synthesis voice.")});
+            EndStream();
+            return false;
+        }
 
+        if (!FetchStream(response["data"]["streamUrl"].asString()))
+        {
+            AddChatCommand(&m_chatCommands2World, {CHAT_COMMAND_ERROR, m_pWorld->T("Failed to synthesis voice.")});
+            EndStream();
+            return false;
+        }
+    }
+    else if (state_code != 200)
+    {
+        AddChatCommand(&m_chatCommands2World, {CHAT_COMMAND_ERROR, m_pWorld->T("Failed to synthesis voice.")});
+        EndStream();
+        return false;
+    }
+    EndStream(); // Wait for the decode thread to drain the remaining data
+    m_turnTimings.Mark(m_turnTimings.total);
+    m_turnTimings.Print();
+
+    SJitterStats jitterStats;
+    m_jitterBuffer.GetStats(jitterStats);
+    std::cout << "Jitter buffer: target " << jitterStats.targetMs << " ms"
+              << ", turn needed " << jitterStats.requiredMs << " ms"
+              << ", throughput " << jitterStats.throughput << "x"
+              << ", underruns " << jitterStats.underruns
+              << ", overruns " << jitterStats.overruns << std::endl;
+
+    if (m_recordTurn)
+    {
+        // Handed over, the next turn starts with empty buffers
+        SRecordedTurn turn;
+        turn.stream = std::move(m_streamDecodeBuffer);
+        CAudioDecoder *decoder = m_decoder.load();
+        turn.streamFormat = decoder ? decoder->GetName() : "bin";
+        turn.pcm = std::move(m_streamPCM);
+        turn.sampleRate = m_resampleOutRate;
+        m_recorder.Submit(std::move(turn), CPlat::GetExecuteAbsolutePath() + "/" + RECORDER_DIRECTORY, m_pWorld->m_configAudio.recordKeepTurns);
+    }
+    return !m_decodeFailed;
 }
 
 void CChat::Run()
@@ -474,12 +1545,16 @@ void CChat::Run()
                 break;
             else if (cmd.cmd == CHAT_COMMAND_RELOAD_CONFIG)
             {
+                UpdateVoiceInput();
+                UpdateFiller();
                 std::string error = CheckChatConfig();
                 if (!error.empty())
                 {
                     AddChatCommand(&m_chatCommands2World, {CHAT_COMMAND_ERROR, error});
                     m_running = false;
                 }
+                else if (m_mode == CHAT_MODE_RTC)
+                    m_running = true; // No voice character, the realtime server speaks itself
                 else
                 {
                     m_running = true;
@@ -554,15 +1629,36 @@ void CChat::Run()
                 chatContent["content"] = cmd.content;
                 m_chatContents.append(chatContent);
 
+                if (m_mode == CHAT_MODE_RTC)
+                {
+                    // Answered like speech, through PollRtc()
+                    m_rtc.SendText(cmd.content);
+                    SaveChatContents();
+                    ChatContents2show();
+                    continue;
+                }
+
+                m_turnTimings.Reset();
+                WarmUpTTS();
+                // Covers the wait for the reply, ducked and stopped once the reply is heard
+                if (m_fillerClip)
+                    m_mixer.Play(MIXER_VOICE_FILLER, *m_fillerClip);
+
                 SChatResponse chatResponse;
 
-                if (!ChatCompletion(chatResponse)) 
+                if (!ChatCompletion(chatResponse))
+                {
+                    m_mixer.Stop(MIXER_VOICE_FILLER);
                     continue;
+                }
+                m_turnTimings.Mark(m_turnTimings.llm);
 
                 SaveChatContents();
                 ChatContents2show();
 
-                TTS(chatResponse);
+                // A failed synthesis or an unsupported stream never starts a segment to stop the filler
+                if (!TTS(chatResponse))
+                    m_mixer.Stop(MIXER_VOICE_FILLER);
             }
 
             if (cmd.cmd != CHAT_COMMAND_CHAT)
@@ -572,6 +1668,18 @@ void CChat::Run()
             }
         }
 
+        PollVoiceInput();
+        PollRtc();
+        PollPlayback();
+
         std::this_thread::sleep_for(std::chrono::milliseconds(10));
     }
-}
\ No newline at end of file
+
+    // The receiver blocks on its socket until the process exits
+    t.detach();
+    m_rtc.Stop();
+    m_asr.Stop();
+    m_capture.Stop();
+    StopSoundPlay();
+    m_recorder.Stop();
+}
@@ -7,22 +7,71 @@
 #include <queue>
 #include <thread>
 #include <vector>
+#include <future>
+#include <chrono>
+#include <atomic>
+#include <cmath>
+#include <cpr/cpr.h>
 #include <json/json.h>
+#include "audioRing.hpp"
+#include "audioDecoder.hpp"
+#include "audioResampler.hpp"
+#include "audioOutput.hpp"
+#include "audioDsp.hpp"
+#include "audioLipSync.hpp"
+#include "audioJitter.hpp"
+#include "audioSegment.hpp"
+#include "audioMixer.hpp"
+#include "audioSink.hpp"
+#include "audioRecorder.hpp"
+#include "audioRealtime.hpp"
+#include "audioCapture.hpp"
+#include "asrClient.hpp"
+#include "rtc.hpp"
 
-#define STREAM_BUFFER_SIZE 44100 * 60 * 10 // 10 minutes
-#define MP3_DECODE_CHUNK_SIZE 65536
-template <typename _T>
-struct SStreamBuffer
+#define PLAY_BUFFER_MS 10000 // Producer waits when the ring is full
+#define STREAM_BYTES_SIZE (1 << 18) // Compressed bytes between network and decode thread
+#define RECORDER_DIRECTORY "recordings" // Next to the executable
+
+enum EChatMode
 {
-    _T buffer[STREAM_BUFFER_SIZE]; 
-    int readPos;
-    int writePos;
+    CHAT_MODE_TTS = 0, // LLM completion, then synthesis
+    CHAT_MODE_RTC,     // Full-duplex voice with a realtime server
+    CHAT_MODE_COUNT,
 };
 
 struct SStreamPlayUserData
 {
-    int* lipEnergy;
-    SStreamBuffer<short>* streamBuffer;
+    CLipEnvelope* lipEnvelope;
+    CAudioRing<float>* streamBuffer;
+    std::atomic<int> sampleRate; // Negotiated with the device, 0 while opening, -1 without output
+    SAudioWriter writer;         // Write path for the negotiated format and layout
+    CAudioDsp* dsp;
+    CJitterBuffer* jitterBuffer;
+    CEchoReference* echoReference; // Tapped after the DSP while the capture cancels echo
+    CSegmentQueue* segments;       // Boundaries matched to the rendered frames
+    CAudioMixer* mixer;            // Clip voices on top of the speech
+    CAudioSink* sink;              // nullptr plays on the default device
+
+    std::atomic<struct SoundIo*> soundio; // Woken to reopen or quit
+    std::atomic<bool> quit;
+    std::atomic<bool> exited;
+    std::atomic<bool> reopen;           // Stream error, set from any thread
+    std::atomic<int> lastError;
+    std::atomic<int> targetLatencyMs;   // Requested, 0 for the backend default
+    std::atomic<double> latency;        // Achieved software latency in seconds
+    std::atomic<int> underflows;
+    std::atomic<int> errors;
+    std::atomic<int> reopens;
+    CAudioCallbackTimer callbackTimer;
+    std::atomic<bool> callbackThreadSet; // By the first callback of a stream, promoted by the sound thread
+    pthread_t callbackThread;
+
+    // Sound thread only
+    bool devicesChanged;
+    bool backendLost;
+    int openedLatencyMs;
+    int openedSampleRate;
 };
 
 class CChat
@@ -75,10 +124,66 @@ public:
 
     bool IsRunning() { return m_running; };
 
+    // Lock-free, called by the UI every frame
+    void SetPlaybackParams(int volume, bool limiter, int minPrebufferMs, int crossfadeMs) {
+        float gain = volume / 100.0f;
+        m_audioDsp.SetVolume(gain * gain); // Closer to perceived loudness than linear
+        m_audioDsp.SetLimiter(limiter);
+        m_jitterBuffer.SetMinPrebuffer(minPrebufferMs);
+        m_segments.SetCrossfade(crossfadeMs);
+        m_mixer.SetVolume(gain * gain);
+    };
+    // Lock-free, called by the UI every frame. Gains in percent like the volume, ducking in dB under speech.
+    void SetMixerParams(int motionGain, int motionDuckDb, int fillerGain, int fillerDuckDb) {
+        float motion = motionGain / 100.0f, filler = fillerGain / 100.0f;
+        m_mixer.SetGain(MIXER_VOICE_MOTION, motion * motion);
+        m_mixer.SetDucking(MIXER_VOICE_MOTION, powf(10.0f, -motionDuckDb / 20.0f));
+        m_mixer.SetGain(MIXER_VOICE_FILLER, filler * filler);
+        m_mixer.SetDucking(MIXER_VOICE_FILLER, powf(10.0f, -fillerDuckDb / 20.0f));
+    };
+    // Any thread, converted on the decode thread once the output rate is known
+    void PrepareClip(const CAudioClip &clip) { m_mixer.Prepare(clip); };
+    // Any thread, e.g. the sound of a Live2D motion. Only enqueues, false without an output or before the clip is converted.
+    bool PlayClip(int voice, const CAudioClip &clip) { return m_mixer.Play(voice, clip); };
+
+    // Reopens the output when the value changed, 0 for the backend default
+    void SetOutputLatency(int ms);
+
+    // Called by the UI every frame, applied between utterances
+    void SetVadParams(int thresholdDb, int hangoverMs, int minSpeechMs) {
+        m_capture.SetParams({(float)thresholdDb, hangoverMs, minSpeechMs, VAD_MAX_SPEECH_MS, VAD_PRE_ROLL_MS});
+    };
+    // Called by the UI every frame, cancels the output's echo from the microphone
+    void SetEchoCancel(bool enabled) { m_capture.SetEchoCancel(enabled); };
+    void GetCaptureStats(SCaptureStats &stats) { m_capture.GetStats(stats); };
+    void GetAsrStats(SAsrStats &stats) { m_asr.GetStats(stats); };
+    void GetRtcStats(SRtcStats &stats) { m_rtc.GetStats(stats); };
+
+    struct SOutputStats
+    {
+        int sampleRate;   // 0 without an open output
+        double latencyMs; // Achieved software latency
+        int underflows;
+        int errors;
+        int reopens;
+        SAudioCallbackStats callback;
+        int violations[AUDIO_RT_VIOLATION_COUNT]; // Debug builds, see CAudioRtScope
+    };
+    void GetOutputStats(SOutputStats &stats);
+    // Runs a file, or synthesized segments, through the playback path into an unthrottled null sink,
+    // or a WAV file, and checks the segment events against the ring positions.
+    static void BenchmarkPlayback(const char *inFile, const char *outFile);
+
+    // Seconds from a frame leaving the callback until it is heard, 0 without an open output
+    double GetOutputLatency() { return m_streamPlayUserData.sampleRate.load() > 0 ? m_streamPlayUserData.latency.load(std::memory_order_relaxed) : 0.0; };
+
     std::string m_systemPromptShow;
     std::string m_chatContentShow;
     std::string m_emotionShow;
-    int m_lipEnergyShow;
+    std::string m_voiceTextShow; // Partial, then final transcript of the last utterance
+    // Mouth opening for the audio heard right now, 0 to 1
+    float GetLipValue() { return m_lipEnvelope.Sample(); };
+    void GetLipVisemes(float weights[VISEME_COUNT]) { m_lipEnvelope.SampleVisemes(weights); };
 
     struct SChatResponse
     {
@@ -86,8 +191,24 @@ public:
         std::string emoMotion;
     };
 
+    // Milliseconds since the user message was received, -1 if not reached.
+    struct STurnTimings
+    {
+        std::chrono::steady_clock::time_point start;
+        double llm;             // LLM completion parsed
+        double ttsRequest;      // Synthesis request answered (streamUrl or first audio byte)
+        double streamFirstByte; // First MP3 byte received
+        double firstAudio;      // First PCM samples ready for playback
+        double total;           // Stream fully received and decoded
+        double heard;           // First segment of the turn heard, by the output clock
+
+        void Reset();
+        double Mark(double &stage);
+        void Print();
+    };
+
 private:
-    int m_mode; // 0: LLM+TTS 1: RTC
+    int m_mode; // EChatMode, taken from the config on reload
     class CWorld* m_pWorld;
     bool m_running;
 
@@ -97,7 +218,27 @@ private:
 
     void StartRecv();
     bool ChatCompletion(SChatResponse& chatResponse);
-    void TTS(SChatResponse& chatResponse);
+    bool TTS(SChatResponse& chatResponse); // False when nothing of the reply can be heard
+
+    // Keep-alive sessions so synthesis and stream fetch reuse warm connections
+    cpr::Session m_reechoSession;
+    cpr::Session m_streamSession;
+    std::string m_streamOrigin; // scheme://host of the last streamUrl
+    std::future<void> m_warmUp;
+    void WarmUpTTS();
+    long PostSynthesis(Json::Value &data, Json::Value &response);
+    bool FetchStream(const std::string &url);
+
+    std::string m_synthesisContentType;
+    std::string m_streamContentType;
+    std::string m_synthesisBody;
+    bool m_synthesisStreamed;
+    bool OnSynthesisHeader(const std::string &header, intptr_t userdata);
+    bool OnStreamHeader(const std::string &header, intptr_t userdata);
+    bool OnSynthesisData(const std::string &data, intptr_t userdata);
+    bool OnStreamData(const std::string &data, intptr_t userdata);
+
+    STurnTimings m_turnTimings;
 
     std::string m_chatContentsJsonPath;
     Json::Value m_chatContents;
@@ -106,14 +247,80 @@ private:
 
     Json::Value m_voiceCharacterInfo;
 
-    bool StreamDecode(std::string data, intptr_t userdata);
-    void DecodeMP3(bool last_chunk = false);
+    // Network thread side, hands compressed bytes to the decode thread
+    bool StreamDecode(const std::string &data, intptr_t userdata);
+    bool SelectDecoder(const std::string &contentType, const std::string &data);
+    // A stream is one playback segment, queued behind what is still playing
+    void BeginStream(const SSegmentInfo &info, bool record = true);
+    void EndStream();
+    void InterruptStream(); // Drops the stream and what is left of it in the play ring
+    void PollPlayback();    // Chat thread, segment started / finished events
+
+    // Decode thread, turns m_streamBytes into PCM in m_streamPlayBuffer
+    void DecodeThread();
+    int DecodeStream(bool lastChunk, short* pcm);
+    bool WritePlayBuffer(const short* pcm, int samples, int sampleRate);
+    void WriteRing(const float* pcm, int count);
+    void ReleaseSegmentTail();
+
+    std::thread* m_threadDecode;
+    CAudioRing<char> m_streamBytes;
+    std::atomic<bool> m_streamEnded;
+    std::atomic<bool> m_decodeIdle;
+    std::atomic<bool> m_decodeQuit;
+    bool m_decodeFailed; // The stream's format turned out unsupported, reported once
+    uint8_t m_decodeCarry[AUDIO_DECODER_MAX_NEED]; // Frame straddling the ring wrap
+
+    // Stream rate to device rate, on the decode thread
+    CAudioResampler m_resampler;
+    int m_resampleQuality; // Taken from the config at the start of every stream
+    bool m_resampleConfigured;
+    int m_resampleOutRate;
+    std::vector<float> m_resampleBuffer;
 
 
     std::thread* m_threadSoundPlay;
+    CAudioSink* m_audioSink; // Without sound hardware, from the config at start
+    void StopSoundPlay();
 
-    SStreamBuffer<short> m_streamPlayBuffer;
+    CAudioRing<float> m_streamPlayBuffer; // Allocated by the sound thread at the device rate
     SStreamPlayUserData m_streamPlayUserData;
+    CAudioDsp m_audioDsp; // Volume, limiter and fades, runs in the audio callback
+    CLipEnvelope m_lipEnvelope; // Filled by the decode thread, clocked by the audio callback
+    CJitterBuffer m_jitterBuffer; // Holds playback until enough of the turn is buffered
+    CEchoReference m_echoReference; // What the output played, for the capture's echo canceller
+    CSegmentQueue m_segments; // Segment boundaries on the play ring, written by the decode thread
+    CAudioMixer m_mixer;      // Motion sounds and fillers over the speech
+    CAudioClip* m_fillerClip; // Played while a reply is on its way, from the config on reload
+    std::string m_fillerFile;
+    void UpdateFiller();
+    std::atomic<int> m_turn;  // Numbers synthesis and RTC responses
+    int m_timedTurn;          // The turn m_turnTimings measures
+    std::atomic<CAudioDecoder*> m_decoder; // Chosen per stream by content type
+
+    // Opt-in, collected only while m_recordTurn, written by the recorder's thread
+    CAudioRecorder m_recorder;
+    bool m_recordTurn; // Taken from the config at the start of every stream
+    std::vector<short> m_streamPCM;
+    std::vector<char> m_streamDecodeBuffer;
+
+    // Voice input and the chat mode, restarted when their config changed on reload
+    CAudioCapture m_capture;
+    CAsrClient m_asr; // Consumes the capture's events in CHAT_MODE_TTS
+    bool m_captureEnabled;
+    int m_captureSource;
+    std::string m_captureFile;
+    std::string m_asrUrl;
+    void UpdateVoiceInput();
+    void PollVoiceInput();
 
-    SStreamBuffer<char> m_streamDecodeBuffer;
+    // CHAT_MODE_RTC, the response audio takes the synthesis playback path from the client's thread
+    CRtcClient m_rtc; // Consumes the capture's events in CHAT_MODE_RTC
+    std::string m_rtcUrl;
+    bool m_rtcBargeIn;
+    std::string m_rtcResponseText;
+    void RtcAudioBegin();
+    bool RtcAudioWrite(const std::string &format, const std::string &data);
+    void RtcAudioEnd(bool interrupted);
+    void PollRtc();
 };
\ No newline at end of file
@@ -1,3 +1,367 @@
 /**
  * Copyright(c) 2024 Reecho inc. All rights reserved.
- */
\ No newline at end of file
+ */
+
+#include "rtc.hpp"
+#include "audioCapture.hpp"
+
+#include <iostream>
+#include <sstream>
+#include <json/json.h>
+
+#define RTC_BENCH_TAIL_MS 5000 // Waited for the last response after the file was spoken
+
+static double MsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static std::string ToMessage(const Json::Value &value)
+{
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    return Json::writeString(builder, value);
+}
+
+CRtcClient::CRtcClient()
+    : m_capture(nullptr), m_bargeIn(false), m_thread(nullptr), m_utterance(-1), m_responding(false),
+      m_responseAudio(false), m_dropAudio(false), m_awaitingResponse(false), m_responseSum(0.0)
+{
+    m_quit = false;
+    m_stats = {};
+}
+
+CRtcClient::~CRtcClient()
+{
+    Stop();
+}
+
+void CRtcClient::Start(CAudioCapture *capture, const std::string &url, const SRtcAudioSink &sink, bool bargeIn)
+{
+    Stop();
+    m_capture = capture;
+    m_url = url;
+    m_sink = sink;
+    m_bargeIn = bargeIn;
+    m_nextConnect = std::chrono::steady_clock::now();
+    m_utterance = -1;
+    m_responding = false;
+    m_awaitingResponse = false;
+    m_quit = false;
+    m_thread = new std::thread(&CRtcClient::Thread, this);
+}
+
+void CRtcClient::Stop()
+{
+    if (!m_thread)
+        return;
+    m_quit = true;
+    m_thread->join();
+    delete m_thread;
+    m_thread = nullptr;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_texts.clear();
+    m_stats.connected = false;
+}
+
+void CRtcClient::SendText(const std::string &text)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_texts.push_back(text);
+}
+
+bool CRtcClient::PollEvent(SRtcEvent &event)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_events.empty())
+        return false;
+    event = std::move(m_events.front());
+    m_events.pop_front();
+    return true;
+}
+
+void CRtcClient::GetStats(SRtcStats &stats) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    stats = m_stats;
+}
+
+void CRtcClient::Push(SRtcEvent &&event)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_events.size() >= RTC_MAX_EVENTS)
+        m_events.pop_front();
+    m_events.push_back(std::move(event));
+}
+
+void CRtcClient::Thread()
+{
+    bool connected = false;
+    bool unreachable = false;
+    while (!m_quit)
+    {
+        if (!connected && std::chrono::steady_clock::now() >= m_nextConnect)
+        {
+            auto start = std::chrono::steady_clock::now();
+            std::string error;
+            Json::Value session;
+            session["type"] = "session.start";
+            session["sample_rate"] = VAD_SAMPLE_RATE;
+            if (m_socket.Connect(m_url, RTC_CONNECT_TIMEOUT_MS, error) && m_socket.SendText(ToMessage(session)))
+            {
+                std::cout << "RTC: connected to " << m_url << std::endl;
+                connected = true;
+                unreachable = false;
+                m_utterance = -1; // Joined mid utterance, the next one is sent
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stats.connected = true;
+                m_stats.connectMs = MsSince(start);
+            }
+            else
+            {
+                if (!unreachable)
+                    std::cout << "RTC: " << m_url << ": " << (error.empty() ? "send failed" : error) << ", retrying every " << RTC_RECONNECT_MS << " ms" << std::endl;
+                unreachable = true;
+                m_nextConnect = start + std::chrono::milliseconds(RTC_RECONNECT_MS);
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stats.errors++;
+            }
+        }
+
+        SVoiceEvent event;
+        while (m_capture->PollEvent(event))
+            OnVoiceEvent(event);
+
+        std::deque<std::string> texts;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            texts.swap(m_texts);
+        }
+        for (auto &text : texts)
+        {
+            Json::Value message;
+            message["type"] = "text";
+            message["text"] = text;
+            if (!m_socket.SendText(ToMessage(message)))
+            {
+                std::cout << "RTC: not connected, message dropped: " << text << std::endl;
+                continue;
+            }
+            m_awaitingResponse = true;
+            m_speechEnd = std::chrono::steady_clock::now();
+        }
+
+        // Answers are read the moment they arrive, the capture is polled between
+        std::vector<SWebSocketMessage> messages;
+        bool open = connected && m_socket.Poll(messages, CAPTURE_POLL_MS);
+        for (auto &message : messages)
+            OnMessage(message);
+
+        if (connected && !open)
+        {
+            // Closed by the server or a failed send
+            std::cout << "RTC: connection to " << m_url << " lost" << std::endl;
+            connected = false;
+            if (m_responding)
+                EndResponse(false); // What arrived still plays
+            m_socket.Close();
+            m_nextConnect = std::chrono::steady_clock::now() + std::chrono::milliseconds(RTC_RECONNECT_MS);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stats.connected = false;
+            m_stats.errors++;
+        }
+        if (!connected)
+            std::this_thread::sleep_for(std::chrono::milliseconds(CAPTURE_POLL_MS));
+    }
+
+    if (m_responding)
+        EndResponse(true);
+    m_socket.Close();
+}
+
+void CRtcClient::OnVoiceEvent(SVoiceEvent &event)
+{
+    if (event.type == VOICE_EVENT_START)
+    {
+        // The speaker stops talking as soon as the user does, also for a response that finished arriving
+        if (m_bargeIn)
+        {
+            if (m_responding)
+            {
+                EndResponse(true);
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stats.interruptions++;
+            }
+            else
+                m_sink.end(true);
+        }
+
+        Json::Value message;
+        message["type"] = "speech.start";
+        message["utterance"] = event.utterance;
+        if (m_socket.SendText(ToMessage(message)))
+            m_utterance = event.utterance;
+    }
+    if (event.utterance != m_utterance)
+        return; // Not connected at its start
+
+    if (event.type == VOICE_EVENT_START || event.type == VOICE_EVENT_AUDIO)
+        m_socket.SendBinary(event.pcm.data(), event.pcm.size() * sizeof(short));
+    else
+    {
+        Json::Value message;
+        message["type"] = event.type == VOICE_EVENT_END ? "speech.end" : "speech.cancel";
+        message["utterance"] = event.utterance;
+        m_socket.SendText(ToMessage(message));
+        m_utterance = -1;
+        if (event.type == VOICE_EVENT_END)
+        {
+            m_awaitingResponse = true;
+            m_speechEnd = event.speechEnd;
+        }
+    }
+    // A failed send closed the socket, noticed by the next Poll()
+}
+
+void CRtcClient::OnMessage(SWebSocketMessage &message)
+{
+    if (message.binary)
+    {
+        if (!m_responding || m_dropAudio)
+            return; // Interrupted, the server has not noticed yet
+
+        if (!m_responseAudio)
+        {
+            m_responseAudio = true;
+            if (m_awaitingResponse)
+            {
+                m_awaitingResponse = false;
+                double responseMs = MsSince(m_speechEnd);
+                m_responseSum += responseMs;
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stats.responses++;
+                m_stats.responseMs = responseMs;
+                m_stats.meanResponseMs = m_responseSum / m_stats.responses;
+            }
+        }
+        if (!m_sink.write(m_format, message.data))
+            m_dropAudio = true;
+        return;
+    }
+
+    Json::Value value;
+    Json::CharReaderBuilder builder;
+    std::string errors;
+    std::istringstream stream(message.data);
+    if (!Json::parseFromStream(builder, stream, &value, &errors) || !value.isObject())
+    {
+        std::cout << "RTC: unreadable message: " << message.data.substr(0, 80) << std::endl;
+        return;
+    }
+
+    std::string type = value["type"].asString();
+    if (type == "response.start")
+    {
+        if (m_responding)
+            EndResponse(false); // Replaced without an end
+        m_responding = true;
+        m_responseAudio = false;
+        m_dropAudio = false;
+        m_format = value["format"].asString();
+        m_sink.begin();
+    }
+    else if (type == "response.end")
+    {
+        if (m_responding)
+            EndResponse(false);
+    }
+    else if (type == "response.text")
+    {
+        if (m_responding)
+            Push({RTC_EVENT_RESPONSE_TEXT, value["text"].asString(), false});
+    }
+    else if (type == "response.emotion")
+    {
+        if (m_responding)
+            Push({RTC_EVENT_EMOTION, value["emotion"].asString(), false});
+    }
+    else if (type == "transcript")
+        Push({RTC_EVENT_TRANSCRIPT, value["text"].asString(), value.get("final", true).asBool()});
+    else if (type == "error")
+    {
+        std::cout << "RTC: server error: " << value["message"].asString() << std::endl;
+        Push({RTC_EVENT_ERROR, value["message"].asString(), false});
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats.errors++;
+    }
+}
+
+void CRtcClient::EndResponse(bool interrupted)
+{
+    m_sink.end(interrupted);
+    m_responding = false;
+    Push({RTC_EVENT_RESPONSE_END, "", !interrupted});
+}
+
+/*
+ * Benchmark
+ */
+void CRtcClient::Benchmark(const char *file, const char *url)
+{
+    std::vector<short> pcm;
+    int sampleRate;
+    if (!CAudioCapture::ReadFile(file, pcm, sampleRate))
+    {
+        std::cout << "Unable to read " << file << std::endl;
+        return;
+    }
+    double fileMs = pcm.size() * 1000.0 / sampleRate;
+    std::cout << "RTC: " << file << ", " << fileMs / 1000.0 << " s to " << url << std::endl;
+
+    // Counts what would be played
+    std::atomic<size_t> audioBytes(0);
+    SRtcAudioSink sink;
+    sink.begin = [&]() { audioBytes = 0; };
+    sink.write = [&](const std::string &format, const std::string &data) { audioBytes += data.size(); return true; };
+    sink.end = [&](bool interrupted) {};
+
+    CAudioCapture capture;
+    CRtcClient client;
+    capture.Start(CAPTURE_SOURCE_FILE, file);
+    client.Start(&capture, url, sink, false);
+
+    auto start = std::chrono::steady_clock::now();
+    std::string text;
+    while (MsSince(start) < fileMs + RTC_BENCH_TAIL_MS)
+    {
+        SRtcEvent event;
+        while (client.PollEvent(event))
+        {
+            if (event.type == RTC_EVENT_TRANSCRIPT && event.final)
+                printf("  heard: %s\n", event.text.c_str());
+            else if (event.type == RTC_EVENT_RESPONSE_TEXT)
+                text += event.text;
+            else if (event.type == RTC_EVENT_EMOTION)
+                printf("  emotion: %s\n", event.text.c_str());
+            else if (event.type == RTC_EVENT_RESPONSE_END)
+            {
+                SRtcStats stats;
+                client.GetStats(stats);
+                printf("  response %d: %.0f ms from the end of speech to the first audio, %zu bytes: %s\n",
+                       stats.responses, stats.responseMs, audioBytes.load(), text.c_str());
+                text.clear();
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    client.Stop();
+    capture.Stop();
+
+    SRtcStats stats;
+    client.GetStats(stats);
+    SCaptureStats captureStats;
+    capture.GetStats(captureStats);
+    printf("  %d utterances, %d responses, mean %.0f ms from the end of speech (endpoint %.0f ms), connect %.1f ms, %d errors\n",
+           captureStats.utterances, stats.responses, stats.meanResponseMs, captureStats.meanEndpointMs, stats.connectMs, stats.errors);
+}
@@ -1,3 +1,118 @@
 /**
  * Copyright(c) 2024 Reecho inc. All rights reserved.
- */
\ No newline at end of file
+ */
+#pragma once
+
+#include <string>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+#include "webSocket.hpp"
+
+#define RTC_CONNECT_TIMEOUT_MS 2000
+#define RTC_RECONNECT_MS 1000 // Between attempts while the server is unreachable
+#define RTC_MAX_EVENTS 256    // Oldest are dropped when nobody polls
+
+enum ERtcEvent
+{
+    RTC_EVENT_TRANSCRIPT = 0, // What the server heard, text and final
+    RTC_EVENT_RESPONSE_TEXT,  // Appended to the response text
+    RTC_EVENT_EMOTION,
+    RTC_EVENT_RESPONSE_END,   // final: played out, false when interrupted
+    RTC_EVENT_ERROR,          // Reported by the server
+};
+
+struct SRtcEvent
+{
+    ERtcEvent type;
+    std::string text;
+    bool final;
+};
+
+struct SRtcStats
+{
+    bool connected;
+    int responses;
+    int interruptions;  // Responses cut off by the user speaking
+    int errors;
+    double connectMs;
+    double responseMs;  // End of speech to the first audio of the last response
+    double meanResponseMs;
+};
+
+// Called on the client's thread, the playback path of the owner
+struct SRtcAudioSink
+{
+    std::function<void()> begin; // A response starts
+    std::function<bool(const std::string &format, const std::string &data)> write; // False drops the rest of the response
+    std::function<void(bool interrupted)> end;
+};
+
+/**
+ * Full-duplex voice chat with a realtime server over one WebSocket.
+ * Up: {"type": "session.start", "sample_rate"} once connected, then per
+ * utterance of a CAudioCapture {"type": "speech.start"}, the PCM as binary
+ * messages (mono 16 bit at VAD_SAMPLE_RATE) and {"type": "speech.end"} or
+ * {"type": "speech.cancel"}; typed messages as {"type": "text", "text"}.
+ * Down: {"type": "response.start", "format"} with a content type the audio
+ * decoders take, the response audio as binary messages, "response.text",
+ * "response.emotion" and "response.end"; "transcript" and "error" at any
+ * time. Speech starting during a response interrupts it when barge-in is
+ * on, its remaining audio is dropped. Reconnects while running.
+ */
+class CRtcClient
+{
+public:
+    CRtcClient();
+    ~CRtcClient();
+
+    // Restarts when running
+    void Start(class CAudioCapture *capture, const std::string &url, const SRtcAudioSink &sink, bool bargeIn);
+    void Stop();
+    bool IsRunning() const { return m_thread != nullptr; }
+
+    // Any thread, sent once connected
+    void SendText(const std::string &text);
+
+    bool PollEvent(SRtcEvent &event);
+    void GetStats(SRtcStats &stats) const;
+
+    // Speaks a file to the server through the file capture and reports the response latency
+    static void Benchmark(const char *file, const char *url);
+
+private:
+    void Thread();
+    bool Connect();
+    void OnVoiceEvent(struct SVoiceEvent &event);
+    void OnMessage(struct SWebSocketMessage &message);
+    void EndResponse(bool interrupted);
+    void Push(SRtcEvent &&event);
+
+    class CAudioCapture *m_capture;
+    std::string m_url;
+    SRtcAudioSink m_sink;
+    bool m_bargeIn;
+    std::thread *m_thread;
+    std::atomic<bool> m_quit;
+
+    // Thread only
+    CWebSocket m_socket;
+    std::chrono::steady_clock::time_point m_nextConnect;
+    int m_utterance;          // Being sent, -1 between utterances
+    bool m_responding;        // Between response.start and response.end
+    bool m_responseAudio;     // First audio of the response received
+    bool m_dropAudio;         // Interrupted or undecodable, until the next response.start
+    std::string m_format;
+    bool m_awaitingResponse;  // Speech ended, its response has not started playing
+    std::chrono::steady_clock::time_point m_speechEnd;
+    double m_responseSum;
+
+    mutable std::mutex m_mutex;
+    std::deque<std::string> m_texts;
+    std::deque<SRtcEvent> m_events;
+    SRtcStats m_stats;
+};
@@ -0,0 +1,320 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+
+#include "webSocket.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <poll.h>
+
+static std::string Base64(const uint8_t *data, size_t size)
+{
+    static const char TABLE[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    for (size_t i = 0; i < size; i += 3)
+    {
+        uint32_t value = data[i] << 16;
+        if (i + 1 < size)
+            value |= data[i + 1] << 8;
+        if (i + 2 < size)
+            value |= data[i + 2];
+        out += TABLE[(value >> 18) & 63];
+        out += TABLE[(value >> 12) & 63];
+        out += i + 1 < size ? TABLE[(value >> 6) & 63] : '=';
+        out += i + 2 < size ? TABLE[value & 63] : '=';
+    }
+    return out;
+}
+
+CWebSocket::CWebSocket()
+    : m_socket(m_io), m_open(false), m_messageOpcode(0)
+{
+    m_maskState = (uint32_t)std::chrono::steady_clock::now().time_since_epoch().count() | 1;
+}
+
+CWebSocket::~CWebSocket()
+{
+    Close();
+}
+
+bool CWebSocket::Connect(const std::string &url, int timeoutMs, std::string &error)
+{
+    Close();
+
+    if (url.compare(0, 5, "ws://") != 0)
+    {
+        error = "only ws:// urls are supported";
+        return false;
+    }
+    size_t hostEnd = url.find('/', 5);
+    std::string authority = url.substr(5, hostEnd == std::string::npos ? std::string::npos : hostEnd - 5);
+    std::string path = hostEnd == std::string::npos ? "/" : url.substr(hostEnd);
+    size_t colon = authority.rfind(':');
+    std::string host = colon == std::string::npos ? authority : authority.substr(0, colon);
+    std::string port = colon == std::string::npos ? "80" : authority.substr(colon + 1);
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    asio::error_code ec;
+    asio::ip::tcp::resolver resolver(m_io);
+    auto endpoints = resolver.resolve(host, port, ec);
+    if (ec)
+    {
+        error = "unable to resolve " + host + ": " + ec.message();
+        return false;
+    }
+
+    // Connect asynchronously, only to bound it by the timeout
+    bool connected = false;
+    asio::error_code connectError = asio::error::timed_out;
+    m_io.restart();
+    asio::async_connect(m_socket, endpoints, [&](const asio::error_code &e, const asio::ip::tcp::endpoint &) {
+        connected = !e;
+        connectError = e;
+    });
+    m_io.run_until(deadline);
+    if (!m_io.stopped())
+    {
+        m_socket.close(ec); // Cancels the attempt
+        m_io.run();
+        connectError = asio::error::timed_out;
+    }
+    if (!connected)
+    {
+        error = "unable to connect to " + authority + ": " + connectError.message();
+        m_socket.close(ec);
+        return false;
+    }
+    m_socket.set_option(asio::ip::tcp::no_delay(true), ec); // Small audio frames go out at once
+    m_socket.non_blocking(true, ec);
+    m_open = true;
+
+    uint8_t nonce[16];
+    for (auto &byte : nonce)
+    {
+        m_maskState ^= m_maskState << 13;
+        m_maskState ^= m_maskState >> 17;
+        m_maskState ^= m_maskState << 5;
+        byte = (uint8_t)m_maskState;
+    }
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: " + authority +
+                          "\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: " + Base64(nonce, sizeof(nonce)) +
+                          "\r\nSec-WebSocket-Version: 13\r\n\r\n";
+    if (!WriteAll(request.data(), request.size()))
+    {
+        error = "handshake failed";
+        Close();
+        return false;
+    }
+
+    // The peer is configured by the user, the accept hash is not checked
+    size_t headerEnd;
+    while ((headerEnd = m_readBuffer.find("\r\n\r\n")) == std::string::npos)
+    {
+        int left = (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        char buffer[4096];
+        size_t count = Wait(false, std::max(left, 0)) ? m_socket.read_some(asio::buffer(buffer), ec) : 0;
+        if (!count || (ec && ec != asio::error::would_block))
+        {
+            error = left > 0 ? "connection closed during the handshake" : "handshake timed out";
+            Close();
+            return false;
+        }
+        m_readBuffer.append(buffer, count);
+    }
+    if (m_readBuffer.compare(0, 12, "HTTP/1.1 101") != 0)
+    {
+        error = "upgrade refused: " + m_readBuffer.substr(0, m_readBuffer.find("\r\n"));
+        Close();
+        return false;
+    }
+    m_readBuffer.erase(0, headerEnd + 4); // Frames may follow the response
+    return true;
+}
+
+void CWebSocket::Close()
+{
+    if (m_open)
+    {
+        const uint8_t status[2] = {1000 >> 8, 1000 & 0xff}; // Normal closure
+        Send(0x8, status, sizeof(status));
+    }
+    asio::error_code ec;
+    m_socket.close(ec);
+    m_open = false;
+    m_readBuffer.clear();
+    m_message.clear();
+    m_messageOpcode = 0;
+}
+
+bool CWebSocket::Wait(bool write, int timeoutMs)
+{
+    struct pollfd fd;
+    fd.fd = m_socket.native_handle();
+    fd.events = write ? POLLOUT : POLLIN;
+    fd.revents = 0;
+    return poll(&fd, 1, timeoutMs) > 0;
+}
+
+bool CWebSocket::WriteAll(const char *data, size_t size)
+{
+    while (size)
+    {
+        asio::error_code ec;
+        size_t count = m_socket.write_some(asio::buffer(data, size), ec);
+        if (ec == asio::error::would_block)
+        {
+            Wait(true, 100);
+            continue;
+        }
+        if (ec)
+        {
+            m_open = false;
+            return false;
+        }
+        data += count;
+        size -= count;
+    }
+    return true;
+}
+
+bool CWebSocket::Send(int opcode, const void *data, size_t size)
+{
+    if (!m_open)
+        return false;
+
+    // Clients mask every frame
+    m_frame.clear();
+    m_frame.push_back((char)(0x80 | opcode));
+    if (size < 126)
+        m_frame.push_back((char)(0x80 | size));
+    else if (size < 65536)
+    {
+        m_frame.push_back((char)(0x80 | 126));
+        m_frame.push_back((char)(size >> 8));
+        m_frame.push_back((char)size);
+    }
+    else
+    {
+        m_frame.push_back((char)(0x80 | 127));
+        for (int shift = 56; shift >= 0; shift -= 8)
+            m_frame.push_back((char)((uint64_t)size >> shift));
+    }
+
+    m_maskState ^= m_maskState << 13;
+    m_maskState ^= m_maskState >> 17;
+    m_maskState ^= m_maskState << 5;
+    char mask[4];
+    memcpy(mask, &m_maskState, sizeof(mask));
+    m_frame.insert(m_frame.end(), mask, mask + 4);
+
+    size_t offset = m_frame.size();
+    m_frame.resize(offset + size);
+    const char *payload = (const char *)data;
+    for (size_t i = 0; i < size; i++)
+        m_frame[offset + i] = payload[i] ^ mask[i & 3];
+    return WriteAll(m_frame.data(), m_frame.size());
+}
+
+bool CWebSocket::Poll(std::vector<SWebSocketMessage> &messages, int timeoutMs)
+{
+    if (!m_open)
+        return false;
+
+    if (Wait(false, timeoutMs))
+    {
+        char buffer[16384];
+        for (;;)
+        {
+            asio::error_code ec;
+            size_t count = m_socket.read_some(asio::buffer(buffer), ec);
+            if (ec == asio::error::would_block)
+                break;
+            if (ec)
+            {
+                m_open = false; // Closed by the peer
+                break;
+            }
+            m_readBuffer.append(buffer, count);
+        }
+    }
+    return ParseFrames(messages) && m_open;
+}
+
+bool CWebSocket::ParseFrames(std::vector<SWebSocketMessage> &messages)
+{
+    size_t offset = 0;
+    while (m_readBuffer.size() - offset >= 2)
+    {
+        const uint8_t *header = (const uint8_t *)m_readBuffer.data() + offset;
+        size_t available = m_readBuffer.size() - offset;
+        bool fin = header[0] & 0x80;
+        int opcode = header[0] & 0x0f;
+        bool masked = header[1] & 0x80;
+        uint64_t length = header[1] & 0x7f;
+        size_t headerSize = 2;
+        if (length == 126)
+        {
+            if (available < 4)
+                break;
+            length = (header[2] << 8) | header[3];
+            headerSize = 4;
+        }
+        else if (length == 127)
+        {
+            if (available < 10)
+                break;
+            length = 0;
+            for (int i = 0; i < 8; i++)
+                length = (length << 8) | header[2 + i];
+            headerSize = 10;
+        }
+        if (length > WEBSOCKET_MAX_MESSAGE)
+        {
+            Close();
+            return false;
+        }
+        size_t maskOffset = headerSize;
+        if (masked)
+            headerSize += 4;
+        if (available < headerSize + length)
+            break;
+
+        std::string payload = m_readBuffer.substr(offset + headerSize, length);
+        if (masked)
+        {
+            for (size_t i = 0; i < payload.size(); i++)
+                payload[i] ^= header[maskOffset + (i & 3)];
+        }
+        offset += headerSize + length;
+
+        if (opcode == 0x8)
+        {
+            Close(); // Answers the close
+            return false;
+        }
+        else if (opcode == 0x9)
+            Send(0xA, payload.data(), payload.size());
+        else if (opcode == 0x0 || opcode == 0x1 || opcode == 0x2)
+        {
+            if (opcode)
+            {
+                m_messageOpcode = opcode;
+                m_message.clear();
+            }
+            m_message += payload;
+            if (m_message.size() > WEBSOCKET_MAX_MESSAGE)
+            {
+                Close();
+                return false;
+            }
+            if (fin)
+            {
+                messages.push_back({m_messageOpcode == 0x2, std::move(m_message)});
+                m_message.clear();
+            }
+        }
+    }
+    m_readBuffer.erase(0, offset);
+    return true;
+}
@@ -0,0 +1,60 @@
+/**
+ * Copyright(c) 2024 Reecho inc. All rights reserved.
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <asio.hpp>
+
+#define WEBSOCKET_MAX_MESSAGE (1 << 24)
+
+struct SWebSocketMessage
+{
+    bool binary;
+    std::string data;
+};
+
+/**
+ * Minimal RFC 6455 client over a plain TCP socket, ws:// only.
+ * Connect() blocks up to its timeout, afterwards the socket is non-blocking:
+ * sends complete before returning, Poll() returns whatever messages arrived.
+ * Pings are answered inside Poll(). Not thread safe, one owner thread.
+ */
+class CWebSocket
+{
+public:
+    CWebSocket();
+    ~CWebSocket();
+
+    CWebSocket(const CWebSocket &) = delete;
+    CWebSocket &operator=(const CWebSocket &) = delete;
+
+    // ws://host[:port][/path]
+    bool Connect(const std::string &url, int timeoutMs, std::string &error);
+    void Close();
+    bool IsOpen() const { return m_open; }
+
+    bool SendText(const std::string &text) { return Send(0x1, text.data(), text.size()); }
+    bool SendBinary(const void *data, size_t size) { return Send(0x2, data, size); }
+
+    // Waits up to timeoutMs for data when nothing is buffered. False once the connection is closed.
+    bool Poll(std::vector<SWebSocketMessage> &messages, int timeoutMs);
+
+private:
+    bool Send(int opcode, const void *data, size_t size);
+    bool WriteAll(const char *data, size_t size);
+    bool Wait(bool write, int timeoutMs);
+    bool ParseFrames(std::vector<SWebSocketMessage> &messages);
+
+    asio::io_context m_io;
+    asio::ip::tcp::socket m_socket;
+    bool m_open;
+    uint32_t m_maskState;
+
+    std::string m_readBuffer;
+    std::string m_message; // Fragments of an unfinished message
+    int m_messageOpcode;
+    std::vector<char> m_frame;
+};
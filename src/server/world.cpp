@@ -60,10 +60,65 @@ std::map<std::string, en2lang> en2lang_map = {
     {"Voice Chat Config", {U8("Voice Chat 配置")}},
     {"Refresh voice character from Server", {U8("从服务器刷新声音角色")}},
     {"Live2D Model Path", {U8("Live2D模型路径")}},
+    {"Direct streaming synthesis", {U8("直接流式合成")}},
+    {"Stream format", {U8("音频流格式")}},
+    {"Resampling quality", {U8("重采样质量")}},
+    {"Limiter", {U8("限幅器")}},
+    {"Minimum prebuffer (ms)", {U8("最小预缓冲(毫秒)")}},
+    {"Segment crossfade (ms)", {U8("片段交叉淡化(毫秒)")}},
+    {"Motion sound volume", {U8("动作音效音量")}},
+    {"Motion sounds under speech (-dB)", {U8("语音时动作音效衰减(-dB)")}},
+    {"Filler while waiting for a reply (wav, mp3 or opus)", {U8("等待回复时的填充音(wav、mp3或opus)")}},
+    {"Filler volume", {U8("填充音音量")}},
+    {"Filler under speech (-dB)", {U8("语音时填充音衰减(-dB)")}},
+    {"Output latency (ms), 0 for the device default", {U8("输出延迟(毫秒)，0为设备默认")}},
+    {"Audio output, applied after a restart", {U8("音频输出，重启后生效")}},
+    {"Output file (wav)", {U8("输出文件(wav)")}},
+    {"Play in real time", {U8("实时播放")}},
+    {"Output:", {U8("输出:")}},
+    {"Underflows:", {U8("欠载:")}},
+    {"Errors:", {U8("错误:")}},
+    {"Reopens:", {U8("重新打开:")}},
+    {"Callback:", {U8("回调:")}},
+    {"Jitter:", {U8("抖动:")}},
+    {"Real time violations:", {U8("实时违规:")}},
+    {"Record turns", {U8("录制对话")}},
+    {"Recorded turns kept", {U8("保留的录制数")}},
+    {"Voice input", {U8("语音输入")}},
+    {"Enable voice input", {U8("启用语音输入")}},
+    {"Input source", {U8("输入源")}},
+    {"Input file (wav, mp3 or opus)", {U8("输入文件(wav、mp3或opus)")}},
+    {"Recognition server (ws://)", {U8("识别服务器(ws://)")}},
+    {"Recognition:", {U8("识别:")}},
+    {"Heard:", {U8("听到:")}},
+    {"Speech threshold (dB above noise)", {U8("语音阈值(高于噪声的分贝)")}},
+    {"End of speech silence (ms)", {U8("语音结束静音(毫秒)")}},
+    {"Minimum speech (ms)", {U8("最短语音(毫秒)")}},
+    {"Cancel speaker echo", {U8("消除扬声器回声")}},
+    {"Echo cancelled:", {U8("回声消除:")}},
+    {"Load:", {U8("负载:")}},
+    {"Input:", {U8("输入:")}},
+    {"Level:", {U8("电平:")}},
+    {"Noise:", {U8("噪声:")}},
+    {"Utterances:", {U8("语句:")}},
+    {"Endpoint latency:", {U8("端点延迟:")}},
+    {"Overflows:", {U8("溢出:")}},
+    {"Unsupported audio format from synthesis.", {U8("不支持的合成音频格式。")}},
+    {"Chat mode", {U8("聊天模式")}},
+    {"Realtime server (ws://)", {U8("实时服务器(ws://)")}},
+    {"Interrupt the reply when the user speaks", {U8("用户说话时打断回复")}},
+    {"Realtime:", {U8("实时:")}},
+    {"connected", {U8("已连接")}},
+    {"not connected", {U8("未连接")}},
+    {"Response latency:", {U8("响应延迟:")}},
+    {"Interruptions:", {U8("打断:")}},
 
     {"Image", {U8("图像")}},
     {"Resolution", {U8("分辨率")}},
     {"Show Background", {U8("显示背景")}},
+    {"Idle frame rate, 0 for full rate", {U8("空闲帧率，0为全帧率")}},
+    {"Simulation rate (Hz)", {U8("模拟频率(赫兹)")}},
+    {"Cache still frames", {U8("缓存静止画面")}},
 
     {"Audio", {U8("音频")}},
     {"Volume", {U8("音量")}},
@@ -80,6 +135,7 @@ std::map<std::string, en2lang> en2lang_map = {
     // Chat
     {"! LLM API key is not set.\n", {U8("! LLM API密钥未设置。\n")}},
     {"! LLM API model is not set.\n", {U8("! LLM API模型未设置。\n")}},
+    {"! Realtime server url is not set.\n", {U8("! 实时服务器地址未设置。\n")}},
 
     {"! Voice character ID is not set.\n", {U8("! 语音角色ID未设置。\n")}},
 
@@ -159,13 +215,46 @@ void CWorld::ResetWorld()
     // Reset VoiceChat
     m_configChat.live2DModelPath[0] = '\0';
     m_configChat.vcID[0] = '\0';
+    m_configChat.directStream = false;
+    m_configChat.streamFormat = 0;
+    m_configChat.mode = CHAT_MODE_TTS;
+    strcpy(m_configChat.rtcUrl, "ws://127.0.0.1:2800");
+    m_configChat.rtcBargeIn = false;
 
     // Reset Image
     m_configImage.resolution = 6;
     m_configImage.showBk = true;
+    m_configImage.idleFps = 10;
+    m_configImage.simulationHz = 60;
+    m_configImage.cacheModel = false;
 
     // Reset Audio
     m_configAudio.volume = 100;
+    m_configAudio.limiter = true;
+    m_configAudio.resampleQuality = RESAMPLE_QUALITY_MEDIUM;
+    m_configAudio.minPrebufferMs = 60;
+    m_configAudio.crossfadeMs = 10;
+    m_configAudio.outputLatencyMs = 0;
+    m_configAudio.sink = AUDIO_SINK_DEVICE;
+    strcpy(m_configAudio.sinkFile, "output.wav");
+    m_configAudio.sinkRealtime = true;
+    m_configAudio.motionGain = 80;
+    m_configAudio.motionDuckDb = 6;
+    m_configAudio.fillerFile[0] = '\0';
+    m_configAudio.fillerGain = 60;
+    m_configAudio.fillerDuckDb = 40;
+    m_configAudio.record = false;
+    m_configAudio.recordKeepTurns = 20;
+
+    // Reset Voice
+    m_configVoice.enabled = false;
+    m_configVoice.source = CAPTURE_SOURCE_MIC;
+    m_configVoice.inputFile[0] = '\0';
+    strcpy(m_configVoice.asrUrl, "ws://127.0.0.1:2700");
+    m_configVoice.thresholdDb = 12;
+    m_configVoice.hangoverMs = 400;
+    m_configVoice.minSpeechMs = 150;
+    m_configVoice.echoCancel = true;
 }
 
 #define SAVE_CONFIOG_STRING(configEle, config, name)    \
@@ -214,6 +303,11 @@ void CWorld::SaveWorld()
 
     SAVE_CONFIOG_STRING(voiceChat, m_configChat, live2DModelPath);
     SAVE_CONFIOG_STRING(voiceChat, m_configChat, vcID)
+    SAVE_CONFIOG_BOOL(voiceChat, m_configChat, directStream);
+    SAVE_CONFIOG_INT(voiceChat, m_configChat, streamFormat);
+    SAVE_CONFIOG_INT(voiceChat, m_configChat, mode);
+    SAVE_CONFIOG_STRING(voiceChat, m_configChat, rtcUrl);
+    SAVE_CONFIOG_BOOL(voiceChat, m_configChat, rtcBargeIn);
 
     // Save Image
     tinyxml2::XMLElement *image = doc.NewElement("image");
@@ -221,12 +315,43 @@ void CWorld::SaveWorld()
 
     SAVE_CONFIOG_INT(image, m_configImage, resolution);
     SAVE_CONFIOG_BOOL(image, m_configImage, showBk);
+    SAVE_CONFIOG_INT(image, m_configImage, idleFps);
+    SAVE_CONFIOG_INT(image, m_configImage, simulationHz);
+    SAVE_CONFIOG_BOOL(image, m_configImage, cacheModel);
 
     // Save Audio
     tinyxml2::XMLElement *audio = doc.NewElement("audio");
     root->InsertEndChild(audio);
 
     SAVE_CONFIOG_INT(audio, m_configAudio, volume);
+    SAVE_CONFIOG_BOOL(audio, m_configAudio, limiter);
+    SAVE_CONFIOG_INT(audio, m_configAudio, resampleQuality);
+    SAVE_CONFIOG_INT(audio, m_configAudio, minPrebufferMs);
+    SAVE_CONFIOG_INT(audio, m_configAudio, crossfadeMs);
+    SAVE_CONFIOG_INT(audio, m_configAudio, outputLatencyMs);
+    SAVE_CONFIOG_INT(audio, m_configAudio, sink);
+    SAVE_CONFIOG_STRING(audio, m_configAudio, sinkFile);
+    SAVE_CONFIOG_BOOL(audio, m_configAudio, sinkRealtime);
+    SAVE_CONFIOG_INT(audio, m_configAudio, motionGain);
+    SAVE_CONFIOG_INT(audio, m_configAudio, motionDuckDb);
+    SAVE_CONFIOG_STRING(audio, m_configAudio, fillerFile);
+    SAVE_CONFIOG_INT(audio, m_configAudio, fillerGain);
+    SAVE_CONFIOG_INT(audio, m_configAudio, fillerDuckDb);
+    SAVE_CONFIOG_BOOL(audio, m_configAudio, record);
+    SAVE_CONFIOG_INT(audio, m_configAudio, recordKeepTurns);
+
+    // Save Voice
+    tinyxml2::XMLElement *voice = doc.NewElement("voice");
+    root->InsertEndChild(voice);
+
+    SAVE_CONFIOG_BOOL(voice, m_configVoice, enabled);
+    SAVE_CONFIOG_INT(voice, m_configVoice, source);
+    SAVE_CONFIOG_STRING(voice, m_configVoice, inputFile);
+    SAVE_CONFIOG_STRING(voice, m_configVoice, asrUrl);
+    SAVE_CONFIOG_INT(voice, m_configVoice, thresholdDb);
+    SAVE_CONFIOG_INT(voice, m_configVoice, hangoverMs);
+    SAVE_CONFIOG_INT(voice, m_configVoice, minSpeechMs);
+    SAVE_CONFIOG_BOOL(voice, m_configVoice, echoCancel);
 
     auto executeAbsolutePath = CPlat::GetExecuteAbsolutePath();
 
@@ -257,16 +382,21 @@ void CWorld::SaveWorld()
         config.name[0] = '\0';                                        \
     }
 
-#define LOAD_CONFIOG_INT(configEle, config, name) \
-    config.name = configEle->FirstChildElement(STRINGIFY(name))->IntText();
+// Missing elements keep the defaults from ResetWorld()
+#define LOAD_CONFIOG_INT(configEle, config, name)             \
+    if (configEle->FirstChildElement(STRINGIFY(name)))        \
+        config.name = configEle->FirstChildElement(STRINGIFY(name))->IntText();
 
-#define LOAD_CONFIOG_BOOL(configEle, config, name) \
-    config.name = configEle->FirstChildElement(STRINGIFY(name))->BoolText();
+#define LOAD_CONFIOG_BOOL(configEle, config, name)            \
+    if (configEle->FirstChildElement(STRINGIFY(name)))        \
+        config.name = configEle->FirstChildElement(STRINGIFY(name))->BoolText();
 
 void CWorld::Initialize()
 {
     const char *value;
 
+    ResetWorld();
+
     tinyxml2::XMLDocument doc;
     tinyxml2::XMLError res = doc.LoadFile((CPlat::GetExecuteAbsolutePath() + "/config.xml").c_str());
 
@@ -308,17 +438,80 @@ void CWorld::Initialize()
 
     LOAD_CONFIOG_STRING(voiceChat, m_configChat, live2DModelPath);
     LOAD_CONFIOG_STRING(voiceChat, m_configChat, vcID);
+    LOAD_CONFIOG_BOOL(voiceChat, m_configChat, directStream);
+    LOAD_CONFIOG_INT(voiceChat, m_configChat, streamFormat);
+    if (m_configChat.streamFormat < 0 || m_configChat.streamFormat >= IM_ARRAYSIZE(CONFIG_STREAM_FORMATS))
+        m_configChat.streamFormat = 0;
+    // Missing in configs saved before the RTC mode
+    if (voiceChat->FirstChildElement("mode"))
+    {
+        LOAD_CONFIOG_INT(voiceChat, m_configChat, mode);
+        LOAD_CONFIOG_STRING(voiceChat, m_configChat, rtcUrl);
+        LOAD_CONFIOG_BOOL(voiceChat, m_configChat, rtcBargeIn);
+    }
+    if (m_configChat.mode < 0 || m_configChat.mode >= CHAT_MODE_COUNT)
+        m_configChat.mode = CHAT_MODE_TTS;
 
     // Load Image
     tinyxml2::XMLElement *image = root->FirstChildElement("image");
 
     LOAD_CONFIOG_INT(image, m_configImage, resolution);
     LOAD_CONFIOG_BOOL(image, m_configImage, showBk);
+    LOAD_CONFIOG_INT(image, m_configImage, idleFps);
+    LOAD_CONFIOG_INT(image, m_configImage, simulationHz);
+    LOAD_CONFIOG_BOOL(image, m_configImage, cacheModel);
 
     // Load Audio
     tinyxml2::XMLElement *audio = root->FirstChildElement("audio");
 
     LOAD_CONFIOG_INT(audio, m_configAudio, volume);
+    LOAD_CONFIOG_BOOL(audio, m_configAudio, limiter);
+    LOAD_CONFIOG_INT(audio, m_configAudio, resampleQuality);
+    if (m_configAudio.resampleQuality < 0 || m_configAudio.resampleQuality >= RESAMPLE_QUALITY_COUNT)
+        m_configAudio.resampleQuality = RESAMPLE_QUALITY_MEDIUM;
+    LOAD_CONFIOG_INT(audio, m_configAudio, minPrebufferMs);
+    LOAD_CONFIOG_INT(audio, m_configAudio, crossfadeMs);
+    LOAD_CONFIOG_INT(audio, m_configAudio, outputLatencyMs);
+    LOAD_CONFIOG_INT(audio, m_configAudio, sink);
+    if (m_configAudio.sink < 0 || m_configAudio.sink >= AUDIO_SINK_COUNT)
+        m_configAudio.sink = AUDIO_SINK_DEVICE;
+    if (audio->FirstChildElement("sinkFile"))
+    {
+        LOAD_CONFIOG_STRING(audio, m_configAudio, sinkFile);
+    }
+    LOAD_CONFIOG_BOOL(audio, m_configAudio, sinkRealtime);
+    LOAD_CONFIOG_INT(audio, m_configAudio, motionGain);
+    LOAD_CONFIOG_INT(audio, m_configAudio, motionDuckDb);
+    if (audio->FirstChildElement("fillerFile"))
+    {
+        LOAD_CONFIOG_STRING(audio, m_configAudio, fillerFile);
+    }
+    LOAD_CONFIOG_INT(audio, m_configAudio, fillerGain);
+    LOAD_CONFIOG_INT(audio, m_configAudio, fillerDuckDb);
+    LOAD_CONFIOG_BOOL(audio, m_configAudio, record);
+    LOAD_CONFIOG_INT(audio, m_configAudio, recordKeepTurns);
+
+    // Load Voice, missing in configs saved before voice input
+    tinyxml2::XMLElement *voice = root->FirstChildElement("voice");
+    if (voice)
+    {
+        LOAD_CONFIOG_BOOL(voice, m_configVoice, enabled);
+        LOAD_CONFIOG_INT(voice, m_configVoice, source);
+        if (m_configVoice.source < 0 || m_configVoice.source >= CAPTURE_SOURCE_COUNT)
+            m_configVoice.source = CAPTURE_SOURCE_MIC;
+        LOAD_CONFIOG_STRING(voice, m_configVoice, inputFile);
+        if (voice->FirstChildElement("asrUrl"))
+        {
+            LOAD_CONFIOG_STRING(voice, m_configVoice, asrUrl);
+        }
+        LOAD_CONFIOG_INT(voice, m_configVoice, thresholdDb);
+        LOAD_CONFIOG_INT(voice, m_configVoice, hangoverMs);
+        LOAD_CONFIOG_INT(voice, m_configVoice, minSpeechMs);
+        if (voice->FirstChildElement("echoCancel"))
+        {
+            LOAD_CONFIOG_BOOL(voice, m_configVoice, echoCancel);
+        }
+    }
 
     RefreshVC();
 
@@ -403,17 +596,127 @@ void CWorld::FrontRender(int width, int height)
 
                 ImGui::Text("%s", TRAN("Live2D Model Path"));
                 ImGui::InputText("##Live2D Model Path", m_configChat.live2DModelPath, IM_ARRAYSIZE(m_configChat.live2DModelPath));
+                ImGui::Checkbox(TRAN("Direct streaming synthesis"), &m_configChat.directStream);
+                ImGui::Text("%s", TRAN("Stream format"));
+                ImGui::Combo("##Stream format", &m_configChat.streamFormat, CONFIG_STREAM_FORMATS, IM_ARRAYSIZE(CONFIG_STREAM_FORMATS));
+                ImGui::Text("%s", TRAN("Chat mode"));
+                ImGui::Combo("##Chat mode", &m_configChat.mode, CONFIG_CHAT_MODES, IM_ARRAYSIZE(CONFIG_CHAT_MODES));
+                if (m_configChat.mode == CHAT_MODE_RTC)
+                {
+                    ImGui::Text("%s", TRAN("Realtime server (ws://)"));
+                    ImGui::InputText("##Realtime server", m_configChat.rtcUrl, IM_ARRAYSIZE(m_configChat.rtcUrl));
+                    ImGui::Checkbox(TRAN("Interrupt the reply when the user speaks"), &m_configChat.rtcBargeIn);
+                    if (m_chat)
+                    {
+                        SRtcStats rtcStats;
+                        m_chat->GetRtcStats(rtcStats);
+                        ImGui::Text("%s %s, %.1f ms", TRAN("Realtime:"), rtcStats.connected ? TRAN("connected") : TRAN("not connected"), rtcStats.connectMs);
+                        ImGui::Text("%s %.0f / %.0f ms, %s %d, %s %d", TRAN("Response latency:"), rtcStats.responseMs, rtcStats.meanResponseMs,
+                                    TRAN("Interruptions:"), rtcStats.interruptions, TRAN("Errors:"), rtcStats.errors);
+                    }
+                }
             }
             if (ImGui::CollapsingHeader(TRAN("Image")))
             {
                 ImGui::Text("%s", TRAN("Resolution"));
                 ImGui::Combo("##Resolution", &m_configImage.resolution, CONFIG_IMAGE_RESOLUTIONS, IM_ARRAYSIZE(CONFIG_IMAGE_RESOLUTIONS));
                 ImGui::Checkbox(TRAN("Show Background"), &m_configImage.showBk);
+                ImGui::Text("%s", TRAN("Idle frame rate, 0 for full rate"));
+                ImGui::SliderInt("##Idle frame rate", &m_configImage.idleFps, 0, 30);
+                ImGui::Text("%s", TRAN("Simulation rate (Hz)"));
+                ImGui::SliderInt("##Simulation rate", &m_configImage.simulationHz, 30, 60);
+                ImGui::Checkbox(TRAN("Cache still frames"), &m_configImage.cacheModel);
             }
             if (ImGui::CollapsingHeader(TRAN("Audio")))
             {
                 ImGui::Text("%s", TRAN("Volume"));
                 ImGui::SliderInt("##Volume", &m_configAudio.volume, 0, 100);
+                ImGui::Checkbox(TRAN("Limiter"), &m_configAudio.limiter);
+                ImGui::Text("%s", TRAN("Resampling quality"));
+                ImGui::Combo("##Resampling quality", &m_configAudio.resampleQuality, CONFIG_RESAMPLE_QUALITIES, IM_ARRAYSIZE(CONFIG_RESAMPLE_QUALITIES));
+                ImGui::Text("%s", TRAN("Minimum prebuffer (ms)"));
+                ImGui::SliderInt("##Minimum prebuffer", &m_configAudio.minPrebufferMs, 0, 1000);
+                ImGui::Text("%s", TRAN("Segment crossfade (ms)"));
+                ImGui::SliderInt("##Segment crossfade", &m_configAudio.crossfadeMs, 0, SEGMENT_CROSSFADE_MAX_MS);
+                ImGui::Text("%s", TRAN("Motion sound volume"));
+                ImGui::SliderInt("##Motion sound volume", &m_configAudio.motionGain, 0, 100);
+                ImGui::Text("%s", TRAN("Motion sounds under speech (-dB)"));
+                ImGui::SliderInt("##Motion sounds under speech", &m_configAudio.motionDuckDb, 0, 60);
+                ImGui::Text("%s", TRAN("Filler while waiting for a reply (wav, mp3 or opus)"));
+                ImGui::InputText("##Filler file", m_configAudio.fillerFile, IM_ARRAYSIZE(m_configAudio.fillerFile));
+                if (m_configAudio.fillerFile[0])
+                {
+                    ImGui::Text("%s", TRAN("Filler volume"));
+                    ImGui::SliderInt("##Filler volume", &m_configAudio.fillerGain, 0, 100);
+                    ImGui::Text("%s", TRAN("Filler under speech (-dB)"));
+                    ImGui::SliderInt("##Filler under speech", &m_configAudio.fillerDuckDb, 0, 60);
+                }
+                ImGui::Text("%s", TRAN("Output latency (ms), 0 for the device default"));
+                ImGui::SliderInt("##Output latency", &m_configAudio.outputLatencyMs, 0, 500);
+                ImGui::Text("%s", TRAN("Audio output, applied after a restart"));
+                ImGui::Combo("##Audio output", &m_configAudio.sink, CONFIG_AUDIO_SINKS, IM_ARRAYSIZE(CONFIG_AUDIO_SINKS));
+                if (m_configAudio.sink == AUDIO_SINK_FILE)
+                {
+                    ImGui::Text("%s", TRAN("Output file (wav)"));
+                    ImGui::InputText("##Output file", m_configAudio.sinkFile, IM_ARRAYSIZE(m_configAudio.sinkFile));
+                }
+                if (m_configAudio.sink != AUDIO_SINK_DEVICE)
+                    ImGui::Checkbox(TRAN("Play in real time"), &m_configAudio.sinkRealtime);
+                ImGui::Checkbox(TRAN("Record turns"), &m_configAudio.record);
+                if (m_configAudio.record)
+                {
+                    ImGui::Text("%s", TRAN("Recorded turns kept"));
+                    ImGui::SliderInt("##Recorded turns kept", &m_configAudio.recordKeepTurns, 1, 200);
+                }
+                if (m_chat)
+                {
+                    CChat::SOutputStats outputStats;
+                    m_chat->GetOutputStats(outputStats);
+                    ImGui::Text("%s %d Hz, %.1f ms", TRAN("Output:"), outputStats.sampleRate, outputStats.latencyMs);
+                    ImGui::Text("%s %d, %s %d, %s %d", TRAN("Underflows:"), outputStats.underflows, TRAN("Errors:"), outputStats.errors, TRAN("Reopens:"), outputStats.reopens);
+                    ImGui::Text("%s %.0f / %.0f us, %.1f%%, %s %.1f / %.1f ms", TRAN("Callback:"), outputStats.callback.meanUs, outputStats.callback.worstUs,
+                                outputStats.callback.load * 100.0, TRAN("Jitter:"), outputStats.callback.jitterMs, outputStats.callback.worstJitterMs);
+                    if (outputStats.violations[AUDIO_RT_ALLOC] || outputStats.violations[AUDIO_RT_LOCK] || outputStats.violations[AUDIO_RT_IO])
+                        ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s alloc %d, lock %d, io %d", TRAN("Real time violations:"), outputStats.violations[AUDIO_RT_ALLOC],
+                                           outputStats.violations[AUDIO_RT_LOCK], outputStats.violations[AUDIO_RT_IO]);
+                }
+            }
+            if (ImGui::CollapsingHeader(TRAN("Voice input")))
+            {
+                ImGui::Checkbox(TRAN("Enable voice input"), &m_configVoice.enabled);
+                ImGui::Text("%s", TRAN("Input source"));
+                ImGui::Combo("##Input source", &m_configVoice.source, CONFIG_CAPTURE_SOURCES, IM_ARRAYSIZE(CONFIG_CAPTURE_SOURCES));
+                if (m_configVoice.source == CAPTURE_SOURCE_FILE)
+                {
+                    ImGui::Text("%s", TRAN("Input file (wav, mp3 or opus)"));
+                    ImGui::InputText("##Input file", m_configVoice.inputFile, IM_ARRAYSIZE(m_configVoice.inputFile));
+                }
+                ImGui::Text("%s", TRAN("Recognition server (ws://)"));
+                ImGui::InputText("##Recognition server", m_configVoice.asrUrl, IM_ARRAYSIZE(m_configVoice.asrUrl));
+                ImGui::Text("%s", TRAN("Speech threshold (dB above noise)"));
+                ImGui::SliderInt("##Speech threshold", &m_configVoice.thresholdDb, 3, 30);
+                ImGui::Text("%s", TRAN("End of speech silence (ms)"));
+                ImGui::SliderInt("##End of speech silence", &m_configVoice.hangoverMs, 100, 2000);
+                ImGui::Text("%s", TRAN("Minimum speech (ms)"));
+                ImGui::SliderInt("##Minimum speech", &m_configVoice.minSpeechMs, 0, 1000);
+                ImGui::Checkbox(TRAN("Cancel speaker echo"), &m_configVoice.echoCancel);
+                if (m_chat && (m_configVoice.enabled || m_configChat.mode == CHAT_MODE_RTC))
+                {
+                    SCaptureStats captureStats;
+                    m_chat->GetCaptureStats(captureStats);
+                    ImGui::Text("%s %d Hz, %.1f ms, %s %d", TRAN("Input:"), captureStats.sampleRate, captureStats.inputLatencyMs, TRAN("Overflows:"), captureStats.overflows);
+                    ImGui::Text("%s %.0f dB, %s %.0f dB %s", TRAN("Level:"), captureStats.levelDb, TRAN("Noise:"), captureStats.noiseDb, captureStats.speaking ? "*" : "");
+                    ImGui::Text("%s %d, %s %.0f / %.0f ms", TRAN("Utterances:"), captureStats.utterances, TRAN("Endpoint latency:"), captureStats.lastEndpointMs, captureStats.meanEndpointMs);
+                    if (captureStats.echoCancel)
+                        ImGui::Text("%s %.0f dB, %s %.1f%%", TRAN("Echo cancelled:"), captureStats.echoErleDb, TRAN("Load:"), captureStats.echoLoad * 100.0);
+                    if (m_configChat.mode == CHAT_MODE_TTS)
+                    {
+                        SAsrStats asrStats;
+                        m_chat->GetAsrStats(asrStats);
+                        ImGui::Text("%s %.0f / %.0f ms, %s %d", TRAN("Recognition:"), asrStats.recognitionMs, asrStats.meanRecognitionMs, TRAN("Errors:"), asrStats.errors);
+                    }
+                    ImGui::TextWrapped("%s %s", TRAN("Heard:"), m_chat->m_voiceTextShow.c_str());
+                }
             }
             ImGui::NewLine();
             ImGui::Text(TRAN("Muji Moe"));
@@ -527,6 +830,13 @@ void CWorld::ServerRender()
     }
 
     // Chat
+    m_chat->SetPlaybackParams(m_configAudio.volume, m_configAudio.limiter, m_configAudio.minPrebufferMs, m_configAudio.crossfadeMs);
+    m_chat->SetMixerParams(m_configAudio.motionGain, m_configAudio.motionDuckDb, m_configAudio.fillerGain, m_configAudio.fillerDuckDb);
+    if (m_configChanged)
+        m_chat->SetOutputLatency(m_configAudio.outputLatencyMs); // Reopens the device, only once saved
+    m_chat->SetVadParams(m_configVoice.thresholdDb, m_configVoice.hangoverMs, m_configVoice.minSpeechMs);
+    m_chat->SetEchoCancel(m_configVoice.echoCancel);
+
     CChat::SChatCommand cmd;
     if (m_chat->GetCommand2World(cmd))
     {
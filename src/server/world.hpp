@@ -34,6 +34,44 @@ static const char *CONFIG_IMAGE_RESOLUTIONS[] = {
     "800x1200", // 2 : 3
 };
 
+// Stream formats that may be requested from synthesis, index 0 is the default
+static const char *CONFIG_STREAM_FORMATS[] = {
+    "mp3",
+    "wav",
+    "opus",
+};
+static const char *CONFIG_STREAM_FORMAT_TYPES[] = {
+    "audio/mpeg",
+    "audio/wav",
+    "audio/ogg",
+};
+
+// Matches EResampleQuality
+static const char *CONFIG_RESAMPLE_QUALITIES[] = {
+    "Low",
+    "Medium",
+    "High",
+};
+
+// EChatMode
+static const char *CONFIG_CHAT_MODES[] = {
+    "LLM + TTS",
+    "RTC / WebSocket",
+};
+
+// ECaptureSource
+static const char *CONFIG_CAPTURE_SOURCES[] = {
+    "Microphone",
+    "File",
+};
+
+// EAudioSink
+static const char *CONFIG_AUDIO_SINKS[] = {
+    "Sound device",
+    "Null",
+    "WAV file",
+};
+
 // Translation
 #define LANGUAGES_COUNT 2
 static const char *CONFIG_LANGUAGES[LANGUAGES_COUNT] = {
@@ -89,20 +127,55 @@ public:
     {
         char live2DModelPath[256];
         char vcID[64];
+        bool directStream; // Ask synthesis to answer with the audio stream itself
+        int streamFormat;  // CONFIG_STREAM_FORMATS
+        int mode;          // EChatMode
+        char rtcUrl[256];  // Realtime voice server, ws://
+        bool rtcBargeIn;   // Speech stops the reply, needs headphones or echo cancellation
     } m_configChat;
 
     struct
     {
         int resolution;
         bool showBk;
+        int idleFps; // Frame rate while nothing visible changes, 0 renders at full rate
+        int simulationHz; // Model simulation ticks per second, MODEL_TICK_HZ_MIN to MODEL_TICK_HZ_MAX
+        bool cacheModel;  // Composite the last image of the model while its parameters stand still, as they do once the window idles
 
     } m_configImage;
 
     struct
     {
         int volume;
+        bool limiter;
+        int resampleQuality; // EResampleQuality
+        int minPrebufferMs;  // Buffered before a turn starts playing, the jitter buffer may wait longer
+        int crossfadeMs;     // Between queued segments, 0 to butt them together
+        int outputLatencyMs; // Requested device latency, 0 for the backend default
+        int sink;            // EAudioSink, taken at start
+        char sinkFile[256];  // AUDIO_SINK_FILE
+        bool sinkRealtime;   // Null and file sinks, or as fast as the audio is buffered
+        int motionGain;      // Sounds of the Live2D motions, percent like the volume
+        int motionDuckDb;    // Attenuation while speech is heard
+        char fillerFile[256]; // Played while a reply is on its way, empty for none
+        int fillerGain;
+        int fillerDuckDb;
+        bool record;         // Save every turn's stream and PCM, for debugging
+        int recordKeepTurns;
     } m_configAudio;
 
+    struct
+    {
+        bool enabled;
+        int source;         // ECaptureSource
+        char inputFile[256];
+        char asrUrl[256];   // Vosk protocol recognition server, ws://
+        int thresholdDb;    // Above the noise floor
+        int hangoverMs;     // Silence that ends an utterance
+        int minSpeechMs;
+        bool echoCancel;    // The output's echo from the microphone
+    } m_configVoice;
+
     bool m_configChanged;
     bool m_triggerConfigChanged;
 